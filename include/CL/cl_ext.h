@@ -137,6 +137,241 @@ typedef CL_API_ENTRY cl_int (CL_API_CALL *clIcdGetPlatformIDsKHR_fn)(
 #define CL_DEVICE_PROFILING_TIMER_OFFSET_AMD        0x4036
 
 
+/*********************************
+* cl_clover_memory_pool extension *
+*********************************/
+#define cl_clover_memory_pool 1
+
+/* Give back to the system the memory cached by the allocator of a context */
+extern CL_API_ENTRY cl_int CL_API_CALL
+clTrimMemoryPoolCLOVER(cl_context /* context */,
+                       size_t *   /* released_size */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clTrimMemoryPoolCLOVER_fn)(
+    cl_context /* context */,
+    size_t *   /* released_size */);
+
+
+/*********************************
+* cl_clover_file_buffer extension *
+*********************************/
+#define cl_clover_file_buffer 1
+
+typedef cl_bitfield cl_file_buffer_flags_clover;
+
+/* cl_file_buffer_flags_clover - bitfield */
+#define CL_FILE_BUFFER_POPULATE_CLOVER              (1 << 0)
+
+/* Create a buffer backed by a memory mapping of a file region. Read-only
+ * buffers are private mappings, the others write into the file, that must
+ * then be open for writing. */
+extern CL_API_ENTRY cl_mem CL_API_CALL
+clCreateBufferFromFileCLOVER(cl_context                  /* context */,
+                             cl_mem_flags                /* flags */,
+                             int                         /* fd */,
+                             cl_ulong                    /* offset */,
+                             size_t                      /* size */,
+                             cl_file_buffer_flags_clover /* file_flags */,
+                             cl_int *                    /* errcode_ret */);
+
+typedef CL_API_ENTRY cl_mem (CL_API_CALL *clCreateBufferFromFileCLOVER_fn)(
+    cl_context                  /* context */,
+    cl_mem_flags                /* flags */,
+    int                         /* fd */,
+    cl_ulong                    /* offset */,
+    size_t                      /* size */,
+    cl_file_buffer_flags_clover /* file_flags */,
+    cl_int *                    /* errcode_ret */);
+
+
+/*****************************************
+* cl_clover_deferred_submission extension *
+*****************************************/
+#define cl_clover_deferred_submission 1
+
+/* cl_command_queue_properties - bitfield. Commands are buffered until the
+ * command queue is flushed, a blocking call is made or enough of them are
+ * queued, and are then submitted together. */
+#define CL_QUEUE_DEFERRED_SUBMISSION_CLOVER         (1 << 16)
+
+
+/*************************************
+* cl_clover_kernel_fusion extension *
+*************************************/
+#define cl_clover_kernel_fusion 1
+
+/* cl_command_queue_properties - bitfield. In an in-order command queue, a
+ * 1D kernel consuming the output of the previous one, with the same NDRange
+ * and accessing the buffers they share only at its global id, is run with it
+ * on the same work-items. */
+#define CL_QUEUE_KERNEL_FUSION_CLOVER               (1 << 17)
+
+
+/**************************************
+* cl_clover_command_buffer extension *
+**************************************/
+#define cl_clover_command_buffer 1
+
+typedef struct _cl_command_buffer_clover * cl_command_buffer_clover;
+
+/* Error codes */
+#define CL_INVALID_COMMAND_BUFFER_CLOVER            -1138
+
+/* Create a command buffer recording commands for a command queue. The
+ * commands are validated when they are recorded, and the kernels keep the
+ * arguments they had at that time. Once finalized, the command buffer can
+ * be enqueued any number of times, its commands then run in the order they
+ * were recorded. */
+extern CL_API_ENTRY cl_command_buffer_clover CL_API_CALL
+clCreateCommandBufferCLOVER(cl_command_queue /* command_queue */,
+                            cl_int *         /* errcode_ret */);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clRetainCommandBufferCLOVER(cl_command_buffer_clover /* command_buffer */);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clReleaseCommandBufferCLOVER(cl_command_buffer_clover /* command_buffer */);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clCommandNDRangeKernelCLOVER(cl_command_buffer_clover /* command_buffer */,
+                             cl_kernel                /* kernel */,
+                             cl_uint                  /* work_dim */,
+                             const size_t *           /* global_work_offset */,
+                             const size_t *           /* global_work_size */,
+                             const size_t *           /* local_work_size */,
+                             cl_uint *                /* command_index */);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clCommandCopyBufferCLOVER(cl_command_buffer_clover /* command_buffer */,
+                          cl_mem                   /* src_buffer */,
+                          cl_mem                   /* dst_buffer */,
+                          size_t                   /* src_offset */,
+                          size_t                   /* dst_offset */,
+                          size_t                   /* cb */,
+                          cl_uint *                /* command_index */);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clCommandFillBufferCLOVER(cl_command_buffer_clover /* command_buffer */,
+                          cl_mem                   /* buffer */,
+                          const void *             /* pattern */,
+                          size_t                   /* pattern_size */,
+                          size_t                   /* offset */,
+                          size_t                   /* cb */,
+                          cl_uint *                /* command_index */);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clFinalizeCommandBufferCLOVER(cl_command_buffer_clover /* command_buffer */);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueCommandBufferCLOVER(cl_command_buffer_clover /* command_buffer */,
+                             cl_uint                  /* num_events_in_wait_list */,
+                             const cl_event *         /* event_wait_list */,
+                             cl_event *               /* event */);
+
+/* Change an argument of a recorded kernel for the next enqueues. The command
+ * buffer must be finalized and none of its enqueues may be running. */
+extern CL_API_ENTRY cl_int CL_API_CALL
+clUpdateCommandBufferKernelArgCLOVER(cl_command_buffer_clover /* command_buffer */,
+                                     cl_uint                  /* command_index */,
+                                     cl_uint                  /* arg_index */,
+                                     size_t                   /* arg_size */,
+                                     const void *             /* arg_value */);
+
+typedef CL_API_ENTRY cl_command_buffer_clover (CL_API_CALL *clCreateCommandBufferCLOVER_fn)(
+    cl_command_queue /* command_queue */,
+    cl_int *         /* errcode_ret */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clRetainCommandBufferCLOVER_fn)(
+    cl_command_buffer_clover /* command_buffer */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clReleaseCommandBufferCLOVER_fn)(
+    cl_command_buffer_clover /* command_buffer */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clCommandNDRangeKernelCLOVER_fn)(
+    cl_command_buffer_clover /* command_buffer */,
+    cl_kernel                /* kernel */,
+    cl_uint                  /* work_dim */,
+    const size_t *           /* global_work_offset */,
+    const size_t *           /* global_work_size */,
+    const size_t *           /* local_work_size */,
+    cl_uint *                /* command_index */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clCommandCopyBufferCLOVER_fn)(
+    cl_command_buffer_clover /* command_buffer */,
+    cl_mem                   /* src_buffer */,
+    cl_mem                   /* dst_buffer */,
+    size_t                   /* src_offset */,
+    size_t                   /* dst_offset */,
+    size_t                   /* cb */,
+    cl_uint *                /* command_index */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clCommandFillBufferCLOVER_fn)(
+    cl_command_buffer_clover /* command_buffer */,
+    cl_mem                   /* buffer */,
+    const void *             /* pattern */,
+    size_t                   /* pattern_size */,
+    size_t                   /* offset */,
+    size_t                   /* cb */,
+    cl_uint *                /* command_index */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clFinalizeCommandBufferCLOVER_fn)(
+    cl_command_buffer_clover /* command_buffer */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clEnqueueCommandBufferCLOVER_fn)(
+    cl_command_buffer_clover /* command_buffer */,
+    cl_uint                  /* num_events_in_wait_list */,
+    const cl_event *         /* event_wait_list */,
+    cl_event *               /* event */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clUpdateCommandBufferKernelArgCLOVER_fn)(
+    cl_command_buffer_clover /* command_buffer */,
+    cl_uint                  /* command_index */,
+    cl_uint                  /* arg_index */,
+    size_t                   /* arg_size */,
+    const void *             /* arg_value */);
+
+
+/***************************************
+* cl_clover_execution_trace extension *
+***************************************/
+#define cl_clover_execution_trace 1
+
+/* Start or stop recording the work-groups run, the program builds and the
+ * JIT compilations of a context. Starting a trace discards the previous one. */
+extern CL_API_ENTRY cl_int CL_API_CALL
+clEnableTraceCLOVER(cl_context /* context */,
+                    cl_bool    /* enable */);
+
+/* Get the recorded trace as a NUL-terminated string in the Chrome
+ * trace-event JSON format, loadable in chrome://tracing */
+extern CL_API_ENTRY cl_int CL_API_CALL
+clGetTraceCLOVER(cl_context /* context */,
+                 size_t     /* param_value_size */,
+                 void *     /* param_value */,
+                 size_t *   /* param_value_size_ret */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clEnableTraceCLOVER_fn)(
+    cl_context /* context */,
+    cl_bool    /* enable */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clGetTraceCLOVER_fn)(
+    cl_context /* context */,
+    size_t     /* param_value_size */,
+    void *     /* param_value */,
+    size_t *   /* param_value_size_ret */);
+
+
+/*************************************
+* cl_clover_host_snapshot extension *
+*************************************/
+#define cl_clover_host_snapshot 1
+
+/* cl_mem_flags - bitfield. With CL_MEM_COPY_HOST_PTR, large page-aligned host
+ * memory may be moved into the buffer instead of being copied, and given back
+ * page by page as the application accesses it. */
+#define CL_MEM_COPY_ON_WRITE_CLOVER                 (1 << 16)
+
+
 #ifdef CL_VERSION_1_1
    /***********************************
     * cl_ext_device_fission extension *
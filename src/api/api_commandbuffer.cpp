@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file api_commandbuffer.cpp
+ * \brief Command buffers (cl_clover_command_buffer)
+ */
+
+#include <CL/cl.h>
+#include <CL/cl_ext.h>
+
+#include <core/commandbuffer.h>
+#include <core/commandqueue.h>
+#include <core/kernel.h>
+#include <core/memobject.h>
+
+// Command Buffer APIs
+cl_command_buffer_clover
+clCreateCommandBufferCLOVER(cl_command_queue command_queue,
+                            cl_int *         errcode_ret)
+{
+    cl_int dummy_errcode;
+
+    if (!errcode_ret)
+        errcode_ret = &dummy_errcode;
+
+    if (!command_queue->isA(Coal::Object::T_CommandQueue))
+    {
+        *errcode_ret = CL_INVALID_COMMAND_QUEUE;
+        return 0;
+    }
+
+    Coal::CommandBuffer *buffer = new Coal::CommandBuffer(command_queue);
+
+    if (!buffer->registered())
+    {
+        delete buffer;
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return 0;
+    }
+
+    *errcode_ret = CL_SUCCESS;
+
+    return (cl_command_buffer_clover)buffer;
+}
+
+cl_int
+clRetainCommandBufferCLOVER(cl_command_buffer_clover command_buffer)
+{
+    if (!command_buffer->isA(Coal::Object::T_CommandBuffer))
+        return CL_INVALID_COMMAND_BUFFER_CLOVER;
+
+    command_buffer->reference();
+
+    return CL_SUCCESS;
+}
+
+cl_int
+clReleaseCommandBufferCLOVER(cl_command_buffer_clover command_buffer)
+{
+    if (!command_buffer->isA(Coal::Object::T_CommandBuffer))
+        return CL_INVALID_COMMAND_BUFFER_CLOVER;
+
+    if (command_buffer->dereference())
+        delete command_buffer;
+
+    return CL_SUCCESS;
+}
+
+cl_int
+clCommandNDRangeKernelCLOVER(cl_command_buffer_clover command_buffer,
+                             cl_kernel                kernel,
+                             cl_uint                  work_dim,
+                             const size_t *           global_work_offset,
+                             const size_t *           global_work_size,
+                             const size_t *           local_work_size,
+                             cl_uint *                command_index)
+{
+    if (!command_buffer->isA(Coal::Object::T_CommandBuffer))
+        return CL_INVALID_COMMAND_BUFFER_CLOVER;
+
+    if (!kernel->isA(Coal::Object::T_Kernel))
+        return CL_INVALID_KERNEL;
+
+    return command_buffer->recordKernel(kernel, work_dim, global_work_offset,
+                                        global_work_size, local_work_size,
+                                        command_index);
+}
+
+cl_int
+clCommandCopyBufferCLOVER(cl_command_buffer_clover command_buffer,
+                          cl_mem                   src_buffer,
+                          cl_mem                   dst_buffer,
+                          size_t                   src_offset,
+                          size_t                   dst_offset,
+                          size_t                   cb,
+                          cl_uint *                command_index)
+{
+    if (!command_buffer->isA(Coal::Object::T_CommandBuffer))
+        return CL_INVALID_COMMAND_BUFFER_CLOVER;
+
+    if (!src_buffer->isA(Coal::Object::T_MemObject) ||
+        !dst_buffer->isA(Coal::Object::T_MemObject))
+        return CL_INVALID_MEM_OBJECT;
+
+    return command_buffer->recordCopyBuffer(src_buffer, dst_buffer, src_offset,
+                                            dst_offset, cb, command_index);
+}
+
+cl_int
+clCommandFillBufferCLOVER(cl_command_buffer_clover command_buffer,
+                          cl_mem                   buffer,
+                          const void *             pattern,
+                          size_t                   pattern_size,
+                          size_t                   offset,
+                          size_t                   cb,
+                          cl_uint *                command_index)
+{
+    if (!command_buffer->isA(Coal::Object::T_CommandBuffer))
+        return CL_INVALID_COMMAND_BUFFER_CLOVER;
+
+    if (!buffer->isA(Coal::Object::T_MemObject))
+        return CL_INVALID_MEM_OBJECT;
+
+    return command_buffer->recordFillBuffer(buffer, pattern, pattern_size,
+                                            offset, cb, command_index);
+}
+
+cl_int
+clFinalizeCommandBufferCLOVER(cl_command_buffer_clover command_buffer)
+{
+    if (!command_buffer->isA(Coal::Object::T_CommandBuffer))
+        return CL_INVALID_COMMAND_BUFFER_CLOVER;
+
+    return command_buffer->finalize();
+}
+
+cl_int
+clEnqueueCommandBufferCLOVER(cl_command_buffer_clover command_buffer,
+                             cl_uint                  num_events_in_wait_list,
+                             const cl_event *         event_wait_list,
+                             cl_event *               event)
+{
+    if (!command_buffer->isA(Coal::Object::T_CommandBuffer))
+        return CL_INVALID_COMMAND_BUFFER_CLOVER;
+
+    return command_buffer->enqueue(num_events_in_wait_list,
+                                   (const Coal::Event **)event_wait_list,
+                                   (Coal::Event **)event);
+}
+
+cl_int
+clUpdateCommandBufferKernelArgCLOVER(cl_command_buffer_clover command_buffer,
+                                     cl_uint                  command_index,
+                                     cl_uint                  arg_index,
+                                     size_t                   arg_size,
+                                     const void *             arg_value)
+{
+    if (!command_buffer->isA(Coal::Object::T_CommandBuffer))
+        return CL_INVALID_COMMAND_BUFFER_CLOVER;
+
+    return command_buffer->updateKernelArg(command_index, arg_index, arg_size,
+                                           arg_value);
+}
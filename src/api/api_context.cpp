@@ -31,7 +31,12 @@
  */
 
 #include <CL/cl.h>
+#include <CL/cl_ext.h>
 #include <core/context.h>
+#include <core/trace.h>
+
+#include <cstring>
+#include <string>
 
 // Context APIs
 
@@ -125,3 +130,58 @@ clGetContextInfo(cl_context         context,
     return context->info(param_name, param_value_size, param_value,
                          param_value_size_ret);
 }
+
+// cl_clover_memory_pool
+
+cl_int
+clTrimMemoryPoolCLOVER(cl_context context,
+                       size_t *   released_size)
+{
+    if (!context->isA(Coal::Object::T_Context))
+        return CL_INVALID_CONTEXT;
+
+    size_t released = context->memoryPool()->trim();
+
+    if (released_size)
+        *released_size = released;
+
+    return CL_SUCCESS;
+}
+
+// cl_clover_execution_trace
+
+cl_int
+clEnableTraceCLOVER(cl_context context,
+                    cl_bool    enable)
+{
+    if (!context->isA(Coal::Object::T_Context))
+        return CL_INVALID_CONTEXT;
+
+    context->trace()->setEnabled(enable != CL_FALSE);
+
+    return CL_SUCCESS;
+}
+
+cl_int
+clGetTraceCLOVER(cl_context context,
+                 size_t     param_value_size,
+                 void *     param_value,
+                 size_t *   param_value_size_ret)
+{
+    if (!context->isA(Coal::Object::T_Context))
+        return CL_INVALID_CONTEXT;
+
+    std::string json = context->trace()->json();
+    size_t size = json.size() + 1;
+
+    if (param_value && param_value_size < size)
+        return CL_INVALID_VALUE;
+
+    if (param_value_size_ret)
+        *param_value_size_ret = size;
+
+    if (param_value)
+        std::memcpy(param_value, json.c_str(), size);
+
+    return CL_SUCCESS;
+}
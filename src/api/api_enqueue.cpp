@@ -44,6 +44,15 @@ static inline cl_int queueEvent(Coal::CommandQueue *queue,
 {
     cl_int rs;
 
+    // Once queued, the command can complete and be released by the command
+    // queue at any time. Take the references of the caller and of the wait
+    // before.
+    if (event)
+        command->reference();
+
+    if (blocking)
+        command->reference();
+
     rs = queue->queueEvent(command);
 
     if (rs != CL_SUCCESS)
@@ -53,20 +62,15 @@ static inline cl_int queueEvent(Coal::CommandQueue *queue,
     }
 
     if (event)
-    {
         *event = (cl_event)command;
-        command->reference();
-    }
 
     if (blocking)
     {
         rs = clWaitForEvents(1, (cl_event *)&command);
+        clReleaseEvent((cl_event)command);
 
         if (rs != CL_SUCCESS)
-        {
-            delete command;
             return rs;
-        }
     }
 
     return CL_SUCCESS;
@@ -284,6 +288,38 @@ clEnqueueCopyBuffer(cl_command_queue    command_queue,
     return queueEvent(command_queue, command, event, false);
 }
 
+cl_int
+clEnqueueFillBuffer(cl_command_queue    command_queue,
+                    cl_mem              buffer,
+                    const void *        pattern,
+                    size_t              pattern_size,
+                    size_t              offset,
+                    size_t              size,
+                    cl_uint             num_events_in_wait_list,
+                    const cl_event *    event_wait_list,
+                    cl_event *          event)
+{
+    cl_int rs = CL_SUCCESS;
+
+    if (!command_queue->isA(Coal::Object::T_CommandQueue))
+        return CL_INVALID_COMMAND_QUEUE;
+
+    Coal::FillBufferEvent *command = new Coal::FillBufferEvent(
+        (Coal::CommandQueue *)command_queue,
+        (Coal::MemObject *)buffer,
+        pattern, pattern_size, offset, size,
+        num_events_in_wait_list, (const Coal::Event **)event_wait_list, &rs
+    );
+
+    if (rs != CL_SUCCESS)
+    {
+        delete command;
+        return rs;
+    }
+
+    return queueEvent(command_queue, command, event, false);
+}
+
 cl_int
 clEnqueueReadImage(cl_command_queue     command_queue,
                    cl_mem               image,
@@ -452,6 +488,41 @@ clEnqueueCopyBufferToImage(cl_command_queue command_queue,
     return queueEvent(command_queue, command, event, false);
 }
 
+cl_int
+clEnqueueFillImage(cl_command_queue     command_queue,
+                   cl_mem               image,
+                   const void *         fill_color,
+                   const size_t *       origin,
+                   const size_t *       region,
+                   cl_uint              num_events_in_wait_list,
+                   const cl_event *     event_wait_list,
+                   cl_event *           event)
+{
+    cl_int rs = CL_SUCCESS;
+
+    if (!command_queue->isA(Coal::Object::T_CommandQueue))
+        return CL_INVALID_COMMAND_QUEUE;
+
+    if (!image || (image->type() != Coal::MemObject::Image2D &&
+        image->type() != Coal::MemObject::Image3D))
+        return CL_INVALID_MEM_OBJECT;
+
+    Coal::FillImageEvent *command = new Coal::FillImageEvent(
+        (Coal::CommandQueue *)command_queue,
+        (Coal::Image2D *)image,
+        fill_color, origin, region,
+        num_events_in_wait_list, (const Coal::Event **)event_wait_list, &rs
+    );
+
+    if (rs != CL_SUCCESS)
+    {
+        delete command;
+        return rs;
+    }
+
+    return queueEvent(command_queue, command, event, false);
+}
+
 void *
 clEnqueueMapBuffer(cl_command_queue command_queue,
                    cl_mem           buffer,
@@ -504,6 +575,7 @@ clEnqueueMapBuffer(cl_command_queue command_queue,
     {
         void *rs = command->ptr();
 
+        ((Coal::MemObject *)buffer)->addMapping(rs);
         clReleaseEvent((cl_event)command);
 
         return rs;
@@ -562,10 +634,7 @@ clEnqueueMapImage(cl_command_queue  command_queue,
     *errcode_ret = queueEvent(command_queue, command, event, blocking_map);
 
     if (*errcode_ret != CL_SUCCESS)
-    {
-        delete command;
         return 0;
-    }
     else
     {
         *image_row_pitch = command->row_pitch();
@@ -575,6 +644,7 @@ clEnqueueMapImage(cl_command_queue  command_queue,
 
         void *rs = command->ptr();
 
+        ((Coal::MemObject *)image)->addMapping(rs);
         clReleaseEvent((cl_event)command);
 
         return rs;
@@ -609,7 +679,13 @@ clEnqueueUnmapMemObject(cl_command_queue command_queue,
         return rs;
     }
 
-    return queueEvent(command_queue, command, event, false);
+    rs = queueEvent(command_queue, command, event, false);
+
+    // The mapping stays valid if the unmap couldn't be queued
+    if (rs == CL_SUCCESS)
+        ((Coal::MemObject *)memobj)->removeMapping(mapped_ptr);
+
+    return rs;
 }
 
 cl_int
@@ -637,6 +713,9 @@ clEnqueueNDRangeKernel(cl_command_queue command_queue,
         num_events_in_wait_list, (const Coal::Event **)event_wait_list, &rs
     );
 
+    if (!command)
+        return CL_OUT_OF_HOST_MEMORY;
+
     if (rs != CL_SUCCESS)
     {
         delete command;
@@ -666,6 +745,9 @@ clEnqueueTask(cl_command_queue  command_queue,
         num_events_in_wait_list, (const Coal::Event **)event_wait_list, &rs
     );
 
+    if (!command)
+        return CL_OUT_OF_HOST_MEMORY;
+
     if (rs != CL_SUCCESS)
     {
         delete command;
@@ -31,8 +31,10 @@
  */
 
 #include "CL/cl.h"
+#include "CL/cl_ext.h"
 #include <core/memobject.h>
 #include <core/context.h>
+#include <core/filemapping.h>
 
 #include <cstring>
 
@@ -416,3 +418,53 @@ clSetMemObjectDestructorCallback(cl_mem memobj,
     return CL_SUCCESS;
 }
 
+// cl_clover_file_buffer
+
+cl_mem
+clCreateBufferFromFileCLOVER(cl_context                  context,
+                             cl_mem_flags                flags,
+                             int                         fd,
+                             cl_ulong                    offset,
+                             size_t                      size,
+                             cl_file_buffer_flags_clover file_flags,
+                             cl_int *                    errcode_ret)
+{
+    cl_int dummy_errcode;
+
+    if (!errcode_ret)
+        errcode_ret = &dummy_errcode;
+
+    if (!context->isA(Coal::Object::T_Context))
+    {
+        *errcode_ret = CL_INVALID_CONTEXT;
+        return 0;
+    }
+
+    // The file is the host memory of the buffer
+    const cl_mem_flags access_flags = CL_MEM_READ_WRITE | CL_MEM_WRITE_ONLY |
+                                      CL_MEM_READ_ONLY;
+
+    if ((flags & ~access_flags) || (file_flags & ~CL_FILE_BUFFER_POPULATE_CLOVER))
+    {
+        *errcode_ret = CL_INVALID_VALUE;
+        return 0;
+    }
+
+    Coal::FileMapping *mapping = Coal::FileMapping::create(fd, offset, size,
+        (flags & CL_MEM_READ_ONLY) == 0,
+        (file_flags & CL_FILE_BUFFER_POPULATE_CLOVER) != 0,
+        errcode_ret);
+
+    if (!mapping)
+        return 0;
+
+    Coal::Buffer *buf = new Coal::Buffer(context, mapping, flags, errcode_ret);
+
+    if (*errcode_ret != CL_SUCCESS || (*errcode_ret = buf->init()) != CL_SUCCESS)
+    {
+        delete buf;
+        return 0;
+    }
+
+    return (cl_mem)buf;
+}
@@ -31,6 +31,7 @@
  */
 
 #include "CL/cl.h"
+#include "CL/cl_ext.h"
 #include <cstring>
 #include <core/config.h>
 
@@ -38,7 +39,32 @@ static const char platform_profile[] = "FULL_PROFILE";
 static const char platform_version[] = "OpenCL 1.1 MESA " COAL_VERSION;
 static const char platform_name[] = "Default";
 static const char platform_vendor[] = "Mesa";
-static const char platform_extensions[] = "cl_khr_fp64 cl_khr_int64_base_atomics cl_khr_int64_extended_atomics";
+static const char platform_extensions[] = "cl_khr_fp64 cl_khr_int64_base_atomics cl_khr_int64_extended_atomics "
+                                          "cl_clover_memory_pool cl_clover_file_buffer "
+                                          "cl_clover_deferred_submission cl_clover_kernel_fusion "
+                                          "cl_clover_command_buffer cl_clover_execution_trace "
+                                          "cl_clover_host_snapshot";
+
+// Extension functions, returned by clGetExtensionFunctionAddress
+static const struct
+{
+    const char *name;
+    void *address;
+} extension_functions[] = {
+    { "clTrimMemoryPoolCLOVER", (void *)&clTrimMemoryPoolCLOVER },
+    { "clCreateBufferFromFileCLOVER", (void *)&clCreateBufferFromFileCLOVER },
+    { "clCreateCommandBufferCLOVER", (void *)&clCreateCommandBufferCLOVER },
+    { "clRetainCommandBufferCLOVER", (void *)&clRetainCommandBufferCLOVER },
+    { "clReleaseCommandBufferCLOVER", (void *)&clReleaseCommandBufferCLOVER },
+    { "clCommandNDRangeKernelCLOVER", (void *)&clCommandNDRangeKernelCLOVER },
+    { "clCommandCopyBufferCLOVER", (void *)&clCommandCopyBufferCLOVER },
+    { "clCommandFillBufferCLOVER", (void *)&clCommandFillBufferCLOVER },
+    { "clFinalizeCommandBufferCLOVER", (void *)&clFinalizeCommandBufferCLOVER },
+    { "clEnqueueCommandBufferCLOVER", (void *)&clEnqueueCommandBufferCLOVER },
+    { "clUpdateCommandBufferKernelArgCLOVER", (void *)&clUpdateCommandBufferKernelArgCLOVER },
+    { "clEnableTraceCLOVER", (void *)&clEnableTraceCLOVER },
+    { "clGetTraceCLOVER", (void *)&clGetTraceCLOVER },
+};
 
 // Platform API
 
@@ -117,3 +143,19 @@ clGetPlatformInfo(cl_platform_id   platform,
 
     return CL_SUCCESS;
 }
+
+void *
+clGetExtensionFunctionAddress(const char *func_name)
+{
+    if (!func_name)
+        return 0;
+
+    for (unsigned int i=0;
+         i<sizeof(extension_functions) / sizeof(extension_functions[0]); ++i)
+    {
+        if (std::strcmp(func_name, extension_functions[i].name) == 0)
+            return extension_functions[i].address;
+    }
+
+    return 0;
+}
@@ -63,6 +63,13 @@ clCreateProgramWithSource(cl_context        context,
 
     Coal::Program *program = new Coal::Program(context);
 
+    if (!program->registered())
+    {
+        delete program;
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return 0;
+    }
+
     *errcode_ret = CL_SUCCESS;
     *errcode_ret = program->loadSources(count, strings, lengths);
 
@@ -152,6 +159,14 @@ clCreateProgramWithBinary(cl_context            context,
 
     // Create a program
     Coal::Program *program = new Coal::Program(context);
+
+    if (!program->registered())
+    {
+        delete program;
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return 0;
+    }
+
     *errcode_ret = CL_SUCCESS;
 
     // Init program
@@ -0,0 +1,501 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file commandbuffer.cpp
+ * \brief Recorded and replayable list of commands
+ */
+
+#include "commandbuffer.h"
+#include "commandqueue.h"
+#include "events.h"
+#include "kernel.h"
+#include "memobject.h"
+#include "deviceinterface.h"
+
+using namespace Coal;
+
+CommandBuffer::CommandBuffer(CommandQueue *queue)
+: Object(Object::T_CommandBuffer, queue), p_finalized(false), p_pending(0)
+{
+    pthread_mutex_init(&p_mutex, 0);
+}
+
+CommandBuffer::~CommandBuffer()
+{
+    // The queued events reference us, they are all completed now
+    for (size_t i=0; i<p_commands.size(); ++i)
+    {
+        Command &command = p_commands[i];
+
+        deleteEvent(command.prototype);
+        releaseMemObjects(command.mem_objects);
+
+        if (command.kernel && command.kernel->dereference())
+            delete command.kernel;
+    }
+
+    pthread_mutex_destroy(&p_mutex);
+}
+
+CommandQueue *CommandBuffer::queue() const
+{
+    return (CommandQueue *)parent();
+}
+
+void CommandBuffer::deleteEvent(Event *event)
+{
+    event->freeDeviceData();
+    delete event;
+}
+
+void CommandBuffer::retainMemObjects(const Command &command,
+                                     std::vector<MemObject *> &objects)
+{
+    Event *prototype = command.prototype;
+
+    switch (prototype->type())
+    {
+        case Event::NDRangeKernel:
+            for (unsigned int i=0; i<command.kernel->numArgs(); ++i)
+            {
+                const Kernel::Arg &arg = command.kernel->arg(i);
+
+                if ((arg.kind() != Kernel::Arg::Buffer &&
+                     arg.kind() != Kernel::Arg::Image2D &&
+                     arg.kind() != Kernel::Arg::Image3D) ||
+                    arg.file() == Kernel::Arg::Local)
+                    continue;
+
+                MemObject *object = *(MemObject **)arg.data();
+
+                if (object)
+                    objects.push_back(object);
+            }
+            break;
+
+        case Event::CopyBuffer:
+            objects.push_back(((CopyBufferEvent *)prototype)->source());
+            objects.push_back(((CopyBufferEvent *)prototype)->destination());
+            break;
+
+        case Event::FillBuffer:
+            objects.push_back(((FillBufferEvent *)prototype)->buffer());
+            break;
+
+        default:
+            break;
+    }
+
+    for (size_t i=0; i<objects.size(); ++i)
+        objects[i]->reference();
+}
+
+void CommandBuffer::releaseMemObjects(std::vector<MemObject *> &objects)
+{
+    for (size_t i=0; i<objects.size(); ++i)
+    {
+        if (objects[i]->dereference())
+            delete objects[i];
+    }
+
+    objects.clear();
+}
+
+cl_int CommandBuffer::record(Event *prototype, Kernel *kernel, cl_int rs,
+                             cl_uint *command_index)
+{
+    // Kernels are made ready for the device once, see
+    // DeviceInterface::initReplayedEventDeviceData()
+    if (rs == CL_SUCCESS && kernel)
+        rs = queue()->device()->initEventDeviceData(prototype);
+
+    if (rs == CL_SUCCESS)
+    {
+        pthread_mutex_lock(&p_mutex);
+
+        if (p_finalized)
+        {
+            rs = CL_INVALID_OPERATION;
+        }
+        else
+        {
+            Command command;
+
+            command.prototype = prototype;
+            command.kernel = kernel;
+
+            // The application can release the memory objects while the
+            // command is recorded
+            retainMemObjects(command, command.mem_objects);
+
+            if (command_index)
+                *command_index = p_commands.size();
+
+            p_commands.push_back(command);
+        }
+
+        pthread_mutex_unlock(&p_mutex);
+    }
+
+    if (rs != CL_SUCCESS)
+    {
+        deleteEvent(prototype);
+
+        if (kernel)
+            delete kernel;
+    }
+
+    return rs;
+}
+
+cl_int CommandBuffer::recordKernel(Kernel *kernel,
+                                   cl_uint work_dim,
+                                   const size_t *global_work_offset,
+                                   const size_t *global_work_size,
+                                   const size_t *local_work_size,
+                                   cl_uint *command_index)
+{
+    cl_int rs = CL_SUCCESS;
+
+    // Snapshot of the kernel and of its current arguments
+    Kernel *copy = kernel->clone(&rs);
+
+    if (rs != CL_SUCCESS)
+    {
+        delete copy;
+        return rs;
+    }
+
+    KernelEvent *prototype = new KernelEvent(queue(), copy, work_dim,
+        global_work_offset, global_work_size, local_work_size, 0, 0, &rs);
+
+    if (!prototype)
+    {
+        delete copy;
+        return CL_OUT_OF_HOST_MEMORY;
+    }
+
+    return record(prototype, copy, rs, command_index);
+}
+
+cl_int CommandBuffer::recordCopyBuffer(MemObject *source,
+                                       MemObject *destination,
+                                       size_t src_offset,
+                                       size_t dst_offset,
+                                       size_t cb,
+                                       cl_uint *command_index)
+{
+    cl_int rs = CL_SUCCESS;
+
+    CopyBufferEvent *prototype = new CopyBufferEvent(queue(), source,
+        destination, src_offset, dst_offset, cb, 0, 0, &rs);
+
+    return record(prototype, 0, rs, command_index);
+}
+
+cl_int CommandBuffer::recordFillBuffer(MemObject *buffer,
+                                       const void *pattern,
+                                       size_t pattern_size,
+                                       size_t offset,
+                                       size_t cb,
+                                       cl_uint *command_index)
+{
+    cl_int rs = CL_SUCCESS;
+
+    FillBufferEvent *prototype = new FillBufferEvent(queue(), buffer,
+        pattern, pattern_size, offset, cb, 0, 0, &rs);
+
+    return record(prototype, 0, rs, command_index);
+}
+
+cl_int CommandBuffer::finalize()
+{
+    cl_int rs = CL_SUCCESS;
+
+    pthread_mutex_lock(&p_mutex);
+
+    if (p_finalized || p_commands.empty())
+        rs = CL_INVALID_OPERATION;
+    else
+        p_finalized = true;
+
+    pthread_mutex_unlock(&p_mutex);
+
+    return rs;
+}
+
+Event *CommandBuffer::replay(const Command &command,
+                             cl_uint num_events_in_wait_list,
+                             const Event **event_wait_list,
+                             cl_int *errcode_ret) const
+{
+    Event *prototype = command.prototype;
+
+    switch (prototype->type())
+    {
+        case Event::NDRangeKernel:
+        {
+            KernelEvent *e = new KernelEvent(queue(), (KernelEvent *)prototype,
+                                             num_events_in_wait_list,
+                                             event_wait_list, errcode_ret);
+
+            if (!e)
+                *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+
+            return e;
+        }
+
+        case Event::CopyBuffer:
+        {
+            // Transfers are only checked against the buffer sizes, they are
+            // simply queued again
+            CopyBufferEvent *e = (CopyBufferEvent *)prototype;
+
+            return new CopyBufferEvent(queue(), e->source(), e->destination(),
+                                       e->src_offset(), e->dst_offset(),
+                                       e->cb(), num_events_in_wait_list,
+                                       event_wait_list, errcode_ret);
+        }
+
+        case Event::FillBuffer:
+        {
+            FillBufferEvent *e = (FillBufferEvent *)prototype;
+
+            return new FillBufferEvent(queue(), e->buffer(), e->pattern(),
+                                       e->pattern_size(), e->offset(), e->cb(),
+                                       num_events_in_wait_list,
+                                       event_wait_list, errcode_ret);
+        }
+
+        default:
+            *errcode_ret = CL_INVALID_OPERATION;
+            return 0;
+    }
+}
+
+cl_int CommandBuffer::enqueue(cl_uint num_events_in_wait_list,
+                              const Event **event_wait_list,
+                              Event **event)
+{
+    cl_int rs = CL_SUCCESS;
+
+    // The commands can't be updated until the events are completed
+    pthread_mutex_lock(&p_mutex);
+
+    if (!p_finalized)
+        rs = CL_INVALID_OPERATION;
+    else
+        p_pending += p_commands.size();
+
+    pthread_mutex_unlock(&p_mutex);
+
+    if (rs != CL_SUCCESS)
+        return rs;
+
+    // Each event keeps us alive until it completes, the application can
+    // release the command buffer without waiting for them
+    for (size_t i=0; i<p_commands.size(); ++i)
+        reference();
+
+    // An in-order command queue already runs the commands one after the
+    // other, an out-of-order one has to chain them
+    cl_command_queue_properties properties = 0;
+    queue()->info(CL_QUEUE_PROPERTIES, sizeof(properties), &properties, 0);
+
+    bool chain = (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+    size_t count = p_commands.size();
+    std::vector<Event *> events(count, (Event *)0);
+    size_t created = 0, queued = 0;
+
+    for (; created<count; ++created)
+    {
+        cl_uint num_wait = num_events_in_wait_list;
+        const Event **wait = event_wait_list;
+
+        if (created > 0)
+        {
+            num_wait = (chain ? 1 : 0);
+            wait = (chain ? (const Event **)&events[created - 1] : 0);
+        }
+
+        Event *e = replay(p_commands[created], num_wait, wait, &rs);
+
+        if (rs != CL_SUCCESS)
+        {
+            if (e)
+                deleteEvent(e);
+
+            break;
+        }
+
+        e->setCallback(CL_COMPLETE, &replayedEventComplete, this);
+        events[created] = e;
+    }
+
+    if (rs == CL_SUCCESS)
+    {
+        // Once queued, the last event can be completed and released at any
+        // time
+        if (event)
+            events.back()->reference();
+
+        for (; queued<count; ++queued)
+        {
+            rs = queue()->queueEvent(events[queued],
+                                     p_commands[queued].prototype);
+
+            if (rs != CL_SUCCESS)
+                break;
+        }
+    }
+
+    if (rs != CL_SUCCESS)
+    {
+        // The events already queued run, the others are dropped. Each one
+        // references the previous one, delete them from the end.
+        for (size_t i=created; i>queued; --i)
+            deleteEvent(events[i - 1]);
+
+        completed(count - queued);
+
+        return rs;
+    }
+
+    if (event)
+        *event = events.back();
+
+    return CL_SUCCESS;
+}
+
+cl_int CommandBuffer::updateKernelArg(cl_uint command_index,
+                                      cl_uint arg_index,
+                                      size_t size,
+                                      const void *value)
+{
+    cl_int rs = CL_SUCCESS;
+
+    pthread_mutex_lock(&p_mutex);
+
+    if (!p_finalized || p_pending)
+        rs = CL_INVALID_OPERATION;
+    else if (command_index >= p_commands.size() ||
+             !p_commands[command_index].kernel)
+        rs = CL_INVALID_VALUE;
+    else if (arg_index >= p_commands[command_index].kernel->numArgs())
+        rs = CL_INVALID_ARG_INDEX;
+
+    if (rs != CL_SUCCESS)
+    {
+        pthread_mutex_unlock(&p_mutex);
+        return rs;
+    }
+
+    Command &command = p_commands[command_index];
+    KernelEvent *old = (KernelEvent *)command.prototype;
+    Kernel::Arg saved = command.kernel->arg(arg_index);
+
+    rs = command.kernel->setArg(arg_index, size, value);
+
+    if (rs != CL_SUCCESS)
+    {
+        pthread_mutex_unlock(&p_mutex);
+        return rs;
+    }
+
+    // Validate the kernel again with the new argument
+    size_t offset[MAX_WORK_DIMS], global[MAX_WORK_DIMS], local[MAX_WORK_DIMS];
+
+    for (cl_uint i=0; i<old->work_dim(); ++i)
+    {
+        offset[i] = old->global_work_offset(i);
+        global[i] = old->global_work_size(i);
+        local[i] = old->local_work_size(i);
+    }
+
+    KernelEvent *prototype = new KernelEvent(queue(), command.kernel,
+        old->work_dim(), offset, global, local, 0, 0, &rs);
+
+    if (!prototype)
+    {
+        command.kernel->restoreArg(arg_index, saved);
+        pthread_mutex_unlock(&p_mutex);
+        return CL_OUT_OF_HOST_MEMORY;
+    }
+
+    if (rs == CL_SUCCESS)
+        rs = queue()->device()->initEventDeviceData(prototype);
+
+    if (rs != CL_SUCCESS)
+    {
+        deleteEvent(prototype);
+        command.kernel->restoreArg(arg_index, saved);
+    }
+    else
+    {
+        std::vector<MemObject *> objects;
+
+        deleteEvent(old);
+        command.prototype = prototype;
+
+        retainMemObjects(command, objects);
+        releaseMemObjects(command.mem_objects);
+        command.mem_objects.swap(objects);
+    }
+
+    pthread_mutex_unlock(&p_mutex);
+
+    return rs;
+}
+
+void CommandBuffer::completed(size_t count)
+{
+    pthread_mutex_lock(&p_mutex);
+
+    p_pending -= count;
+
+    pthread_mutex_unlock(&p_mutex);
+
+    // Release the references taken by enqueue(), the last one deletes us
+    for (size_t i=0; i<count; ++i)
+    {
+        if (dereference())
+        {
+            delete this;
+            return;
+        }
+    }
+}
+
+void CommandBuffer::replayedEventComplete(cl_event event, cl_int status,
+                                          void *user_data)
+{
+    (void)event;
+    (void)status;
+
+    ((CommandBuffer *)user_data)->completed(1);
+}
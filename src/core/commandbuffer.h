@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file commandbuffer.h
+ * \brief Recorded and replayable list of commands
+ */
+
+#ifndef __COMMANDBUFFER_H__
+#define __COMMANDBUFFER_H__
+
+#include "object.h"
+
+#include <CL/cl.h>
+#include <pthread.h>
+
+#include <vector>
+
+namespace Coal
+{
+
+class CommandQueue;
+class Event;
+class Kernel;
+class MemObject;
+
+/**
+ * \brief Command buffer
+ *
+ * A command buffer records commands for a \c Coal::CommandQueue and queues
+ * them again each time it is enqueued, in the order they were recorded.
+ *
+ * Each command is kept as a prototype event, built and validated like an
+ * enqueued one when the command is recorded, but never queued. Enqueuing
+ * the command buffer copies the prototypes into new events without checking
+ * them again, and lets the device initialize them from the prototypes (see
+ * \c Coal::DeviceInterface::initReplayedEventDeviceData()).
+ *
+ * A kernel is recorded with a private copy of the \c Coal::Kernel, holding
+ * the arguments it had at that time. Only \c updateKernelArg() can change
+ * them afterwards.
+ */
+class CommandBuffer : public Object
+{
+    public:
+        /**
+         * \brief Constructor
+         * \param queue \c Coal::CommandQueue on which the commands will run
+         */
+        CommandBuffer(CommandQueue *queue);
+
+        /**
+         * \brief Destructor
+         *
+         * Called once the application released the command buffer and all
+         * the commands queued by \c enqueue() are completed, as each of
+         * their events holds a reference to it.
+         */
+        ~CommandBuffer();
+
+        /**
+         * \name Recording
+         *
+         * These functions take the same parameters as the corresponding
+         * \c clEnqueue functions and do the same checks. They fail with
+         * \c CL_INVALID_OPERATION once the command buffer is finalized.
+         *
+         * \param command_index index of the command in this command buffer,
+         *        ignored if NULL
+         * @{
+         */
+        cl_int recordKernel(Kernel *kernel,
+                            cl_uint work_dim,
+                            const size_t *global_work_offset,
+                            const size_t *global_work_size,
+                            const size_t *local_work_size,
+                            cl_uint *command_index);
+        cl_int recordCopyBuffer(MemObject *source,
+                                MemObject *destination,
+                                size_t src_offset,
+                                size_t dst_offset,
+                                size_t cb,
+                                cl_uint *command_index);
+        cl_int recordFillBuffer(MemObject *buffer,
+                                const void *pattern,
+                                size_t pattern_size,
+                                size_t offset,
+                                size_t cb,
+                                cl_uint *command_index);
+        /**
+         * @}
+         */
+
+        /**
+         * \brief End the recording
+         * \return \c CL_SUCCESS, or \c CL_INVALID_OPERATION if the command
+         *         buffer is already finalized or has no command
+         */
+        cl_int finalize();
+
+        /**
+         * \brief Queue the recorded commands on the command queue
+         *
+         * The first command waits for \p event_wait_list, each other one for
+         * the previous command. If a command fails, the ones after it don't
+         * run and fail with the same status, the command buffer can then be
+         * updated again.
+         *
+         * \param num_events_in_wait_list number of events in \p event_wait_list
+         * \param event_wait_list events the first command waits for
+         * \param event if not NULL, receives a referenced event completed
+         *        with the last command
+         * \return \c CL_SUCCESS if success, otherwise an error code
+         */
+        cl_int enqueue(cl_uint num_events_in_wait_list,
+                       const Event **event_wait_list,
+                       Event **event);
+
+        /**
+         * \brief Change an argument of a recorded kernel
+         *
+         * The kernel is validated again with its recorded NDRange. If it
+         * fails, the argument keeps its previous value.
+         *
+         * \param command_index index of an NDRange command
+         * \param arg_index index of the argument
+         * \param size size of \p value, as for \c Coal::Kernel::setArg()
+         * \param value new value of the argument
+         * \return \c CL_SUCCESS if success, \c CL_INVALID_OPERATION if the
+         *         command buffer isn't finalized or commands it queued are
+         *         not complete yet, otherwise an error code
+         */
+        cl_int updateKernelArg(cl_uint command_index,
+                               cl_uint arg_index,
+                               size_t size,
+                               const void *value);
+
+        CommandQueue *queue() const;    /*!< \brief Command queue on which the commands run */
+
+    private:
+        struct Command
+        {
+            Event *prototype;   /*!< \brief Validated event, copied at each enqueue */
+            Kernel *kernel;     /*!< \brief Private copy of the kernel, 0 for transfers */
+            std::vector<MemObject *> mem_objects; /*!< \brief Referenced buffers and images used by the command */
+        };
+
+        std::vector<Command> p_commands;
+        bool p_finalized;
+
+        pthread_mutex_t p_mutex;
+        size_t p_pending;       /*!< \brief Queued events not completed yet */
+
+        cl_int record(Event *prototype, Kernel *kernel, cl_int rs,
+                      cl_uint *command_index);
+        Event *replay(const Command &command,
+                      cl_uint num_events_in_wait_list,
+                      const Event **event_wait_list,
+                      cl_int *errcode_ret) const;
+        void completed(size_t count);
+
+        static void deleteEvent(Event *event);
+        static void retainMemObjects(const Command &command,
+                                     std::vector<MemObject *> &objects);
+        static void releaseMemObjects(std::vector<MemObject *> &objects);
+        static void replayedEventComplete(cl_event event, cl_int status,
+                                          void *user_data);
+};
+
+}
+
+struct _cl_command_buffer_clover : public Coal::CommandBuffer
+{};
+
+#endif
@@ -35,10 +35,16 @@
 #include "deviceinterface.h"
 #include "propertylist.h"
 #include "events.h"
+#include "kernel.h"
+#include "memobject.h"
+#include "trace.h"
+
+#include <CL/cl_ext.h>
 
 #include <cstring>
 #include <cstdlib>
 #include <ctime>
+#include <sched.h>
 #include <iostream>
 
 using namespace Coal;
@@ -52,12 +58,20 @@ CommandQueue::CommandQueue(Context *ctx,
                            cl_command_queue_properties properties,
                            cl_int *errcode_ret)
 : Object(Object::T_CommandQueue, ctx), p_device(device),
-  p_properties(properties), p_flushed(true)
+  p_properties(properties), p_last_event(0), p_last_barrier(0),
+  p_intake(0), p_draining(0), p_intake_takes(0), p_intake_size(0),
+  p_intake_since(0)
 {
     // Initialize the locking machinery
     pthread_mutex_init(&p_event_list_mutex, 0);
     pthread_cond_init(&p_event_list_cond, 0);
 
+    if (!registered())
+    {
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return;
+    }
+
     // Check that the device belongs to the context
     if (!ctx->hasDevice(device))
     {
@@ -66,6 +80,11 @@ CommandQueue::CommandQueue(Context *ctx,
     }
 
     *errcode_ret = checkProperties();
+
+    if (*errcode_ret != CL_SUCCESS)
+        return;
+
+    *errcode_ret = readDeviceLimits();
 }
 
 CommandQueue::~CommandQueue()
@@ -75,6 +94,50 @@ CommandQueue::~CommandQueue()
     pthread_cond_destroy(&p_event_list_cond);
 }
 
+DeviceInterface *CommandQueue::device() const
+{
+    return p_device;
+}
+
+const DeviceLimits &CommandQueue::deviceLimits() const
+{
+    return p_limits;
+}
+
+cl_int CommandQueue::readDeviceLimits()
+{
+    cl_int rs;
+
+    std::memset(&p_limits, 0, sizeof(p_limits));
+
+    rs = p_device->info(CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t),
+                        &p_limits.max_work_group_size, 0);
+    rs |= p_device->info(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(cl_uint),
+                         &p_limits.max_work_item_dimensions, 0);
+
+    if (rs != CL_SUCCESS)
+        return rs;
+
+    if (p_limits.max_work_item_dimensions > MAX_WORK_DIMS)
+        p_limits.max_work_item_dimensions = MAX_WORK_DIMS;
+
+    rs |= p_device->info(CL_DEVICE_MAX_WORK_ITEM_SIZES,
+                         p_limits.max_work_item_dimensions * sizeof(size_t),
+                         p_limits.max_work_item_sizes, 0);
+    rs |= p_device->info(CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(size_t),
+                         &p_limits.image2d_max_width, 0);
+    rs |= p_device->info(CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(size_t),
+                         &p_limits.image2d_max_height, 0);
+    rs |= p_device->info(CL_DEVICE_IMAGE3D_MAX_WIDTH, sizeof(size_t),
+                         &p_limits.image3d_max_width, 0);
+    rs |= p_device->info(CL_DEVICE_IMAGE3D_MAX_HEIGHT, sizeof(size_t),
+                         &p_limits.image3d_max_height, 0);
+    rs |= p_device->info(CL_DEVICE_IMAGE3D_MAX_DEPTH, sizeof(size_t),
+                         &p_limits.image3d_max_depth, 0);
+
+    return rs;
+}
+
 cl_int CommandQueue::info(cl_command_queue_info param_name,
                           size_t param_value_size,
                           void *param_value,
@@ -144,7 +207,9 @@ cl_int CommandQueue::checkProperties() const
     // Check that all the properties are valid
     cl_command_queue_properties properties =
         CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE |
-        CL_QUEUE_PROFILING_ENABLE;
+        CL_QUEUE_PROFILING_ENABLE |
+        CL_QUEUE_DEFERRED_SUBMISSION_CLOVER |
+        CL_QUEUE_KERNEL_FUSION_CLOVER;
 
     if ((p_properties & properties) != p_properties)
         return CL_INVALID_VALUE;
@@ -168,214 +233,540 @@ cl_int CommandQueue::checkProperties() const
 
 void CommandQueue::flush()
 {
-    // Wait for the command queue to be in state "flushed".
-    pthread_mutex_lock(&p_event_list_mutex);
-
-    while (!p_flushed)
-        pthread_cond_wait(&p_event_list_cond, &p_event_list_mutex);
-
-    pthread_mutex_unlock(&p_event_list_mutex);
+    // Submit what is buffered, without waiting for anything
+    drainIntake();
 }
 
 void CommandQueue::finish()
 {
-    // As pushEventsOnDevice doesn't remove SUCCESS events, we may need
-    // to do that here in order not to be stuck.
-    cleanEvents();
+    // The buffered events must also be completed
+    drainIntake();
 
     // All the queued events must have completed. When they are, they get
-    // deleted from the command queue, so simply wait for it to become empty.
+    // removed from the command queue, so simply wait for it to become empty.
     pthread_mutex_lock(&p_event_list_mutex);
 
     while (p_events.size() != 0)
         pthread_cond_wait(&p_event_list_cond, &p_event_list_mutex);
 
     pthread_mutex_unlock(&p_event_list_mutex);
+
+    // Release the completed events now
+    cleanEvents(true);
+}
+
+void CommandQueue::drainIntake()
+{
+    std::vector<Event *> ready;
+
+    pthread_mutex_lock(&p_event_list_mutex);
+    linkIntake(ready);
+    pthread_mutex_unlock(&p_event_list_mutex);
+
+    submitEvents(ready);
 }
 
-cl_int CommandQueue::queueEvent(Event *event)
+// Events a deferred command queue buffers before submitting them, and the
+// time in nanoseconds they can stay buffered
+static const size_t deferred_batch_size = 64;
+static const cl_ulong deferred_delay = 1000000;
+
+cl_int CommandQueue::queueEvent(Event *event, Event *prototype)
 {
     // Let the device initialize the event (for instance, a pointer at which
     // memory would be mapped)
-    cl_int rs = p_device->initEventDeviceData(event);
+    cl_int rs;
+
+    if (prototype)
+        rs = p_device->initReplayedEventDeviceData(event, prototype);
+    else
+        rs = p_device->initEventDeviceData(event);
 
     if (rs != CL_SUCCESS)
         return rs;
 
-    // Append the event at the end of the list
-    pthread_mutex_lock(&p_event_list_mutex);
-
-    p_events.push_back(event);
-    p_flushed = false;
-
-    pthread_mutex_unlock(&p_event_list_mutex);
-
     // Timing info if needed
     if (p_properties & CL_QUEUE_PROFILING_ENABLE)
         event->updateTiming(Event::Queue);
 
-    // Explore the list for events we can push on the device
-    pushEventsOnDevice();
+    // Hand the event to the intake, without locking
+    Event *head;
+
+    do
+    {
+        head = p_intake;
+        event->setIntakeNext(head);
+    }
+    while (!__sync_bool_compare_and_swap(&p_intake, head, event));
+
+    // A deferred command queue keeps the events in the intake until it is
+    // flushed, until they are numerous or old enough, or until a marker or a
+    // barrier is queued: the application waits for them to complete.
+    if (p_properties & CL_QUEUE_DEFERRED_SUBMISSION_CLOVER)
+    {
+        size_t buffered = __sync_add_and_fetch(&p_intake_size, 1);
+        cl_ulong now = monotonicTime();
+
+        if (head == 0)
+            p_intake_since = now;
+
+        if (!event->isDummy() &&
+            buffered < deferred_batch_size &&
+            now - p_intake_since < deferred_delay)
+            return CL_SUCCESS;
+    }
+
+    // Only one thread at a time links the events of the intake in the graph.
+    // Any take of the intake counted from now includes our event, as takes
+    // are counted before the intake is emptied. Stop as soon as one happens:
+    // each thread links at most one batch, never the work of the others
+    // indefinitely.
+    unsigned int takes = p_intake_takes;
+
+    while (p_intake && p_intake_takes == takes)
+    {
+        if (!__sync_bool_compare_and_swap(&p_draining, 0, 1))
+        {
+            // The drainer only holds the intake while linking it
+            sched_yield();
+            continue;
+        }
+
+        std::vector<Event *> ready;
+
+        pthread_mutex_lock(&p_event_list_mutex);
+        linkIntake(ready);
+        pthread_mutex_unlock(&p_event_list_mutex);
+
+        __sync_bool_compare_and_swap(&p_draining, 1, 0);
+
+        submitEvents(ready);
+        break;
+    }
 
     return CL_SUCCESS;
 }
 
-void CommandQueue::cleanEvents()
+void CommandQueue::linkIntake(std::vector<Event *> &ready)
 {
-    pthread_mutex_lock(&p_event_list_mutex);
+    // Take the whole intake. It is a stack, reverse it to get the events in
+    // the order they were queued. The take is counted first, see
+    // queueEvent().
+    __sync_add_and_fetch(&p_intake_takes, 1);
 
-    std::list<Event *>::iterator it = p_events.begin(), oldit;
+    Event *stack = __sync_lock_test_and_set(&p_intake, (Event *)0);
+    Event *events = 0;
+    size_t count = 0;
 
-    while (it != p_events.end())
+    while (stack)
+    {
+        Event *next = stack->intakeNext();
+
+        stack->setIntakeNext(events);
+        events = stack;
+        stack = next;
+        count++;
+    }
+
+    if (p_properties & CL_QUEUE_DEFERRED_SUBMISSION_CLOVER)
+        __sync_sub_and_fetch(&p_intake_size, count);
+
+    while (events)
+    {
+        Event *event = events;
+        events = event->intakeNext();
+
+        if (linkEvent(event))
+            ready.push_back(event);
+    }
+}
+
+bool CommandQueue::linkEvent(Event *event)
+{
+    // A kernel consuming the output of the previous one can run with it. It
+    // is never submitted, the device completes it with the other kernel.
+    if (fuseKernelEvent(event))
     {
-        Event *event = *it;
+        p_events.push_back(event);
+        event->setQueuePosition(--p_events.end());
+        p_last_event = event;
+
+        event->setPendingDependencies(1);
+        return false;
+    }
+
+    // Find the events we have to wait for
+    cl_uint count;
+    Event **event_wait_list = (Event **)event->waitEvents(count);
+    std::vector<Event *> dependencies(event_wait_list,
+                                      event_wait_list + count);
 
-        if (event->status() == Event::Complete)
+    if ((p_properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) == 0)
+    {
+        // In-order, the previous event completes after all the others
+        if (p_last_event)
+            dependencies.push_back(p_last_event);
+    }
+    else
+    {
+        // A barrier waits for all the events queued since the previous one
+        if (event->type() == Event::Barrier)
         {
-            // We cannot be deleted from inside us
-            event->setReleaseParent(false);
-            oldit = it;
-            ++it;
+            std::list<Event *>::reverse_iterator it;
 
-            p_events.erase(oldit);
-            clReleaseEvent((cl_event)event);
+            for (it = p_events.rbegin(); it != p_events.rend(); ++it)
+            {
+                if (*it == p_last_barrier)
+                    break;
+
+                dependencies.push_back(*it);
+            }
         }
+
+        if (p_last_barrier)
+            dependencies.push_back(p_last_barrier);
+
+        // No event can be executed before a barrier or a wait for events
+        if (event->type() == Event::Barrier ||
+            event->type() == Event::WaitForEvents)
+            p_last_barrier = event;
+    }
+
+    // Append the event at the end of the list
+    p_events.push_back(event);
+    event->setQueuePosition(--p_events.end());
+    p_last_event = event;
+
+    // One more dependency that we release once all the others are registered,
+    // so that the event cannot be submitted while we are exploring them
+    event->setPendingDependencies(dependencies.size() + 1);
+
+    for (size_t i=0; i<dependencies.size(); ++i)
+    {
+        Event *dependency = dependencies[i];
+
+        // Already completed or failed, the status doesn't change anymore
+        if (dependency->addSuccessor(event))
+            continue;
+
+        if (dependency->status() < 0)
+            event->dependencyFailed(dependency->status());
         else
-        {
-            ++it;
-        }
+            event->dependencyMet();
     }
 
-    // We have cleared the list, so wake up the sleeping threads
-    if (p_events.size() == 0)
-        pthread_cond_broadcast(&p_event_list_cond);
+    return event->dependencyMet();
+}
 
-    pthread_mutex_unlock(&p_event_list_mutex);
+// Maximum number of kernels run together
+static const size_t max_fused_kernels = 8;
 
-    // Check now if we have to be deleted
-    if (references() == 0)
-        delete this;
+static MemObject *rootBuffer(MemObject *buffer)
+{
+    if (buffer->type() == MemObject::SubBuffer)
+        return ((SubBuffer *)buffer)->parent();
+
+    return buffer;
 }
 
-void CommandQueue::pushEventsOnDevice()
+/**
+ * \brief Check that \p second can run after \p first on the same work-items
+ *
+ * Every buffer shared by the two kernels and written by one of them must be
+ * the same object in both, and be accessed element-wise with the same
+ * element size. The work-items then only see their own elements.
+ *
+ * \param produces set to true if \p second reads a buffer \p first writes
+ */
+static bool fusableKernels(KernelEvent *first, KernelEvent *second,
+                           bool &produces)
 {
-    pthread_mutex_lock(&p_event_list_mutex);
-    // Explore the events in p_events and push on the device all of them that
-    // are :
-    //
-    // - Not already pushed (in Event::Queued state)
-    // - Not after a barrier, except if we begin with a barrier
-    // - If we are in-order, only the first event in Event::Queued state can
-    //   be pushed
+    const DeviceKernel::ArgAccess *first_access =
+        first->deviceKernel()->argAccesses();
+    const DeviceKernel::ArgAccess *second_access =
+        second->deviceKernel()->argAccesses();
 
-    std::list<Event *>::iterator it = p_events.begin();
-    bool first = true;
+    if (!first_access || !second_access)
+        return false;
 
-    // We assume that we will flush the command queue (submit all the events)
-    // This will be changed in the while() when we know that not all events
-    // are submitted.
-    p_flushed = true;
+    const Kernel *first_kernel = first->kernel();
+    const Kernel *second_kernel = second->kernel();
 
-    while (it != p_events.end())
+    for (unsigned int i=0; i<first_kernel->numArgs(); ++i)
     {
-        Event *event = *it;
+        const Kernel::Arg &a = first_kernel->arg(i);
 
-        // If the event is completed, remove it
-        if (event->status() == Event::Complete)
-        {
-            ++it;
+        if (a.kind() != Kernel::Arg::Buffer || a.file() == Kernel::Arg::Local)
             continue;
-        }
 
-        // We cannot do out-of-order, so we can only push the first event.
-        if ((p_properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) == 0 &&
-            !first)
-        {
-            p_flushed = false; // There are remaining events.
-            break;
-        }
+        MemObject *a_buffer = *(MemObject **)a.data();
+
+        if (!a_buffer)
+            continue;
 
-        // Stop if we encounter a barrier that isn't the first event in the list.
-        if (event->type() == Event::Barrier && !first)
+        for (unsigned int j=0; j<second_kernel->numArgs(); ++j)
         {
-            // We have events to wait, stop
-            p_flushed = false;
-            break;
-        }
+            const Kernel::Arg &b = second_kernel->arg(j);
 
-        // Completed events and first barriers are out, it remains real events
-        // that have to block in-order execution.
-        first = false;
+            if (b.kind() != Kernel::Arg::Buffer ||
+                b.file() == Kernel::Arg::Local)
+                continue;
 
-        // If the event is not "pushable" (in Event::Queued state), skip it
-        // It is either Submitted or Running.
-        if (event->status() != Event::Queued)
-        {
-            ++it;
-            continue;
-        }
+            MemObject *b_buffer = *(MemObject **)b.data();
 
-        // Check that all the waiting-on events of this event are finished
-        cl_uint count;
-        const Event **event_wait_list;
-        bool skip_event = false;
+            if (!b_buffer || rootBuffer(a_buffer) != rootBuffer(b_buffer))
+                continue;
 
-        event_wait_list = event->waitEvents(count);
+            // Reading the same buffer is always fine
+            if (!first_access[i].written && !second_access[j].written)
+                continue;
 
-        for (cl_uint i=0; i<count; ++i)
-        {
-            if (event_wait_list[i]->status() != Event::Complete)
-            {
-                skip_event = true;
-                p_flushed = false;
-                break;
-            }
+            if (a_buffer != b_buffer || !first_access[i].element_size ||
+                first_access[i].element_size != second_access[j].element_size)
+                return false;
+
+            if (first_access[i].written && second_access[j].read)
+                produces = true;
         }
+    }
 
-        if (skip_event)
-        {
-            // If we encounter a WaitForEvents event that is not "finished",
-            // don't push events after it.
-            if (event->type() == Event::WaitForEvents)
-                break;
+    return true;
+}
 
-            // The event has its dependencies not already met.
-            ++it;
-            continue;
-        }
+bool CommandQueue::fuseKernelEvent(Event *event)
+{
+    if ((p_properties & CL_QUEUE_KERNEL_FUSION_CLOVER) == 0 ||
+        (p_properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) ||
+        event->type() != Event::NDRangeKernel || !p_last_event ||
+        p_last_event->type() != Event::NDRangeKernel)
+        return false;
 
-        // The event can be pushed, if we need to
-        if (!event->isDummy())
-        {
-            if (p_properties & CL_QUEUE_PROFILING_ENABLE)
-                event->updateTiming(Event::Submit);
+    // Nothing else than the previous event must be waited for
+    cl_uint count;
+    event->waitEvents(count);
 
-            event->setStatus(Event::Submitted);
-            p_device->pushEvent(event);
-        }
-        else
+    if (count)
+        return false;
+
+    KernelEvent *next = (KernelEvent *)event;
+    KernelEvent *last = (KernelEvent *)p_last_event;
+    KernelEvent *head = last->fusedInto() ? last->fusedInto() : last;
+
+    if (head->fusionClosed() ||
+        head->fusedEvents().size() + 1 >= max_fused_kernels)
+        return false;
+
+    // Same 1D NDRange. Element-wise accesses are only element-wise in 1D.
+    if (head->work_dim() != 1 || next->work_dim() != 1 ||
+        head->global_work_offset(0) != next->global_work_offset(0) ||
+        head->global_work_size(0) != next->global_work_size(0) ||
+        head->local_work_size(0) != next->local_work_size(0))
+        return false;
+
+    // The new kernel must be compatible with all the kernels it runs with,
+    // and consume the output of the last one
+    bool produces = false, dummy = false;
+
+    if (!fusableKernels(last, next, produces) || !produces)
+        return false;
+
+    if (last != head && !fusableKernels(head, next, dummy))
+        return false;
+
+    for (size_t i=0; i<head->fusedEvents().size(); ++i)
+    {
+        KernelEvent *fused = head->fusedEvents()[i];
+
+        if (fused != last && !fusableKernels(fused, next, dummy))
+            return false;
+    }
+
+    head->fuse(next);
+
+    return true;
+}
+
+void CommandQueue::submitEvents(std::vector<Event *> &events)
+{
+    DeviceInterface *device = p_device;
+    std::vector<Event *> batch;
+    std::vector<Event *> dummies;
+
+    batch.reserve(events.size());
+
+    for (size_t i=0; i<events.size(); ++i)
+    {
+        Event *event = events[i];
+
+        if (event->isDummy() || !runnable(event))
         {
-            // Set the event as completed. This will call pushEventsOnDevice,
-            // again, so release the lock to avoid a deadlock. We also return
-            // because the recursive call will continue our work.
-            pthread_mutex_unlock(&p_event_list_mutex);
-            event->setStatus(Event::Complete);
-            return;
+            dummies.push_back(event);
+            continue;
         }
+
+        setSubmitted(event);
+        batch.push_back(event);
     }
 
-    if (p_flushed)
+    // Push all the events at once, the device wakes its workers only once.
+    // They can then complete the events and release us, don't use this
+    // command queue anymore. The dummy events are not yet completed and
+    // still retain it.
+    if (batch.size())
+        device->pushEvents(batch.data(), batch.size());
+
+    if (!dummies.size())
+        return;
+
+    // No worker retires the dummy events, release them now. Keep us alive
+    // meanwhile, a worker can release the retired events first. The events
+    // waiting for a failed one fail too.
+    reference();
+
+    for (size_t i=0; i<dummies.size(); ++i)
+        dummies[i]->setStatus(dummies[i]->dependencyStatus());
+
+    cleanEvents(true);
+
+    if (dereference())
+        delete this;
+}
+
+void CommandQueue::retireEvent(Event *event)
+{
+    pthread_mutex_lock(&p_event_list_mutex);
+
+    p_events.erase(event->queuePosition());
+    p_retired.push_back(event);
+
+    // Completed events are never waited on
+    if (event == p_last_event)
+        p_last_event = 0;
+
+    if (event == p_last_barrier)
+        p_last_barrier = 0;
+
+    // Wake up the threads waiting for the queue to finish
+    if (p_events.size() == 0)
         pthread_cond_broadcast(&p_event_list_cond);
 
     pthread_mutex_unlock(&p_event_list_mutex);
 }
 
+// Number of retired events released together by cleanEvents()
+static const size_t retire_batch_size = 32;
+
+void CommandQueue::cleanEvents(bool force)
+{
+    std::vector<Event *> retired;
+
+    pthread_mutex_lock(&p_event_list_mutex);
+
+    // Release by batches, except when the queue becomes idle
+    if (force || p_events.size() == 0 ||
+        p_retired.size() >= retire_batch_size)
+        retired.swap(p_retired);
+
+    pthread_mutex_unlock(&p_event_list_mutex);
+
+    for (size_t i=0; i<retired.size(); ++i)
+    {
+        // We cannot be deleted from inside us
+        retired[i]->setReleaseParent(false);
+        clReleaseEvent((cl_event)retired[i]);
+    }
+
+    // Check now if we have to be deleted
+    if (references() == 0)
+        delete this;
+}
+
+bool CommandQueue::submitEvent(Event *event)
+{
+    // Dummy events are completed by the caller, and so are the events that
+    // can't run
+    if (event->isDummy() || !runnable(event))
+        return true;
+
+    setSubmitted(event);
+    p_device->pushEvent(event);
+
+    return false;
+}
+
+bool CommandQueue::runnable(Event *event)
+{
+    Event::Status status = event->dependencyStatus();
+
+    if (status == Event::Complete)
+        return true;
+
+    // The kernels fused in this one fail with it
+    if ((p_properties & CL_QUEUE_KERNEL_FUSION_CLOVER) &&
+        event->type() == Event::NDRangeKernel)
+    {
+        KernelEvent *kernel_event = (KernelEvent *)event;
+        std::vector<KernelEvent *> fused;
+
+        pthread_mutex_lock(&p_event_list_mutex);
+
+        kernel_event->closeFusion();
+        fused = kernel_event->fusedEvents();
+
+        pthread_mutex_unlock(&p_event_list_mutex);
+
+        for (size_t i=0; i<fused.size(); ++i)
+            fused[i]->setStatus(status);
+    }
+
+    return false;
+}
+
+void CommandQueue::setSubmitted(Event *event)
+{
+    std::vector<KernelEvent *> fused;
+
+    // Nothing can be fused in a kernel once it is submitted
+    if ((p_properties & CL_QUEUE_KERNEL_FUSION_CLOVER) &&
+        event->type() == Event::NDRangeKernel)
+    {
+        KernelEvent *kernel_event = (KernelEvent *)event;
+
+        pthread_mutex_lock(&p_event_list_mutex);
+
+        kernel_event->closeFusion();
+        fused = kernel_event->fusedEvents();
+
+        pthread_mutex_unlock(&p_event_list_mutex);
+    }
+
+    cl_ulong submitted = 0;
+
+    if (p_properties & CL_QUEUE_PROFILING_ENABLE)
+        submitted = event->updateTiming(Event::Submit);
+
+    event->setStatus(Event::Submitted);
+
+    // The fused events are submitted with it
+    for (size_t i=0; i<fused.size(); ++i)
+    {
+        if (p_properties & CL_QUEUE_PROFILING_ENABLE)
+            fused[i]->updateTiming(Event::Submit, submitted);
+
+        fused[i]->setStatus(Event::Submitted);
+    }
+}
+
 Event **CommandQueue::events(unsigned int &count)
 {
     Event **result;
+    std::vector<Event *> ready;
 
     pthread_mutex_lock(&p_event_list_mutex);
 
+    // The events still in the intake are queued too, and are flushed
+    linkIntake(ready);
+
     count = p_events.size();
     result = (Event **)std::malloc(count * sizeof(Event *));
 
@@ -397,6 +788,8 @@ Event **CommandQueue::events(unsigned int &count)
     // are retained and so guaranteed to remain valid.
     pthread_mutex_unlock(&p_event_list_mutex);
 
+    submitEvents(ready);
+
     return result;
 }
 
@@ -411,14 +804,23 @@ Event::Event(CommandQueue *parent,
              cl_int *errcode_ret)
 : Object(Object::T_Event, parent),
   p_num_events_in_wait_list(num_events_in_wait_list), p_event_wait_list(0),
-  p_status(status), p_device_data(0)
+  p_state_change_cond_init(false), p_status(status), p_device_data(0),
+  p_pending_dependencies(0), p_dependency_status(Complete), p_intake_next(0)
 {
-    // Initialize the locking machinery
-    pthread_cond_init(&p_state_change_cond, 0);
+    // Initialize the locking machinery. The condition variable is only
+    // needed when someone waits for the event, most events are not.
     pthread_mutex_init(&p_state_mutex, 0);
 
     std::memset(&p_timing, 0, sizeof(p_timing));
 
+    if (!registered())
+    {
+        // Nothing is retained yet, don't let the destructor release it
+        p_num_events_in_wait_list = 0;
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return;
+    }
+
     // Check sanity of parameters
     if (!event_wait_list && num_events_in_wait_list)
     {
@@ -447,11 +849,15 @@ Event::Event(CommandQueue *parent,
         }
     }
 
-    // Allocate a new buffer for the events to wait
+    // Copy the events to wait, small lists are stored in the event itself
     if (num_events_in_wait_list)
     {
         const unsigned int len = num_events_in_wait_list * sizeof(Event *);
-        p_event_wait_list = (const Event **)std::malloc(len);
+
+        if (num_events_in_wait_list <= inline_wait_list_size)
+            p_event_wait_list = p_inline_wait_list;
+        else
+            p_event_wait_list = (const Event **)std::malloc(len);
 
         if (!p_event_wait_list)
         {
@@ -466,9 +872,6 @@ Event::Event(CommandQueue *parent,
     for (cl_uint i=0; i<num_events_in_wait_list; ++i)
     {
         clRetainEvent((cl_event)event_wait_list[i]);
-
-        if (event_wait_list[i]->type() == Event::User && parent)
-            ((UserEvent *)event_wait_list[i])->addDependentCommandQueue(parent);
     }
 }
 
@@ -488,11 +891,13 @@ Event::~Event()
     for (cl_uint i=0; i<p_num_events_in_wait_list; ++i)
         clReleaseEvent((cl_event)p_event_wait_list[i]);
 
-    if (p_event_wait_list)
+    if (p_event_wait_list && p_event_wait_list != p_inline_wait_list)
         std::free((void *)p_event_wait_list);
 
     pthread_mutex_destroy(&p_state_mutex);
-    pthread_cond_destroy(&p_state_change_cond);
+
+    if (p_state_change_cond_init)
+        pthread_cond_destroy(&p_state_change_cond);
 }
 
 bool Event::isDummy() const
@@ -515,11 +920,32 @@ bool Event::isDummy() const
 
 void Event::setStatus(Status status)
 {
-    // TODO: If status < 0, terminate all the events depending on us.
+    std::vector<Event *> ready;
+
+    changeStatus(status, ready);
+
+    // Submit the events that were only waiting for us. Dummy events, and
+    // events failing with us, complete here instead of recursively, a long
+    // chain of them would otherwise exhaust the stack.
+    while (!ready.empty())
+    {
+        Event *event = ready.back();
+        ready.pop_back();
+
+        if (((CommandQueue *)event->parent())->submitEvent(event))
+            event->changeStatus(event->dependencyStatus(), ready);
+    }
+}
+
+void Event::changeStatus(Status status, std::vector<Event *> &ready)
+{
+    std::vector<Event *> successors;
+
     pthread_mutex_lock(&p_state_mutex);
     p_status = status;
 
-    pthread_cond_broadcast(&p_state_change_cond);
+    if (p_state_change_cond_init)
+        pthread_cond_broadcast(&p_state_change_cond);
 
     // Call the callbacks
     std::multimap<Status, CallbackData>::const_iterator it;
@@ -534,14 +960,109 @@ void Event::setStatus(Status status)
         data.callback((cl_event)this, p_status, data.user_data);
     }
 
+    // Nobody can wait on us anymore once we are completed or failed
+    if (status <= Complete)
+        successors.swap(p_successors);
+
     pthread_mutex_unlock(&p_state_mutex);
 
-    // If the event is completed, inform our parent so it can push other events
-    // to the device.
-    if (parent() && status == Complete)
-        ((CommandQueue *)parent())->pushEventsOnDevice();
-    else if (type() == Event::User)
-        ((UserEvent *)this)->flushQueues();
+    // Leave the event list of our command queue
+    if (status == Complete && parent())
+        ((CommandQueue *)parent())->retireEvent(this);
+
+    // We may be deleted from now, only the successors are still valid as they
+    // are not completed. If we failed, they fail too instead of running.
+    for (size_t i=0; i<successors.size(); ++i)
+    {
+        Event *successor = successors[i];
+
+        if (status == Complete ? successor->dependencyMet() :
+                                 successor->dependencyFailed(status))
+            ready.push_back(successor);
+    }
+}
+
+bool Event::addSuccessor(Event *event)
+{
+    pthread_mutex_lock(&p_state_mutex);
+
+    if (p_status <= Complete)
+    {
+        pthread_mutex_unlock(&p_state_mutex);
+        return false;
+    }
+
+    p_successors.push_back(event);
+
+    pthread_mutex_unlock(&p_state_mutex);
+
+    return true;
+}
+
+void Event::setPendingDependencies(cl_uint count)
+{
+    pthread_mutex_lock(&p_state_mutex);
+
+    p_pending_dependencies = count;
+
+    pthread_mutex_unlock(&p_state_mutex);
+}
+
+void Event::setIntakeNext(Event *next)
+{
+    p_intake_next = next;
+}
+
+Event *Event::intakeNext() const
+{
+    return p_intake_next;
+}
+
+void Event::setQueuePosition(std::list<Event *>::iterator position)
+{
+    p_queue_position = position;
+}
+
+std::list<Event *>::iterator Event::queuePosition() const
+{
+    return p_queue_position;
+}
+
+bool Event::dependencyMet()
+{
+    bool rs;
+
+    pthread_mutex_lock(&p_state_mutex);
+
+    p_pending_dependencies--;
+    rs = (p_pending_dependencies == 0);
+
+    pthread_mutex_unlock(&p_state_mutex);
+
+    return rs;
+}
+
+bool Event::dependencyFailed(Status status)
+{
+    bool rs;
+
+    pthread_mutex_lock(&p_state_mutex);
+
+    // The first failure is reported
+    if (p_dependency_status == Complete)
+        p_dependency_status = status;
+
+    p_pending_dependencies--;
+    rs = (p_pending_dependencies == 0);
+
+    pthread_mutex_unlock(&p_state_mutex);
+
+    return rs;
+}
+
+Event::Status Event::dependencyStatus() const
+{
+    return p_dependency_status;
 }
 
 void Event::setDeviceData(void *data)
@@ -549,32 +1070,22 @@ void Event::setDeviceData(void *data)
     p_device_data = data;
 }
 
-void Event::updateTiming(Timing timing)
+cl_ulong Event::updateTiming(Timing timing, cl_ulong time)
 {
     if (timing >= Max)
-        return;
+        return 0;
 
     pthread_mutex_lock(&p_state_mutex);
 
     // Don't update more than one time (NDRangeKernel for example)
-    if (p_timing[timing])
-    {
-        pthread_mutex_unlock(&p_state_mutex);
-        return;
-    }
-
-    struct timespec tp;
-    cl_ulong rs;
-
-    if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
-        clock_gettime(CLOCK_REALTIME, &tp);
+    if (!p_timing[timing])
+        p_timing[timing] = (time ? time : monotonicTime());
 
-    rs = tp.tv_nsec;
-    rs += tp.tv_sec * 1000000;
-
-    p_timing[timing] = rs;
+    time = p_timing[timing];
 
     pthread_mutex_unlock(&p_state_mutex);
+
+    return time;
 }
 
 Event::Status Event::status() const
@@ -595,6 +1106,12 @@ void Event::waitForStatus(Status status)
 {
     pthread_mutex_lock(&p_state_mutex);
 
+    if (!p_state_change_cond_init)
+    {
+        pthread_cond_init(&p_state_change_cond, 0);
+        p_state_change_cond_init = true;
+    }
+
     while (p_status != status && p_status > 0)
     {
         pthread_cond_wait(&p_state_change_cond, &p_state_mutex);
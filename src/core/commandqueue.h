@@ -36,10 +36,12 @@
 #include "object.h"
 
 #include <CL/cl.h>
+#include <core/config.h>
 #include <pthread.h>
 
 #include <map>
 #include <list>
+#include <vector>
 
 namespace Coal
 {
@@ -48,6 +50,24 @@ class Context;
 class DeviceInterface;
 class Event;
 
+/**
+ * \brief Limits of a device checked when commands are queued
+ *
+ * They are read once when the \c Coal::CommandQueue is created, so that
+ * queuing a command doesn't go through \c Coal::DeviceInterface::info() .
+ */
+struct DeviceLimits
+{
+    size_t max_work_group_size;                 /*!< \brief \c CL_DEVICE_MAX_WORK_GROUP_SIZE */
+    cl_uint max_work_item_dimensions;           /*!< \brief \c CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS */
+    size_t max_work_item_sizes[MAX_WORK_DIMS];  /*!< \brief \c CL_DEVICE_MAX_WORK_ITEM_SIZES */
+    size_t image2d_max_width;                   /*!< \brief \c CL_DEVICE_IMAGE2D_MAX_WIDTH */
+    size_t image2d_max_height;                  /*!< \brief \c CL_DEVICE_IMAGE2D_MAX_HEIGHT */
+    size_t image3d_max_width;                   /*!< \brief \c CL_DEVICE_IMAGE3D_MAX_WIDTH */
+    size_t image3d_max_height;                  /*!< \brief \c CL_DEVICE_IMAGE3D_MAX_HEIGHT */
+    size_t image3d_max_depth;                   /*!< \brief \c CL_DEVICE_IMAGE3D_MAX_DEPTH */
+};
+
 /**
  * \brief Command queue
  *
@@ -66,10 +86,33 @@ class CommandQueue : public Object
 
         /**
          * \brief Queue an event
+         *
+         * This function can be called by many threads at the same time. The
+         * event is first pushed on a lock-free intake. One thread at a time
+         * then takes all the events of the intake, in the order they were
+         * pushed, and links them in the dependency graph under the lock. A
+         * thread returns as soon as its event has been taken, by itself or
+         * by another one, so it links at most one batch and never works
+         * indefinitely for the others.
+         *
+         * If the command queue has the \c CL_QUEUE_DEFERRED_SUBMISSION_CLOVER
+         * property, the events stay in the intake until \c flush() or a
+         * blocking call, until a marker, a barrier or a wait for events is
+         * queued, or until enough of them are buffered or the oldest one has
+         * waited long enough when a new one is queued. They are then
+         * submitted as one batch.
+         *
          * \param event event to be queued
+         * \param prototype if \p event is a copy of a command recorded in a
+         *        \c Coal::CommandBuffer, the recorded event. The device then
+         *        initializes \p event from it, see
+         *        \c Coal::DeviceInterface::initReplayedEventDeviceData()
          * \return \c CL_SUCCESS if success, otherwise an error code
          */
-        cl_int queueEvent(Event *event);
+        cl_int queueEvent(Event *event, Event *prototype = 0);
+
+        DeviceInterface *device() const;            /*!< \brief Device of this command queue */
+        const DeviceLimits &deviceLimits() const;   /*!< \brief Cached limits of \c device() */
 
         /**
          * \brief Information about the command queue
@@ -101,60 +144,68 @@ class CommandQueue : public Object
         cl_int checkProperties() const;
 
         /**
-         * \brief Push events on the device
+         * \brief Submit an event whose dependencies are met
          *
          * This function implements a big part of what is described in
          * \ref events .
          *
-         * It is called by \c Coal::Event::setStatus() when an event is
-         * completed, or by \c queueEvent(). Its purpose is to explore the list
-         * of queued events (\c p_events) and to call
-         * \c Coal::DeviceInterface::pushEvent() for each event meeting its push
-         * conditions.
+         * The events of a command queue form a dependency graph. When an event
+         * is queued by \c queueEvent(), it is registered as a successor
+         * (see \c Coal::Event::addSuccessor()) of each event it has to wait
+         * for:
          *
-         * \section conditions Conditions
+         * - The events of its wait list (see \c Coal::Event::waitEvents())
+         * - If the command queue has the
+         *   \c CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE property disabled, the
+         *   previously queued event. This ensures in-order execution.
+         * - Otherwise, the last \c Coal::BarrierEvent or
+         *   \c Coal::WaitForEventsEvent queued. A \c Coal::BarrierEvent
+         *   also waits for all the events queued before it.
          *
-         * If the command queue has the \c CL_OUT_OF_ORDER_EXEC_MODE_ENABLE
-         * property disabled, an event can be pushed only if all the previous
-         * ones in the list are completed with success. This way, an event
-         * must be completed before any other can be pushed. This ensures
-         * in-order execution.
+         * When an event completes, only its successors are visited, and the
+         * ones having no more dependencies are given to this function.
          *
-         * If this property is enable, more complex heuristics are used.
+         * \param event event to submit, belonging to this command queue
+         * \return true if \p event is a dummy event (see
+         *         \c Coal::Event::isDummy()) or an event waiting for a failed
+         *         one. It is not pushed on the device and the caller must
+         *         set it to \c Coal::Event::dependencyStatus() .
+         */
+        bool submitEvent(Event *event);
+
+        /**
+         * \brief Remove a completed event from the event list
          *
-         * The event list \c p_events is explored from top to bottom. At each
-         * loop iteration, checks are performed to see if the event can be pushed.
+         * Called by \c Coal::Event::setStatus() when \p event becomes
+         * \c Coal::Event::Complete . The event is unlinked from \c p_events
+         * in constant time and kept aside until the next \c cleanEvents().
          *
-         * - When a \c Coal::BarrierEvent is encountered, no more events can be
-         *   pushed, except if the \c Coal::BarrierEvent is the first in the list,
-         *   as that means there are no other events that can be pushed, so the
-         *   barrier can go away
-         * - All events that are already pushed or finished are skipped
-         * - The wait list of the event is then explored to ensure that all its
-         *   dependencies are met.
-         * - Finally, if the events passes all the tests, it is either pushed on
-         *   the device, or simply set to \c Coal::Event::Complete if it's a
-         *   dummy event (see \c Coal::Event::isDummy()).
+         * \param event completed event belonging to this command queue
          */
-        void pushEventsOnDevice();
+        void retireEvent(Event *event);
 
         /**
-         * \brief Remove from the event list completed events
+         * \brief Release the retired events
          *
-         * This function is called periodically to clean the event list from
-         * completed events.
+         * This function is called periodically, after events are completed.
+         * The retired events are released by batches, or all at once when the
+         * command queue has no more events.
          *
-         * It is needed to do that out of \c pushEventsOnDevice() as deleting
+         * It is needed to do that out of \c Coal::Event::setStatus() as deleting
          * event may \c dereference() this command queue, and also delete it. It
          * would produce crashes.
+         *
+         * \param force release the retired events even if they don't fill a
+         *        batch
          */
-        void cleanEvents();
+        void cleanEvents(bool force = false);
 
         /**
          * \brief Flush the command queue
          *
-         * Pushes all the events on the device, and then return. The event
-         * don't need to be completed after this call.
+         * Submits the events buffered in the intake and returns at once. The
+         * events don't need to be submitted or completed after this call,
+         * some can still wait for their dependencies.
          */
         void flush();
 
@@ -175,13 +226,88 @@ class CommandQueue : public Object
         Event **events(unsigned int &count);
 
     private:
+        cl_int readDeviceLimits();  /*!< \brief Fill \c p_limits */
+
+        /**
+         * \brief Link the events of the intake in the dependency graph
+         * \note \c p_event_list_mutex must be locked
+         * \param ready events having no dependency, to be given to
+         *        \c submitEvents() once the lock is released
+         */
+        void linkIntake(std::vector<Event *> &ready);
+
+        /**
+         * \brief Link \p event in the dependency graph
+         * \note \c p_event_list_mutex must be locked
+         * \return true if \p event has no dependency and can be submitted
+         */
+        bool linkEvent(Event *event);
+
+        /**
+         * \brief Submit \p events, completing the dummy ones
+         *
+         * The events are given together to \c Coal::DeviceInterface::pushEvents()
+         *
+         * \note \c p_event_list_mutex must not be locked
+         */
+        void submitEvents(std::vector<Event *> &events);
+
+        /**
+         * \brief Check that none of the events \p event waits for failed
+         *
+         * If one did, \p event must not run. The kernels fused in it are
+         * then failed with \c Coal::Event::dependencyStatus().
+         *
+         * \note \c p_event_list_mutex must not be locked
+         */
+        bool runnable(Event *event);
+
+        /**
+         * \brief Link the events of the intake and submit the ready ones
+         */
+        void drainIntake();
+
+        /**
+         * \brief Set \p event submitted, with the events fused in it
+         */
+        void setSubmitted(Event *event);
+
+        /**
+         * \brief Fuse \p event in the kernel queued before it if possible
+         *
+         * See \c Coal::KernelEvent::fuse(). \p event must be a 1D kernel
+         * with the same NDRange as the previous kernel, waiting for nothing
+         * else, and reading a buffer the previous kernel writes. The buffers
+         * it shares with the kernels it runs with must be accessed
+         * element-wise (see \c Coal::DeviceKernel::argAccesses()).
+         *
+         * Nothing can be fused in a submitted kernel. Kernels are therefore
+         * fused when the first one waits for a command or an event, or when
+         * the command queue also has the
+         * \c CL_QUEUE_DEFERRED_SUBMISSION_CLOVER property.
+         *
+         * \note \c p_event_list_mutex must be locked
+         * \return true if \p event is fused and must not be submitted
+         */
+        bool fuseKernelEvent(Event *event);
+
         DeviceInterface *p_device;
         cl_command_queue_properties p_properties;
+        DeviceLimits p_limits;
 
-        std::list<Event *> p_events;
+        std::list<Event *> p_events;    /*!< \brief Events not yet completed */
+        std::vector<Event *> p_retired; /*!< \brief Completed events to release */
         pthread_mutex_t p_event_list_mutex;
         pthread_cond_t p_event_list_cond;
-        bool p_flushed;
+
+        Event *p_last_event;            /*!< \brief Last queued event, 0 once completed */
+        Event *p_last_barrier;          /*!< \brief Last queued barrier or wait for events, 0 once completed */
+
+        Event *volatile p_intake;       /*!< \brief Events queued but not yet linked, the last one first */
+        volatile int p_draining;        /*!< \brief 1 while a thread links the intake */
+        volatile unsigned int p_intake_takes; /*!< \brief Number of times the intake was taken */
+        volatile size_t p_intake_size;  /*!< \brief Events in the intake, only counted if deferred */
+        volatile cl_ulong p_intake_since; /*!< \brief Time at which the intake became non-empty */
 };
 
 /**
@@ -225,6 +351,8 @@ class Event : public Object
             ReadBufferRect = CL_COMMAND_READ_BUFFER_RECT,
             WriteBufferRect = CL_COMMAND_WRITE_BUFFER_RECT,
             CopyBufferRect = CL_COMMAND_COPY_BUFFER_RECT,
+            FillBuffer = CL_COMMAND_FILL_BUFFER,
+            FillImage = CL_COMMAND_FILL_IMAGE,
             User = CL_COMMAND_USER,
             Barrier,
             WaitForEvents
@@ -305,13 +433,73 @@ class Event : public Object
         /**
          * \brief Set the event status
          * 
-         * This function calls the event callbacks, and
-         * \c Coal::CommandQueue::pushEventsOnDevice() if \p status is
-         * \c Complete .
+         * This function calls the event callbacks. If \p status is
+         * \c Complete , the successors of this event having no more
+         * dependencies are submitted with
+         * \c Coal::CommandQueue::submitEvent(). If it is an error, they
+         * never run and get the same status once their other dependencies
+         * are met (see \c dependencyFailed()).
          * 
          * \param status new status of the event
          */
         void setStatus(Status status);
+
+        /**
+         * \brief Make \p event wait for this event
+         *
+         * \param event event to notify when this one completes
+         * \return false if this event is already completed or failed,
+         *         \p event doesn't have to wait for it
+         */
+        bool addSuccessor(Event *event);
+
+        /**
+         * \brief Set the number of events this one has to wait for
+         * \note Called by \c Coal::CommandQueue::queueEvent() before any
+         *       \c addSuccessor() involving this event
+         */
+        void setPendingDependencies(cl_uint count);
+
+        /**
+         * \brief One of the events this one waits for has completed
+         * \return true if this event has no more dependencies
+         */
+        bool dependencyMet();
+
+        /**
+         * \brief One of the events this one waits for has failed
+         * \param status error status of the failed event
+         * \return true if this event has no more dependencies
+         */
+        bool dependencyFailed(Status status);
+
+        /**
+         * \brief \c Complete, or the error status of an event this one
+         *        waits for
+         *
+         * An event whose dependency failed is not run, it is given this
+         * status instead of being submitted.
+         */
+        Status dependencyStatus() const;
+
+        /**
+         * \brief Remember the position of this event in the event list of its
+         *        \c Coal::CommandQueue
+         */
+        void setQueuePosition(std::list<Event *>::iterator position);
+
+        /**
+         * \brief Position of this event in the event list of its
+         *        \c Coal::CommandQueue
+         */
+        std::list<Event *>::iterator queuePosition() const;
+
+        /**
+         * \brief Set the next event in the intake of the
+         *        \c Coal::CommandQueue
+         */
+        void setIntakeNext(Event *next);
+        Event *intakeNext() const;  /*!< \brief Next event in the intake */
         
         /**
          * \brief Set device-specific data
@@ -322,11 +510,16 @@ class Event : public Object
         /**
          * \brief Update timing info
          * 
-         * This function reads current system time and puts it in \c p_timing
+         * This function reads the current time, in nanoseconds from
+         * \c Coal::monotonicTime(), and puts it in \c p_timing. A timing
+         * already set is kept.
          * 
          * \param timing timing event having just finished
+         * \param time time to use instead of the current one, if not 0. Kernels
+         *        fused together get the timings of the one running them.
+         * \return the time stored for \p timing
          */
-        void updateTiming(Timing timing);
+        cl_ulong updateTiming(Timing timing, cl_ulong time = 0);
         
         /**
          * \brief Status
@@ -387,17 +580,35 @@ class Event : public Object
                              void *param_value,
                              size_t *param_value_size_ret) const;
     private:
+        /**
+         * \brief Set the status and collect the successors made ready
+         *
+         * \c setStatus() without submitting the successors having no more
+         * dependencies, they are appended to \p ready instead.
+         */
+        void changeStatus(Status status, std::vector<Event *> &ready);
+
+        static const cl_uint inline_wait_list_size = 4;   /*!< \brief Wait lists up to this size are not allocated */
+
         cl_uint p_num_events_in_wait_list;
         const Event **p_event_wait_list;
+        const Event *p_inline_wait_list[inline_wait_list_size];
 
-        pthread_cond_t p_state_change_cond;
+        pthread_cond_t p_state_change_cond;     /*!< \brief Only initialized by the first \c waitForStatus() */
+        bool p_state_change_cond_init;
         pthread_mutex_t p_state_mutex;
 
         Status p_status;
         void *p_device_data;
         std::multimap<Status, CallbackData> p_callbacks;
 
-        cl_uint p_timing[Max];
+        cl_uint p_pending_dependencies;
+        Status p_dependency_status;
+        std::vector<Event *> p_successors;
+        std::list<Event *>::iterator p_queue_position;
+        Event *p_intake_next;
+
+        cl_ulong p_timing[Max];
 };
 
 }
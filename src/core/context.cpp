@@ -60,6 +60,12 @@ Context::Context(const cl_context_properties *properties,
     if (!p_pfn_notify)
         p_pfn_notify = &default_pfn_notify;
 
+    if (!registered())
+    {
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return;
+    }
+
     // Intialize LLVM, this can be done more than one time per program
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
@@ -221,3 +227,23 @@ bool Context::hasDevice(DeviceInterface *device) const
 
     return false;
 }
+
+unsigned int Context::numDevices() const
+{
+    return p_num_devices;
+}
+
+DeviceInterface *const *Context::devices() const
+{
+    return p_devices;
+}
+
+MemoryPool *Context::memoryPool()
+{
+    return &p_memory_pool;
+}
+
+Trace *Context::trace()
+{
+    return &p_trace;
+}
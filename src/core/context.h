@@ -34,6 +34,8 @@
 #define __CONTEXT_H__
 
 #include "object.h"
+#include "mempool.h"
+#include "trace.h"
 
 #include <CL/cl.h>
 
@@ -85,6 +87,20 @@ class Context : public Object
          */
         bool hasDevice(DeviceInterface *device) const;
 
+        unsigned int numDevices() const;         /*!< \brief Number of devices of this context */
+        DeviceInterface *const *devices() const; /*!< \brief Devices of this context */
+
+        /**
+         * \brief Caching allocator that the devices can use for the memory
+         *        objects of this context
+         */
+        MemoryPool *memoryPool();
+
+        /**
+         * \brief Execution trace of this context, see \c Coal::Trace
+         */
+        Trace *trace();
+
     private:
         cl_context_properties *p_properties;
         void (CL_CALLBACK *p_pfn_notify)(const char *, const void *,
@@ -94,6 +110,9 @@ class Context : public Object
         DeviceInterface **p_devices;
         unsigned int p_num_devices, p_props_len;
         cl_platform_id p_platform;
+
+        MemoryPool p_memory_pool;
+        Trace p_trace;
 };
 
 }
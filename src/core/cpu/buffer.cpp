@@ -34,17 +34,95 @@
 #include "device.h"
 
 #include "../memobject.h"
+#include "../context.h"
+#include "../hostsnapshot.h"
+
+#include <CL/cl_ext.h>
 
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 
+#include <sys/mman.h>
+#include <stdint.h>
+
 using namespace Coal;
 
+/*
+ * Aligned allocation
+ */
+
+// Allocate size bytes aligned on CPUBuffer::alignment. mapped_size receives
+// the size of the mapping to munmap() later, 0 if the memory must be free()d.
+static void *allocateAligned(size_t size, size_t &mapped_size)
+{
+    void *ptr;
+
+    mapped_size = 0;
+
+    if (size >= CPUBuffer::huge_page_threshold)
+    {
+        const size_t page = CPUBuffer::huge_page_size;
+        size_t rounded = (size + page - 1) & ~(page - 1);
+
+#ifdef MAP_HUGETLB
+        // Explicit huge pages, only available if the administrator reserved
+        // some
+        ptr = mmap(0, rounded, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (ptr != MAP_FAILED)
+        {
+            mapped_size = rounded;
+            return ptr;
+        }
+#endif
+
+        // Map one more huge page and trim the mapping so that it starts on a
+        // huge page boundary, transparent huge pages can then back all of it
+        size_t len = rounded + page;
+        unsigned char *raw = (unsigned char *)mmap(0, len, PROT_READ | PROT_WRITE,
+                                                   MAP_PRIVATE | MAP_ANONYMOUS,
+                                                   -1, 0);
+
+        if (raw != MAP_FAILED)
+        {
+            unsigned char *aligned = (unsigned char *)
+                (((uintptr_t)raw + page - 1) & ~(uintptr_t)(page - 1));
+            size_t tail = (raw + len) - (aligned + rounded);
+
+            if (aligned != raw)
+                munmap(raw, aligned - raw);
+
+            if (tail)
+                munmap(aligned + rounded, tail);
+
+#ifdef MADV_HUGEPAGE
+            madvise(aligned, rounded, MADV_HUGEPAGE);
+#endif
+
+            mapped_size = rounded;
+            return aligned;
+        }
+    }
+
+    if (posix_memalign(&ptr, CPUBuffer::alignment, size) != 0)
+        return 0;
+
+    return ptr;
+}
+
 CPUBuffer::CPUBuffer(CPUDevice *device, MemObject *buffer, cl_int *rs)
 : DeviceBuffer(), p_device(device), p_buffer(buffer), p_data(0),
-  p_data_malloced(false)
+  p_data_malloced(false), p_data_mapped(false), p_data_pooled(false),
+  p_mapped_size(0), p_pooled_size(0), p_snapshot(0),
+  p_tiled(false), p_tiles_x(0), p_tiles_y(0),
+  p_pixel_size(0), p_tile_depth_shift(0), p_tile_texels_shift(0),
+  p_tile_depth_mask(0)
 {
+    pthread_mutex_init(&p_mappings_mutex, 0);
+    std::memset(&p_image_descriptor, 0, sizeof(p_image_descriptor));
+
     if (buffer->type() == MemObject::SubBuffer)
     {
         // We need to create this CPUBuffer based on the CPUBuffer of the
@@ -63,6 +141,48 @@ CPUBuffer::CPUBuffer(CPUDevice *device, MemObject *buffer, cl_int *rs)
         // We use the host ptr, we are already allocated
         p_data = buffer->host_ptr();
     }
+    else if (buffer->type() == MemObject::Image2D ||
+             buffer->type() == MemObject::Image3D)
+    {
+        // Images we allocate ourselves are tiled
+        Image2D *image = (Image2D *)buffer;
+
+        p_tiled = true;
+        p_pixel_size = image->pixel_size();
+        p_tiles_x = (image->width() + tile_mask) >> tile_shift;
+        p_tiles_y = (image->height() + tile_mask) >> tile_shift;
+
+        if (buffer->type() == MemObject::Image3D)
+        {
+            p_tile_depth_shift = tile_shift;
+            p_tile_depth_mask = tile_mask;
+        }
+
+        p_tile_texels_shift = 2 * tile_shift + p_tile_depth_shift;
+    }
+
+    if (buffer->type() == MemObject::Image2D ||
+        buffer->type() == MemObject::Image3D)
+    {
+        Image2D *image = (Image2D *)buffer;
+        CPUImageDescriptor &desc = p_image_descriptor;
+
+        desc.image = image;
+        desc.data = (unsigned char *)p_data;
+        desc.row_pitch = image->row_pitch();
+        desc.slice_pitch = image->slice_pitch();
+        desc.width = image->width();
+        desc.height = image->height();
+        desc.depth = (buffer->type() == MemObject::Image3D ?
+                        ((Image3D *)image)->depth() : 1);
+        desc.order = image->format().image_channel_order;
+        desc.type = image->format().image_channel_data_type;
+        desc.pixel_size = image->pixel_size();
+        desc.tiles_x = p_tiles_x;
+        desc.tiles_y = p_tiles_y;
+        desc.tile_depth_shift = p_tile_depth_shift;
+        desc.tile_texels_shift = p_tile_texels_shift;
+    }
 
     // NOTE: This function can also reject Image buffers by setting a value
     // != CL_SUCCESS in rs.
@@ -70,10 +190,30 @@ CPUBuffer::CPUBuffer(CPUDevice *device, MemObject *buffer, cl_int *rs)
 
 CPUBuffer::~CPUBuffer()
 {
-    if (p_data_malloced)
+    if (p_data_mapped)
+    {
+        munmap(p_data, p_mapped_size);
+    }
+    else if (p_snapshot)
+    {
+        delete p_snapshot;
+    }
+    else if (p_data_pooled)
+    {
+        ((Context *)p_buffer->parent())->memoryPool()->release(p_data,
+                                                               p_pooled_size);
+    }
+    else if (p_data_malloced)
     {
         std::free((void *)p_data);
     }
+
+    // Mappings not unmapped by the application
+    for (std::list<TiledMapping>::iterator it = p_mappings.begin();
+         it != p_mappings.end(); ++it)
+        std::free((*it).ptr);
+
+    pthread_mutex_destroy(&p_mappings_mutex);
 }
 
 void *CPUBuffer::data() const
@@ -86,7 +226,7 @@ void *CPUBuffer::nativeGlobalPointer() const
     return data();
 }
 
-bool CPUBuffer::allocate()
+bool CPUBuffer::allocate(bool discard)
 {
     size_t buf_size = p_buffer->size();
 
@@ -94,21 +234,91 @@ bool CPUBuffer::allocate()
         // Something went wrong...
         return false;
 
+    if (p_tiled)
+    {
+        // Whole tiles are allocated, the image is padded if needed
+        size_t depth = 1;
+
+        if (p_buffer->type() == MemObject::Image3D)
+            depth = ((Image3D *)p_buffer)->depth();
+
+        depth = (depth + p_tile_depth_mask) >> p_tile_depth_shift;
+        buf_size = (p_tiles_x * p_tiles_y * depth * p_pixel_size)
+                   << p_tile_texels_shift;
+    }
+
     if (!p_data)
     {
-        // We don't use a host ptr, we need to allocate a buffer
-        p_data = std::malloc(buf_size);
+        // Large read-only buffers copied from the host take a copy-on-write
+        // snapshot of it if the application asks for it. Kernels cannot
+        // write them, the snapshot is detached from the host memory if the
+        // application does. With more than one device, host_ptr is already a
+        // copy made by MemObject.
+        if (!discard &&
+            p_buffer->type() == MemObject::Buffer &&
+            (p_buffer->flags() & CL_MEM_COPY_ON_WRITE_CLOVER) &&
+            (p_buffer->flags() & CL_MEM_READ_ONLY) &&
+            buf_size >= HostSnapshot::min_size &&
+            ((Context *)p_buffer->parent())->numDevices() == 1)
+        {
+            p_snapshot = HostSnapshot::create(p_buffer->host_ptr(), buf_size);
+        }
+
+        // We don't use a host ptr, we need to allocate a buffer. Buffers
+        // too small for huge pages come from the memory pool of the context,
+        // as they are often created and released at a high rate.
+        if (p_snapshot)
+        {
+            p_data = p_snapshot->data();
+        }
+        else if (buf_size < huge_page_threshold)
+        {
+            MemoryPool *pool = ((Context *)p_buffer->parent())->memoryPool();
+
+            p_data = pool->allocate(buf_size);
 
-        if (!p_data)
-            return false;
+            if (!p_data)
+                return false;
 
-        p_data_malloced = true;
+            p_data_pooled = true;
+            p_pooled_size = buf_size;
+        }
+        else
+        {
+            p_data = allocateAligned(buf_size, p_mapped_size);
+
+            if (!p_data)
+                return false;
+
+            p_data_malloced = true;
+            p_data_mapped = (p_mapped_size != 0);
+        }
+
+        p_image_descriptor.data = (unsigned char *)p_data;
     }
 
+    // Nothing to copy if the contents are about to be overwritten, for
+    // instance mapped with CL_MAP_WRITE_INVALIDATE_REGION
     if (p_buffer->type() != MemObject::SubBuffer &&
-        p_buffer->flags() & CL_MEM_COPY_HOST_PTR)
+        p_buffer->flags() & CL_MEM_COPY_HOST_PTR &&
+        !p_snapshot && !discard)
     {
-        std::memcpy(p_data, p_buffer->host_ptr(), buf_size);
+        if (p_tiled)
+        {
+            Image2D *image = (Image2D *)p_buffer;
+            size_t origin[3] = {0, 0, 0};
+            size_t region[3] = {image->width(), image->height(), 1};
+
+            if (p_buffer->type() == MemObject::Image3D)
+                region[2] = ((Image3D *)p_buffer)->depth();
+
+            tiledCopy((unsigned char *)p_buffer->host_ptr(), image->row_pitch(),
+                      image->slice_pitch(), origin, region, true);
+        }
+        else
+        {
+            std::memcpy(p_data, p_buffer->host_ptr(), buf_size);
+        }
     }
 
     // Say to the memobject that we are allocated
@@ -122,7 +332,206 @@ DeviceInterface *CPUBuffer::device() const
     return p_device;
 }
 
+void CPUBuffer::prepareWrite()
+{
+    if (p_buffer->type() == MemObject::SubBuffer)
+    {
+        // Sub-buffers write in the data of their parent
+        MemObject *parent = ((SubBuffer *)p_buffer)->parent();
+
+        ((CPUBuffer *)parent->deviceBuffer(p_device))->prepareWrite();
+    }
+    else if (p_snapshot)
+    {
+        p_snapshot->detach();
+    }
+}
+
+bool CPUBuffer::ownsPages() const
+{
+    if (p_buffer->type() == MemObject::SubBuffer)
+    {
+        MemObject *parent = ((SubBuffer *)p_buffer)->parent();
+
+        return ((CPUBuffer *)parent->deviceBuffer(p_device))->ownsPages();
+    }
+
+    return p_data_mapped;
+}
+
+bool CPUBuffer::zeroPages(size_t offset, size_t size)
+{
+    if (p_buffer->type() == MemObject::SubBuffer)
+    {
+        SubBuffer *subbuf = (SubBuffer *)p_buffer;
+        CPUBuffer *parent =
+            (CPUBuffer *)subbuf->parent()->deviceBuffer(p_device);
+
+        return parent->zeroPages(subbuf->offset() + offset, size);
+    }
+
+    if (!p_data_mapped)
+        return false;
+
+    // Only whole huge pages can be dropped, explicit huge pages cannot be
+    // split. The mapping past the end of the buffer is padding.
+    unsigned char *data = (unsigned char *)p_data;
+    size_t end = offset + size;
+    size_t first = (offset + huge_page_size - 1) & ~(huge_page_size - 1);
+    size_t last = end & ~(huge_page_size - 1);
+
+    if (end == p_buffer->size())
+        last = p_mapped_size;
+
+    if (first < last &&
+        madvise(data + first, last - first, MADV_DONTNEED) == 0)
+    {
+        std::memset(data + offset, 0, first - offset);
+
+        if (last < end)
+            std::memset(data + last, 0, end - last);
+    }
+    else
+    {
+        std::memset(data + offset, 0, size);
+    }
+
+    return true;
+}
+
 bool CPUBuffer::allocated() const
 {
     return p_data != 0;
 }
+
+const CPUImageDescriptor *CPUBuffer::imageDescriptor() const
+{
+    return &p_image_descriptor;
+}
+
+bool CPUBuffer::tiled() const
+{
+    return p_tiled;
+}
+
+void CPUBuffer::tiledCopy(unsigned char *linear, size_t row_pitch,
+                          size_t slice_pitch, const size_t origin[3],
+                          const size_t region[3], bool to_image) const
+{
+    size_t end_x = origin[0] + region[0];
+
+    for (size_t z=0; z<region[2]; ++z)
+    {
+        for (size_t y=0; y<region[1]; ++y)
+        {
+            unsigned char *line = linear + z * slice_pitch + y * row_pitch;
+            size_t x = origin[0];
+
+            // Copy the row in runs that stop at tile boundaries, pixels
+            // of a tile row being contiguous
+            while (x < end_x)
+            {
+                size_t run = (tile_mask + 1) - (x & tile_mask);
+
+                if (run > end_x - x)
+                    run = end_x - x;
+
+                unsigned char *texel = texelAddress(x, y + origin[1],
+                                                    z + origin[2]);
+                size_t bytes = run * p_pixel_size;
+
+                if (to_image)
+                    std::memcpy(texel, line, bytes);
+                else
+                    std::memcpy(line, texel, bytes);
+
+                line += bytes;
+                x += run;
+            }
+        }
+    }
+}
+
+void *CPUBuffer::mapTiled(const size_t origin[3], const size_t region[3],
+                          cl_map_flags flags, size_t *row_pitch,
+                          size_t *slice_pitch)
+{
+    TiledMapping mapping;
+
+    mapping.row_pitch = region[0] * p_pixel_size;
+    mapping.slice_pitch = mapping.row_pitch * region[1];
+    mapping.flags = flags;
+    mapping.ptr = std::malloc(mapping.slice_pitch * region[2]);
+
+    if (!mapping.ptr)
+        return 0;
+
+    for (unsigned int i=0; i<3; ++i)
+    {
+        mapping.origin[i] = origin[i];
+        mapping.region[i] = region[i];
+    }
+
+    pthread_mutex_lock(&p_mappings_mutex);
+    p_mappings.push_back(mapping);
+    pthread_mutex_unlock(&p_mappings_mutex);
+
+    *row_pitch = mapping.row_pitch;
+    *slice_pitch = mapping.slice_pitch;
+
+    return mapping.ptr;
+}
+
+bool CPUBuffer::findMapping(void *ptr, TiledMapping &mapping, bool remove)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&p_mappings_mutex);
+
+    for (std::list<TiledMapping>::iterator it = p_mappings.begin();
+         it != p_mappings.end(); ++it)
+    {
+        if ((*it).ptr != ptr)
+            continue;
+
+        mapping = *it;
+        found = true;
+
+        if (remove)
+            p_mappings.erase(it);
+
+        break;
+    }
+
+    pthread_mutex_unlock(&p_mappings_mutex);
+
+    return found;
+}
+
+void CPUBuffer::fillMapping(void *ptr)
+{
+    TiledMapping mapping;
+
+    if (!findMapping(ptr, mapping, false))
+        return;
+
+    // Mappings for writing must also show the pixels, the application may
+    // only write some of them. Invalidated regions are entirely overwritten.
+    if (mapping.flags & (CL_MAP_READ | CL_MAP_WRITE))
+        tiledCopy((unsigned char *)ptr, mapping.row_pitch, mapping.slice_pitch,
+                  mapping.origin, mapping.region, false);
+}
+
+void CPUBuffer::unmapTiled(void *ptr)
+{
+    TiledMapping mapping;
+
+    if (!findMapping(ptr, mapping, true))
+        return;
+
+    if (mapping.flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION))
+        tiledCopy((unsigned char *)ptr, mapping.row_pitch, mapping.slice_pitch,
+                  mapping.origin, mapping.region, true);
+
+    std::free(ptr);
+}
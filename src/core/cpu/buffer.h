@@ -35,17 +35,64 @@
 
 #include "../deviceinterface.h"
 
+#include <pthread.h>
+#include <stdint.h>
+#include <list>
+
 namespace Coal
 {
 
 class CPUDevice;
 class MemObject;
+class Image2D;
+class HostSnapshot;
+
+/**
+ * \brief Image as seen by the kernels
+ *
+ * Image arguments of kernels are pointers to this structure. Its layout must
+ * match the one of \c struct \c image2d in \c src/runtime/stdlib.h, the
+ * standard library reading it to address the pixels of common formats inline
+ * in the kernel instead of calling into Clover.
+ */
+struct CPUImageDescriptor
+{
+    Image2D *image;             /*!< \brief Image, given back to the native built-ins */
+    unsigned char *data;        /*!< \brief Pixels */
+    size_t row_pitch;           /*!< \brief Row pitch of a linear image */
+    size_t slice_pitch;         /*!< \brief Slice pitch of a linear image */
+    uint32_t width;             /*!< \brief Width */
+    uint32_t height;            /*!< \brief Height */
+    uint32_t depth;             /*!< \brief Depth, 1 for 2D images */
+    uint32_t order;             /*!< \brief Channel order */
+    uint32_t type;              /*!< \brief Channel data type */
+    uint32_t pixel_size;        /*!< \brief Size of a pixel in bytes */
+    uint32_t tiles_x;           /*!< \brief Tiles in a row, 0 if the image is linear */
+    uint32_t tiles_y;           /*!< \brief Tiles in a column */
+    uint32_t tile_depth_shift;  /*!< \brief log2 of the tile depth */
+    uint32_t tile_texels_shift; /*!< \brief log2 of the number of pixels in a tile */
+};
 
 /**
  * \brief CPU implementation of \c Coal::MemObject
  *
- * This class is responsible of the actual allocation of buffer objects, using
- * \c malloc() or by reusing a given \c host_ptr.
+ * This class is responsible of the actual allocation of buffer objects, or
+ * reuses a given \c host_ptr.
+ *
+ * Allocated buffers are aligned on \c alignment bytes. Buffers smaller than
+ * \c huge_page_threshold bytes come from the \c Coal::MemoryPool of the context.
+ * Buffers of at least
+ * \c huge_page_threshold bytes are mapped on a huge page boundary and backed
+ * by explicit huge pages if the system has a pool of them, or else marked for
+ * transparent huge pages. Large read-only buffers copied from page-aligned
+ * host memory with \c CL_MEM_COPY_ON_WRITE_CLOVER are copy-on-write snapshots
+ * of it when the system allows.
+ *
+ * Images that don't use a host pointer are stored tiled: the image is cut in
+ * blocks of 4x4 pixels (4x4x4 for 3D images), each block being contiguous in
+ * memory. This keeps the neighbours read by a filtering sampler in one or two
+ * cache lines. The linear layout seen by the application is restored when the
+ * image is read, written, copied or mapped.
  */
 class CPUBuffer : public DeviceBuffer
 {
@@ -59,17 +106,133 @@ class CPUBuffer : public DeviceBuffer
         CPUBuffer(CPUDevice *device, MemObject *buffer, cl_int *rs);
         ~CPUBuffer();
 
-        bool allocate();
+        bool allocate(bool discard);
         DeviceInterface *device() const;
         void *data() const;                 /*!< \brief Pointer to the buffer's data */
         void *nativeGlobalPointer() const;
         bool allocated() const;
 
+        /**
+         * \brief Prepare the buffer for a write not done by a kernel
+         *
+         * Large read-only buffers created with \c CL_MEM_COPY_ON_WRITE_CLOVER may
+         * share their pages with the host memory they were copied from (see
+         * \c Coal::HostSnapshot). This function must be called before the
+         * buffer is written by a command or mapped for writing.
+         */
+        void prepareWrite();
+
+        /**
+         * \brief Whether the pages of the buffer can be given back to the system
+         *
+         * True for buffers mapped by Clover (the large ones), and their
+         * sub-buffers.
+         */
+        bool ownsPages() const;
+
+        /**
+         * \brief Zero a range of the buffer
+         *
+         * The whole huge pages of the range are given back to the system
+         * instead of being written. They are replaced by zero pages, only
+         * allocated again when written.
+         *
+         * \param offset offset of the range, in bytes
+         * \param size size of the range, in bytes
+         * \return false if \c ownsPages() is false, nothing being done
+         */
+        bool zeroPages(size_t offset, size_t size);
+
+        static const size_t alignment = 128;                   /*!< \brief Alignment of the allocated buffers, the size of a \c double16 */
+        static const size_t huge_page_threshold = 4 << 20;     /*!< \brief Size from which buffers use huge pages */
+        static const size_t huge_page_size = 2 << 20;          /*!< \brief Size of a huge page */
+
+        static const unsigned int tile_shift = 2;             /*!< \brief log2 of the tile side */
+        static const size_t tile_mask = (1 << tile_shift) - 1; /*!< \brief Mask giving the position in a tile */
+
+        /**
+         * \brief Whether this buffer stores a tiled image
+         */
+        bool tiled() const;
+
+        /**
+         * \brief Address of a pixel in a tiled image
+         *
+         * This function must only be called when \c tiled() is true, linear
+         * images use \c imageData().
+         */
+        inline unsigned char *texelAddress(size_t x, size_t y, size_t z) const
+        {
+            size_t tile = (((z >> p_tile_depth_shift) * p_tiles_y + (y >> tile_shift))
+                           * p_tiles_x) + (x >> tile_shift);
+            size_t inside = ((((z & p_tile_depth_mask) << tile_shift) + (y & tile_mask))
+                             << tile_shift) + (x & tile_mask);
+
+            return (unsigned char *)p_data +
+                ((tile << p_tile_texels_shift) + inside) * p_pixel_size;
+        }
+
+        /**
+         * \brief Copy a region between a linear memory area and this tiled image
+         * \param linear linear memory
+         * \param row_pitch size in bytes of a row in \p linear
+         * \param slice_pitch size in bytes of a slice in \p linear
+         * \param origin origin of the region in the image, in pixels
+         * \param region size of the region, in pixels
+         * \param to_image true to copy \p linear into the image, false to copy
+         *        the image into \p linear
+         */
+        void tiledCopy(unsigned char *linear, size_t row_pitch,
+                       size_t slice_pitch, const size_t origin[3],
+                       const size_t region[3], bool to_image) const;
+
+        /**
+         * \brief Map a region of a tiled image
+         *
+         * A linear staging area is allocated and its pitches returned. It is
+         * filled by \c fillMapping() and written back by \c unmapTiled().
+         *
+         * \return the staging area, 0 if it cannot be allocated
+         */
+        void *mapTiled(const size_t origin[3], const size_t region[3],
+                       cl_map_flags flags, size_t *row_pitch,
+                       size_t *slice_pitch);
+        void fillMapping(void *ptr);   /*!< \brief Fill a staging area with the image pixels if mapped for reading */
+        void unmapTiled(void *ptr);    /*!< \brief Write back (if mapped for writing) and free a staging area */
+
+        /**
+         * \brief Descriptor of the image passed to the kernels
+         * \note Only valid for allocated images
+         */
+        const CPUImageDescriptor *imageDescriptor() const;
+
     private:
         CPUDevice *p_device;
         MemObject *p_buffer;
         void *p_data;
-        bool p_data_malloced;
+        bool p_data_malloced, p_data_mapped, p_data_pooled;
+        size_t p_mapped_size, p_pooled_size;
+        HostSnapshot *p_snapshot;
+
+        bool p_tiled;
+        size_t p_tiles_x, p_tiles_y, p_pixel_size;
+        unsigned int p_tile_depth_shift, p_tile_texels_shift;
+        size_t p_tile_depth_mask;
+
+        struct TiledMapping
+        {
+            void *ptr;
+            size_t origin[3], region[3];
+            size_t row_pitch, slice_pitch;
+            cl_map_flags flags;
+        };
+
+        CPUImageDescriptor p_image_descriptor;
+
+        std::list<TiledMapping> p_mappings;
+        pthread_mutex_t p_mappings_mutex;
+
+        bool findMapping(void *ptr, TiledMapping &mapping, bool remove);
 };
 
 }
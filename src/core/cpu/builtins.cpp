@@ -306,96 +306,75 @@ static void barrier(unsigned int flags)
 
 // Images
 
-static int get_image_width(Image2D *image)
-{
-    return image->width();
-}
-
-static int get_image_height(Image2D *image)
-{
-    return image->height();
-}
-
-static int get_image_depth(Image3D *image)
-{
-    if (image->type() != MemObject::Image3D)
-        return 1;
-
-    return image->depth();
-}
-
-static int get_image_channel_data_type(Image2D *image)
-{
-    return image->format().image_channel_data_type;
-}
-
-static int get_image_channel_order(Image2D *image)
-{
-    return image->format().image_channel_order;
-}
+// Kernels receive image descriptors. The common cases are handled inline by
+// the standard library, these functions are the slow path.
 
-static void *image_data(Image2D *image, int x, int y, int z, int *order, int *type)
+static void *image_data(CPUImageDescriptor *image, int x, int y, int z,
+                        int *order, int *type)
 {
-    *order = image->format().image_channel_order;
-    *type = image->format().image_channel_data_type;
+    *order = image->order;
+    *type = image->type;
 
-    return g_work_group->getImageData(image, x, y, z);
+    return g_work_group->getImageData(image->image, x, y, z);
 }
 
-static bool is_image_3d(Image3D *image)
+static bool is_image_3d(CPUImageDescriptor *image)
 {
-    return (image->type() == MemObject::Image3D ? 1 : 0);
+    return (image->image->type() == MemObject::Image3D ? 1 : 0);
 }
 
-static void write_imagef(Image2D *image, int x, int y, int z, float *color)
+static void write_imagef(CPUImageDescriptor *image, int x, int y, int z,
+                         float *color)
 {
-    g_work_group->writeImage(image, x, y, z, color);
+    g_work_group->writeImage(image->image, x, y, z, color);
 }
 
-static void write_imagei(Image2D *image, int x, int y, int z, int32_t *color)
+static void write_imagei(CPUImageDescriptor *image, int x, int y, int z,
+                         int32_t *color)
 {
-    g_work_group->writeImage(image, x, y, z, color);
+    g_work_group->writeImage(image->image, x, y, z, color);
 }
 
-static void write_imageui(Image2D *image, int x, int y, int z, uint32_t *color)
+static void write_imageui(CPUImageDescriptor *image, int x, int y, int z,
+                          uint32_t *color)
 {
-    g_work_group->writeImage(image, x, y, z, color);
+    g_work_group->writeImage(image->image, x, y, z, color);
 }
 
-static void read_imagefi(float *result, Image2D *image, int x, int y, int z,
-                         int32_t sampler)
+static void read_imagefi(float *result, CPUImageDescriptor *image, int x, int y,
+                         int z, int32_t sampler)
 {
-    g_work_group->readImage(result, image, x, y, z, sampler);
+    g_work_group->readImage(result, image->image, x, y, z, sampler);
 }
 
-static void read_imageii(int32_t *result, Image2D *image, int x, int y, int z,
-                         int32_t sampler)
+static void read_imageii(int32_t *result, CPUImageDescriptor *image, int x,
+                         int y, int z, int32_t sampler)
 {
-    g_work_group->readImage(result, image, x, y, z, sampler);
+    g_work_group->readImage(result, image->image, x, y, z, sampler);
 }
 
-static void read_imageuii(uint32_t *result, Image2D *image, int x, int y, int z,
-                         int32_t sampler)
+static void read_imageuii(uint32_t *result, CPUImageDescriptor *image, int x,
+                          int y, int z, int32_t sampler)
 {
-    g_work_group->readImage(result, image, x, y, z, sampler);
+    g_work_group->readImage(result, image->image, x, y, z, sampler);
 }
 
-static void read_imageff(float *result, Image2D *image, float x, float y,
-                         float z, int32_t sampler)
+static void read_imageff(float *result, CPUImageDescriptor *image, float x,
+                         float y, float z, int32_t sampler)
 {
-    g_work_group->readImage(result, image, x, y, z, sampler);
+    g_work_group->readImage(result, image->image, x, y, z, sampler);
 }
 
-static void read_imageif(int32_t *result, Image2D *image, float x, float y,
-                         float z, int32_t sampler)
+static void read_imageif(int32_t *result, CPUImageDescriptor *image, float x,
+                         float y, float z, int32_t sampler)
 {
-    g_work_group->readImage(result, image, x, y, z, sampler);
+    g_work_group->readImage(result, image->image, x, y, z, sampler);
 }
 
-static void read_imageuif(uint32_t *result, Image2D *image, float x, float y,
-                          float z, int32_t sampler)
+static void read_imageuif(uint32_t *result, CPUImageDescriptor *image, float x,
+                          float y, float z, int32_t sampler)
 {
-    g_work_group->readImage(result, image, x, y, z, sampler);
+    g_work_group->readImage(result, image->image, x, y, z, sampler);
 }
 
 /*
@@ -434,16 +413,6 @@ void *getBuiltin(const std::string &name)
     else if (name == "barrier")
         return (void *)&barrier;
 
-    else if (name == "__cpu_get_image_width")
-        return (void *)&get_image_width;
-    else if (name == "__cpu_get_image_height")
-        return (void *)&get_image_height;
-    else if (name == "__cpu_get_image_depth")
-        return (void *)&get_image_depth;
-    else if (name == "__cpu_get_image_channel_data_type")
-        return (void *)&get_image_channel_data_type;
-    else if (name == "__cpu_get_image_channel_order")
-        return (void *)&get_image_channel_order;
     else if (name == "__cpu_image_data")
         return (void *)&image_data;
     else if (name == "__cpu_is_image_3d")
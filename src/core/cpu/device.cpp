@@ -36,6 +36,7 @@
 #include "program.h"
 #include "worker.h"
 #include "builtins.h"
+#include "transfer.h"
 
 #include <core/config.h>
 #include "../propertylist.h"
@@ -45,9 +46,12 @@
 #include "../kernel.h"
 #include "../program.h"
 
+#include <CL/cl_ext.h>
+
 #include <cstring>
 #include <cstdlib>
 #include <unistd.h>
+#include <time.h>
 
 #include <iostream>
 #include <fstream>
@@ -56,8 +60,8 @@
 using namespace Coal;
 
 CPUDevice::CPUDevice()
-: DeviceInterface(), p_cores(0), p_num_events(0), p_workers(0), p_stop(false),
-  p_initialized(false)
+: DeviceInterface(), p_cores(0), p_num_events(0), p_idle_workers(0),
+  p_workers(0), p_stop(false), p_initialized(false)
 {
 
 }
@@ -74,6 +78,17 @@ void CPUDevice::init()
     // Get info about the system
     p_cores = sysconf(_SC_NPROCESSORS_ONLN);
     p_cpu_mhz = 0.0f;
+    p_cache_size = 0;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    long cache_size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+
+    if (cache_size <= 0)
+        cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+    if (cache_size > 0)
+        p_cache_size = cache_size;
+#endif
 
     std::filebuf fb;
     fb.open("/proc/cpuinfo", std::ios::in);
@@ -91,10 +106,22 @@ void CPUDevice::init()
         {
             std::istringstream ss(value);
             ss >> p_cpu_mhz;
-            break;
         }
+        else if (key.compare(0, 10, "cache size") == 0 && !p_cache_size)
+        {
+            // In KB
+            std::istringstream ss(value);
+            ss >> p_cache_size;
+            p_cache_size *= 1024;
+        }
+
+        if (p_cpu_mhz != 0.0f && p_cache_size)
+            break;
     }
 
+    if (!p_cache_size)
+        p_cache_size = 8 << 20;
+
     // Create worker threads
     p_workers = (pthread_t *)std::malloc(numCPUs() * sizeof(pthread_t));
 
@@ -156,6 +183,9 @@ cl_int CPUDevice::initEventDeviceData(Event *event)
             CPUBuffer *buf = (CPUBuffer *)e->buffer()->deviceBuffer(this);
             unsigned char *data = (unsigned char *)buf->data();
 
+            if (e->flags() & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION))
+                buf->prepareWrite();
+
             data += e->offset();
 
             e->setPtr((void *)data);
@@ -168,6 +198,30 @@ cl_int CPUDevice::initEventDeviceData(Event *event)
             CPUBuffer *buf = (CPUBuffer *)image->deviceBuffer(this);
             unsigned char *data = (unsigned char *)buf->data();
 
+            if (buf->tiled())
+            {
+                // Tiled images are mapped through a linear staging area,
+                // filled by the worker
+                size_t origin[3], region[3], row_pitch, slice_pitch;
+
+                for (unsigned int i=0; i<3; ++i)
+                {
+                    origin[i] = e->origin(i);
+                    region[i] = e->region(i);
+                }
+
+                data = (unsigned char *)buf->mapTiled(origin, region, e->flags(),
+                                                      &row_pitch, &slice_pitch);
+
+                if (!data)
+                    return CL_OUT_OF_HOST_MEMORY;
+
+                e->setPtr((void *)data);
+                e->setRowPitch(row_pitch);
+                e->setSlicePitch(slice_pitch);
+                break;
+            }
+
             data = imageData(data,
                              e->origin(0),
                              e->origin(1),
@@ -185,6 +239,99 @@ cl_int CPUDevice::initEventDeviceData(Event *event)
             // Nothing do to
             break;
 
+        case Event::ReadBuffer:
+        case Event::WriteBuffer:
+        {
+            // Large transfers are split between the workers
+            ReadWriteBufferEvent *e = (ReadWriteBufferEvent *)event;
+
+            if (e->cb() < CPUTransferEvent::min_parallel_size || numCPUs() < 2)
+                break;
+
+            CPUBuffer *buf = (CPUBuffer *)e->buffer()->deviceBuffer(this);
+            unsigned char *data = (unsigned char *)buf->data();
+
+            data += e->offset();
+
+            if (event->type() == Event::ReadBuffer)
+                e->setDeviceData(new CPUTransferEvent(this, e->ptr(), data,
+                                                      e->cb()));
+            else
+                e->setDeviceData(new CPUTransferEvent(this, data, e->ptr(),
+                                                      e->cb()));
+
+            break;
+        }
+        case Event::CopyBuffer:
+        {
+            CopyBufferEvent *e = (CopyBufferEvent *)event;
+
+            if (e->cb() < CPUTransferEvent::min_parallel_size || numCPUs() < 2)
+                break;
+
+            CPUBuffer *src = (CPUBuffer *)e->source()->deviceBuffer(this);
+            CPUBuffer *dst = (CPUBuffer *)e->destination()->deviceBuffer(this);
+
+            e->setDeviceData(new CPUTransferEvent(this,
+                (unsigned char *)dst->data() + e->dst_offset(),
+                (unsigned char *)src->data() + e->src_offset(),
+                e->cb()));
+
+            break;
+        }
+        case Event::ReadBufferRect:
+        case Event::WriteBufferRect:
+        case Event::CopyBufferRect:
+        case Event::ReadImage:
+        case Event::WriteImage:
+        case Event::CopyImage:
+        case Event::CopyBufferToImage:
+        case Event::CopyImageToBuffer:
+        {
+            // Large regions are split in blocks of rows between the workers
+            ReadWriteCopyBufferRectEvent *e = (ReadWriteCopyBufferRectEvent *)event;
+            CPURect rect;
+
+            if (e->region(0) * e->region(1) * e->region(2) <
+                    CPUTransferEvent::min_parallel_size || numCPUs() < 2)
+                break;
+
+            if (rectTransfer(event, this, rect))
+                e->setDeviceData(new CPUTransferEvent(this, rect));
+
+            break;
+        }
+        case Event::FillBuffer:
+        case Event::FillImage:
+        {
+            // Large fills are split between the workers, except zero fills
+            // of buffers that can simply drop their pages
+            CPURect rect;
+            unsigned char pattern[FillBufferEvent::max_pattern_size];
+            size_t pattern_size;
+
+            if (numCPUs() < 2 ||
+                !fillTransfer(event, this, rect, pattern, pattern_size))
+                break;
+
+            if (rect.region[0] * rect.region[1] * rect.region[2] <
+                    CPUTransferEvent::min_parallel_size)
+                break;
+
+            if (event->type() == Event::FillBuffer)
+            {
+                FillBufferEvent *e = (FillBufferEvent *)event;
+                CPUBuffer *buf = (CPUBuffer *)e->buffer()->deviceBuffer(this);
+
+                if (e->zero() && buf->ownsPages())
+                    break;
+            }
+
+            event->setDeviceData(new CPUTransferEvent(this, rect, pattern,
+                                                      pattern_size));
+            break;
+        }
+
         case Event::NDRangeKernel:
         case Event::TaskKernel:
         {
@@ -198,6 +345,10 @@ cl_int CPUDevice::initEventDeviceData(Event *event)
 
             // Set device-specific data
             CPUKernelEvent *cpu_e = new CPUKernelEvent(this, e);
+
+            if (!cpu_e)
+                return CL_OUT_OF_HOST_MEMORY;
+
             e->setDeviceData((void *)cpu_e);
 
             break;
@@ -209,6 +360,25 @@ cl_int CPUDevice::initEventDeviceData(Event *event)
     return CL_SUCCESS;
 }
 
+cl_int CPUDevice::initReplayedEventDeviceData(Event *event, Event *prototype)
+{
+    // A recorded kernel keeps its work-groups and its arguments between the
+    // replays. The JIT was initialized when it was recorded.
+    if (event->type() != Event::NDRangeKernel || !prototype->deviceData())
+        return initEventDeviceData(event);
+
+    KernelEvent *e = (KernelEvent *)event;
+    CPUKernelEvent *cpu_e = new CPUKernelEvent(this, e,
+        (CPUKernelEvent *)prototype->deviceData());
+
+    if (!cpu_e)
+        return CL_OUT_OF_HOST_MEMORY;
+
+    e->setDeviceData((void *)cpu_e);
+
+    return CL_SUCCESS;
+}
+
 void CPUDevice::freeEventDeviceData(Event *event)
 {
     switch (event->type())
@@ -220,6 +390,29 @@ void CPUDevice::freeEventDeviceData(Event *event)
 
             if (cpu_e)
                 delete cpu_e;
+
+            break;
+        }
+        case Event::ReadBuffer:
+        case Event::WriteBuffer:
+        case Event::CopyBuffer:
+        case Event::ReadBufferRect:
+        case Event::WriteBufferRect:
+        case Event::CopyBufferRect:
+        case Event::ReadImage:
+        case Event::WriteImage:
+        case Event::CopyImage:
+        case Event::CopyBufferToImage:
+        case Event::CopyImageToBuffer:
+        case Event::FillBuffer:
+        case Event::FillImage:
+        {
+            CPUTransferEvent *cpu_e = (CPUTransferEvent *)event->deviceData();
+
+            if (cpu_e)
+                delete cpu_e;
+
+            break;
         }
         default:
             break;
@@ -228,13 +421,39 @@ void CPUDevice::freeEventDeviceData(Event *event)
 
 void CPUDevice::pushEvent(Event *event)
 {
-    // Add an event in the list
+    pushEvents(&event, 1);
+}
+
+void CPUDevice::pushEvents(Event **events, size_t count)
+{
+    // Add the events in the list
+    bool multi_slot = false;
+
     pthread_mutex_lock(&p_events_mutex);
 
-    p_events.push_back(event);
-    p_num_events++;                 // Way faster than STL list::size() !
+    for (size_t i=0; i<count; ++i)
+    {
+        Event *event = events[i];
+
+        p_events.push_back(event);
+        p_num_events++;             // Way faster than STL list::size() !
+
+        // Kernels and parallel transfers are split among all the workers
+        if (event->type() == Event::NDRangeKernel ||
+            event->type() == Event::TaskKernel ||
+            isParallelTransfer(event))
+            multi_slot = true;
+    }
+
+    // Wake up only the workers that can run the events, once for all of them
+    if (p_idle_workers != 0)
+    {
+        if (count == 1 && !multi_slot)
+            pthread_cond_signal(&p_events_cond);
+        else
+            pthread_cond_broadcast(&p_events_cond);
+    }
 
-    pthread_cond_broadcast(&p_events_cond);
     pthread_mutex_unlock(&p_events_mutex);
 }
 
@@ -245,7 +464,11 @@ Event *CPUDevice::getEvent(bool &stop)
     pthread_mutex_lock(&p_events_mutex);
 
     while (p_num_events == 0 && !p_stop)
+    {
+        p_idle_workers++;
         pthread_cond_wait(&p_events_cond, &p_events_mutex);
+        p_idle_workers--;
+    }
 
     if (p_stop)
     {
@@ -265,6 +488,11 @@ Event *CPUDevice::getEvent(bool &stop)
         CPUKernelEvent *ke = (CPUKernelEvent *)event->deviceData();
         last_slot = ke->reserve();
     }
+    else if (isParallelTransfer(event))
+    {
+        CPUTransferEvent *te = (CPUTransferEvent *)event->deviceData();
+        last_slot = te->reserve();
+    }
 
     if (last_slot)
     {
@@ -287,6 +515,11 @@ float CPUDevice::cpuMhz() const
     return p_cpu_mhz;
 }
 
+size_t CPUDevice::cacheSize() const
+{
+    return p_cache_size;
+}
+
 // From inner parentheses to outher ones :
 //
 // sizeof * 8 => 8
@@ -431,11 +664,13 @@ cl_int CPUDevice::info(cl_device_info param_name,
             break;
 
         case CL_DEVICE_MEM_BASE_ADDR_ALIGN:
-            SIMPLE_ASSIGN(cl_uint, 0);
+            // In bits. Sub-buffers not aligned on it are rejected when used,
+            // see BufferEvent::isSubBufferAligned()
+            SIMPLE_ASSIGN(cl_uint, CPUBuffer::alignment * 8);
             break;
 
         case CL_DEVICE_MIN_DATA_TYPE_ALIGN_SIZE:
-            SIMPLE_ASSIGN(cl_uint, 16);
+            SIMPLE_ASSIGN(cl_uint, CPUBuffer::alignment);
             break;
 
         case CL_DEVICE_SINGLE_FP_CONFIG:
@@ -457,8 +692,7 @@ cl_int CPUDevice::info(cl_device_info param_name,
             break;
 
         case CL_DEVICE_GLOBAL_MEM_CACHE_SIZE:
-            // TODO: Get this information from the processor
-            SIMPLE_ASSIGN(cl_ulong, 512*1024*1024);
+            SIMPLE_ASSIGN(cl_ulong, p_cache_size);
             break;
 
         case CL_DEVICE_GLOBAL_MEM_SIZE:
@@ -487,9 +721,18 @@ cl_int CPUDevice::info(cl_device_info param_name,
             break;
 
         case CL_DEVICE_PROFILING_TIMER_RESOLUTION:
-            // TODO
-            SIMPLE_ASSIGN(size_t, 1000);        // 1000 nanoseconds = 1 ms
+        {
+            // Resolution of the clock read by Coal::monotonicTime()
+            struct timespec res;
+            size_t resolution = 1;
+
+            if (clock_getres(CLOCK_MONOTONIC, &res) == 0 && res.tv_sec == 0 &&
+                res.tv_nsec > 0)
+                resolution = res.tv_nsec;
+
+            SIMPLE_ASSIGN(size_t, resolution);
             break;
+        }
 
         case CL_DEVICE_ENDIAN_LITTLE:
             SIMPLE_ASSIGN(cl_bool, CL_TRUE);
@@ -511,7 +754,9 @@ cl_int CPUDevice::info(cl_device_info param_name,
         case CL_DEVICE_QUEUE_PROPERTIES:
             SIMPLE_ASSIGN(cl_command_queue_properties,
                           CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE |
-                          CL_QUEUE_PROFILING_ENABLE);
+                          CL_QUEUE_PROFILING_ENABLE |
+                          CL_QUEUE_DEFERRED_SUBMISSION_CLOVER |
+                          CL_QUEUE_KERNEL_FUSION_CLOVER);
             break;
 
         case CL_DEVICE_NAME:
@@ -69,7 +69,8 @@ class CPUDevice : public DeviceInterface
          * \brief Initialize the CPU device
          *
          * This function creates the worker threads and get information about
-         * the host system for the \c numCPUs() and \c cpuMhz functions.
+         * the host system for the \c numCPUs(), \c cpuMhz() and
+         * \c cacheSize() functions.
          */
         void init();
 
@@ -84,17 +85,22 @@ class CPUDevice : public DeviceInterface
                                          llvm::Function *function);
 
         cl_int initEventDeviceData(Event *event);
+        cl_int initReplayedEventDeviceData(Event *event, Event *prototype);
         void freeEventDeviceData(Event *event);
 
         void pushEvent(Event *event);
+        void pushEvents(Event **events, size_t count);
         Event *getEvent(bool &stop);
 
         unsigned int numCPUs() const;   /*!< \brief Number of logical CPU cores on the system */
         float cpuMhz() const;           /*!< \brief Speed of the CPU in Mhz */
+        size_t cacheSize() const;       /*!< \brief Size of the last level cache of the CPU */
 
     private:
         unsigned int p_cores, p_num_events;
+        unsigned int p_idle_workers;    /*!< \brief Workers waiting for an event */
         float p_cpu_mhz;
+        size_t p_cache_size;
         pthread_t *p_workers;
 
         std::list<Event *> p_events;
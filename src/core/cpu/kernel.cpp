@@ -40,6 +40,10 @@
 #include "../memobject.h"
 #include "../events.h"
 #include "../program.h"
+#include "../context.h"
+#include "../trace.h"
+#include "../filemapping.h"
+#include "../mempool.h"
 
 #include <llvm/Function.h>
 #include <llvm/Constants.h>
@@ -48,16 +52,19 @@
 #include <llvm/Module.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <set>
 #include <sys/mman.h>
 
 using namespace Coal;
 
 CPUKernel::CPUKernel(CPUDevice *device, Kernel *kernel, llvm::Function *function)
 : DeviceKernel(), p_device(device), p_kernel(kernel), p_function(function),
-  p_call_function(0)
+  p_call_function(0), p_function_address(0), p_accesses_analysed(false),
+  p_fusable(false)
 {
     pthread_mutex_init(&p_call_function_mutex, 0);
 }
@@ -127,12 +134,171 @@ size_t CPUKernel::guessWorkGroupSize(cl_uint num_dims, cl_uint dim,
             divisor = 1;  // Not parallel but has no CommandQueue overhead
             break;
         }
+
+        divisor++;
     }
 
     // Return the size
     return global_work_size / divisor;
 }
 
+// True if function, or a function it calls, may call barrier()
+static bool callsBarrier(llvm::Function *function,
+                         std::set<llvm::Function *> &visited)
+{
+    if (!visited.insert(function).second)
+        return false;
+
+    for (llvm::Function::iterator block = function->begin();
+         block != function->end(); ++block)
+    {
+        for (llvm::BasicBlock::iterator inst = block->begin();
+             inst != block->end(); ++inst)
+        {
+            llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(inst);
+
+            if (!call)
+                continue;
+
+            llvm::Function *callee = call->getCalledFunction();
+
+            // Indirect call, assume the worst
+            if (!callee)
+                return true;
+
+            if (callee->getName() == "barrier")
+                return true;
+
+            if (!callee->isDeclaration() && callsBarrier(callee, visited))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// True if value is get_global_id(0), maybe truncated or extended
+static bool isFirstGlobalId(llvm::Value *value)
+{
+    while (llvm::CastInst *cast = llvm::dyn_cast<llvm::CastInst>(value))
+        value = cast->getOperand(0);
+
+    llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(value);
+
+    if (!call || !call->getCalledFunction() ||
+        call->getCalledFunction()->getName() != "get_global_id")
+        return false;
+
+    llvm::ConstantInt *dim =
+        llvm::dyn_cast<llvm::ConstantInt>(call->getArgOperand(0));
+
+    return dim && dim->isZero();
+}
+
+bool CPUKernel::analyseAccesses()
+{
+    if (p_kernel->hasLocals())
+        return false;
+
+    std::set<llvm::Function *> visited;
+
+    if (callsBarrier(p_function, visited))
+        return false;
+
+    p_accesses.resize(p_kernel->numArgs());
+
+    unsigned int index = 0;
+
+    for (llvm::Function::arg_iterator arg = p_function->arg_begin();
+         arg != p_function->arg_end(); ++arg, ++index)
+    {
+        const Kernel::Arg &kernel_arg = p_kernel->arg(index);
+        ArgAccess &access = p_accesses[index];
+
+        access.read = false;
+        access.written = false;
+        access.element_size = 0;
+
+        // Images may be accessed anywhere
+        if (kernel_arg.kind() == Kernel::Arg::Image2D ||
+            kernel_arg.kind() == Kernel::Arg::Image3D)
+            return false;
+
+        if (kernel_arg.kind() != Kernel::Arg::Buffer)
+            continue;
+
+        llvm::PointerType *type = llvm::cast<llvm::PointerType>(arg->getType());
+        bool element_wise = true;
+
+        access.element_size =
+            type->getElementType()->getPrimitiveSizeInBits() / 8;
+
+        // Every use must be a getelementptr at get_global_id(0), only used
+        // to load or store an element
+        for (llvm::Value::use_iterator use = arg->use_begin();
+             use != arg->use_end() && element_wise; ++use)
+        {
+            llvm::GetElementPtrInst *gep =
+                llvm::dyn_cast<llvm::GetElementPtrInst>(*use);
+
+            if (!gep || gep->getNumIndices() != 1 ||
+                !isFirstGlobalId(gep->getOperand(1)))
+            {
+                element_wise = false;
+                break;
+            }
+
+            for (llvm::Value::use_iterator gep_use = gep->use_begin();
+                 gep_use != gep->use_end(); ++gep_use)
+            {
+                llvm::StoreInst *store = llvm::dyn_cast<llvm::StoreInst>(*gep_use);
+
+                if (llvm::isa<llvm::LoadInst>(*gep_use))
+                {
+                    access.read = true;
+                }
+                else if (store && store->getPointerOperand() == gep)
+                {
+                    access.written = true;
+                }
+                else
+                {
+                    element_wise = false;
+                    break;
+                }
+            }
+        }
+
+        // Unknown accesses, the kernel may do anything with the buffer
+        if (!element_wise || !access.element_size)
+        {
+            access.read = true;
+            access.written = true;
+            access.element_size = 0;
+        }
+    }
+
+    return true;
+}
+
+const DeviceKernel::ArgAccess *CPUKernel::argAccesses()
+{
+    pthread_mutex_lock(&p_call_function_mutex);
+
+    if (!p_accesses_analysed)
+    {
+        p_fusable = analyseAccesses();
+        p_accesses_analysed = true;
+    }
+
+    pthread_mutex_unlock(&p_call_function_mutex);
+
+    if (!p_fusable || p_accesses.empty())
+        return 0;
+
+    return &p_accesses.front();
+}
+
 llvm::Function *CPUKernel::function() const
 {
     return p_function;
@@ -294,9 +460,13 @@ llvm::Function *CPUKernel::callFunction()
 /*
  * CPUKernelEvent
  */
+
+// Amount of every file-backed argument read ahead at once
+static const size_t file_prefetch_window = 4 * 1024 * 1024;
+
 CPUKernelEvent::CPUKernelEvent(CPUDevice *device, KernelEvent *event)
 : p_device(device), p_event(event), p_current_wg(0), p_finished_wg(0),
-  p_kernel_args(0)
+  p_kernel_args(0), p_shared_args(false), p_prefetch_wg(0), p_prefetch_step(0)
 {
     // Mutex
     pthread_mutex_init(&p_mutex, 0);
@@ -314,13 +484,105 @@ CPUKernelEvent::CPUKernelEvent(CPUDevice *device, KernelEvent *event)
 
         p_num_wg *= p_max_work_groups[i] + 1;
     }
+
+    // Find the buffers backed by a file, the kernel will read them in order
+    const Kernel *kernel = event->kernel();
+    size_t largest = 0;
+
+    for (unsigned int i=0; i<kernel->numArgs(); ++i)
+    {
+        const Kernel::Arg &arg = kernel->arg(i);
+
+        if (arg.kind() != Kernel::Arg::Buffer ||
+            arg.file() == Kernel::Arg::Local)
+            continue;
+
+        MemObject *buffer = *(MemObject **)arg.data();
+        FileArg file_arg;
+
+        if (!buffer)
+            continue;
+
+        file_arg.offset = 0;
+        file_arg.size = buffer->size();
+
+        if (buffer->type() == MemObject::SubBuffer)
+        {
+            file_arg.offset = ((SubBuffer *)buffer)->offset();
+            buffer = ((SubBuffer *)buffer)->parent();
+        }
+
+        if (buffer->type() != MemObject::Buffer)
+            continue;
+
+        file_arg.mapping = ((Buffer *)buffer)->fileMapping();
+
+        if (!file_arg.mapping)
+            continue;
+
+        file_arg.mapping->adviseSequential();
+        p_file_args.push_back(file_arg);
+
+        if (file_arg.size > largest)
+            largest = file_arg.size;
+    }
+
+    // Number of work-groups covering file_prefetch_window bytes of the
+    // largest argument
+    if (largest)
+    {
+        p_prefetch_step = (p_num_wg * file_prefetch_window) / largest;
+
+        if (p_prefetch_step == 0)
+            p_prefetch_step = 1;
+    }
+}
+
+CPUKernelEvent::CPUKernelEvent(CPUDevice *device, KernelEvent *event,
+                               CPUKernelEvent *prototype)
+: p_device(device), p_event(event), p_current_wg(0), p_finished_wg(0),
+  p_num_wg(prototype->p_num_wg), p_kernel_args(0), p_shared_args(false),
+  p_file_args(prototype->p_file_args), p_prefetch_wg(0),
+  p_prefetch_step(prototype->p_prefetch_step)
+{
+    pthread_mutex_init(&p_mutex, 0);
+
+    std::memset(p_current_work_group, 0, event->work_dim() * sizeof(size_t));
+    std::memcpy(p_max_work_groups, prototype->p_max_work_groups,
+                event->work_dim() * sizeof(size_t));
+
+    // The arguments only change with CommandBuffer::updateKernelArg(), that
+    // replaces the prototype
+    if (event->kernel()->hasLocals())
+        return;
+
+    if (!prototype->kernelArgs())
+    {
+        std::vector<void *> locals;
+
+        CPUKernelWorkGroup::callArgs((CPUKernel *)event->deviceKernel(),
+                                     prototype, locals);
+    }
+
+    p_kernel_args = prototype->kernelArgs();
+    p_shared_args = (p_kernel_args != 0);
+}
+
+void *CPUKernelEvent::operator new(size_t size) throw()
+{
+    return MemoryPool::eventPool().allocate(size);
+}
+
+void CPUKernelEvent::operator delete(void *ptr, size_t size)
+{
+    MemoryPool::eventPool().release(ptr, size);
 }
 
 CPUKernelEvent::~CPUKernelEvent()
 {
     pthread_mutex_destroy(&p_mutex);
 
-    if (p_kernel_args)
+    if (p_kernel_args && !p_shared_args)
         std::free(p_kernel_args);
 }
 
@@ -366,20 +628,55 @@ CPUKernelWorkGroup *CPUKernelEvent::takeInstance()
     incVec(p_event->work_dim(), p_current_work_group, p_max_work_groups);
     p_current_wg += 1;
 
+    // Keep one window ahead of the running work-groups in the files
+    size_t prefetch_first = 0, prefetch_last = 0;
+
+    if (p_prefetch_step && p_prefetch_wg < p_num_wg &&
+        p_current_wg + p_prefetch_step >= p_prefetch_wg)
+    {
+        prefetch_first = p_prefetch_wg;
+        prefetch_last = std::min(p_num_wg, p_prefetch_wg + p_prefetch_step);
+        p_prefetch_wg = prefetch_last;
+    }
+
     // Release event
     pthread_mutex_unlock(&p_mutex);
 
+    if (prefetch_last)
+        prefetchFiles(prefetch_first, prefetch_last);
+
     return wg;
 }
 
+void CPUKernelEvent::prefetchFiles(size_t first, size_t last) const
+{
+    for (size_t i=0; i<p_file_args.size(); ++i)
+    {
+        const FileArg &file_arg = p_file_args[i];
+        size_t part = file_arg.size / p_num_wg,
+               rem = file_arg.size % p_num_wg;
+        size_t begin = part * first + (rem * first) / p_num_wg;
+        size_t end = part * last + (rem * last) / p_num_wg;
+
+        file_arg.mapping->prefetch(file_arg.offset + begin, end - begin);
+    }
+}
+
 void *CPUKernelEvent::kernelArgs() const
 {
     return p_kernel_args;
 }
 
-void CPUKernelEvent::cacheKernelArgs(void *args)
+void *CPUKernelEvent::cacheKernelArgs(void *args)
 {
-    p_kernel_args = args;
+    // Work-groups of the same event can build the arguments concurrently,
+    // keep the first ones
+    if (__sync_bool_compare_and_swap(&p_kernel_args, (void *)0, args))
+        return args;
+
+    std::free(args);
+
+    return p_kernel_args;
 }
 
 /*
@@ -389,9 +686,11 @@ CPUKernelWorkGroup::CPUKernelWorkGroup(CPUKernel *kernel, KernelEvent *event,
                                        CPUKernelEvent *cpu_event,
                                        const size_t *work_group_index)
 : p_kernel(kernel), p_cpu_event(cpu_event), p_event(event),
-  p_work_dim(event->work_dim()), p_contexts(0), p_stack_size(8192 /* TODO */),
-  p_had_barrier(false)
+  p_work_dim(event->work_dim()), p_next_image_sampler(0), p_contexts(0),
+  p_stack_size(8192 /* TODO */), p_had_barrier(false)
 {
+    for (unsigned int i=0; i<p_num_image_samplers; ++i)
+        p_image_samplers[i].image = 0;
 
     // Set index
     std::memcpy(p_index, work_group_index, p_work_dim * sizeof(size_t));
@@ -417,10 +716,16 @@ CPUKernelWorkGroup::~CPUKernelWorkGroup()
 
 void *CPUKernelWorkGroup::callArgs(std::vector<void *> &locals_to_free)
 {
-    if (p_cpu_event->kernelArgs() && !p_kernel->kernel()->hasLocals())
+    return callArgs(p_kernel, p_cpu_event, locals_to_free);
+}
+
+void *CPUKernelWorkGroup::callArgs(CPUKernel *kernel, CPUKernelEvent *cpu_event,
+                                   std::vector<void *> &locals_to_free)
+{
+    if (cpu_event->kernelArgs() && !kernel->kernel()->hasLocals())
     {
         // We have cached the args and can reuse them
-        return p_cpu_event->kernelArgs();
+        return cpu_event->kernelArgs();
     }
 
     // We need to create them from scratch
@@ -428,9 +733,9 @@ void *CPUKernelWorkGroup::callArgs(std::vector<void *> &locals_to_free)
 
     size_t args_size = 0;
 
-    for (unsigned int i=0; i<p_kernel->kernel()->numArgs(); ++i)
+    for (unsigned int i=0; i<kernel->kernel()->numArgs(); ++i)
     {
-        const Kernel::Arg &arg = p_kernel->kernel()->arg(i);
+        const Kernel::Arg &arg = kernel->kernel()->arg(i);
         CPUKernel::typeOffset(args_size, arg.valueSize() * arg.vecDim());
     }
 
@@ -441,9 +746,9 @@ void *CPUKernelWorkGroup::callArgs(std::vector<void *> &locals_to_free)
 
     size_t arg_offset = 0;
 
-    for (unsigned int i=0; i<p_kernel->kernel()->numArgs(); ++i)
+    for (unsigned int i=0; i<kernel->kernel()->numArgs(); ++i)
     {
-        const Kernel::Arg &arg = p_kernel->kernel()->arg(i);
+        const Kernel::Arg &arg = kernel->kernel()->arg(i);
         size_t size = arg.valueSize() * arg.vecDim();
         size_t offset = CPUKernel::typeOffset(arg_offset, size);
 
@@ -476,10 +781,10 @@ void *CPUKernelWorkGroup::callArgs(std::vector<void *> &locals_to_free)
                     {
                         // Get the CPU buffer, allocate it and get its pointer
                         CPUBuffer *cpubuf =
-                            (CPUBuffer *)buffer->deviceBuffer(p_kernel->device());
+                            (CPUBuffer *)buffer->deviceBuffer(kernel->device());
                         void *buf_ptr = 0;
 
-                        buffer->allocate(p_kernel->device());
+                        buffer->allocate(kernel->device());
                         buf_ptr = cpubuf->data();
 
                         *(void **)target = buf_ptr;
@@ -491,11 +796,16 @@ void *CPUKernelWorkGroup::callArgs(std::vector<void *> &locals_to_free)
             case Kernel::Arg::Image2D:
             case Kernel::Arg::Image3D:
             {
-                // We need to ensure the image is allocated
+                // We need to ensure the image is allocated, the kernel then
+                // receives its descriptor
                 Image2D *image = *(Image2D **)arg.data();
-                image->allocate(p_kernel->device());
+                CPUBuffer *cpubuf =
+                    (CPUBuffer *)image->deviceBuffer(kernel->device());
+
+                image->allocate(kernel->device());
+                *(const CPUImageDescriptor **)target = cpubuf->imageDescriptor();
 
-                // Fall through to the memcpy
+                break;
             }
             default:
                 // Simply copy the arg's data into the buffer
@@ -505,30 +815,84 @@ void *CPUKernelWorkGroup::callArgs(std::vector<void *> &locals_to_free)
     }
 
     // Cache the arguments if we can do so
-    if (!p_kernel->kernel()->hasLocals())
-        p_cpu_event->cacheKernelArgs(rs);
+    if (!kernel->kernel()->hasLocals())
+        rs = cpu_event->cacheKernelArgs(rs);
 
     return rs;
 }
 
+void *CPUKernel::functionAddress()
+{
+    pthread_mutex_lock(&p_call_function_mutex);
+    void *rs = p_function_address;
+    pthread_mutex_unlock(&p_call_function_mutex);
+
+    if (rs)
+        return rs;
+
+    // callFunction() takes the lock itself
+    llvm::Function *stub = callFunction();
+
+    if (!stub)
+        return 0;
+
+    Program *p = (Program *)p_kernel->parent();
+    CPUProgram *prog = (CPUProgram *)(p->deviceDependentProgram(p_device));
+
+    pthread_mutex_lock(&p_call_function_mutex);
+
+    if (!p_function_address)
+    {
+        cl_ulong start = monotonicTime();
+
+        p_function_address = prog->jit()->getPointerToFunction(stub);
+
+        ((Context *)p->parent())->trace()->record(Trace::JIT, p_kernel->name(),
+                                                  start);
+    }
+
+    rs = p_function_address;
+    pthread_mutex_unlock(&p_call_function_mutex);
+
+    return rs;
+}
+
+// Address of the JIT-compiled stub function of kernel, 0 in case of error
+static void (*kernelFunctionAddress(CPUKernel *kernel))(void *)
+{
+    return (void(*)(void *))kernel->functionAddress();
+}
+
 bool CPUKernelWorkGroup::run()
 {
     // Get the kernel function to call
     std::vector<void *> locals_to_free;
-    llvm::Function *kernel_func = p_kernel->callFunction();
 
-    if (!kernel_func)
-        return false;
-
-    Program *p = (Program *)p_kernel->kernel()->parent();
-    CPUProgram *prog = (CPUProgram *)(p->deviceDependentProgram(p_kernel->device()));
+    p_kernel_func_addr = kernelFunctionAddress(p_kernel);
 
-    p_kernel_func_addr =
-        (void(*)(void *))prog->jit()->getPointerToFunction(kernel_func);
+    if (!p_kernel_func_addr)
+        return false;
 
     // Get the arguments
     p_args = callArgs(locals_to_free);
 
+    // And the ones of the kernels fused in this one
+    const std::vector<KernelEvent *> &fused = p_event->fusedEvents();
+
+    for (size_t i=0; i<fused.size(); ++i)
+    {
+        CPUKernel *kernel = (CPUKernel *)fused[i]->deviceKernel();
+        void (*func_addr)(void *) = kernelFunctionAddress(kernel);
+
+        if (!func_addr)
+            return false;
+
+        p_fused_func_addrs.push_back(func_addr);
+        p_fused_args.push_back(
+            callArgs(kernel, (CPUKernelEvent *)fused[i]->deviceData(),
+                     locals_to_free));
+    }
+
     // Tell the builtins this thread will run a kernel work group
     setThreadLocalWorkGroup(this);
 
@@ -538,12 +902,27 @@ bool CPUKernelWorkGroup::run()
 
     std::memset(p_dummy_context.local_id, 0, p_work_dim * sizeof(size_t));
 
-    do
+    if (p_fused_func_addrs.empty())
+    {
+        do
+        {
+            // Simply call the "call function", it and the builtins will do the rest
+            p_kernel_func_addr(p_args);
+        } while (!p_had_barrier &&
+                 !incVec(p_work_dim, p_dummy_context.local_id, p_max_local_id));
+    }
+    else
     {
-        // Simply call the "call function", it and the builtins will do the rest
-        p_kernel_func_addr(p_args);
-    } while (!p_had_barrier &&
-             !incVec(p_work_dim, p_dummy_context.local_id, p_max_local_id));
+        // Fused kernels don't call barrier(). Each work-item runs all of
+        // them, reading what the previous ones wrote while it is in the cache.
+        do
+        {
+            p_kernel_func_addr(p_args);
+
+            for (size_t i=0; i<p_fused_func_addrs.size(); ++i)
+                p_fused_func_addrs[i](p_fused_args[i]);
+        } while (!incVec(p_work_dim, p_dummy_context.local_id, p_max_local_id));
+    }
 
     // If no barrier() call was made, all is fine. If not, only the first
     // work-item has currently finished. We must let the others run.
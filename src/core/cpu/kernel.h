@@ -34,6 +34,7 @@
 #define __CPU_KERNEL_H__
 
 #include "../deviceinterface.h"
+#include "sampler.h"
 #include <core/config.h>
 
 #include <llvm/ExecutionEngine/GenericValue.h>
@@ -57,6 +58,7 @@ class Kernel;
 class KernelEvent;
 class Image2D;
 class Image3D;
+class FileMapping;
 
 /**
  * \brief CPU kernel
@@ -88,12 +90,32 @@ class CPUKernel : public DeviceKernel
         size_t guessWorkGroupSize(cl_uint num_dims, cl_uint dim,
                                   size_t global_work_size) const;
 
+        /**
+         * \brief Accesses of the kernel to its arguments
+         *
+         * The kernel and the functions it calls are scanned once. A buffer
+         * argument is accessed element-wise if it is only used by loads and
+         * stores at <tt>arg[get_global_id(0)]</tt>.
+         */
+        const ArgAccess *argAccesses();
+
         Kernel *kernel() const;     /*!< \brief \c Coal::Kernel object this kernel will run */
         CPUDevice *device() const;  /*!< \brief device on which the kernel will be run */
 
         llvm::Function *function() const;   /*!< \brief \c llvm::Function representing the kernel but <strong>not to be run</strong> */
         llvm::Function *callFunction();     /*!< \brief stub function used to run the kernel, see \ref llvm */
 
+        /**
+         * \brief Native address of \c callFunction()
+         *
+         * The stub is JIT-compiled the first time this function is called,
+         * and the compilation is recorded in the trace of the context. The
+         * address is then cached for the next work-groups.
+         *
+         * \return address of the stub, 0 in case of error
+         */
+        void *functionAddress();
+
         /**
          * \brief Calculate where to place a value in an array
          *
@@ -130,10 +152,16 @@ class CPUKernel : public DeviceKernel
         static size_t typeOffset(size_t &offset, size_t type_len);
 
     private:
+        bool analyseAccesses();     /*!< \brief Fill \c p_accesses, false if the kernel cannot be fused */
+
         CPUDevice *p_device;
         Kernel *p_kernel;
         llvm::Function *p_function, *p_call_function;
+        void *p_function_address;
         pthread_mutex_t p_call_function_mutex;
+
+        std::vector<ArgAccess> p_accesses;
+        bool p_accesses_analysed, p_fusable;
 };
 
 class CPUKernelEvent;
@@ -179,6 +207,16 @@ class CPUKernelWorkGroup
          */
         void *callArgs(std::vector<void *> &locals_to_free);
 
+        /**
+         * \brief Build the structure of arguments of another kernel
+         *
+         * Used for the kernels fused in the one of this work-group, see
+         * \c Coal::KernelEvent::fusedEvents(), and to build the arguments
+         * of a kernel recorded in a \c Coal::CommandBuffer
+         */
+        static void *callArgs(CPUKernel *kernel, CPUKernelEvent *cpu_event,
+                              std::vector<void *> &locals_to_free);
+
         /**
          * \brief Run the work-group
          *
@@ -209,6 +247,16 @@ class CPUKernelWorkGroup
 
         void *getImageData(Image2D *image, int x, int y, int z) const;
 
+        /**
+         * \brief Image bound to a sampler
+         *
+         * Return the \c Coal::CPUImageSampler binding \p image to \p sampler,
+         * binding them if this pair isn't already in the small cache of this
+         * work-group.
+         */
+        const CPUImageSampler *imageSampler(Image2D *image,
+                                            uint32_t sampler) const;
+
         void writeImage(Image2D *image, int x, int y, int z, float *color) const;
         void writeImage(Image2D *image, int x, int y, int z, int32_t *color) const;
         void writeImage(Image2D *image, int x, int y, int z, uint32_t *color) const;
@@ -264,6 +312,16 @@ class CPUKernelWorkGroup
         void (*p_kernel_func_addr)(void *);
         void *p_args;
 
+        // Kernels fused in this one, run by the same work-items
+        std::vector<void (*)(void *)> p_fused_func_addrs;
+        std::vector<void *> p_fused_args;
+
+        // Images bound to samplers, see imageSampler()
+        static const unsigned int p_num_image_samplers = 4;
+
+        mutable CPUImageSampler p_image_samplers[p_num_image_samplers];
+        mutable unsigned int p_next_image_sampler;
+
         // Machinery to have barrier() working
         struct Context
         {
@@ -299,6 +357,21 @@ class CPUKernelEvent
          *              about the event
          */
         CPUKernelEvent(CPUDevice *device, KernelEvent *event);
+
+        /**
+         * \brief Constructor for a kernel replayed by a \c Coal::CommandBuffer
+         *
+         * The work-groups and the file-backed buffers are taken from
+         * \p prototype. If the kernel has no \c __local argument, its
+         * arguments are built once for \p prototype and shared by all the
+         * replays.
+         *
+         * \param device device running the kernel
+         * \param event copy of the recorded \c Coal::KernelEvent
+         * \param prototype data of the recorded event
+         */
+        CPUKernelEvent(CPUDevice *device, KernelEvent *event,
+                       CPUKernelEvent *prototype);
         ~CPUKernelEvent();
 
         bool reserve();  /*!< \brief The next Work Group that will execute will be the last. Locks the event */
@@ -306,11 +379,33 @@ class CPUKernelEvent
         CPUKernelWorkGroup *takeInstance(); /*!< \brief Must be called exactly one time after reserve(). Unlocks the event */
 
         void *kernelArgs() const;           /*!< \brief Return the cached kernel arguments */
-        void cacheKernelArgs(void *args);   /*!< \brief Cache pre-built kernel arguments */
+        void *cacheKernelArgs(void *args);  /*!< \brief Cache pre-built kernel arguments, return the ones cached first if another thread was faster */
 
         void workGroupFinished();           /*!< \brief A work-group has just finished */
 
+        static void *operator new(size_t size) throw();     /*!< \brief Allocate from a pool, one is created for every queued kernel. 0 if the pool is exhausted */
+        static void operator delete(void *ptr, size_t size); /*!< \brief Give back to the pool */
+
     private:
+        /**
+         * \brief Ask the kernel to read ahead the file-backed buffers
+         *
+         * Work-groups are assumed to walk their buffers linearly, so the
+         * work-groups <tt>[first, last)</tt> are expected to touch the same
+         * fraction of every file-backed argument.
+         */
+        void prefetchFiles(size_t first, size_t last) const;
+
+        /**
+         * \brief Region of a file-backed buffer passed as argument
+         */
+        struct FileArg
+        {
+            FileMapping *mapping;   /*!< \brief Mapping of the root buffer */
+            size_t offset;          /*!< \brief Offset of the argument in \c mapping */
+            size_t size;            /*!< \brief Size of the argument */
+        };
+
         CPUDevice *p_device;
         KernelEvent *p_event;
         size_t p_current_work_group[MAX_WORK_DIMS],
@@ -318,6 +413,10 @@ class CPUKernelEvent
         size_t p_current_wg, p_finished_wg, p_num_wg;
         pthread_mutex_t p_mutex;
         void *p_kernel_args;
+        bool p_shared_args;     /*!< \brief \c p_kernel_args belongs to a prototype */
+
+        std::vector<FileArg> p_file_args;
+        size_t p_prefetch_wg, p_prefetch_step;
 };
 
 }
@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file cpu/pixel.cpp
+ * \brief Conversion of pixels between image formats and RGBA values
+ */
+
+#include "pixel.h"
+
+#include <cstring>
+#include <stdint.h>
+#include <immintrin.h>
+
+using namespace Coal;
+
+/*
+ * Scalar helpers
+ */
+
+// Round to nearest even and saturate, NaN giving 0
+static int satRound(float x, float lo, float hi)
+{
+    if (x != x)
+        return 0;
+
+    x = (x < lo ? lo : (x > hi ? hi : x));
+
+    return _mm_cvtss_si32(_mm_set_ss(x));
+}
+
+static uint16_t floatToHalf(float f)
+{
+    uint32_t x, sign, abs;
+
+    std::memcpy(&x, &f, sizeof(x));
+    sign = (x >> 16) & 0x8000;
+    abs = x & 0x7fffffff;
+
+    if (abs >= 0x7f800000)
+        // Infinity or NaN (kept quiet)
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+
+    if (abs >= 0x477ff000)
+        // Rounds to more than 65504
+        return sign | 0x7c00;
+
+    if (abs < 0x38800000)
+    {
+        // Denormalized half, in units of 2^-24
+        float v;
+
+        std::memcpy(&v, &abs, sizeof(v));
+        return sign | _mm_cvtss_si32(_mm_set_ss(v * 16777216.0f));
+    }
+
+    // Rebias the exponent and round the mantissa to nearest even
+    abs -= 0x38000000;
+    abs += 0xfff + ((abs >> 13) & 1);
+
+    return sign | (abs >> 13);
+}
+
+static float halfToFloat(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t man = h & 0x3ff;
+    uint32_t x;
+    float f;
+
+    if (exp == 0)
+    {
+        // Zero or denormalized
+        f = (float)man * (1.0f / 16777216.0f);
+        std::memcpy(&x, &f, sizeof(x));
+        x |= sign;
+    }
+    else if (exp == 31)
+    {
+        x = sign | 0x7f800000 | (man << 13);
+    }
+    else
+    {
+        x = sign | ((exp + 112) << 23) | (man << 13);
+    }
+
+    std::memcpy(&f, &x, sizeof(f));
+
+    return f;
+}
+
+/*
+ * Channel types : storage of a channel and conversion from and to the value
+ * seen by the kernels
+ */
+
+struct ChannelSnormInt8
+{
+    typedef int8_t storage;
+    typedef float value;
+
+    static float unpack(int8_t c) { float f = c * (1.0f / 127.0f); return (f < -1.0f ? -1.0f : f); }
+    static int8_t pack(float f) { return satRound(f * 127.0f, -128.0f, 127.0f); }
+};
+
+struct ChannelSnormInt16
+{
+    typedef int16_t storage;
+    typedef float value;
+
+    static float unpack(int16_t c) { float f = c * (1.0f / 32767.0f); return (f < -1.0f ? -1.0f : f); }
+    static int16_t pack(float f) { return satRound(f * 32767.0f, -32768.0f, 32767.0f); }
+};
+
+struct ChannelUnormInt8
+{
+    typedef uint8_t storage;
+    typedef float value;
+
+    static float unpack(uint8_t c) { return c * (1.0f / 255.0f); }
+    static uint8_t pack(float f) { return satRound(f * 255.0f, 0.0f, 255.0f); }
+};
+
+struct ChannelUnormInt16
+{
+    typedef uint16_t storage;
+    typedef float value;
+
+    static float unpack(uint16_t c) { return c * (1.0f / 65535.0f); }
+    static uint16_t pack(float f) { return satRound(f * 65535.0f, 0.0f, 65535.0f); }
+};
+
+template<typename S, typename V, V lo, V hi>
+struct ChannelInt
+{
+    typedef S storage;
+    typedef V value;
+
+    static V unpack(S c) { return c; }
+    static S pack(V v) { return (v < lo ? lo : (v > hi ? hi : v)); }
+};
+
+typedef ChannelInt<int8_t, int32_t, -128, 127> ChannelSignedInt8;
+typedef ChannelInt<int16_t, int32_t, -32768, 32767> ChannelSignedInt16;
+typedef ChannelInt<int32_t, int32_t, (-2147483647 - 1), 2147483647> ChannelSignedInt32;
+typedef ChannelInt<uint8_t, uint32_t, 0, 255> ChannelUnsignedInt8;
+typedef ChannelInt<uint16_t, uint32_t, 0, 65535> ChannelUnsignedInt16;
+typedef ChannelInt<uint32_t, uint32_t, 0, 0xffffffff> ChannelUnsignedInt32;
+
+struct ChannelHalfFloat
+{
+    typedef uint16_t storage;
+    typedef float value;
+
+    static float unpack(uint16_t c) { return halfToFloat(c); }
+    static uint16_t pack(float f) { return floatToHalf(f); }
+};
+
+struct ChannelFloat
+{
+    typedef float storage;
+    typedef float value;
+
+    static float unpack(float c) { return c; }
+    static float pack(float f) { return f; }
+};
+
+/*
+ * Channel orders : which stored channel gives each RGBA component, and which
+ * RGBA component is stored in each channel
+ */
+
+enum
+{
+    Zero = -1,  /*!< Missing component, 0 */
+    One = -2    /*!< Missing alpha, 1 */
+};
+
+struct OrderR
+{
+    static const unsigned int channels = 1;
+    static int source(unsigned int c) { return (c == 0 ? 0 : (c == 3 ? One : Zero)); }
+    static unsigned int component(unsigned int i) { (void)i; return 0; }
+};
+
+struct OrderA
+{
+    static const unsigned int channels = 1;
+    static int source(unsigned int c) { return (c == 3 ? 0 : Zero); }
+    static unsigned int component(unsigned int i) { (void)i; return 3; }
+};
+
+struct OrderIntensity
+{
+    static const unsigned int channels = 1;
+    static int source(unsigned int c) { (void)c; return 0; }
+    static unsigned int component(unsigned int i) { (void)i; return 0; }
+};
+
+struct OrderLuminance
+{
+    static const unsigned int channels = 1;
+    static int source(unsigned int c) { return (c < 3 ? 0 : One); }
+    static unsigned int component(unsigned int i) { (void)i; return 0; }
+};
+
+struct OrderRG
+{
+    static const unsigned int channels = 2;
+    static int source(unsigned int c) { return (c < 2 ? (int)c : (c == 3 ? One : Zero)); }
+    static unsigned int component(unsigned int i) { return i; }
+};
+
+struct OrderRA
+{
+    static const unsigned int channels = 2;
+    static int source(unsigned int c) { return (c == 0 ? 0 : (c == 3 ? 1 : Zero)); }
+    static unsigned int component(unsigned int i) { return (i == 0 ? 0 : 3); }
+};
+
+struct OrderRGBA
+{
+    static const unsigned int channels = 4;
+    static int source(unsigned int c) { return c; }
+    static unsigned int component(unsigned int i) { return i; }
+};
+
+struct OrderARGB
+{
+    static const unsigned int channels = 4;
+    static int source(unsigned int c) { return (c + 1) & 3; }
+    static unsigned int component(unsigned int i) { return (i + 3) & 3; }
+};
+
+struct OrderBGRA
+{
+    static const unsigned int channels = 4;
+    static int source(unsigned int c) { return (c == 3 ? 3 : 2 - c); }
+    static unsigned int component(unsigned int i) { return (i == 3 ? 3 : 2 - i); }
+};
+
+/*
+ * Generic conversions, the loops over the components are unrolled by the
+ * compiler and the order tests folded
+ */
+
+template<class Channel, class Order>
+static void unpackPixels(void *rgba, const void *pixels, size_t count)
+{
+    typedef typename Channel::storage S;
+    typedef typename Channel::value V;
+
+    const S *p = (const S *)pixels;
+    V *v = (V *)rgba;
+
+    for (size_t n=0; n<count; ++n, p += Order::channels, v += 4)
+    {
+        for (unsigned int c=0; c<4; ++c)
+        {
+            int s = Order::source(c);
+
+            if (s >= 0)
+                v[c] = Channel::unpack(p[s]);
+            else
+                v[c] = (s == One ? 1 : 0);
+        }
+    }
+}
+
+template<class Channel, class Order>
+static void packPixels(void *pixels, const void *rgba, size_t count)
+{
+    typedef typename Channel::storage S;
+    typedef typename Channel::value V;
+
+    S *p = (S *)pixels;
+    const V *v = (const V *)rgba;
+
+    for (size_t n=0; n<count; ++n, p += Order::channels, v += 4)
+    {
+        for (unsigned int i=0; i<Order::channels; ++i)
+            p[i] = Channel::pack(v[Order::component(i)]);
+    }
+}
+
+/*
+ * SSE2 conversions of the common formats
+ */
+
+template<bool bgra>
+static inline __m128 swapRB(__m128 v)
+{
+    return (bgra ? _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2)) : v);
+}
+
+// Four RGBA floats to four integers in [0, 255], NaN giving 0
+template<bool bgra>
+static inline __m128i toUnorm8(const float *rgba)
+{
+    const __m128 scale = _mm_set1_ps(255.0f);
+    __m128 v = _mm_mul_ps(swapRB<bgra>(_mm_loadu_ps(rgba)), scale);
+
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), scale);
+
+    return _mm_cvtps_epi32(v);
+}
+
+template<bool bgra>
+static void packUnormInt8(void *pixels, const void *rgba, size_t count)
+{
+    uint8_t *p = (uint8_t *)pixels;
+    const float *v = (const float *)rgba;
+    size_t n = 0;
+
+    for (; n + 4 <= count; n += 4, p += 16, v += 16)
+    {
+        __m128i lo = _mm_packs_epi32(toUnorm8<bgra>(v), toUnorm8<bgra>(v + 4));
+        __m128i hi = _mm_packs_epi32(toUnorm8<bgra>(v + 8), toUnorm8<bgra>(v + 12));
+
+        _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(lo, hi));
+    }
+
+    for (; n < count; ++n, p += 4, v += 4)
+    {
+        __m128i i = toUnorm8<bgra>(v);
+        int32_t packed;
+
+        i = _mm_packs_epi32(i, i);
+        packed = _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+        std::memcpy(p, &packed, sizeof(packed));
+    }
+}
+
+template<bool bgra>
+static inline void storeUnorm8(float *rgba, __m128i i)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+
+    _mm_storeu_ps(rgba, swapRB<bgra>(_mm_mul_ps(_mm_cvtepi32_ps(i), scale)));
+}
+
+template<bool bgra>
+static void unpackUnormInt8(void *rgba, const void *pixels, size_t count)
+{
+    const uint8_t *p = (const uint8_t *)pixels;
+    float *v = (float *)rgba;
+    const __m128i zero = _mm_setzero_si128();
+    size_t n = 0;
+
+    for (; n + 4 <= count; n += 4, p += 16, v += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+
+        storeUnorm8<bgra>(v, _mm_unpacklo_epi16(lo, zero));
+        storeUnorm8<bgra>(v + 4, _mm_unpackhi_epi16(lo, zero));
+        storeUnorm8<bgra>(v + 8, _mm_unpacklo_epi16(hi, zero));
+        storeUnorm8<bgra>(v + 12, _mm_unpackhi_epi16(hi, zero));
+    }
+
+    for (; n < count; ++n, p += 4, v += 4)
+    {
+        int32_t packed;
+        __m128i i;
+
+        std::memcpy(&packed, p, sizeof(packed));
+        i = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+        storeUnorm8<bgra>(v, _mm_unpacklo_epi16(i, zero));
+    }
+}
+
+template<>
+void packPixels<ChannelUnormInt8, OrderRGBA>(void *pixels, const void *rgba,
+                                             size_t count)
+{
+    packUnormInt8<false>(pixels, rgba, count);
+}
+
+template<>
+void packPixels<ChannelUnormInt8, OrderBGRA>(void *pixels, const void *rgba,
+                                             size_t count)
+{
+    packUnormInt8<true>(pixels, rgba, count);
+}
+
+template<>
+void unpackPixels<ChannelUnormInt8, OrderRGBA>(void *rgba, const void *pixels,
+                                               size_t count)
+{
+    unpackUnormInt8<false>(rgba, pixels, count);
+}
+
+template<>
+void unpackPixels<ChannelUnormInt8, OrderBGRA>(void *rgba, const void *pixels,
+                                               size_t count)
+{
+    unpackUnormInt8<true>(rgba, pixels, count);
+}
+
+// RGBA quadruplets of 32-bit values are stored as they are
+template<>
+void packPixels<ChannelFloat, OrderRGBA>(void *pixels, const void *rgba,
+                                         size_t count)
+{
+    std::memcpy(pixels, rgba, count * 4 * sizeof(float));
+}
+
+template<>
+void unpackPixels<ChannelFloat, OrderRGBA>(void *rgba, const void *pixels,
+                                           size_t count)
+{
+    std::memcpy(rgba, pixels, count * 4 * sizeof(float));
+}
+
+/*
+ * Packed formats, only used with CL_RGB and CL_RGBx
+ */
+
+template<typename S, unsigned int bits, unsigned int green_bits>
+struct Packed
+{
+    typedef S storage;
+
+    static const unsigned int blue_shift = 0;
+    static const unsigned int green_shift = bits;
+    static const unsigned int red_shift = bits + green_bits;
+    static const unsigned int max = (1 << bits) - 1;
+    static const unsigned int green_max = (1 << green_bits) - 1;
+};
+
+typedef Packed<uint16_t, 5, 6> PackedShort565;
+typedef Packed<uint16_t, 5, 5> PackedShort555;
+typedef Packed<uint32_t, 10, 10> PackedInt101010;
+
+template<class P>
+static void unpackPackedPixels(void *rgba, const void *pixels, size_t count)
+{
+    const typename P::storage *p = (const typename P::storage *)pixels;
+    float *v = (float *)rgba;
+
+    for (size_t n=0; n<count; ++n, ++p, v += 4)
+    {
+        v[0] = ((*p >> P::red_shift) & P::max) * (1.0f / P::max);
+        v[1] = ((*p >> P::green_shift) & P::green_max) * (1.0f / P::green_max);
+        v[2] = ((*p >> P::blue_shift) & P::max) * (1.0f / P::max);
+        v[3] = 1.0f;
+    }
+}
+
+template<class P>
+static void packPackedPixels(void *pixels, const void *rgba, size_t count)
+{
+    typename P::storage *p = (typename P::storage *)pixels;
+    const float *v = (const float *)rgba;
+
+    for (size_t n=0; n<count; ++n, ++p, v += 4)
+    {
+        *p = (satRound(v[0] * P::max, 0.0f, P::max) << P::red_shift) |
+             (satRound(v[1] * P::green_max, 0.0f, P::green_max) << P::green_shift) |
+             (satRound(v[2] * P::max, 0.0f, P::max) << P::blue_shift);
+    }
+}
+
+/*
+ * Format tables
+ */
+
+template<class Channel, class Order>
+static const CPUPixelFormat *formatOf()
+{
+    static const CPUPixelFormat format = {
+        &packPixels<Channel, Order>,
+        &unpackPixels<Channel, Order>,
+        Order::channels * sizeof(typename Channel::storage)
+    };
+
+    return &format;
+}
+
+template<class P>
+static const CPUPixelFormat *packedFormatOf()
+{
+    static const CPUPixelFormat format = {
+        &packPackedPixels<P>,
+        &unpackPackedPixels<P>,
+        sizeof(typename P::storage)
+    };
+
+    return &format;
+}
+
+template<class Order>
+static const CPUPixelFormat *formatOfType(cl_channel_type type)
+{
+    switch (type)
+    {
+        case CL_SNORM_INT8:
+            return formatOf<ChannelSnormInt8, Order>();
+        case CL_SNORM_INT16:
+            return formatOf<ChannelSnormInt16, Order>();
+        case CL_UNORM_INT8:
+            return formatOf<ChannelUnormInt8, Order>();
+        case CL_UNORM_INT16:
+            return formatOf<ChannelUnormInt16, Order>();
+        case CL_SIGNED_INT8:
+            return formatOf<ChannelSignedInt8, Order>();
+        case CL_SIGNED_INT16:
+            return formatOf<ChannelSignedInt16, Order>();
+        case CL_SIGNED_INT32:
+            return formatOf<ChannelSignedInt32, Order>();
+        case CL_UNSIGNED_INT8:
+            return formatOf<ChannelUnsignedInt8, Order>();
+        case CL_UNSIGNED_INT16:
+            return formatOf<ChannelUnsignedInt16, Order>();
+        case CL_UNSIGNED_INT32:
+            return formatOf<ChannelUnsignedInt32, Order>();
+        case CL_HALF_FLOAT:
+            return formatOf<ChannelHalfFloat, Order>();
+        case CL_FLOAT:
+            return formatOf<ChannelFloat, Order>();
+        default:
+            return 0;
+    }
+}
+
+const CPUPixelFormat *Coal::pixelFormat(const cl_image_format &format)
+{
+    switch (format.image_channel_order)
+    {
+        case CL_R:
+        case CL_Rx:
+            return formatOfType<OrderR>(format.image_channel_data_type);
+        case CL_A:
+            return formatOfType<OrderA>(format.image_channel_data_type);
+        case CL_INTENSITY:
+            return formatOfType<OrderIntensity>(format.image_channel_data_type);
+        case CL_LUMINANCE:
+            return formatOfType<OrderLuminance>(format.image_channel_data_type);
+        case CL_RG:
+        case CL_RGx:
+            return formatOfType<OrderRG>(format.image_channel_data_type);
+        case CL_RA:
+            return formatOfType<OrderRA>(format.image_channel_data_type);
+        case CL_RGBA:
+            return formatOfType<OrderRGBA>(format.image_channel_data_type);
+        case CL_ARGB:
+            return formatOfType<OrderARGB>(format.image_channel_data_type);
+        case CL_BGRA:
+            return formatOfType<OrderBGRA>(format.image_channel_data_type);
+        case CL_RGB:
+        case CL_RGBx:
+            switch (format.image_channel_data_type)
+            {
+                case CL_UNORM_SHORT_565:
+                    return packedFormatOf<PackedShort565>();
+                case CL_UNORM_SHORT_555:
+                    return packedFormatOf<PackedShort555>();
+                case CL_UNORM_INT_101010:
+                    return packedFormatOf<PackedInt101010>();
+                default:
+                    return 0;
+            }
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file cpu/pixel.h
+ * \brief Conversion of pixels between image formats and RGBA values
+ */
+
+#ifndef __CPU_PIXEL_H__
+#define __CPU_PIXEL_H__
+
+#include <CL/cl.h>
+
+#include <cstddef>
+
+namespace Coal
+{
+
+/**
+ * \brief Packing and unpacking of the pixels of an image format
+ *
+ * The pixels are converted from and to RGBA quadruplets, as seen by the
+ * kernels: four \c float for the normalized, half and float channel types,
+ * four \c int32_t for the signed integer types and four \c uint32_t for the
+ * unsigned ones. Conversions follow the rules of section 8.3 of the OpenCL
+ * specification: rounding to nearest even and saturation when packing,
+ * missing components set to 0 and missing alpha to 1 when unpacking.
+ *
+ * The common formats (8-bit normalized RGBA and BGRA, float RGBA) use SSE2
+ * and process four pixels per iteration.
+ */
+struct CPUPixelFormat
+{
+    /**
+     * \brief Pack \p count RGBA quadruplets from \p rgba into \p pixels
+     */
+    typedef void (*PackFunc)(void *pixels, const void *rgba, size_t count);
+
+    /**
+     * \brief Unpack \p count pixels from \p pixels into RGBA quadruplets
+     */
+    typedef void (*UnpackFunc)(void *rgba, const void *pixels, size_t count);
+
+    PackFunc pack;              /*!< \brief RGBA to pixels */
+    UnpackFunc unpack;          /*!< \brief Pixels to RGBA */
+    unsigned int pixel_size;    /*!< \brief Size of a pixel in bytes */
+};
+
+/**
+ * \brief Conversion routines of an image format
+ * \return 0 if \p format isn't a valid image format
+ */
+const CPUPixelFormat *pixelFormat(const cl_image_format &format);
+
+}
+
+#endif
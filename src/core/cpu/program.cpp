@@ -36,6 +36,8 @@
 #include "builtins.h"
 
 #include "../program.h"
+#include "../context.h"
+#include "../trace.h"
 
 #include <llvm/PassManager.h>
 #include <llvm/Analysis/Passes.h>
@@ -119,6 +121,7 @@ bool CPUProgram::initJIT()
         return false;
 
     // Create the JIT
+    cl_ulong start = monotonicTime();
     std::string err;
     llvm::EngineBuilder builder(p_module);
 
@@ -136,6 +139,9 @@ bool CPUProgram::initJIT()
     p_jit->DisableSymbolSearching(true);    // Avoid an enormous security hole (a kernel calling system())
     p_jit->InstallLazyFunctionCreator(&getBuiltin);
 
+    ((Context *)p_program->parent())->trace()->record(Trace::JIT, "JIT engine",
+                                                      start);
+
     return true;
 }
 
@@ -29,9 +29,8 @@
  * \file cpu/sampler.cpp
  * \brief OpenCL C image access functions
  *
- * It is recommended to compile this file using Clang as it supports the
- * \c __builtin_shufflevector() built-in function, providing SSE or
- * NEON-accelerated code.
+ * Pixels are converted from and to the image formats by the routines of
+ * \c cpu/pixel.cpp.
  */
 
 #include "../memobject.h"
@@ -39,6 +38,8 @@
 #include "kernel.h"
 #include "buffer.h"
 #include "builtins.h"
+#include "sampler.h"
+#include "pixel.h"
 
 #include <cstdlib>
 #include <cmath>
@@ -99,160 +100,6 @@ static bool handle_address_mode(Image2D *image, int &x, int &y, int &z,
     return (x == w || y == h || z == d);
 }
 
-/*
- * Macros or functions used to accelerate the functions
- */
-#ifndef __has_builtin
-    #define __has_builtin(x) 0
-#endif
-
-static void slow_shuffle4(uint32_t *rs, uint32_t *a, uint32_t *b,
-                          int x, int y, int z, int w)
-{
-    rs[0] = (x < 4 ? a[x] : b[x - 4]);
-    rs[1] = (y < 4 ? a[y] : b[y - 4]);
-    rs[2] = (z < 4 ? a[z] : b[z - 4]);
-    rs[3] = (w < 4 ? a[w] : b[w - 4]);
-}
-
-static void convert_to_format(void *dest, float *data,
-                                   cl_channel_type type, unsigned int channels)
-{
-    // Convert always the four components of source to target
-    if (type == CL_FLOAT)
-        std::memcpy(dest, data, channels * sizeof(float));
-
-    for (unsigned int i=0; i<channels; ++i)
-    {
-        switch (type)
-        {
-            case CL_SNORM_INT8:
-                ((int8_t *)dest)[i] = data[i] * 128.0f;
-                break;
-            case CL_SNORM_INT16:
-                ((int16_t *)dest)[i] = data[i] * 32767.0f;
-                break;
-            case CL_UNORM_INT8:
-                ((uint8_t *)dest)[i] = data[i] * 255.0f;
-                break;
-            case CL_UNORM_INT16:
-                ((uint16_t *)dest)[i] = data[i] * 65535.0f;
-                break;
-        }
-    }
-}
-
-static void convert_from_format(float *data, void *source,
-                                     cl_channel_type type, unsigned int channels)
-{
-    // Convert always the four components of source to target
-    if (type == CL_FLOAT)
-        std::memcpy(data, source, channels * sizeof(float));
-
-    for (unsigned int i=0; i<channels; ++i)
-    {
-        switch (type)
-        {
-            case CL_SNORM_INT8:
-                data[i] = (float)((int8_t *)source)[i] / 127.0f;
-                break;
-            case CL_SNORM_INT16:
-                data[i] = (float)((int16_t *)source)[i] / 32767.0f;
-                break;
-            case CL_UNORM_INT8:
-                data[i] = (float)((uint8_t *)source)[i] / 127.0f;
-                break;
-            case CL_UNORM_INT16:
-                data[i] = (float)((uint16_t *)source)[i] / 127.0f;
-                break;
-        }
-    }
-}
-
-static void convert_to_format(void *dest, int *data,
-                                   cl_channel_type type, unsigned int channels)
-{
-    // Convert always the four components of source to target
-    if (type == CL_SIGNED_INT32)
-        std::memcpy(dest, data, channels * sizeof(int32_t));
-
-    for (unsigned int i=0; i<channels; ++i)
-    {
-        switch (type)
-        {
-            case CL_SIGNED_INT8:
-                ((int8_t *)dest)[i] = data[i];
-                break;
-            case CL_SIGNED_INT16:
-                ((int16_t *)dest)[i] = data[i];
-                break;
-        }
-    }
-}
-
-static void convert_from_format(int32_t *data, void *source,
-                                     cl_channel_type type, unsigned int channels)
-{
-    // Convert always the four components of source to target
-    if (type == CL_SIGNED_INT32)
-        std::memcpy(data, source, channels * sizeof(int32_t));
-
-    for (unsigned int i=0; i<channels; ++i)
-    {
-        switch (type)
-        {
-            case CL_SIGNED_INT8:
-                data[i] = ((int8_t *)source)[i];
-                break;
-            case CL_SIGNED_INT16:
-                data[i] = ((int16_t *)source)[i];
-                break;
-        }
-    }
-}
-
-static void convert_to_format(void *dest, uint32_t *data,
-                                   cl_channel_type type, unsigned int channels)
-{
-    // Convert always the four components of source to target
-    if (type == CL_UNSIGNED_INT32)
-        std::memcpy(dest, data, channels * sizeof(uint32_t));
-
-    for (unsigned int i=0; i<3; ++i)
-    {
-        switch (type)
-        {
-            case CL_UNSIGNED_INT8:
-                ((uint8_t *)dest)[i] = data[i];
-                break;
-            case CL_UNSIGNED_INT16:
-                ((uint16_t *)dest)[i] = data[i];
-                break;
-        }
-    }
-}
-
-static void convert_from_format(uint32_t *data, void *source,
-                                     cl_channel_type type, unsigned int channels)
-{
-    // Convert always the four components of source to target
-    if (type == CL_UNSIGNED_INT32)
-        std::memcpy(data, source, channels * sizeof(uint32_t));
-
-    for (unsigned int i=0; i<channels; ++i)
-    {
-        switch (type)
-        {
-            case CL_UNSIGNED_INT8:
-                data[i] = ((uint8_t *)source)[i];
-                break;
-            case CL_UNSIGNED_INT16:
-                data[i] = ((uint16_t *)source)[i];
-                break;
-        }
-    }
-}
-
 template<typename T>
 static void vec4_scalar_mul(T *vec, float val)
 {
@@ -328,92 +175,6 @@ void CPUKernelWorkGroup::linear2D(T *result, float a, float b, float c, int i0,
     vec4_add(result, accum);
 }
 
-#if __has_builtin(__builtin_shufflevector)
-    #define shuffle4(rs, a, b, x, y, z, w) \
-        *(__v4sf *)rs = __builtin_shufflevector(*(__v4sf *)a, *(__v4sf *)b, \
-                                                x, y, z, w)
-#else
-    #define shuffle4(rs, a, b, x, y, z, w) \
-        slow_shuffle4(rs, a, b, x, y, z, w)
-#endif
-
-static void swizzle(uint32_t *target, uint32_t *source,
-                    cl_channel_order order, bool reading, uint32_t t_max)
-{
-    uint32_t special[4] = {0, t_max, 0, 0 };
-
-    if (reading)
-    {
-        switch (order)
-        {
-            case CL_R:
-            case CL_Rx:
-                // target = {source->x, 0, 0, t_max}
-                shuffle4(target, source, special, 0, 4, 4, 5);
-                break;
-            case CL_A:
-                // target = {0, 0, 0, source->x}
-                shuffle4(target, source, special, 4, 4, 4, 0);
-                break;
-            case CL_INTENSITY:
-                // target = {source->x, source->x, source->x, source->x}
-                shuffle4(target, source, source, 0, 0, 0, 0);
-                break;
-            case CL_LUMINANCE:
-                // target = {source->x, source->x, source->x, t_max}
-                shuffle4(target, source, special, 0, 0, 0, 5);
-                break;
-            case CL_RG:
-            case CL_RGx:
-                // target = {source->x, source->y, 0, t_max}
-                shuffle4(target, source, special, 0, 1, 4, 5);
-                break;
-            case CL_RA:
-                // target = {source->x, 0, 0, source->y}
-                shuffle4(target, source, special, 0, 4, 4, 1);
-                break;
-            case CL_RGB:
-            case CL_RGBx:
-            case CL_RGBA:
-                // Nothing to do, already the good order
-                std::memcpy(target, source, 16);
-                break;
-            case CL_ARGB:
-                // target = {source->y, source->z, source->w, source->x}
-                shuffle4(target, source, source, 1, 2, 3, 0);
-                break;
-            case CL_BGRA:
-                // target = {source->z, source->y, source->x, source->w}
-                shuffle4(target, source, source, 2, 1, 0, 3);
-                break;
-        }
-    }
-    else
-    {
-        switch (order)
-        {
-            case CL_A:
-                // target = {source->w, undef, undef, undef}
-                shuffle4(target, source, source, 3, 3, 3, 3);
-                break;
-            case CL_RA:
-                // target = {source->x, source->w, undef, undef}
-                shuffle4(target, source, source, 0, 3, 3, 3);
-                break;
-            case CL_ARGB:
-                // target = {source->w, source->x, source->y, source->z}
-                shuffle4(target, source, source, 3, 0, 1, 2);
-                break;
-            case CL_BGRA:
-                // target = {source->z, source->y, source->x, source->w}
-                shuffle4(target, source, source, 2, 1, 0, 3);
-                break;
-            default:
-                std::memcpy(target, source, 16);
-        }
-    }
-}
-
 /*
  * Actual implementation of the built-ins
  */
@@ -423,6 +184,9 @@ void *CPUKernelWorkGroup::getImageData(Image2D *image, int x, int y, int z) cons
     CPUBuffer *buffer =
         (CPUBuffer *)image->deviceBuffer((DeviceInterface *)p_kernel->device());
 
+    if (buffer->tiled())
+        return buffer->texelAddress(x, y, z);
+
     return imageData((unsigned char *)buffer->data(),
                      x, y, z,
                      image->row_pitch(),
@@ -434,21 +198,11 @@ template<typename T>
 void CPUKernelWorkGroup::writeImageImpl(Image2D *image, int x, int y, int z,
                                         T *color) const
 {
-    T converted[4];
-
-    // Swizzle to the correct order (float, int and uint are 32-bit, so the
-    // type has no importance
-    swizzle((uint32_t *)converted, (uint32_t *)color,
-            image->format().image_channel_order, false, 0);
-
     // Get a pointer in the image where to write the data
     void *target = getImageData(image, x, y, z);
 
-    // Convert color to the correct format
-    convert_to_format(target,
-                      converted,
-                      image->format().image_channel_data_type,
-                      image->channels());
+    // Convert color to the format of the image
+    pixelFormat(image->format())->pack(target, color, 1);
 }
 
 void CPUKernelWorkGroup::writeImage(Image2D *image, int x, int y, int z,
@@ -469,30 +223,6 @@ void CPUKernelWorkGroup::writeImage(Image2D *image, int x, int y, int z,
     writeImageImpl<uint32_t>(image, x, y, z, color);
 }
 
-template<typename T>
-uint32_t type_max_value()
-{
-    return 0;
-}
-
-template<>
-uint32_t type_max_value<float>()
-{
-    return 1065353216; // 1.0f in decimal form
-}
-
-template<>
-uint32_t type_max_value<int32_t>()
-{
-    return 0x7fffffff;
-}
-
-template<>
-uint32_t type_max_value<uint32_t>()
-{
-    return 0xffffffff;
-}
-
 template<typename T>
 void CPUKernelWorkGroup::readImageImplI(T *result, Image2D *image, int x, int y,
                                         int z, uint32_t sampler) const
@@ -522,22 +252,410 @@ void CPUKernelWorkGroup::readImageImplI(T *result, Image2D *image, int x, int y,
 
     // Load the data from the image, converting it
     void *source = getImageData(image, x, y, z);
-    T converted[4];
 
-    convert_from_format(converted,
-                        source,
-                        image->format().image_channel_data_type,
-                        image->channels());
+    pixelFormat(image->format())->unpack(result, source, 1);
+}
+
+/*
+ * Sampling engine
+ *
+ * Reading a texel with a float result goes through a routine specialized for
+ * a (texel format, addressing mode, filter, normalization, dimensions) tuple,
+ * selected by CPUImageSampler::bind(). Texels are handled as four floats in a
+ * SSE register, so that the bilinear and trilinear filters are a handful of
+ * vector multiply-adds.
+ */
+
+static inline int ifloor(float x)
+{
+    int i = (int)x;
+
+    return i - (x < (float)i);
+}
+
+static inline unsigned char *texelAddress(const CPUImageSampler *s,
+                                          int i, int j, int k)
+{
+    if (s->tiles)
+        return s->tiles->texelAddress(i, j, k);
+
+    return s->data + k * s->slice_pitch + j * s->row_pitch
+                   + i * s->pixel_size;
+}
+
+// Texel fetchers : read a texel and return it as RGBA floats
+struct FetchGeneric
+{
+    static __m128 load(const CPUImageSampler *s, const unsigned char *p)
+    {
+        float result[4];
+
+        s->format->unpack(result, p, 1);
+
+        return _mm_loadu_ps(result);
+    }
+};
+
+struct FetchRGBAUnormInt8
+{
+    static __m128 load(const CPUImageSampler *s, const unsigned char *p)
+    {
+        (void)s;
+        __m128i zero = _mm_setzero_si128();
+        __m128i v = _mm_cvtsi32_si128(*(const int *)p);
+
+        v = _mm_unpacklo_epi8(v, zero);
+        v = _mm_unpacklo_epi16(v, zero);
+
+        return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f / 255.0f));
+    }
+};
+
+struct FetchBGRAUnormInt8
+{
+    static __m128 load(const CPUImageSampler *s, const unsigned char *p)
+    {
+        __m128 v = FetchRGBAUnormInt8::load(s, p);
+
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2));
+    }
+};
+
+struct FetchRGBAFloat
+{
+    static __m128 load(const CPUImageSampler *s, const unsigned char *p)
+    {
+        (void)s;
+        return _mm_loadu_ps((const float *)p);
+    }
+};
+
+/*
+ * Addressing modes, working on one coordinate. A texel index of -1 designates
+ * the border color. The coordinates given to the repeat modes are always
+ * normalized, the other modes receive coordinates in texels.
+ */
+struct AddressClampToEdge
+{
+    static const bool border = false;
+    static const bool takes_normalized = false;
+
+    static int nearest(float u, int size)
+    {
+        return clamp(ifloor(u), 0, size - 1);
+    }
+
+    static void linear(float u, int size, int &i0, int &i1, float &a)
+    {
+        u -= 0.5f;
+        int i = ifloor(u);
+
+        a = u - (float)i;
+        i0 = clamp(i, 0, size - 1);
+        i1 = clamp(i + 1, 0, size - 1);
+    }
+};
+
+// CLK_ADDRESS_NONE leaves out of range coordinates undefined, clamping them
+// is the cheapest way to stay in the image
+typedef AddressClampToEdge AddressNone;
+
+struct AddressClamp
+{
+    static const bool border = true;
+    static const bool takes_normalized = false;
+
+    static int nearest(float u, int size)
+    {
+        int i = ifloor(u);
+
+        return (i < 0 || i >= size ? -1 : i);
+    }
+
+    static void linear(float u, int size, int &i0, int &i1, float &a)
+    {
+        u -= 0.5f;
+        int i = ifloor(u);
+
+        a = u - (float)i;
+        i0 = (i < 0 || i >= size ? -1 : i);
+        i1 = (i + 1 < 0 || i + 1 >= size ? -1 : i + 1);
+    }
+};
+
+struct AddressRepeat
+{
+    static const bool border = false;
+    static const bool takes_normalized = true;
+
+    static int nearest(float s, int size)
+    {
+        int i = ifloor((s - std::floor(s)) * (float)size);
+
+        return (i > size - 1 ? i - size : i);
+    }
+
+    static void linear(float s, int size, int &i0, int &i1, float &a)
+    {
+        float u = (s - std::floor(s)) * (float)size - 0.5f;
+        int i = ifloor(u);
+
+        a = u - (float)i;
+        i0 = (i < 0 ? i + size : i);
+        i1 = (i + 1 > size - 1 ? i + 1 - size : i + 1);
+    }
+};
+
+struct AddressMirroredRepeat
+{
+    static const bool border = false;
+    static const bool takes_normalized = true;
+
+    static float mirror(float s, int size)
+    {
+        return std::fabs(s - 2.0f * rintf(0.5f * s)) * (float)size;
+    }
+
+    static int nearest(float s, int size)
+    {
+        return min(ifloor(mirror(s, size)), size - 1);
+    }
+
+    static void linear(float s, int size, int &i0, int &i1, float &a)
+    {
+        float u = mirror(s, size) - 0.5f;
+        int i = ifloor(u);
+
+        a = u - (float)i;
+        i0 = max(i, 0);
+        i1 = min(i + 1, size - 1);
+    }
+};
+
+template<class Fetch, class Address>
+static inline __m128 texel(const CPUImageSampler *s, int i, int j, int k)
+{
+    if (Address::border && (i < 0 || j < 0 || k < 0))
+        return _mm_loadu_ps(s->border);
+
+    return Fetch::load(s, texelAddress(s, i, j, k));
+}
+
+static inline __m128 lerp(__m128 a, __m128 b, float t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(_mm_set1_ps(t), _mm_sub_ps(b, a)));
+}
+
+template<class Address, bool Normalized>
+static inline float toAddress(float u, int size)
+{
+    // Repeat modes work on normalized coordinates, the others on texels
+    if (Normalized && !Address::takes_normalized)
+        return u * (float)size;
+
+    return u;
+}
 
-    // Swizzle the pixel just read and place it in result
-    swizzle((uint32_t *)result, (uint32_t *)converted,
-            image->format().image_channel_order, true, type_max_value<T>());
+template<class Fetch, class Address, bool Normalized, bool Is3D>
+static void readNearest(const CPUImageSampler *s, float *result,
+                        float x, float y, float z)
+{
+    int i = Address::nearest(toAddress<Address, Normalized>(x, s->width),
+                             s->width);
+    int j = Address::nearest(toAddress<Address, Normalized>(y, s->height),
+                             s->height);
+    int k = 0;
+
+    if (Is3D)
+        k = Address::nearest(toAddress<Address, Normalized>(z, s->depth),
+                             s->depth);
+
+    _mm_storeu_ps(result, texel<Fetch, Address>(s, i, j, k));
+}
+
+template<class Fetch, class Address, bool Normalized, bool Is3D>
+static void readLinear(const CPUImageSampler *s, float *result,
+                       float x, float y, float z)
+{
+    int i0, i1, j0, j1, k0 = 0, k1 = 0;
+    float a, b, c = 0.0f;
+
+    Address::linear(toAddress<Address, Normalized>(x, s->width), s->width,
+                    i0, i1, a);
+    Address::linear(toAddress<Address, Normalized>(y, s->height), s->height,
+                    j0, j1, b);
+
+    if (Is3D)
+        Address::linear(toAddress<Address, Normalized>(z, s->depth), s->depth,
+                        k0, k1, c);
+
+    // Bilinear filtering on slice k0, then on k1 if the image is 3D
+    __m128 r0 = lerp(texel<Fetch, Address>(s, i0, j0, k0),
+                     texel<Fetch, Address>(s, i1, j0, k0), a);
+    __m128 r1 = lerp(texel<Fetch, Address>(s, i0, j1, k0),
+                     texel<Fetch, Address>(s, i1, j1, k0), a);
+    __m128 r = lerp(r0, r1, b);
+
+    if (Is3D)
+    {
+        r0 = lerp(texel<Fetch, Address>(s, i0, j0, k1),
+                  texel<Fetch, Address>(s, i1, j0, k1), a);
+        r1 = lerp(texel<Fetch, Address>(s, i0, j1, k1),
+                  texel<Fetch, Address>(s, i1, j1, k1), a);
+        r = lerp(r, lerp(r0, r1, b), c);
+    }
+
+    _mm_storeu_ps(result, r);
+}
+
+template<class Fetch, class Address, bool Is3D>
+static CPUImageReadFunc readFunction(bool normalized, bool linear)
+{
+    if (linear)
+    {
+        if (normalized)
+            return &readLinear<Fetch, Address, true, Is3D>;
+        else
+            return &readLinear<Fetch, Address, false, Is3D>;
+    }
+    else
+    {
+        if (normalized)
+            return &readNearest<Fetch, Address, true, Is3D>;
+        else
+            return &readNearest<Fetch, Address, false, Is3D>;
+    }
+}
+
+template<class Fetch, class Address>
+static void selectReadFunctions(CPUImageSampler *s, bool is_3d)
+{
+    bool normalized = ((s->sampler & CLK_NORMALIZED_COORDS_MASK)
+                            == CLK_NORMALIZED_COORDS_TRUE);
+    bool linear = ((s->sampler & CLK_FILTER_MASK) == CLK_FILTER_LINEAR);
+
+    if (is_3d)
+        s->readF = readFunction<Fetch, Address, true>(normalized, linear);
+    else
+        s->readF = readFunction<Fetch, Address, false>(normalized, linear);
+}
+
+template<class Fetch>
+static void selectReadFunctions(CPUImageSampler *s)
+{
+    bool is_3d = (s->image->type() == MemObject::Image3D);
+
+    switch (s->sampler & CLK_ADDRESS_MODE_MASK)
+    {
+        case CLK_ADDRESS_CLAMP:
+            selectReadFunctions<Fetch, AddressClamp>(s, is_3d);
+            break;
+        case CLK_ADDRESS_REPEAT:
+            selectReadFunctions<Fetch, AddressRepeat>(s, is_3d);
+            break;
+        case CLK_ADDRESS_MIRRORED_REPEAT:
+            selectReadFunctions<Fetch, AddressMirroredRepeat>(s, is_3d);
+            break;
+        case CLK_ADDRESS_CLAMP_TO_EDGE:
+            selectReadFunctions<Fetch, AddressClampToEdge>(s, is_3d);
+            break;
+        default:
+            selectReadFunctions<Fetch, AddressNone>(s, is_3d);
+    }
+
+    // Integer coordinates are unnormalized and not filtered, and only the
+    // clamp modes are valid with them
+    if ((s->sampler & CLK_ADDRESS_MODE_MASK) == CLK_ADDRESS_CLAMP)
+    {
+        s->readI = (is_3d ?
+            readFunction<Fetch, AddressClamp, true>(false, false) :
+            readFunction<Fetch, AddressClamp, false>(false, false));
+    }
+    else
+    {
+        s->readI = (is_3d ?
+            readFunction<Fetch, AddressNone, true>(false, false) :
+            readFunction<Fetch, AddressNone, false>(false, false));
+    }
+}
+
+void CPUImageSampler::bind(Image2D *image, uint32_t sampler,
+                           DeviceInterface *device)
+{
+    CPUBuffer *buffer = (CPUBuffer *)image->deviceBuffer(device);
+
+    this->image = image;
+    this->sampler = sampler;
+
+    data = (unsigned char *)buffer->data();
+    tiles = (buffer->tiled() ? buffer : 0);
+    row_pitch = image->row_pitch();
+    slice_pitch = image->slice_pitch();
+    pixel_size = image->pixel_size();
+    order = image->format().image_channel_order;
+    type = image->format().image_channel_data_type;
+    channels = image->channels();
+    format = pixelFormat(image->format());
+    width = image->width();
+    height = image->height();
+    depth = (image->type() == MemObject::Image3D ?
+                ((Image3D *)image)->depth() : 1);
+
+    // Border color, opaque black if the image has no alpha channel
+    border[0] = border[1] = border[2] = 0.0f;
+
+    switch (order)
+    {
+        case CL_R:
+        case CL_Rx:
+        case CL_RG:
+        case CL_RGx:
+        case CL_RGB:
+        case CL_RGBx:
+        case CL_LUMINANCE:
+            border[3] = 1.0f;
+            break;
+        default:
+            border[3] = 0.0f;
+    }
+
+    // Select the specialized routines
+    if (order == CL_RGBA && type == CL_UNORM_INT8)
+        selectReadFunctions<FetchRGBAUnormInt8>(this);
+    else if (order == CL_BGRA && type == CL_UNORM_INT8)
+        selectReadFunctions<FetchBGRAUnormInt8>(this);
+    else if (order == CL_RGBA && type == CL_FLOAT)
+        selectReadFunctions<FetchRGBAFloat>(this);
+    else
+        selectReadFunctions<FetchGeneric>(this);
+}
+
+const CPUImageSampler *CPUKernelWorkGroup::imageSampler(Image2D *image,
+                                                        uint32_t sampler) const
+{
+    for (unsigned int i=0; i<p_num_image_samplers; ++i)
+    {
+        const CPUImageSampler *s = &p_image_samplers[i];
+
+        if (s->image == image && s->sampler == sampler)
+            return s;
+    }
+
+    // Not yet bound, replace the oldest binding
+    CPUImageSampler *s = &p_image_samplers[p_next_image_sampler];
+
+    p_next_image_sampler = (p_next_image_sampler + 1) % p_num_image_samplers;
+    s->bind(image, sampler, (DeviceInterface *)p_kernel->device());
+
+    return s;
 }
 
 void CPUKernelWorkGroup::readImage(float *result, Image2D *image, int x, int y,
                                    int z, uint32_t sampler) const
 {
-    readImageImplI<float>(result, image, x, y, z, sampler);
+    const CPUImageSampler *s = imageSampler(image, sampler);
+
+    s->readI(s, result, x, y, z);
 }
 
 void CPUKernelWorkGroup::readImage(int32_t *result, Image2D *image, int x, int y,
@@ -582,6 +700,7 @@ void CPUKernelWorkGroup::readImageImplF(T *result, Image2D *image, float x,
                 {
                     readImageImplI<T>(result, image, std::floor(x),
                                       std::floor(y), std::floor(z), sampler);
+                    break;
                 }
                 case CLK_FILTER_LINEAR:
                 {
@@ -640,6 +759,7 @@ void CPUKernelWorkGroup::readImageImplF(T *result, Image2D *image, float x,
                     }
 
                     readImageImplI<T>(result, image, i, j, k, sampler);
+                    break;
                 }
                 case CLK_FILTER_LINEAR:
                 {
@@ -704,6 +824,7 @@ void CPUKernelWorkGroup::readImageImplF(T *result, Image2D *image, float x,
                                       min(std::floor(y), h - 1),
                                       min(std::floor(z), d - 1),
                                       sampler);
+                    break;
                 }
                 case CLK_FILTER_LINEAR:
                 {
@@ -753,7 +874,9 @@ void CPUKernelWorkGroup::readImageImplF(T *result, Image2D *image, float x,
 void CPUKernelWorkGroup::readImage(float *result, Image2D *image, float x,
                                    float y, float z, uint32_t sampler) const
 {
-    readImageImplF<float>(result, image, x, y, z, sampler);
+    const CPUImageSampler *s = imageSampler(image, sampler);
+
+    s->readF(s, result, x, y, z);
 }
 
 void CPUKernelWorkGroup::readImage(int32_t *result, Image2D *image, float x,
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file cpu/sampler.h
+ * \brief Image sampling engine
+ */
+
+#ifndef __CPU_SAMPLER_H__
+#define __CPU_SAMPLER_H__
+
+#include <CL/cl.h>
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace Coal
+{
+
+class Image2D;
+class DeviceInterface;
+class CPUBuffer;
+struct CPUPixelFormat;
+struct CPUImageSampler;
+
+/**
+ * \brief Routine reading a texel, filtered and converted to floats
+ *
+ * \p result receives the four RGBA components of the texel at (\p x, \p y,
+ * \p z). \p z is ignored for 2D images.
+ */
+typedef void (*CPUImageReadFunc)(const CPUImageSampler *s, float *result,
+                                 float x, float y, float z);
+
+/**
+ * \brief Image bound to a sampler
+ *
+ * The sampler bitfield and the image format are known when an image is first
+ * read with a given sampler. This structure caches everything that is needed
+ * to address a texel of the image and points to routines specialized for the
+ * channel order and type, filter, addressing mode and coordinate
+ * normalization. Reading a texel is then only a call through a function
+ * pointer, without any switch.
+ *
+ * \see Coal::CPUKernelWorkGroup::imageSampler()
+ */
+struct CPUImageSampler
+{
+    Image2D *image;                 /*!< \brief Image bound, 0 if unused */
+    uint32_t sampler;               /*!< \brief Sampler bitfield */
+
+    unsigned char *data;            /*!< \brief Address of the first texel */
+    const CPUBuffer *tiles;         /*!< \brief Buffer addressing the texels if the image is tiled, 0 otherwise */
+    size_t row_pitch;               /*!< \brief Row pitch of the image */
+    size_t slice_pitch;             /*!< \brief Slice pitch of the image */
+    unsigned int pixel_size;        /*!< \brief Size of a texel in bytes */
+    cl_channel_order order;         /*!< \brief Channel order */
+    cl_channel_type type;           /*!< \brief Channel data type */
+    unsigned int channels;          /*!< \brief Number of channels */
+    const CPUPixelFormat *format;   /*!< \brief Conversion routines of the format */
+    int width;                      /*!< \brief Width of the image */
+    int height;                     /*!< \brief Height of the image */
+    int depth;                      /*!< \brief Depth of the image, 1 for 2D images */
+    float border[4];                /*!< \brief Border color for \c CLK_ADDRESS_CLAMP */
+
+    CPUImageReadFunc readF;         /*!< \brief Read with floating-point coordinates */
+    CPUImageReadFunc readI;         /*!< \brief Read with integer coordinates (given as floats) */
+
+    /**
+     * \brief Bind an image and a sampler
+     *
+     * Fill the fields of this structure and select the routines to use.
+     *
+     * \param image image to bind
+     * \param sampler sampler bitfield
+     * \param device device on which the image is read
+     */
+    void bind(Image2D *image, uint32_t sampler, DeviceInterface *device);
+};
+
+}
+
+#endif
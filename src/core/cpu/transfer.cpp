@@ -0,0 +1,602 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file cpu/transfer.cpp
+ * \brief Parallel buffer transfers
+ */
+
+#include "transfer.h"
+#include "device.h"
+#include "buffer.h"
+#include "builtins.h"
+#include "pixel.h"
+
+#include "../events.h"
+#include "../memobject.h"
+
+#include <cstring>
+#include <stdint.h>
+
+#include <immintrin.h>
+
+using namespace Coal;
+
+void Coal::copyMemory(void *dst, const void *src, size_t size, bool streaming)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+
+    if (!streaming || size < 256)
+    {
+        std::memcpy(d, s, size);
+        return;
+    }
+
+    // Align the destination for the non-temporal stores
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+    std::memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    // Copy a cache line at a time
+    for (size_t i = size / 64; i > 0; --i)
+    {
+        _mm_prefetch((const char *)s + 512, _MM_HINT_NTA);
+
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+
+        d += 64;
+        s += 64;
+    }
+
+    // Non-temporal stores are weakly ordered, make them visible before the
+    // event is marked as complete
+    _mm_sfence();
+
+    std::memcpy(d, s, size & 63);
+}
+
+/*
+ * Rectangular copies
+ */
+
+// Merge the rows and slices that are contiguous in both the source and the
+// destination
+static void coalesce(CPURect &r)
+{
+    if (r.region[1] > 1 &&
+        r.dst_row_pitch == r.region[0] && r.src_row_pitch == r.region[0])
+    {
+        r.region[0] *= r.region[1];
+        r.region[1] = 1;
+    }
+
+    if (r.region[2] == 1)
+        return;
+
+    if (r.region[1] == 1)
+    {
+        // Slices of one row are rows, maybe contiguous
+        r.region[1] = r.region[2];
+        r.region[2] = 1;
+        r.dst_row_pitch = r.dst_slice_pitch;
+        r.src_row_pitch = r.src_slice_pitch;
+
+        if (r.dst_row_pitch == r.region[0] && r.src_row_pitch == r.region[0])
+        {
+            r.region[0] *= r.region[1];
+            r.region[1] = 1;
+        }
+    }
+    else if (r.dst_slice_pitch == r.dst_row_pitch * r.region[1] &&
+             r.src_slice_pitch == r.src_row_pitch * r.region[1])
+    {
+        // The slices follow each other, they are simply more rows
+        r.region[1] *= r.region[2];
+        r.region[2] = 1;
+    }
+}
+
+template<size_t width>
+static void copySmallRows(unsigned char *d, size_t d_pitch,
+                          const unsigned char *s, size_t s_pitch, size_t rows)
+{
+    // memcpy() of a constant size is a simple load and store
+    for (; rows > 0; --rows)
+    {
+        std::memcpy(d, s, width);
+
+        d += d_pitch;
+        s += s_pitch;
+    }
+}
+
+static void copyRows(unsigned char *d, size_t d_pitch,
+                     const unsigned char *s, size_t s_pitch,
+                     size_t width, size_t rows, bool streaming)
+{
+    switch (width)
+    {
+#define SMALL_ROWS(n) \
+        case n: \
+            copySmallRows<n>(d, d_pitch, s, s_pitch, rows); \
+            return;
+
+        SMALL_ROWS(1)  SMALL_ROWS(2)  SMALL_ROWS(3)  SMALL_ROWS(4)
+        SMALL_ROWS(5)  SMALL_ROWS(6)  SMALL_ROWS(7)  SMALL_ROWS(8)
+        SMALL_ROWS(9)  SMALL_ROWS(10) SMALL_ROWS(11) SMALL_ROWS(12)
+        SMALL_ROWS(13) SMALL_ROWS(14) SMALL_ROWS(15) SMALL_ROWS(16)
+#undef SMALL_ROWS
+
+        default:
+            break;
+    }
+
+    for (; rows > 0; --rows)
+    {
+        copyMemory(d, s, width, streaming);
+
+        d += d_pitch;
+        s += s_pitch;
+    }
+}
+
+// Copy num_rows rows of r, starting at first_row. Rows are numbered slice
+// after slice.
+static void copyRectRows(const CPURect &r, size_t first_row, size_t num_rows,
+                         bool streaming)
+{
+    size_t z = first_row / r.region[1];
+    size_t y = first_row % r.region[1];
+
+    while (num_rows)
+    {
+        size_t rows = r.region[1] - y;
+
+        if (rows > num_rows)
+            rows = num_rows;
+
+        copyRows(r.dst + z * r.dst_slice_pitch + y * r.dst_row_pitch,
+                 r.dst_row_pitch,
+                 r.src + z * r.src_slice_pitch + y * r.src_row_pitch,
+                 r.src_row_pitch,
+                 r.region[0], rows, streaming);
+
+        num_rows -= rows;
+        y = 0;
+        z++;
+    }
+}
+
+void Coal::copyRect(const CPURect &rect, bool streaming)
+{
+    CPURect r = rect;
+
+    if (!r.region[0] || !r.region[1] || !r.region[2])
+        return;
+
+    coalesce(r);
+    copyRectRows(r, 0, r.region[1] * r.region[2], streaming);
+}
+
+bool Coal::rectTransfer(Event *event, CPUDevice *device, CPURect &rect)
+{
+    // src = buffer and dst = mem if not copy
+    ReadWriteCopyBufferRectEvent *e = (ReadWriteCopyBufferRectEvent *)event;
+    Event::Type t = event->type();
+    CPUBuffer *src_buf = (CPUBuffer *)e->source()->deviceBuffer(device);
+    CPUBuffer *dst_buf = 0;
+
+    unsigned char *src = (unsigned char *)src_buf->data();
+    unsigned char *dst;
+
+    switch (t)
+    {
+        case Event::CopyBufferRect:
+        case Event::CopyImage:
+        case Event::CopyImageToBuffer:
+        case Event::CopyBufferToImage:
+        {
+            CopyBufferRectEvent *cbre = (CopyBufferRectEvent *)e;
+            dst_buf = (CPUBuffer *)cbre->destination()->deviceBuffer(device);
+
+            dst = (unsigned char *)dst_buf->data();
+            break;
+        }
+        default:
+        {
+            // dst = host memory location
+            ReadWriteBufferRectEvent *rwbre = (ReadWriteBufferRectEvent *)e;
+
+            dst = (unsigned char *)rwbre->ptr();
+        }
+    }
+
+    if (src_buf->tiled() || (dst_buf && dst_buf->tiled()))
+        return false;
+
+    src = imageData(src, e->src_origin(0), e->src_origin(1), e->src_origin(2),
+                    e->src_row_pitch(), e->src_slice_pitch(), 1);
+    dst = imageData(dst, e->dst_origin(0), e->dst_origin(1), e->dst_origin(2),
+                    e->dst_row_pitch(), e->dst_slice_pitch(), 1);
+
+    // Copying and image to a buffer may need to add an offset to the buffer
+    // address (its rectangular origin is always (0, 0, 0)).
+    if (t == Event::CopyBufferToImage)
+        src += ((CopyBufferToImageEvent *)e)->offset();
+    else if (t == Event::CopyImageToBuffer)
+        dst += ((CopyImageToBufferEvent *)e)->offset();
+
+    if (t == Event::WriteBufferRect || t == Event::WriteImage)
+    {
+        // Write dest (memory) in src
+        rect.dst = src;
+        rect.src = dst;
+        rect.dst_row_pitch = e->src_row_pitch();
+        rect.dst_slice_pitch = e->src_slice_pitch();
+        rect.src_row_pitch = e->dst_row_pitch();
+        rect.src_slice_pitch = e->dst_slice_pitch();
+    }
+    else
+    {
+        rect.dst = dst;
+        rect.src = src;
+        rect.dst_row_pitch = e->dst_row_pitch();
+        rect.dst_slice_pitch = e->dst_slice_pitch();
+        rect.src_row_pitch = e->src_row_pitch();
+        rect.src_slice_pitch = e->src_slice_pitch();
+    }
+
+    for (unsigned int i=0; i<3; ++i)
+        rect.region[i] = e->region(i);
+
+    return true;
+}
+
+/*
+ * Fills
+ */
+
+void Coal::fillMemory(void *dst, size_t size, const void *pattern,
+                      size_t pattern_size, bool streaming)
+{
+    unsigned char *d = (unsigned char *)dst;
+    unsigned char block[256];
+
+    // Every pattern size divides 128, so any 128 bytes of the block starting
+    // at a position p hold the pattern shifted by p
+    for (size_t i=0; i<sizeof(block); i += pattern_size)
+        std::memcpy(block + i, pattern, pattern_size);
+
+    if (size < 128)
+    {
+        std::memcpy(d, block, size);
+        return;
+    }
+
+    // Align the destination, the pattern then continues at position head
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    const unsigned char *b = block + head;
+
+    std::memcpy(d, block, head);
+    d += head;
+    size -= head;
+
+    __m128i v0 = _mm_loadu_si128((const __m128i *)b);
+    __m128i v1 = _mm_loadu_si128((const __m128i *)(b + 16));
+    __m128i v2 = _mm_loadu_si128((const __m128i *)(b + 32));
+    __m128i v3 = _mm_loadu_si128((const __m128i *)(b + 48));
+    __m128i v4 = _mm_loadu_si128((const __m128i *)(b + 64));
+    __m128i v5 = _mm_loadu_si128((const __m128i *)(b + 80));
+    __m128i v6 = _mm_loadu_si128((const __m128i *)(b + 96));
+    __m128i v7 = _mm_loadu_si128((const __m128i *)(b + 112));
+
+    if (streaming)
+    {
+        for (size_t i = size / 128; i > 0; --i)
+        {
+            _mm_stream_si128((__m128i *)d, v0);
+            _mm_stream_si128((__m128i *)(d + 16), v1);
+            _mm_stream_si128((__m128i *)(d + 32), v2);
+            _mm_stream_si128((__m128i *)(d + 48), v3);
+            _mm_stream_si128((__m128i *)(d + 64), v4);
+            _mm_stream_si128((__m128i *)(d + 80), v5);
+            _mm_stream_si128((__m128i *)(d + 96), v6);
+            _mm_stream_si128((__m128i *)(d + 112), v7);
+
+            d += 128;
+        }
+
+        _mm_sfence();
+    }
+    else
+    {
+        for (size_t i = size / 128; i > 0; --i)
+        {
+            _mm_store_si128((__m128i *)d, v0);
+            _mm_store_si128((__m128i *)(d + 16), v1);
+            _mm_store_si128((__m128i *)(d + 32), v2);
+            _mm_store_si128((__m128i *)(d + 48), v3);
+            _mm_store_si128((__m128i *)(d + 64), v4);
+            _mm_store_si128((__m128i *)(d + 80), v5);
+            _mm_store_si128((__m128i *)(d + 96), v6);
+            _mm_store_si128((__m128i *)(d + 112), v7);
+
+            d += 128;
+        }
+    }
+
+    std::memcpy(d, b, size & 127);
+}
+
+// Fill num_rows rows of r, numbered like in copyRectRows()
+static void fillRectRows(const CPURect &r, size_t first_row, size_t num_rows,
+                         const void *pattern, size_t pattern_size,
+                         bool streaming)
+{
+    size_t z = first_row / r.region[1];
+    size_t y = first_row % r.region[1];
+
+    for (; num_rows > 0; --num_rows)
+    {
+        fillMemory(r.dst + z * r.dst_slice_pitch + y * r.dst_row_pitch,
+                   r.region[0], pattern, pattern_size, streaming);
+
+        if (++y == r.region[1])
+        {
+            y = 0;
+            z++;
+        }
+    }
+}
+
+void Coal::fillRect(const CPURect &rect, const void *pattern,
+                    size_t pattern_size, bool streaming)
+{
+    CPURect r = rect;
+
+    if (!r.region[0] || !r.region[1] || !r.region[2])
+        return;
+
+    coalesce(r);
+    fillRectRows(r, 0, r.region[1] * r.region[2], pattern, pattern_size,
+                 streaming);
+}
+
+bool Coal::fillTransfer(Event *event, CPUDevice *device, CPURect &rect,
+                        unsigned char *pattern, size_t &pattern_size)
+{
+    if (event->type() == Event::FillBuffer)
+    {
+        FillBufferEvent *e = (FillBufferEvent *)event;
+        CPUBuffer *buf = (CPUBuffer *)e->buffer()->deviceBuffer(device);
+
+        pattern_size = e->pattern_size();
+        std::memcpy(pattern, e->pattern(), pattern_size);
+
+        rect.dst = (unsigned char *)buf->data() + e->offset();
+        rect.src = 0;
+        rect.dst_row_pitch = rect.dst_slice_pitch = e->cb();
+        rect.src_row_pitch = rect.src_slice_pitch = e->cb();
+        rect.region[0] = e->cb();
+        rect.region[1] = 1;
+        rect.region[2] = 1;
+
+        return true;
+    }
+
+    // Images are filled with their color packed in a pixel
+    FillImageEvent *e = (FillImageEvent *)event;
+    Image2D *image = (Image2D *)e->buffer();
+    CPUBuffer *buf = (CPUBuffer *)image->deviceBuffer(device);
+
+    pattern_size = image->pixel_size();
+    pixelFormat(image->format())->pack(pattern, e->fill_color(), 1);
+
+    if (buf->tiled())
+        return false;
+
+    rect.dst = imageData((unsigned char *)buf->data(), e->origin(0),
+                         e->origin(1), e->origin(2), image->row_pitch(),
+                         image->slice_pitch(), image->pixel_size());
+    rect.src = 0;
+    rect.dst_row_pitch = rect.src_row_pitch = image->row_pitch();
+    rect.dst_slice_pitch = rect.src_slice_pitch = image->slice_pitch();
+    rect.region[0] = e->region(0) * image->pixel_size();
+    rect.region[1] = e->region(1);
+    rect.region[2] = e->region(2);
+
+    return true;
+}
+
+bool Coal::isParallelTransfer(Event *event)
+{
+    switch (event->type())
+    {
+        case Event::ReadBuffer:
+        case Event::WriteBuffer:
+        case Event::CopyBuffer:
+        case Event::ReadBufferRect:
+        case Event::WriteBufferRect:
+        case Event::CopyBufferRect:
+        case Event::ReadImage:
+        case Event::WriteImage:
+        case Event::CopyImage:
+        case Event::CopyBufferToImage:
+        case Event::CopyImageToBuffer:
+        case Event::FillBuffer:
+        case Event::FillImage:
+            return event->deviceData() != 0;
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * CPUTransferEvent
+ */
+
+CPUTransferEvent::CPUTransferEvent(CPUDevice *device, void *dst,
+                                   const void *src, size_t size)
+{
+    p_rect.dst = (unsigned char *)dst;
+    p_rect.src = (const unsigned char *)src;
+    p_rect.dst_row_pitch = p_rect.dst_slice_pitch = size;
+    p_rect.src_row_pitch = p_rect.src_slice_pitch = size;
+    p_rect.region[0] = size;
+    p_rect.region[1] = 1;
+    p_rect.region[2] = 1;
+    p_pattern_size = 0;
+
+    init(device);
+}
+
+CPUTransferEvent::CPUTransferEvent(CPUDevice *device, const CPURect &rect)
+: p_rect(rect), p_pattern_size(0)
+{
+    coalesce(p_rect);
+    init(device);
+}
+
+CPUTransferEvent::CPUTransferEvent(CPUDevice *device, const CPURect &rect,
+                                   const void *pattern, size_t pattern_size)
+: p_rect(rect), p_pattern_size(pattern_size)
+{
+    std::memcpy(p_pattern, pattern, pattern_size);
+
+    coalesce(p_rect);
+    init(device);
+}
+
+void CPUTransferEvent::init(CPUDevice *device)
+{
+    size_t rows = p_rect.region[1] * p_rect.region[2];
+
+    pthread_mutex_init(&p_mutex, 0);
+
+    p_current_chunk = 0;
+    p_finished_chunks = 0;
+    p_streaming = (p_rect.region[0] * rows > device->cacheSize());
+
+    if (rows == 1)
+    {
+        // Chunks of bytes
+        p_chunk_rows = 0;
+        p_num_chunks = (p_rect.region[0] + chunk_size - 1) / chunk_size;
+    }
+    else
+    {
+        // Blocks of rows
+        p_chunk_rows = chunk_size / p_rect.region[0];
+
+        if (!p_chunk_rows)
+            p_chunk_rows = 1;
+
+        p_num_chunks = (rows + p_chunk_rows - 1) / p_chunk_rows;
+    }
+}
+
+CPUTransferEvent::~CPUTransferEvent()
+{
+    pthread_mutex_destroy(&p_mutex);
+}
+
+bool CPUTransferEvent::reserve()
+{
+    // Lock, this will be unlocked in copyChunk()
+    pthread_mutex_lock(&p_mutex);
+
+    return (p_current_chunk == p_num_chunks - 1);
+}
+
+void CPUTransferEvent::copyChunk()
+{
+    size_t chunk = p_current_chunk;
+
+    p_current_chunk++;
+
+    pthread_mutex_unlock(&p_mutex);
+
+    if (!p_chunk_rows)
+    {
+        size_t offset = chunk * chunk_size;
+        size_t size = chunk_size;
+
+        if (offset + size > p_rect.region[0])
+            size = p_rect.region[0] - offset;
+
+        // chunk_size is a multiple of the pattern size, the chunk starts
+        // with a pattern
+        if (p_pattern_size)
+            fillMemory(p_rect.dst + offset, size, p_pattern, p_pattern_size,
+                       p_streaming);
+        else
+            copyMemory(p_rect.dst + offset, p_rect.src + offset, size,
+                       p_streaming);
+    }
+    else
+    {
+        size_t rows = p_rect.region[1] * p_rect.region[2];
+        size_t first = chunk * p_chunk_rows;
+        size_t count = p_chunk_rows;
+
+        if (first + count > rows)
+            count = rows - first;
+
+        if (p_pattern_size)
+            fillRectRows(p_rect, first, count, p_pattern, p_pattern_size,
+                         p_streaming);
+        else
+            copyRectRows(p_rect, first, count, p_streaming);
+    }
+}
+
+bool CPUTransferEvent::chunkFinished()
+{
+    bool rs;
+
+    pthread_mutex_lock(&p_mutex);
+
+    p_finished_chunks++;
+    rs = (p_finished_chunks == p_num_chunks);
+
+    pthread_mutex_unlock(&p_mutex);
+
+    return rs;
+}
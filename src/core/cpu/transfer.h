@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file cpu/transfer.h
+ * \brief Parallel buffer transfers
+ */
+
+#ifndef __CPU_TRANSFER_H__
+#define __CPU_TRANSFER_H__
+
+#include <pthread.h>
+#include <cstddef>
+
+namespace Coal
+{
+
+class CPUDevice;
+class Event;
+
+/**
+ * \brief Copy memory
+ *
+ * When \p streaming is true, the destination is written using non-temporal
+ * stores. They bypass the caches, which is faster when the copied data is
+ * larger than the caches and wouldn't stay in them anyway.
+ *
+ * \param dst destination
+ * \param src source
+ * \param size number of bytes to copy
+ * \param streaming use non-temporal stores
+ */
+void copyMemory(void *dst, const void *src, size_t size, bool streaming);
+
+/**
+ * \brief Rectangular region of memory to copy
+ *
+ * Rows of \c region[0] bytes are copied, \c region[1] rows per slice and
+ * \c region[2] slices.
+ */
+struct CPURect
+{
+    unsigned char *dst;         /*!< \brief First byte of the destination */
+    const unsigned char *src;   /*!< \brief First byte of the source */
+    size_t dst_row_pitch;       /*!< \brief Distance between two destination rows */
+    size_t dst_slice_pitch;     /*!< \brief Distance between two destination slices */
+    size_t src_row_pitch;       /*!< \brief Distance between two source rows */
+    size_t src_slice_pitch;     /*!< \brief Distance between two source slices */
+    size_t region[3];           /*!< \brief Size of the region, region[0] in bytes */
+};
+
+/**
+ * \brief Copy a rectangular region
+ *
+ * Contiguous rows and slices are merged so that as few copies as possible
+ * are made. Rows of up to 16 bytes are copied by specialized loops.
+ *
+ * \param rect region to copy
+ * \param streaming use non-temporal stores for large rows
+ */
+void copyRect(const CPURect &rect, bool streaming);
+
+/**
+ * \brief Rectangular region copied by a rect or image \p event
+ *
+ * \param event \c Coal::ReadWriteCopyBufferRectEvent
+ * \param device device running the event
+ * \param rect region to copy
+ * \return false if the source or the destination is a tiled image, that
+ *         cannot be copied as a rectangle
+ */
+bool rectTransfer(Event *event, CPUDevice *device, CPURect &rect);
+
+/**
+ * \brief Fill memory with a pattern
+ *
+ * The pattern is replicated in SSE registers and \p dst is written 16 bytes
+ * at a time, whatever the size of the pattern.
+ *
+ * \param dst memory to fill, a pattern starts at \p dst
+ * \param size number of bytes to fill, a multiple of \p pattern_size
+ * \param pattern pattern to repeat
+ * \param pattern_size size of the pattern, a power of two up to 128
+ * \param streaming use non-temporal stores
+ */
+void fillMemory(void *dst, size_t size, const void *pattern,
+                size_t pattern_size, bool streaming);
+
+/**
+ * \brief Fill a rectangular region with a pattern
+ *
+ * The source of \p rect is not used, its pitches must be the ones of the
+ * destination. Every row starts with a pattern.
+ */
+void fillRect(const CPURect &rect, const void *pattern, size_t pattern_size,
+              bool streaming);
+
+/**
+ * \brief Region and pattern of a fill \p event
+ *
+ * The pattern of a \c Coal::FillImageEvent is its color packed in a pixel.
+ *
+ * \param event \c Coal::FillBufferEvent or \c Coal::FillImageEvent
+ * \param device device running the event
+ * \param rect region to fill
+ * \param pattern receives the pattern, \c Coal::FillBufferEvent::max_pattern_size bytes
+ * \param pattern_size receives the size of the pattern
+ * \return false if the event fills a tiled image, that cannot be filled as a
+ *         rectangle. \p pattern is set anyway
+ */
+bool fillTransfer(Event *event, CPUDevice *device, CPURect &rect,
+                  unsigned char *pattern, size_t &pattern_size);
+
+/**
+ * \brief Whether \p event is a transfer split between the workers
+ *
+ * Such events have a \c Coal::CPUTransferEvent as device data.
+ */
+bool isParallelTransfer(Event *event);
+
+/**
+ * \brief CPU-specific data of a large buffer transfer
+ *
+ * Reading, writing, copying or filling at least \c min_parallel_size bytes
+ * is split in chunks of about \c chunk_size bytes, a chunk being a range of
+ * bytes for linear transfers, a block of rows for rectangular ones. The event
+ * stays at the head of
+ * the event list of the \c Coal::CPUDevice until all its chunks are taken, so
+ * that every idle worker copies a part of it, the same way the work-groups
+ * of a kernel are distributed.
+ *
+ * Transfers larger than the last level cache of the CPU use non-temporal
+ * stores.
+ */
+class CPUTransferEvent
+{
+    public:
+        /**
+         * \brief Constructor
+         * \param device device running the transfer
+         * \param dst destination of the transfer
+         * \param src source of the transfer
+         * \param size number of bytes to copy
+         */
+        CPUTransferEvent(CPUDevice *device, void *dst, const void *src,
+                         size_t size);
+
+        /**
+         * \brief Constructor of a rectangular transfer
+         * \param device device running the transfer
+         * \param rect region to copy
+         */
+        CPUTransferEvent(CPUDevice *device, const CPURect &rect);
+
+        /**
+         * \brief Constructor of a fill
+         * \param device device running the fill
+         * \param rect region to fill, see \c fillRect()
+         * \param pattern pattern to repeat, copied
+         * \param pattern_size size of the pattern
+         */
+        CPUTransferEvent(CPUDevice *device, const CPURect &rect,
+                         const void *pattern, size_t pattern_size);
+        ~CPUTransferEvent();
+
+        static const size_t min_parallel_size = 1 << 20; /*!< \brief Smallest transfer split between the workers */
+        static const size_t chunk_size = 256 << 10;      /*!< \brief Size of a chunk, fits in the L2 cache */
+
+        bool reserve();      /*!< \brief The next chunk that will be copied will be the last. Locks the event */
+        void copyChunk();    /*!< \brief Must be called exactly one time after reserve(). Unlocks the event and copies a chunk */
+        bool chunkFinished(); /*!< \brief A chunk has been copied, returns true if it was the last one to finish */
+
+    private:
+        CPURect p_rect;
+        bool p_streaming;
+        size_t p_chunk_rows;  /*!< \brief Rows in a chunk, 0 for linear transfers */
+        unsigned char p_pattern[128];
+        size_t p_pattern_size; /*!< \brief Size of the pattern of a fill, 0 for copies */
+
+        size_t p_current_chunk, p_finished_chunks, p_num_chunks;
+        pthread_mutex_t p_mutex;
+
+        void init(CPUDevice *device);
+};
+
+}
+
+#endif
@@ -36,19 +36,83 @@
 #include "buffer.h"
 #include "kernel.h"
 #include "builtins.h"
+#include "transfer.h"
 
 #include "../commandqueue.h"
 #include "../events.h"
 #include "../memobject.h"
 #include "../kernel.h"
+#include "../context.h"
+#include "../trace.h"
 
 #include <sys/mman.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <vector>
 
 using namespace Coal;
 
+/**
+ * \brief One side of a rectangular copy
+ */
+struct RectSide
+{
+    CPUBuffer *buf;         /*!< \brief Device buffer, 0 for host memory */
+    unsigned char *linear;  /*!< \brief Address of the region if not tiled */
+    size_t origin[3];       /*!< \brief Origin, x in bytes */
+    size_t row_pitch, slice_pitch;
+};
+
+static bool isTiled(const RectSide &side)
+{
+    return side.buf && side.buf->tiled();
+}
+
+/**
+ * \brief Rectangular copy where at least one side is a tiled image
+ */
+static void tiledRectCopy(const RectSide &from, const RectSide &to,
+                          const size_t region[3], size_t pixel_size)
+{
+    size_t px_region[3] = {region[0] / pixel_size, region[1], region[2]};
+    size_t from_origin[3] = {from.origin[0] / pixel_size, from.origin[1],
+                             from.origin[2]};
+    size_t to_origin[3] = {to.origin[0] / pixel_size, to.origin[1],
+                           to.origin[2]};
+
+    if (isTiled(from) && isTiled(to))
+    {
+        // Go through a linear temporary
+        size_t row_pitch = region[0];
+        size_t slice_pitch = row_pitch * region[1];
+        unsigned char *tmp =
+            (unsigned char *)std::malloc(slice_pitch * region[2]);
+
+        if (!tmp)
+            return;
+
+        from.buf->tiledCopy(tmp, row_pitch, slice_pitch, from_origin,
+                            px_region, false);
+        to.buf->tiledCopy(tmp, row_pitch, slice_pitch, to_origin,
+                          px_region, true);
+
+        std::free(tmp);
+    }
+    else if (isTiled(from))
+    {
+        from.buf->tiledCopy(to.linear, to.row_pitch, to.slice_pitch,
+                            from_origin, px_region, false);
+    }
+    else
+    {
+        to.buf->tiledCopy(from.linear, from.row_pitch, from.slice_pitch,
+                          to_origin, px_region, true);
+    }
+}
+
 void *worker(void *data)
 {
     CPUDevice *device = (CPUDevice *)data;
@@ -61,8 +125,13 @@ void *worker(void *data)
 
     while (true)
     {
+        // The time spent waiting for an event is only measured when tracing
+        cl_ulong wait_begin = Trace::anyEnabled() ? monotonicTime() : 0;
+
         event = device->getEvent(stop);
 
+        cl_ulong taken = wait_begin ? monotonicTime() : 0;
+
         // Ensure we have a good event and we don't have to stop
         if (stop) break;
         if (!event) continue;
@@ -81,7 +150,19 @@ void *worker(void *data)
                         &queue_props, 0);
 
         if (queue_props & CL_QUEUE_PROFILING_ENABLE)
-            event->updateTiming(Event::Start);
+        {
+            cl_ulong start = event->updateTiming(Event::Start);
+
+            // The kernels fused in this one start with it
+            if (t == Event::NDRangeKernel)
+            {
+                const std::vector<KernelEvent *> &fused =
+                    ((KernelEvent *)event)->fusedEvents();
+
+                for (size_t i=0; i<fused.size(); ++i)
+                    fused[i]->updateTiming(Event::Start, start);
+            }
+        }
 
         // Execute the action
         switch (t)
@@ -93,6 +174,16 @@ void *worker(void *data)
                 CPUBuffer *buf = (CPUBuffer *)e->buffer()->deviceBuffer(device);
                 char *data = (char *)buf->data();
 
+                if (t == Event::WriteBuffer)
+                    buf->prepareWrite();
+
+                if (isParallelTransfer(event))
+                {
+                    // Copy a chunk of a large transfer
+                    ((CPUTransferEvent *)e->deviceData())->copyChunk();
+                    break;
+                }
+
                 data += e->offset();
 
                 if (t == Event::ReadBuffer)
@@ -108,7 +199,16 @@ void *worker(void *data)
                 CPUBuffer *src = (CPUBuffer *)e->source()->deviceBuffer(device);
                 CPUBuffer *dst = (CPUBuffer *)e->destination()->deviceBuffer(device);
 
-                std::memcpy(dst->data(), src->data(), e->cb());
+                dst->prepareWrite();
+
+                if (isParallelTransfer(event))
+                {
+                    ((CPUTransferEvent *)e->deviceData())->copyChunk();
+                    break;
+                }
+
+                std::memcpy((char *)dst->data() + e->dst_offset(),
+                            (char *)src->data() + e->src_offset(), e->cb());
 
                 break;
             }
@@ -125,6 +225,8 @@ void *worker(void *data)
                 ReadWriteCopyBufferRectEvent *e = (ReadWriteCopyBufferRectEvent *)event;
                 CPUBuffer *src_buf = (CPUBuffer *)e->source()->deviceBuffer(device);
 
+                CPUBuffer *dst_buf = 0;
+
                 unsigned char *src = (unsigned char *)src_buf->data();
                 unsigned char *dst;
 
@@ -136,10 +238,11 @@ void *worker(void *data)
                     case Event::CopyBufferToImage:
                     {
                         CopyBufferRectEvent *cbre = (CopyBufferRectEvent *)e;
-                        CPUBuffer *dst_buf =
+                        dst_buf =
                             (CPUBuffer *)cbre->destination()->deviceBuffer(device);
 
                         dst = (unsigned char *)dst_buf->data();
+                        dst_buf->prepareWrite();
                         break;
                     }
                     default:
@@ -148,61 +251,158 @@ void *worker(void *data)
                         ReadWriteBufferRectEvent *rwbre = (ReadWriteBufferRectEvent *)e;
 
                         dst = (unsigned char *)rwbre->ptr();
+
+                        if (t == Event::WriteBufferRect || t == Event::WriteImage)
+                            src_buf->prepareWrite();
                     }
                 }
 
-                // Iterate over the lines to copy and use memcpy
-                for (size_t z=0; z<e->region(2); ++z)
+                CPURect rect;
+
+                if (isParallelTransfer(event))
                 {
-                    for (size_t y=0; y<e->region(1); ++y)
-                    {
-                        unsigned char *s;
-                        unsigned char *d;
-
-                        d = imageData(dst,
-                                      e->dst_origin(0),
-                                      y + e->dst_origin(1),
-                                      z + e->dst_origin(2),
-                                      e->dst_row_pitch(),
-                                      e->dst_slice_pitch(),
-                                      1);
-
-                        s = imageData(src,
-                                      e->src_origin(0),
-                                      y + e->src_origin(1),
-                                      z + e->src_origin(2),
-                                      e->src_row_pitch(),
-                                      e->src_slice_pitch(),
-                                      1);
-
-                        // Copying and image to a buffer may need to add an offset
-                        // to the buffer address (its rectangular origin is
-                        // always (0, 0, 0)).
-                        if (t == Event::CopyBufferToImage)
-                        {
-                            CopyBufferToImageEvent *cptie = (CopyBufferToImageEvent *)e;
-                            s += cptie->offset();
-                        }
-                        else if (t == Event::CopyImageToBuffer)
-                        {
-                            CopyImageToBufferEvent *citbe = (CopyImageToBufferEvent *)e;
-                            d += citbe->offset();
-                        }
+                    // Copy a block of rows of a large region
+                    ((CPUTransferEvent *)e->deviceData())->copyChunk();
+                    break;
+                }
+                else if (rectTransfer(event, device, rect))
+                {
+                    copyRect(rect, false);
+                    break;
+                }
 
-                        if (t == Event::WriteBufferRect || t == Event::WriteImage)
-                            std::memcpy(s, d, e->region(0)); // Write dest (memory) in src
-                        else
-                            std::memcpy(d, s, e->region(0)); // Write src (buffer) in dest (memory), or copy the buffers
-                    }
+                // Tiled images are converted from/to the linear layout
+                RectSide s_side, d_side;
+                MemObject *image = e->source();
+
+                s_side.buf = src_buf;
+                d_side.buf = dst_buf;
+
+                for (unsigned int i=0; i<3; ++i)
+                {
+                    s_side.origin[i] = e->src_origin(i);
+                    d_side.origin[i] = e->dst_origin(i);
+                }
+
+                s_side.row_pitch = e->src_row_pitch();
+                s_side.slice_pitch = e->src_slice_pitch();
+                d_side.row_pitch = e->dst_row_pitch();
+                d_side.slice_pitch = e->dst_slice_pitch();
+
+                s_side.linear = imageData(src, s_side.origin[0],
+                                          s_side.origin[1], s_side.origin[2],
+                                          s_side.row_pitch, s_side.slice_pitch, 1);
+                d_side.linear = imageData(dst, d_side.origin[0],
+                                          d_side.origin[1], d_side.origin[2],
+                                          d_side.row_pitch, d_side.slice_pitch, 1);
+
+                if (t == Event::CopyBufferToImage)
+                {
+                    s_side.linear += ((CopyBufferToImageEvent *)e)->offset();
+                    image = ((CopyBufferRectEvent *)e)->destination();
+                }
+                else if (t == Event::CopyImageToBuffer)
+                {
+                    d_side.linear += ((CopyImageToBufferEvent *)e)->offset();
                 }
 
+                size_t region[3] = {e->region(0), e->region(1), e->region(2)};
+                size_t pixel_size = ((Image2D *)image)->pixel_size();
+
+                if (t == Event::WriteImage)
+                    tiledRectCopy(d_side, s_side, region, pixel_size);
+                else
+                    tiledRectCopy(s_side, d_side, region, pixel_size);
+
+                break;
+            }
+            case Event::FillBuffer:
+            case Event::FillImage:
+            {
+                BufferEvent *e = (BufferEvent *)event;
+                CPUBuffer *buf = (CPUBuffer *)e->buffer()->deviceBuffer(device);
+
+                buf->prepareWrite();
+
+                if (isParallelTransfer(event))
+                {
+                    ((CPUTransferEvent *)e->deviceData())->copyChunk();
+                    break;
+                }
+
+                if (t == Event::FillBuffer)
+                {
+                    // Zeroing a large buffer gives its pages back to the
+                    // system, they read as zero until written again
+                    FillBufferEvent *fbe = (FillBufferEvent *)e;
+
+                    if (fbe->zero() && buf->zeroPages(fbe->offset(), fbe->cb()))
+                        break;
+                }
+
+                CPURect rect;
+                unsigned char pattern[FillBufferEvent::max_pattern_size];
+                size_t pattern_size;
+
+                if (fillTransfer(event, device, rect, pattern, pattern_size))
+                {
+                    fillRect(rect, pattern, pattern_size, false);
+                    break;
+                }
+
+                // Tiled image, fill a row of pixels and copy it in every row
+                // of the region
+                FillImageEvent *fie = (FillImageEvent *)e;
+                size_t origin[3], region[3];
+
+                for (unsigned int i=0; i<3; ++i)
+                {
+                    origin[i] = fie->origin(i);
+                    region[i] = fie->region(i);
+                }
+
+                size_t row_size = region[0] * pattern_size;
+                unsigned char *row = (unsigned char *)std::malloc(row_size);
+
+                if (!row)
+                {
+                    errcode = CL_OUT_OF_HOST_MEMORY;
+                    break;
+                }
+
+                fillMemory(row, row_size, pattern, pattern_size, false);
+                buf->tiledCopy(row, 0, 0, origin, region, true);
+
+                std::free(row);
                 break;
             }
             case Event::MapBuffer:
-            case Event::MapImage:
                 // All was already done in CPUBuffer::initEventDeviceData()
                 break;
 
+            case Event::MapImage:
+            {
+                // Tiled images are mapped in a staging area that has to be
+                // filled, the rest was done in CPUBuffer::initEventDeviceData()
+                MapImageEvent *e = (MapImageEvent *)event;
+                CPUBuffer *buf = (CPUBuffer *)e->buffer()->deviceBuffer(device);
+
+                if (buf->tiled())
+                    buf->fillMapping(e->ptr());
+
+                break;
+            }
+            case Event::UnmapMemObject:
+            {
+                UnmapBufferEvent *e = (UnmapBufferEvent *)event;
+                CPUBuffer *buf = (CPUBuffer *)e->buffer()->deviceBuffer(device);
+
+                if (buf->tiled())
+                    buf->unmapTiled(e->mapping());
+
+                break;
+            }
+
             case Event::NativeKernel:
             {
                 NativeKernelEvent *e = (NativeKernelEvent *)event;
@@ -223,9 +423,36 @@ void *worker(void *data)
                 CPUKernelWorkGroup *instance = ke->takeInstance();
                 ke = 0;     // Unlocked, don't use anymore
 
+                Trace *trace = ((Context *)queue->parent())->trace();
+
+                if (!taken || !trace->enabled())
+                {
+                    if (!instance->run())
+                        errcode = CL_INVALID_PROGRAM_EXECUTABLE;
+
+                    delete instance;
+                    break;
+                }
+
+                // Record the work-group in the trace of the context
+                Trace::Span span;
+
+                span.category = Trace::WorkGroup;
+                span.name = e->kernel()->name();
+                span.work_dim = std::min(e->work_dim(), (cl_uint)3);
+                span.queue_wait = taken - wait_begin;
+
+                for (cl_uint d=0; d<span.work_dim; ++d)
+                    span.group[d] = instance->getGroupID(d);
+
+                span.start = monotonicTime();
+
                 if (!instance->run())
                     errcode = CL_INVALID_PROGRAM_EXECUTABLE;
 
+                span.end = monotonicTime();
+                trace->record(span);
+
                 delete instance;
 
                 break;
@@ -235,36 +462,61 @@ void *worker(void *data)
         }
 
         // Cleanups
+        bool finished = true;
+
         if (errcode == CL_SUCCESS)
         {
-            bool finished = true;
-
             if (event->type() == Event::NDRangeKernel ||
                 event->type() == Event::TaskKernel)
             {
                 CPUKernelEvent *ke = (CPUKernelEvent *)event->deviceData();
                 finished = ke->finished();
             }
-
-            if (finished)
+            else if (isParallelTransfer(event))
             {
-                event->setStatus(Event::Complete);
-
-                if (queue_props & CL_QUEUE_PROFILING_ENABLE)
-                    event->updateTiming(Event::End);
-
-                // Clean the queue
-                if (queue)
-                    queue->cleanEvents();
+                CPUTransferEvent *te = (CPUTransferEvent *)event->deviceData();
+                finished = te->chunkFinished();
             }
         }
-        else
+
+        if (finished)
         {
-            // The event failed
-            event->setStatus((Event::Status)errcode);
+            // The kernels fused in this one end with it. Copy their list, the
+            // event can be released as soon as it is completed.
+            std::vector<KernelEvent *> fused;
+
+            if (t == Event::NDRangeKernel)
+                fused = ((KernelEvent *)event)->fusedEvents();
 
             if (queue_props & CL_QUEUE_PROFILING_ENABLE)
-                    event->updateTiming(Event::End);
+            {
+                cl_ulong end = event->updateTiming(Event::End);
+
+                for (size_t i=0; i<fused.size(); ++i)
+                    fused[i]->updateTiming(Event::End, end);
+            }
+
+            // If the event failed, so did the fused events
+            Event::Status status = (errcode == CL_SUCCESS ?
+                                    Event::Complete : (Event::Status)errcode);
+
+            // Once the events are completed, the application can finish and
+            // release the queue. Keep it alive until its retired events are
+            // released.
+            if (queue)
+                queue->reference();
+
+            event->setStatus(status);
+
+            for (size_t i=0; i<fused.size(); ++i)
+                fused[i]->setStatus(status);
+
+            // Release the retired events of the queue
+            if (queue && errcode == CL_SUCCESS)
+                queue->cleanEvents();
+
+            if (queue && queue->dereference())
+                delete queue;
         }
     }
 
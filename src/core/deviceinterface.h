@@ -132,6 +132,23 @@ class DeviceInterface : public Object
          */
         virtual void pushEvent(Event *event) = 0;
 
+        /**
+         * \brief Push several events on the device at once
+         *
+         * The events are pushed in the order of \p events. Devices can
+         * reimplement this function to wake up their workers only once for
+         * the whole batch, the default implementation calls \c pushEvent()
+         * for each event.
+         *
+         * \param events the events to be pushed
+         * \param count number of events in \p events
+         */
+        virtual void pushEvents(Event **events, size_t count)
+        {
+            for (size_t i=0; i<count; ++i)
+                pushEvent(events[i]);
+        }
+
         /**
          * \brief Initialize device-specific event data
          *
@@ -150,6 +167,27 @@ class DeviceInterface : public Object
          */
         virtual cl_int initEventDeviceData(Event *event) = 0;
 
+        /**
+         * \brief Initialize device-specific data of a replayed event
+         *
+         * Called instead of \c initEventDeviceData() for an event queued by
+         * a \c Coal::CommandBuffer. \p prototype is the recorded event
+         * \p event is a copy of, whose data was initialized once by
+         * \c initEventDeviceData(). Devices can share with \p event what
+         * doesn't change between replays, the default implementation calls
+         * \c initEventDeviceData().
+         *
+         * \param event the event for which data can be set
+         * \param prototype recorded event of the same type, never pushed
+         * \return CL_SUCCESS in case of success
+         */
+        virtual cl_int initReplayedEventDeviceData(Event *event, Event *prototype)
+        {
+            (void)prototype;
+
+            return initEventDeviceData(event);
+        }
+
         /**
          * \brief Free device-specific event data
          *
@@ -175,9 +213,11 @@ class DeviceBuffer
 
         /**
          * \brief Allocate the buffer on the device
+         * \param discard the whole contents of the buffer will be overwritten,
+         *        they don't need to be initialized from the host pointer
          * \return true when success, false otherwise
          */
-        virtual bool allocate() = 0;
+        virtual bool allocate(bool discard) = 0;
 
         /**
          * \brief \c Coal::DeviceInterface of this buffer
@@ -320,6 +360,29 @@ class DeviceKernel
          */
         virtual size_t guessWorkGroupSize(cl_uint num_dims, cl_uint dim,
                                           size_t global_work_size) const = 0;
+
+        /**
+         * \brief How a work-item accesses a buffer argument of the kernel
+         */
+        struct ArgAccess
+        {
+            bool read;              /*!< \brief The buffer may be read */
+            bool written;           /*!< \brief The buffer may be written */
+            size_t element_size;    /*!< \brief If not 0, the work-item of global id \c i only accesses the \c i th element of this size */
+        };
+
+        /**
+         * \brief Accesses of the kernel to its arguments
+         *
+         * This function is used to decide whether kernels can be fused, see
+         * \c Coal::KernelEvent::fuse(). Devices not able to run fused kernels
+         * don't need to reimplement it.
+         *
+         * \return an \c ArgAccess for each argument of the kernel, or 0 if
+         *         they are unknown or the kernel cannot be fused (it calls
+         *         \c barrier() for instance)
+         */
+        virtual const ArgAccess *argAccesses() { return 0; }
 };
 
 }
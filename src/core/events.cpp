@@ -32,7 +32,9 @@
 
 #include "events.h"
 #include "commandqueue.h"
+#include "context.h"
 #include "memobject.h"
+#include "mempool.h"
 #include "kernel.h"
 #include "deviceinterface.h"
 
@@ -50,7 +52,8 @@ BufferEvent::BufferEvent(CommandQueue *parent,
                          MemObject *buffer,
                          cl_uint num_events_in_wait_list,
                          const Event **event_wait_list,
-                         cl_int *errcode_ret)
+                         cl_int *errcode_ret,
+                         bool discard)
 : Event(parent, Queued, num_events_in_wait_list, event_wait_list, errcode_ret),
   p_buffer(buffer)
 {
@@ -90,7 +93,7 @@ BufferEvent::BufferEvent(CommandQueue *parent,
     }
 
     // Allocate the buffer for the device
-    if (!buffer->allocate(device))
+    if (!buffer->allocate(device, discard))
     {
         *errcode_ret = CL_MEM_OBJECT_ALLOCATION_FAILURE;
         return;
@@ -111,18 +114,16 @@ bool BufferEvent::isSubBufferAligned(const MemObject *buffer,
     if (buffer->type() != MemObject::SubBuffer)
         return true;
 
-    rs = device->info(CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(uint),
+    rs = device->info(CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint),
                       &align, 0);
 
     if (rs != CL_SUCCESS)
         return false;
 
-    size_t mask = 0;
-
-    for (cl_uint i=0; i<align; ++i)
-        mask = 1 | (mask << 1);
+    // The alignment is given in bits
+    align /= 8;
 
-    if (((SubBuffer *)buffer)->offset() & mask)
+    if (align > 1 && ((SubBuffer *)buffer)->offset() % align != 0)
         return false;
 
     return true;
@@ -204,6 +205,51 @@ Event::Type WriteBufferEvent::type() const
     return Event::WriteBuffer;
 }
 
+/*
+ * Map flags
+ */
+
+static bool validMapFlags(cl_map_flags map_flags)
+{
+    if (map_flags & ~(CL_MAP_READ | CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION))
+        return false;
+
+    // Invalidating a region excludes reading or writing it
+    if ((map_flags & CL_MAP_WRITE_INVALIDATE_REGION) &&
+        (map_flags & (CL_MAP_READ | CL_MAP_WRITE)))
+        return false;
+
+    return true;
+}
+
+// Whether a map invalidates the whole buffer, that doesn't need to be
+// initialized if not yet allocated. Invalid flags invalidate nothing, the
+// buffer is allocated with its contents before the map is rejected.
+static bool invalidatesBuffer(MemObject *buffer, cl_map_flags map_flags,
+                              size_t offset, size_t cb)
+{
+    return buffer && validMapFlags(map_flags) &&
+           (map_flags & CL_MAP_WRITE_INVALIDATE_REGION) &&
+           offset == 0 && cb == buffer->size();
+}
+
+static bool invalidatesImage(Image2D *image, cl_map_flags map_flags,
+                             const size_t origin[3], const size_t region[3])
+{
+    if (!image || !origin || !region || !validMapFlags(map_flags) ||
+        !(map_flags & CL_MAP_WRITE_INVALIDATE_REGION))
+        return false;
+
+    size_t depth = 1;
+
+    if (image->type() == MemObject::Image3D)
+        depth = ((Image3D *)image)->depth();
+
+    return origin[0] == 0 && origin[1] == 0 && origin[2] == 0 &&
+           region[0] == image->width() && region[1] == image->height() &&
+           region[2] == depth;
+}
+
 MapBufferEvent::MapBufferEvent(CommandQueue *parent,
                                MemObject *buffer,
                                size_t offset,
@@ -212,13 +258,14 @@ MapBufferEvent::MapBufferEvent(CommandQueue *parent,
                                cl_uint num_events_in_wait_list,
                                const Event **event_wait_list,
                                cl_int *errcode_ret)
-: BufferEvent(parent, buffer, num_events_in_wait_list, event_wait_list, errcode_ret),
+: BufferEvent(parent, buffer, num_events_in_wait_list, event_wait_list,
+              errcode_ret, invalidatesBuffer(buffer, map_flags, offset, cb)),
   p_offset(offset), p_cb(cb), p_map_flags(map_flags)
 {
     if (*errcode_ret != CL_SUCCESS) return;
 
     // Check flags
-    if (map_flags & ~(CL_MAP_READ | CL_MAP_WRITE))
+    if (!validMapFlags(map_flags))
     {
         *errcode_ret = CL_INVALID_VALUE;
         return;
@@ -270,12 +317,14 @@ MapImageEvent::MapImageEvent(CommandQueue *parent,
                              cl_uint num_events_in_wait_list,
                              const Event **event_wait_list,
                              cl_int *errcode_ret)
-: BufferEvent (parent, image, num_events_in_wait_list, event_wait_list, errcode_ret)
+: BufferEvent (parent, image, num_events_in_wait_list, event_wait_list,
+               errcode_ret, invalidatesImage(image, map_flags, origin, region)),
+  p_map_flags(map_flags)
 {
     if (*errcode_ret != CL_SUCCESS) return;
 
     // Check flags
-    if (map_flags & ~(CL_MAP_READ | CL_MAP_WRITE))
+    if (!validMapFlags(map_flags))
     {
         *errcode_ret = CL_INVALID_VALUE;
         return;
@@ -382,8 +431,9 @@ UnmapBufferEvent::UnmapBufferEvent(CommandQueue *parent,
 {
     if (*errcode_ret != CL_SUCCESS) return;
 
-    // TODO: Check that p_mapping is ok (will be done in the drivers)
-    if (!mapped_addr)
+    // The address must have been returned by a map of this object. It is
+    // only forgotten once the unmap is queued.
+    if (!mapped_addr || !buffer->hasMapping(mapped_addr))
     {
         *errcode_ret = CL_INVALID_VALUE;
         return;
@@ -492,6 +542,93 @@ Event::Type CopyBufferEvent::type() const
     return Event::CopyBuffer;
 }
 
+/*
+ * Fill buffer
+ */
+
+FillBufferEvent::FillBufferEvent(CommandQueue *parent,
+                                 MemObject *buffer,
+                                 const void *pattern,
+                                 size_t pattern_size,
+                                 size_t offset,
+                                 size_t cb,
+                                 cl_uint num_events_in_wait_list,
+                                 const Event **event_wait_list,
+                                 cl_int *errcode_ret)
+: BufferEvent(parent, buffer, num_events_in_wait_list, event_wait_list,
+              errcode_ret), p_pattern_size(pattern_size), p_offset(offset),
+  p_cb(cb)
+{
+    if (*errcode_ret != CL_SUCCESS) return;
+
+    // Images have their own fill command
+    if (buffer->type() != MemObject::Buffer &&
+        buffer->type() != MemObject::SubBuffer)
+    {
+        *errcode_ret = CL_INVALID_MEM_OBJECT;
+        return;
+    }
+
+    // The pattern is a scalar or vector type, its size is a power of two
+    if (!pattern || !pattern_size || pattern_size > max_pattern_size ||
+        (pattern_size & (pattern_size - 1)))
+    {
+        *errcode_ret = CL_INVALID_VALUE;
+        return;
+    }
+
+    // Only whole patterns are written
+    if ((offset % pattern_size) || (cb % pattern_size))
+    {
+        *errcode_ret = CL_INVALID_VALUE;
+        return;
+    }
+
+    // Check for out-of-bounds
+    if (offset + cb > buffer->size())
+    {
+        *errcode_ret = CL_INVALID_VALUE;
+        return;
+    }
+
+    // The application may reuse pattern as soon as the call returns
+    std::memcpy(p_pattern, pattern, pattern_size);
+}
+
+const void *FillBufferEvent::pattern() const
+{
+    return p_pattern;
+}
+
+size_t FillBufferEvent::pattern_size() const
+{
+    return p_pattern_size;
+}
+
+size_t FillBufferEvent::offset() const
+{
+    return p_offset;
+}
+
+size_t FillBufferEvent::cb() const
+{
+    return p_cb;
+}
+
+bool FillBufferEvent::zero() const
+{
+    for (size_t i=0; i<p_pattern_size; ++i)
+        if (p_pattern[i])
+            return false;
+
+    return true;
+}
+
+Event::Type FillBufferEvent::type() const
+{
+    return Event::FillBuffer;
+}
+
 /*
  * Native kernel
  */
@@ -631,7 +768,8 @@ KernelEvent::KernelEvent(CommandQueue *parent,
                          const Event **event_wait_list,
                          cl_int *errcode_ret)
 : Event(parent, Queued, num_events_in_wait_list, event_wait_list, errcode_ret),
-  p_work_dim(work_dim), p_kernel(kernel)
+  p_work_dim(work_dim), p_kernel(kernel), p_fused_into(0),
+  p_fusion_closed(false)
 {
     if (*errcode_ret != CL_SUCCESS) return;
 
@@ -644,29 +782,14 @@ KernelEvent::KernelEvent(CommandQueue *parent,
         return;
     }
 
-    // Check that the kernel was built for parent's device.
-    DeviceInterface *device;
+    // Check that the kernel was built for parent's device. The limits of the
+    // device are cached by the command queue.
+    DeviceInterface *device = parent->device();
+    const DeviceLimits &limits = parent->deviceLimits();
     Context *k_ctx, *q_ctx;
-    size_t max_work_group_size;
-    cl_uint max_dims = 0;
 
-    *errcode_ret = parent->info(CL_QUEUE_DEVICE, sizeof(DeviceInterface *),
-                                &device, 0);
-
-    if (*errcode_ret != CL_SUCCESS)
-        return;
-
-    *errcode_ret = parent->info(CL_QUEUE_CONTEXT, sizeof(Context *), &q_ctx, 0);
-    *errcode_ret |= kernel->info(CL_KERNEL_CONTEXT, sizeof(Context *), &k_ctx, 0);
-    *errcode_ret |= device->info(CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t),
-                                &max_work_group_size, 0);
-    *errcode_ret |= device->info(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(size_t),
-                                &max_dims, 0);
-    *errcode_ret |= device->info(CL_DEVICE_MAX_WORK_ITEM_SIZES,
-                                max_dims * sizeof(size_t), p_max_work_item_sizes, 0);
-
-    if (*errcode_ret != CL_SUCCESS)
-        return;
+    q_ctx = (Context *)parent->parent();
+    k_ctx = (Context *)kernel->parent()->parent();
 
     p_dev_kernel = kernel->deviceDependentKernel(device);
 
@@ -691,7 +814,7 @@ KernelEvent::KernelEvent(CommandQueue *parent,
     }
 
     // Check dimension
-    if (work_dim == 0 || work_dim > max_dims)
+    if (work_dim == 0 || work_dim > limits.max_work_item_dimensions)
     {
         *errcode_ret = CL_INVALID_WORK_DIMENSION;
         return;
@@ -714,6 +837,7 @@ KernelEvent::KernelEvent(CommandQueue *parent,
         if (!global_work_size || !global_work_size[i])
         {
             *errcode_ret = CL_INVALID_GLOBAL_WORK_SIZE;
+            return;
         }
         p_global_work_size[i] = global_work_size[i];
 
@@ -736,7 +860,7 @@ KernelEvent::KernelEvent(CommandQueue *parent,
             }
 
             // Not too big ?
-            if (local_work_size[i] > p_max_work_item_sizes[i])
+            if (local_work_size[i] > limits.max_work_item_sizes[i])
             {
                 *errcode_ret = CL_INVALID_WORK_ITEM_SIZE;
                 return;
@@ -751,7 +875,7 @@ KernelEvent::KernelEvent(CommandQueue *parent,
     }
 
     // Check we don't ask too much to the device
-    if (work_group_size > max_work_group_size)
+    if (work_group_size > limits.max_work_group_size)
     {
         *errcode_ret = CL_INVALID_WORK_GROUP_SIZE;
         return;
@@ -775,17 +899,9 @@ KernelEvent::KernelEvent(CommandQueue *parent,
         else if (a.kind() == Kernel::Arg::Image2D)
         {
             const Image2D *image = *(const Image2D **)(a.value(0));
-            size_t maxWidth, maxHeight;
-
-            *errcode_ret = device->info(CL_DEVICE_IMAGE2D_MAX_WIDTH,
-                                        sizeof(size_t), &maxWidth, 0);
-            *errcode_ret |= device->info(CL_DEVICE_IMAGE2D_MAX_HEIGHT,
-                                         sizeof(size_t), &maxHeight, 0);
 
-            if (*errcode_ret != CL_SUCCESS)
-                return;
-
-            if (image->width() > maxWidth || image->height() > maxHeight)
+            if (image->width() > limits.image2d_max_width ||
+                image->height() > limits.image2d_max_height)
             {
                 *errcode_ret = CL_INVALID_IMAGE_SIZE;
                 return;
@@ -794,20 +910,10 @@ KernelEvent::KernelEvent(CommandQueue *parent,
         else if (a.kind() == Kernel::Arg::Image3D)
         {
             const Image3D *image = *(const Image3D **)a.value(0);
-            size_t maxWidth, maxHeight, maxDepth;
-
-            *errcode_ret = device->info(CL_DEVICE_IMAGE3D_MAX_WIDTH,
-                                        sizeof(size_t), &maxWidth, 0);
-            *errcode_ret |= device->info(CL_DEVICE_IMAGE3D_MAX_HEIGHT,
-                                         sizeof(size_t), &maxHeight, 0);
-            *errcode_ret |= device->info(CL_DEVICE_IMAGE3D_MAX_DEPTH,
-                                         sizeof(size_t), &maxDepth, 0);
 
-            if (*errcode_ret != CL_SUCCESS)
-                return;
-
-            if (image->width() > maxWidth || image->height() > maxHeight ||
-                image->depth() > maxDepth)
+            if (image->width() > limits.image3d_max_width ||
+                image->height() > limits.image3d_max_height ||
+                image->depth() > limits.image3d_max_depth)
             {
                 *errcode_ret = CL_INVALID_IMAGE_SIZE;
                 return;
@@ -816,6 +922,33 @@ KernelEvent::KernelEvent(CommandQueue *parent,
     }
 }
 
+KernelEvent::KernelEvent(CommandQueue *parent,
+                         const KernelEvent *prototype,
+                         cl_uint num_events_in_wait_list,
+                         const Event **event_wait_list,
+                         cl_int *errcode_ret)
+: Event(parent, Queued, num_events_in_wait_list, event_wait_list, errcode_ret),
+  p_work_dim(prototype->p_work_dim), p_kernel(prototype->p_kernel),
+  p_dev_kernel(prototype->p_dev_kernel), p_fused_into(0),
+  p_fusion_closed(false)
+{
+    const size_t len = p_work_dim * sizeof(size_t);
+
+    std::memcpy(p_global_work_offset, prototype->p_global_work_offset, len);
+    std::memcpy(p_global_work_size, prototype->p_global_work_size, len);
+    std::memcpy(p_local_work_size, prototype->p_local_work_size, len);
+}
+
+void *KernelEvent::operator new(size_t size) throw()
+{
+    return MemoryPool::eventPool().allocate(size);
+}
+
+void KernelEvent::operator delete(void *ptr, size_t size)
+{
+    MemoryPool::eventPool().release(ptr, size);
+}
+
 KernelEvent::~KernelEvent()
 {
 
@@ -856,6 +989,32 @@ Event::Type KernelEvent::type() const
     return Event::NDRangeKernel;
 }
 
+void KernelEvent::fuse(KernelEvent *event)
+{
+    p_fused.push_back(event);
+    event->p_fused_into = this;
+}
+
+const std::vector<KernelEvent *> &KernelEvent::fusedEvents() const
+{
+    return p_fused;
+}
+
+KernelEvent *KernelEvent::fusedInto() const
+{
+    return p_fused_into;
+}
+
+void KernelEvent::closeFusion()
+{
+    p_fusion_closed = true;
+}
+
+bool KernelEvent::fusionClosed() const
+{
+    return p_fusion_closed;
+}
+
 static size_t one = 1;
 
 TaskEvent::TaskEvent(CommandQueue *parent,
@@ -892,25 +1051,6 @@ Context *UserEvent::context() const
     return p_context;
 }
 
-void UserEvent::addDependentCommandQueue(CommandQueue *queue)
-{
-    std::vector<CommandQueue *>::const_iterator it;
-
-    for (it = p_dependent_queues.begin(); it != p_dependent_queues.end(); ++it)
-        if (*it == queue)
-            return;
-
-    p_dependent_queues.push_back(queue);
-}
-
-void UserEvent::flushQueues()
-{
-    std::vector<CommandQueue *>::const_iterator it;
-
-    for (it = p_dependent_queues.begin(); it != p_dependent_queues.end(); ++it)
-        (*it)->pushEventsOnDevice();
-}
-
 /*
  * ReadWriteBufferRectEvent
  */
@@ -1447,6 +1587,74 @@ Event::Type CopyBufferToImageEvent::type() const
     return Event::CopyBufferToImage;
 }
 
+FillImageEvent::FillImageEvent(CommandQueue *parent,
+                               Image2D *image,
+                               const void *fill_color,
+                               const size_t origin[3],
+                               const size_t region[3],
+                               cl_uint num_events_in_wait_list,
+                               const Event **event_wait_list,
+                               cl_int *errcode_ret)
+: BufferEvent(parent, image, num_events_in_wait_list, event_wait_list,
+              errcode_ret)
+{
+    if (*errcode_ret != CL_SUCCESS) return;
+
+    if (!fill_color || !origin || !region)
+    {
+        *errcode_ret = CL_INVALID_VALUE;
+        return;
+    }
+
+    for (unsigned int i=0; i<3; ++i)
+    {
+        if (!region[i])
+        {
+            *errcode_ret = CL_INVALID_VALUE;
+            return;
+        }
+
+        p_origin[i] = origin[i];
+        p_region[i] = region[i];
+    }
+
+    size_t depth = 1;
+
+    if (image->type() == MemObject::Image3D)
+        depth = ((Image3D *)image)->depth();
+
+    // Check for out-of-bounds
+    if (origin[0] + region[0] > image->width() ||
+        origin[1] + region[1] > image->height() ||
+        origin[2] + region[2] > depth)
+    {
+        *errcode_ret = CL_INVALID_VALUE;
+        return;
+    }
+
+    std::memcpy(p_fill_color, fill_color, sizeof(p_fill_color));
+}
+
+const void *FillImageEvent::fill_color() const
+{
+    return p_fill_color;
+}
+
+size_t FillImageEvent::origin(unsigned int index) const
+{
+    return p_origin[index];
+}
+
+size_t FillImageEvent::region(unsigned int index) const
+{
+    return p_region[index];
+}
+
+Event::Type FillImageEvent::type() const
+{
+    return Event::FillImage;
+}
+
 /*
  * Barrier
  */
@@ -53,11 +53,19 @@ class DeviceInterface;
 class BufferEvent : public Event
 {
     public:
+        /**
+         * \brief Constructor
+         *
+         * \p buffer is allocated on the device of \p parent. If \p discard
+         * is true, the event overwrites all of it and its contents are not
+         * initialized (see \c Coal::DeviceBuffer::allocate()).
+         */
         BufferEvent(CommandQueue *parent,
                     MemObject *buffer,
                     cl_uint num_events_in_wait_list,
                     const Event **event_wait_list,
-                    cl_int *errcode_ret);
+                    cl_int *errcode_ret,
+                    bool discard = false);
 
         MemObject *buffer() const; /*!< \brief Buffer on which to operate */
 
@@ -286,6 +294,41 @@ class CopyBufferEvent : public BufferEvent
         size_t p_src_offset, p_dst_offset, p_cb;
 };
 
+/**
+ * \brief Filling a buffer with a pattern
+ */
+class FillBufferEvent : public BufferEvent
+{
+    public:
+        FillBufferEvent(CommandQueue *parent,
+                        MemObject *buffer,
+                        const void *pattern,
+                        size_t pattern_size,
+                        size_t offset,
+                        size_t cb,
+                        cl_uint num_events_in_wait_list,
+                        const Event **event_wait_list,
+                        cl_int *errcode_ret);
+
+        Type type() const; /*!< \brief Say the event is a \c Coal::Event::FillBuffer one */
+
+        const void *pattern() const; /*!< \brief Pattern repeated in the buffer, copied at the creation of the event */
+        size_t pattern_size() const; /*!< \brief Size of the pattern, a power of two up to \c max_pattern_size */
+        size_t offset() const;       /*!< \brief Offset in the buffer at which the fill begins, in bytes */
+        size_t cb() const;           /*!< \brief Number of bytes to fill */
+
+        /**
+         * \brief Whether the pattern is only made of zeroes
+         */
+        bool zero() const;
+
+        static const size_t max_pattern_size = 128; /*!< \brief Largest pattern, the size of a \c double16 */
+
+    private:
+        unsigned char p_pattern[max_pattern_size];
+        size_t p_pattern_size, p_offset, p_cb;
+};
+
 /**
  * \brief Events related to rectangular (or cubic) memory regions
  * 
@@ -551,6 +594,38 @@ class CopyBufferToImageEvent : public CopyBufferRectEvent
         size_t p_offset;
 };
 
+/**
+ * \brief Filling a region of an image with a color
+ */
+class FillImageEvent : public BufferEvent
+{
+    public:
+        FillImageEvent(CommandQueue *parent,
+                       Image2D *image,
+                       const void *fill_color,
+                       const size_t origin[3],
+                       const size_t region[3],
+                       cl_uint num_events_in_wait_list,
+                       const Event **event_wait_list,
+                       cl_int *errcode_ret);
+
+        Type type() const; /*!< \brief Say the event is a \c Coal::Event::FillImage one */
+
+        /**
+         * \brief Color with which the region is filled
+         *
+         * Four \c float, \c int or \c unsigned \c int depending on the
+         * channel data type of the image, as read and written by the kernels.
+         */
+        const void *fill_color() const;
+        size_t origin(unsigned int index) const; /*!< \brief Origin of the region for the \p index dimension, in pixels */
+        size_t region(unsigned int index) const; /*!< \brief Size of the region for the \p index dimension, in pixels */
+
+    private:
+        unsigned char p_fill_color[16];
+        size_t p_origin[3], p_region[3];
+};
+
 /**
  * \brief Executing a native function as a kernel
  * 
@@ -599,6 +674,24 @@ class KernelEvent : public Event
                     cl_uint num_events_in_wait_list,
                     const Event **event_wait_list,
                     cl_int *errcode_ret);
+
+        /**
+         * \brief Copy an already validated kernel event
+         *
+         * Used by \c Coal::CommandBuffer to queue again a recorded kernel,
+         * without checking the kernel and its work sizes again.
+         *
+         * \param parent command queue of \p prototype
+         * \param prototype recorded event, never queued
+         * \param num_events_in_wait_list number of events in \p event_wait_list
+         * \param event_wait_list events this one waits for
+         * \param errcode_ret return code (\c CL_SUCCESS if all is good)
+         */
+        KernelEvent(CommandQueue *parent,
+                    const KernelEvent *prototype,
+                    cl_uint num_events_in_wait_list,
+                    const Event **event_wait_list,
+                    cl_int *errcode_ret);
         ~KernelEvent();
 
         cl_uint work_dim() const;                     /*!< \brief Number of working dimensions */
@@ -610,14 +703,53 @@ class KernelEvent : public Event
 
         virtual Type type() const;                    /*!< \brief Say the event is a \c Coal::Event::NDRangeKernel one */
 
+        /**
+         * \name Kernel fusion
+         *
+         * A \c Coal::CommandQueue having the \c CL_QUEUE_KERNEL_FUSION_CLOVER
+         * property can fuse a kernel in the previous one, when it consumes
+         * what this one produces. The fused kernels are run by the device
+         * with this event, on the same work-items, and are completed with it.
+         *
+         * These functions are called with the mutex of the command queue
+         * locked. Once this event is submitted, \c fusionClosed() is true and
+         * \c fusedEvents() doesn't change anymore.
+         * @{
+         */
+        void fuse(KernelEvent *event);                /*!< \brief Run \p event with this one, after the already fused events */
+        const std::vector<KernelEvent *> &fusedEvents() const; /*!< \brief Events fused in this one, in the order they were queued */
+        KernelEvent *fusedInto() const;               /*!< \brief Event in which this one is fused, 0 if none */
+        void closeFusion();                           /*!< \brief Don't accept fused events anymore */
+        bool fusionClosed() const;                    /*!< \brief The event is submitted, nothing can be fused in it */
+        /**
+         * @}
+         */
+
+        /**
+         * \name Allocation of kernel events
+         *
+         * Applications can queue tens of thousands of kernels per second. The
+         * memory of the kernel events is taken from a pool instead of the
+         * system allocator. \c new returns 0 when the pool is exhausted.
+         * @{
+         */
+        static void *operator new(size_t size) throw();
+        static void operator delete(void *ptr, size_t size);
+        /**
+         * @}
+         */
+
     private:
         cl_uint p_work_dim;
         size_t p_global_work_offset[MAX_WORK_DIMS],
                p_global_work_size[MAX_WORK_DIMS],
-               p_local_work_size[MAX_WORK_DIMS],
-               p_max_work_item_sizes[MAX_WORK_DIMS];
+               p_local_work_size[MAX_WORK_DIMS];
         Kernel *p_kernel;
         DeviceKernel *p_dev_kernel;
+
+        std::vector<KernelEvent *> p_fused;
+        KernelEvent *p_fused_into;
+        bool p_fusion_closed;
 };
 
 /**
@@ -648,13 +780,12 @@ class TaskEvent : public KernelEvent
  * \brief User event
  * 
  * This event is a bit special as it is created by a call to 
- * \c clCreateUserEvent() and doesn't belong to an event queue. Thus, a mean had
- * to be found for all to work.
+ * \c clCreateUserEvent() and doesn't belong to an event queue.
  * 
- * The solution is the \c addDependentCommandQueue() function, called every time
- * the user event is added to a command queue. When this event becomes completed,
- * \c flushQueues() is called to allow all the \c Coal::CommandQueue objects
- * containing this event to push more events on their device.
+ * The events waiting on it are registered as its successors (see
+ * \c Coal::Event::addSuccessor()), like for any other event. When it becomes
+ * completed, they are submitted to their command queue if it was their last
+ * dependency.
  * 
  * This way, command queues are not blocked by user events.
  */
@@ -665,20 +796,9 @@ class UserEvent : public Event
 
         Type type() const;        /*!< \brief Say the event is a \c Coal::Event::User one */
         Context *context() const; /*!< \brief Context of this event */
-        void flushQueues();       /*!< \brief Call \c Coal::CommandQueue::pushEventsOnDevice() for each command queue in which this event is queued */
-        
-        /**
-         * \brief Add a \c Coal::CommandQueue that will have to be flushed when this event becomes completed
-         * 
-         * See the long description of this class for a complete explanation
-         * 
-         * \param queue \c Coal::CommandQueue to add in the list of queues to flush
-         */
-        void addDependentCommandQueue(CommandQueue *queue);
 
     private:
         Context *p_context;
-        std::vector<CommandQueue *> p_dependent_queues;
 };
 
 /**
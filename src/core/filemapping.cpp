@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file filemapping.cpp
+ * \brief Memory mapping of a file region
+ */
+
+#include "filemapping.h"
+
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+
+using namespace Coal;
+
+static size_t pageSize()
+{
+    static size_t page_size = sysconf(_SC_PAGESIZE);
+
+    return page_size;
+}
+
+FileMapping *FileMapping::create(int fd, cl_ulong offset, size_t size,
+                                 bool shared, bool populate,
+                                 cl_int *errcode_ret)
+{
+    struct stat st;
+
+    if (fd < 0 || !size || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        *errcode_ret = CL_INVALID_VALUE;
+        return 0;
+    }
+
+    // Pages past the end of the file cannot be accessed
+    if (offset + size > (cl_ulong)st.st_size)
+    {
+        *errcode_ret = CL_INVALID_BUFFER_SIZE;
+        return 0;
+    }
+
+    // mmap() only maps whole pages
+    size_t delta = offset & (pageSize() - 1);
+    size_t length = size + delta;
+    int flags = (shared ? MAP_SHARED : MAP_PRIVATE);
+
+#ifdef MAP_POPULATE
+    if (populate)
+        flags |= MAP_POPULATE;
+#else
+    (void)populate;
+#endif
+
+    void *base = mmap(0, length, PROT_READ | PROT_WRITE, flags, fd,
+                      offset - delta);
+
+    if (base == MAP_FAILED)
+    {
+        // EACCES: shared mapping of a file not opened for writing
+        *errcode_ret = (errno == ENOMEM ? CL_OUT_OF_HOST_MEMORY
+                                        : CL_INVALID_VALUE);
+        return 0;
+    }
+
+    *errcode_ret = CL_SUCCESS;
+
+    return new FileMapping(base, length, delta, size);
+}
+
+FileMapping::FileMapping(void *base, size_t length, size_t delta, size_t size)
+: p_base(base), p_length(length), p_data((unsigned char *)base + delta),
+  p_size(size)
+{
+}
+
+FileMapping::~FileMapping()
+{
+    munmap(p_base, p_length);
+}
+
+void *FileMapping::data() const
+{
+    return p_data;
+}
+
+size_t FileMapping::size() const
+{
+    return p_size;
+}
+
+void FileMapping::adviseSequential()
+{
+    madvise(p_base, p_length, MADV_SEQUENTIAL);
+}
+
+void FileMapping::prefetch(size_t offset, size_t size)
+{
+    if (offset >= p_size)
+        return;
+
+    if (offset + size > p_size)
+        size = p_size - offset;
+
+    // madvise() wants an address aligned on a page
+    uintptr_t start = (uintptr_t)(p_data + offset);
+    uintptr_t aligned = start & ~(uintptr_t)(pageSize() - 1);
+
+    madvise((void *)aligned, size + (start - aligned), MADV_WILLNEED);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file filemapping.h
+ * \brief Memory mapping of a file region
+ */
+
+#ifndef __FILEMAPPING_H__
+#define __FILEMAPPING_H__
+
+#include <CL/cl.h>
+
+#include <cstddef>
+
+namespace Coal
+{
+
+/**
+ * \brief Memory mapping of a file region
+ *
+ * Buffers created by \c clCreateBufferFromFileCLOVER() use the mapping as
+ * their host pointer, so kernels read the file straight from the page cache
+ * and datasets larger than the RAM can be processed, the kernel paging them
+ * in and out as needed.
+ *
+ * Read-only buffers are private mappings: commands writing them don't
+ * modify the file. The other buffers are shared mappings and write into it.
+ */
+class FileMapping
+{
+    public:
+        /**
+         * \brief Map a file region
+         * \param fd file descriptor, that can be closed once the mapping exists
+         * \param offset offset of the region in the file, in bytes
+         * \param size size of the region, in bytes
+         * \param shared writes into the mapping are written in the file
+         * \param populate read the whole region before returning
+         * \param errcode_ret return code
+         * \return the mapping, 0 in case of error
+         */
+        static FileMapping *create(int fd, cl_ulong offset, size_t size,
+                                   bool shared, bool populate,
+                                   cl_int *errcode_ret);
+        ~FileMapping();
+
+        void *data() const;   /*!< \brief First byte of the region */
+        size_t size() const;  /*!< \brief Size of the region */
+
+        /**
+         * \brief Tell the system that the region is read from start to end
+         *
+         * The system then reads ahead more aggressively and frees the pages
+         * behind the reader sooner.
+         */
+        void adviseSequential();
+
+        /**
+         * \brief Start reading a part of the region in the background
+         * \param offset offset in the region, in bytes
+         * \param size number of bytes to read
+         */
+        void prefetch(size_t offset, size_t size);
+
+    private:
+        FileMapping(void *base, size_t length, size_t delta, size_t size);
+
+        void *p_base;       /*!< \brief Start of the mapping, aligned on a page */
+        size_t p_length;    /*!< \brief Length of the mapping */
+        unsigned char *p_data;
+        size_t p_size;
+};
+
+}
+
+#endif
@@ -0,0 +1,715 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file hostsnapshot.cpp
+ * \brief Copy-on-write snapshot of host memory
+ */
+
+#include "hostsnapshot.h"
+
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/userfaultfd.h>
+#endif
+
+#if defined(MREMAP_DONTUNMAP) && defined(__NR_userfaultfd) && \
+    defined(UFFDIO_COPY) && defined(UFFD_FEATURE_EVENT_UNMAP)
+#define COAL_HOST_SNAPSHOTS
+#endif
+
+using namespace Coal;
+
+#ifdef COAL_HOST_SNAPSHOTS
+
+/*
+ * Page faults in the ranges of the application are handled by a thread
+ * filling the missing pages from the snapshots. The same thread follows the
+ * changes the application makes to its memory: a range is forgotten when it
+ * is unmapped or discarded, moved when it is remapped, and copied in the
+ * forked children.
+ */
+
+struct SnapshotRange
+{
+    uintptr_t host;             /*!< Part of the application memory still missing pages */
+    const unsigned char *data;  /*!< Snapshot of host */
+    size_t size;
+    const void *owner;          /*!< Data of the HostSnapshot, ranges can be split */
+};
+
+/*
+ * The registry of the ranges and the buffer given to mincore() are used while
+ * ranges_mutex is held, and by the fault handler. They live in their own
+ * mappings so that they can never be part of a snapshot: touching them then
+ * would fault, and the fault handler would wait for ranges_mutex.
+ */
+static const size_t chunk_pages = 65536;
+
+static int uffd = -1;
+static pid_t uffd_pid = 0;
+static pthread_once_t uffd_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t ranges_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SnapshotRange *ranges = 0;
+static size_t num_ranges = 0, max_ranges = 0;
+static unsigned char *mincore_vec = 0;
+
+static size_t pageSize()
+{
+    static size_t page_size = sysconf(_SC_PAGESIZE);
+
+    return page_size;
+}
+
+// The userfaultfd belongs to the process that opened it. A forked child
+// shares the file but not the memory, it must not use it.
+static bool snapshotsUsable()
+{
+    return uffd >= 0 && getpid() == uffd_pid;
+}
+
+// Copy the pages of src missing in [dst, dst + len) through fd, skipping the
+// ones already present. dst, src and len are advanced past the pages handled.
+// Returns 0, or the error that stopped the copy: EAGAIN when the memory of
+// the process is changing, any other when the range is not there anymore.
+static int copyPages(int fd, uintptr_t &dst, const unsigned char *&src,
+                     size_t &len)
+{
+    while (len)
+    {
+        struct uffdio_copy copy;
+        size_t done;
+
+        copy.dst = dst;
+        copy.src = (uintptr_t)src;
+        copy.len = len;
+        copy.mode = 0;
+        copy.copy = 0;
+
+        if (ioctl(fd, UFFDIO_COPY, &copy) == 0)
+            done = len;
+        else if (copy.copy > 0)
+            done = copy.copy;
+        else if (errno == EEXIST)
+            done = pageSize();  // Already present
+        else
+            return errno;
+
+        if (done > len)
+            done = len;
+
+        dst += done;
+        src += done;
+        len -= done;
+    }
+
+    return 0;
+}
+
+static void unregisterRange(uintptr_t start, size_t len)
+{
+    struct uffdio_range range;
+
+    if (!len)
+        return;
+
+    range.start = start;
+    range.len = len;
+
+    ioctl(uffd, UFFDIO_UNREGISTER, &range);
+}
+
+// Called with ranges_mutex held
+static bool addRange(const SnapshotRange &range)
+{
+    if (num_ranges == max_ranges)
+    {
+        size_t size = max_ranges * sizeof(SnapshotRange);
+        void *grown = mremap(ranges, size, size * 2, MREMAP_MAYMOVE);
+
+        if (grown == MAP_FAILED)
+            return false;
+
+        ranges = (SnapshotRange *)grown;
+        max_ranges *= 2;
+    }
+
+    ranges[num_ranges++] = range;
+
+    return true;
+}
+
+// Like addRange(), but the pages of the range are given to the application
+// right away if it cannot be kept
+static void keepRange(const SnapshotRange &range)
+{
+    if (addRange(range))
+        return;
+
+    uintptr_t dst = range.host;
+    const unsigned char *src = range.data;
+    size_t len = range.size;
+
+    copyPages(uffd, dst, src, len);
+    unregisterRange(range.host, range.size);
+}
+
+// Take [start, end) out of ranges[i], that must overlap it. What remains
+// before start stays at i, what remains after end is added at the end.
+static void cutRange(size_t i, uintptr_t start, uintptr_t end)
+{
+    SnapshotRange range = ranges[i];
+    uintptr_t range_end = range.host + range.size;
+
+    if (start > range.host)
+        ranges[i].size = start - range.host;
+    else
+        ranges[i] = ranges[--num_ranges];
+
+    if (end < range_end)
+    {
+        SnapshotRange tail;
+
+        tail.host = end;
+        tail.data = range.data + (end - range.host);
+        tail.size = range_end - end;
+        tail.owner = range.owner;
+
+        keepRange(tail);
+    }
+}
+
+static bool overlaps(const SnapshotRange &range, uintptr_t start,
+                     uintptr_t end)
+{
+    return range.host < end && start < range.host + range.size;
+}
+
+// First range overlapping [start, end)
+static const SnapshotRange *findRange(uintptr_t start, uintptr_t end)
+{
+    for (size_t i=0; i<num_ranges; ++i)
+        if (overlaps(ranges[i], start, end))
+            return &ranges[i];
+
+    return 0;
+}
+
+static void handleFault(uintptr_t address)
+{
+    const size_t page = pageSize();
+    const SnapshotRange *range = findRange(address, address + page);
+
+    if (range)
+    {
+        struct uffdio_copy copy;
+
+        copy.dst = address;
+        copy.src = (uintptr_t)(range->data + (address - range->host));
+        copy.len = page;
+        copy.mode = 0;
+
+        if (ioctl(uffd, UFFDIO_COPY, &copy) == 0)
+            return;
+    }
+    else
+    {
+        // Registered memory no snapshot stands behind anymore, as a range
+        // discarded by the application or the source of a MREMAP_DONTUNMAP.
+        // It reads as zeros like any anonymous memory.
+        struct uffdio_zeropage zero;
+
+        zero.range.start = address;
+        zero.range.len = page;
+        zero.mode = 0;
+
+        if (ioctl(uffd, UFFDIO_ZEROPAGE, &zero) == 0)
+            return;
+    }
+
+    // The page was filled meanwhile, or the memory is changing. Let the
+    // faulting thread retry.
+    struct uffdio_range wake;
+
+    wake.start = address;
+    wake.len = page;
+
+    ioctl(uffd, UFFDIO_WAKE, &wake);
+}
+
+// The application unmapped or discarded [start, end)
+static void dropRanges(uintptr_t start, uintptr_t end, bool discarded)
+{
+    for (size_t i=0; i<num_ranges; )
+    {
+        const SnapshotRange &range = ranges[i];
+
+        if (!overlaps(range, start, end))
+        {
+            ++i;
+            continue;
+        }
+
+        uintptr_t cut_start = (start > range.host ? start : range.host);
+        uintptr_t cut_end = (end < range.host + range.size ?
+                             end : range.host + range.size);
+
+        // Discarded pages must read as zeros, not as the snapshot
+        if (discarded)
+            unregisterRange(cut_start, cut_end - cut_start);
+
+        cutRange(i, cut_start, cut_end);
+    }
+}
+
+// The application moved [from, from + len) to to
+static void moveRanges(uintptr_t from, uintptr_t to, size_t len)
+{
+    for (size_t i=0; i<num_ranges; )
+    {
+        const SnapshotRange &range = ranges[i];
+
+        if (!overlaps(range, from, from + len))
+        {
+            ++i;
+            continue;
+        }
+
+        SnapshotRange moved;
+
+        moved.host = (from > range.host ? from : range.host);
+        moved.size = (from + len < range.host + range.size ?
+                      from + len : range.host + range.size) - moved.host;
+        moved.data = range.data + (moved.host - range.host);
+        moved.owner = range.owner;
+
+        // HostSnapshot::create() moving the pages into the snapshot
+        if (to + (moved.host - from) == (uintptr_t)moved.data)
+        {
+            ++i;
+            continue;
+        }
+
+        cutRange(i, moved.host, moved.host + moved.size);
+
+        moved.host = to + (moved.host - from);
+        keepRange(moved);
+    }
+}
+
+// Read and ignore the events of a forked child
+static void drainEvents(int fd)
+{
+    struct uffd_msg msg;
+
+    while (read(fd, &msg, sizeof(msg)) == sizeof(msg))
+    {
+        // Its own children get the pages it already has
+        if (msg.event == UFFD_EVENT_FORK)
+            close(msg.arg.fork.ufd);
+    }
+}
+
+// A forked child has its copy of the ranges. They are filled at once, the
+// snapshots may not live as long as it.
+static void fillChild(int fd)
+{
+    for (size_t i=0; i<num_ranges; ++i)
+    {
+        uintptr_t dst = ranges[i].host;
+        const unsigned char *src = ranges[i].data;
+        size_t len = ranges[i].size;
+        int error;
+
+        while ((error = copyPages(fd, dst, src, len)) == EAGAIN)
+        {
+            drainEvents(fd);
+            sched_yield();
+        }
+
+        if (error == ESRCH)
+            // The child exited
+            break;
+    }
+
+    // Its ranges are unregistered, they are complete
+    close(fd);
+}
+
+static void handleMessage(const struct uffd_msg &msg)
+{
+    switch (msg.event)
+    {
+        case UFFD_EVENT_PAGEFAULT:
+            handleFault(msg.arg.pagefault.address & ~(uintptr_t)(pageSize() - 1));
+            break;
+
+        case UFFD_EVENT_UNMAP:
+            dropRanges(msg.arg.remove.start, msg.arg.remove.end, false);
+            break;
+
+        case UFFD_EVENT_REMOVE:
+            dropRanges(msg.arg.remove.start, msg.arg.remove.end, true);
+            break;
+
+        case UFFD_EVENT_REMAP:
+            moveRanges(msg.arg.remap.from, msg.arg.remap.to,
+                       msg.arg.remap.len);
+            break;
+
+        case UFFD_EVENT_FORK:
+            fillChild(msg.arg.fork.ufd);
+            break;
+    }
+}
+
+static void *handleFaults(void *)
+{
+    struct pollfd pfd;
+
+    pfd.fd = uffd;
+    pfd.events = POLLIN;
+
+    while (true)
+    {
+        struct uffd_msg msg;
+
+        if (poll(&pfd, 1, -1) <= 0)
+            continue;
+
+        // A thread changing its memory waits until the event is read. Doing
+        // it with ranges_mutex held guarantees that no other thread sees the
+        // ranges before they are updated.
+        pthread_mutex_lock(&ranges_mutex);
+
+        if (read(uffd, &msg, sizeof(msg)) == sizeof(msg))
+            handleMessage(msg);
+
+        pthread_mutex_unlock(&ranges_mutex);
+    }
+
+    return 0;
+}
+
+static void initUserfaultfd()
+{
+    int fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+
+    if (fd < 0)
+        // Not supported, or not allowed for this process
+        return;
+
+    // Without the events, the ranges would outlive the memory of the
+    // application and the snapshots would be wrong
+    struct uffdio_api api;
+
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_EVENT_FORK | UFFD_FEATURE_EVENT_REMAP |
+                   UFFD_FEATURE_EVENT_REMOVE | UFFD_FEATURE_EVENT_UNMAP;
+
+    if (ioctl(fd, UFFDIO_API, &api) != 0)
+    {
+        close(fd);
+        return;
+    }
+
+    max_ranges = pageSize() / sizeof(SnapshotRange);
+    ranges = (SnapshotRange *)mmap(0, max_ranges * sizeof(SnapshotRange),
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    mincore_vec = (unsigned char *)mmap(0, chunk_pages, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (ranges == MAP_FAILED || mincore_vec == MAP_FAILED)
+    {
+        close(fd);
+        return;
+    }
+
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    uffd = fd;
+    uffd_pid = getpid();
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&thread, &attr, &handleFaults, 0) != 0)
+    {
+        uffd = -1;
+        close(fd);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+// Register a range and add it to the registry
+static bool trackRange(const SnapshotRange &range)
+{
+    struct uffdio_register reg;
+
+    reg.range.start = range.host;
+    reg.range.len = range.size;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+
+    pthread_mutex_lock(&ranges_mutex);
+
+    // Memory already in another snapshot, or not anonymous memory
+    if (findRange(range.host, range.host + range.size) ||
+        ioctl(uffd, UFFDIO_REGISTER, &reg) != 0)
+    {
+        pthread_mutex_unlock(&ranges_mutex);
+        return false;
+    }
+
+    if (!addRange(range))
+    {
+        unregisterRange(range.host, range.size);
+        pthread_mutex_unlock(&ranges_mutex);
+        return false;
+    }
+
+    pthread_mutex_unlock(&ranges_mutex);
+
+    return true;
+}
+
+// Undo trackRange()
+static void untrackRange(const SnapshotRange &range)
+{
+    pthread_mutex_lock(&ranges_mutex);
+
+    for (size_t i=0; i<num_ranges; )
+    {
+        if (ranges[i].owner == range.owner)
+            ranges[i] = ranges[--num_ranges];
+        else
+            ++i;
+    }
+
+    unregisterRange(range.host, range.size);
+
+    pthread_mutex_unlock(&ranges_mutex);
+}
+
+// Whether a page of [ptr, ptr + len) is present. Uses mincore_vec, must be
+// called with ranges_mutex held.
+static bool anyPagePresent(void *ptr, size_t len)
+{
+    const size_t page = pageSize();
+    const size_t chunk = chunk_pages * page;
+
+    for (size_t offset = 0; offset < len; offset += chunk)
+    {
+        size_t l = (len - offset < chunk ? len - offset : chunk);
+
+        if (mincore((unsigned char *)ptr + offset, l, mincore_vec) != 0)
+            return true;
+
+        for (size_t i=0; i<(l + page - 1) / page; ++i)
+            if (mincore_vec[i] & 1)
+                return true;
+    }
+
+    return false;
+}
+
+#endif
+
+/*
+ * HostSnapshot
+ */
+
+HostSnapshot::HostSnapshot(void *data, size_t mapped_size)
+: p_data(data), p_mapped_size(mapped_size), p_detached(false)
+{
+    pthread_mutex_init(&p_mutex, 0);
+}
+
+HostSnapshot::~HostSnapshot()
+{
+    detach();
+
+    munmap(p_data, p_mapped_size);
+    pthread_mutex_destroy(&p_mutex);
+}
+
+HostSnapshot *HostSnapshot::create(void *host_ptr, size_t size)
+{
+#ifdef COAL_HOST_SNAPSHOTS
+    const size_t page = pageSize();
+
+    if (size < min_size || ((uintptr_t)host_ptr & (page - 1)))
+        return 0;
+
+    // Only the pages entirely in the range are moved. The last page can be
+    // shared with other data of the application or of malloc(), it is copied.
+    size_t snapshot_size = size & ~(page - 1);
+    size_t mapped_size = (size + page - 1) & ~(page - 1);
+
+    pthread_once(&uffd_once, &initUserfaultfd);
+
+    if (!snapshotsUsable())
+        return 0;
+
+    // Mapping receiving the snapshot and the copy of the last page
+    void *data = mmap(0, mapped_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (data == MAP_FAILED)
+        return 0;
+
+    SnapshotRange range;
+
+    range.host = (uintptr_t)host_ptr;
+    range.data = (const unsigned char *)data;
+    range.size = snapshot_size;
+    range.owner = data;
+
+    // Register the range before moving its pages, they must never appear
+    // empty to the application
+    if (!trackRange(range))
+    {
+        munmap(data, mapped_size);
+        return 0;
+    }
+
+    // The fault handler reads the remap event, ranges_mutex must be free
+    if (mremap(host_ptr, snapshot_size, snapshot_size,
+               MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP,
+               data) == MAP_FAILED)
+    {
+        untrackRange(range);
+        munmap(data, mapped_size);
+        return 0;
+    }
+
+    // The snapshot stays registered like the range it comes from. Its
+    // missing pages are zeros and don't need the fault handler.
+    unregisterRange((uintptr_t)data, snapshot_size);
+
+    // Shared memory stays mapped in the application range and would be
+    // modified by writes in the snapshot
+    pthread_mutex_lock(&ranges_mutex);
+    bool shared = anyPagePresent(host_ptr, snapshot_size);
+    pthread_mutex_unlock(&ranges_mutex);
+
+    if (shared)
+    {
+        untrackRange(range);
+        munmap(data, mapped_size);
+        return 0;
+    }
+
+    std::memcpy((unsigned char *)data + snapshot_size,
+                (unsigned char *)host_ptr + snapshot_size, size - snapshot_size);
+
+    return new HostSnapshot(data, mapped_size);
+#else
+    (void) host_ptr;
+    (void) size;
+
+    return 0;
+#endif
+}
+
+void *HostSnapshot::data() const
+{
+    return p_data;
+}
+
+void HostSnapshot::detach()
+{
+    pthread_mutex_lock(&p_mutex);
+
+    if (p_detached)
+    {
+        pthread_mutex_unlock(&p_mutex);
+        return;
+    }
+
+#ifdef COAL_HOST_SNAPSHOTS
+    // In a forked child, the fault handler of the parent filled everything
+    if (snapshotsUsable())
+    {
+        // Give the application the pages it didn't access yet, in the ranges
+        // it still has
+        pthread_mutex_lock(&ranges_mutex);
+
+        for (size_t i=0; i<num_ranges; )
+        {
+            SnapshotRange &range = ranges[i];
+
+            if (range.owner != p_data)
+            {
+                ++i;
+                continue;
+            }
+
+            uintptr_t start = range.host;
+            int error = copyPages(uffd, range.host, range.data, range.size);
+
+            unregisterRange(start, range.host - start);
+
+            if (error == EAGAIN)
+            {
+                // The application is changing its memory, let the fault
+                // handler update the ranges and look at them again
+                pthread_mutex_unlock(&ranges_mutex);
+                sched_yield();
+                pthread_mutex_lock(&ranges_mutex);
+
+                i = 0;
+                continue;
+            }
+
+            // Complete, or not there anymore
+            unregisterRange(range.host, range.size);
+            ranges[i] = ranges[--num_ranges];
+        }
+
+        pthread_mutex_unlock(&ranges_mutex);
+    }
+#endif
+
+    p_detached = true;
+
+    pthread_mutex_unlock(&p_mutex);
+}
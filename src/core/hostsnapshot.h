@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file hostsnapshot.h
+ * \brief Copy-on-write snapshot of host memory
+ */
+
+#ifndef __HOSTSNAPSHOT_H__
+#define __HOSTSNAPSHOT_H__
+
+#include <pthread.h>
+#include <cstddef>
+
+namespace Coal
+{
+
+/**
+ * \brief Copy-on-write snapshot of host memory
+ *
+ * \c CL_MEM_COPY_HOST_PTR requires the implementation to copy \c host_ptr
+ * before \c clCreateBuffer() returns, as the application is then free to
+ * modify or release it. For large page-aligned regions, this class makes the
+ * copy without copying anything: the pages of the application are moved to a
+ * new mapping, that becomes the snapshot, and the now empty range of the
+ * application is filled page by page from the snapshot when it is accessed.
+ * Only the pages entirely inside the region are moved, the end of a region
+ * not ending on a page boundary is copied.
+ *
+ * The pages still missing in the application range are copied back before
+ * the snapshot is modified (see \c detach()) or destroyed, so that the
+ * application never sees a modification of the snapshot.
+ *
+ * The fault handler follows the changes the application makes to its memory:
+ * the parts it unmaps or discards with \c madvise() are forgotten, the parts
+ * it moves with \c mremap() are followed, and forked children get a full
+ * copy of the ranges they inherit.
+ *
+ * This uses \c mremap() with \c MREMAP_DONTUNMAP and \c userfaultfd() with
+ * its non-cooperative events, both Linux-specific and maybe restricted to
+ * privileged processes. When they are not available, \c create() fails and
+ * the caller must copy the memory. Snapshots are only taken for buffers
+ * created with \c CL_MEM_COPY_ON_WRITE_CLOVER.
+ */
+class HostSnapshot
+{
+    public:
+        /**
+         * \brief Take a snapshot of host memory
+         * \param host_ptr memory to copy, must be aligned on a page
+         * \param size size of the memory to copy, at least \c min_size
+         * \return the snapshot, 0 if the memory must be copied instead
+         */
+        static HostSnapshot *create(void *host_ptr, size_t size);
+        ~HostSnapshot();
+
+        static const size_t min_size = 1 << 20; /*!< \brief Smallest region worth a snapshot */
+
+        void *data() const; /*!< \brief Snapshot of the memory */
+
+        /**
+         * \brief Prepare the snapshot for modification
+         *
+         * The pages not yet accessed by the application are copied back in
+         * its range, so that writing into \c data() doesn't change what the
+         * application sees. This function must be called before each
+         * modification of the snapshot, it does nothing once the snapshot is
+         * detached.
+         */
+        void detach();
+
+    private:
+        HostSnapshot(void *data, size_t mapped_size);
+
+        void *p_data;
+        size_t p_mapped_size;
+        bool p_detached;
+        pthread_mutex_t p_mutex;
+};
+
+}
+
+#endif
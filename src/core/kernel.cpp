@@ -295,6 +295,41 @@ cl_int Kernel::setArg(cl_uint index, size_t size, const void *value)
     return CL_SUCCESS;
 }
 
+void Kernel::restoreArg(cl_uint index, const Arg &arg)
+{
+    p_args[index] = arg;
+}
+
+Kernel *Kernel::clone(cl_int *errcode_ret) const
+{
+    Kernel *rs = new Kernel((Program *)parent());
+
+    if (!rs->registered())
+    {
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return rs;
+    }
+
+    for (size_t i=0; i<p_device_dependent.size(); ++i)
+    {
+        const DeviceDependent &dep = p_device_dependent[i];
+
+        *errcode_ret = rs->addFunction(dep.device, dep.function, dep.module);
+
+        if (*errcode_ret != CL_SUCCESS)
+            return rs;
+    }
+
+    rs->p_args = p_args;
+
+    return rs;
+}
+
+const std::string &Kernel::name() const
+{
+    return p_name;
+}
+
 unsigned int Kernel::numArgs() const
 {
     return p_args.size();
@@ -450,6 +485,41 @@ Kernel::Arg::Arg(unsigned short vec_dim, File file, Kind kind)
 
 }
 
+Kernel::Arg::Arg(const Arg &other)
+: p_vec_dim(other.p_vec_dim), p_file(other.p_file), p_kind(other.p_kind),
+  p_data(0), p_defined(other.p_defined), p_runtime_alloc(other.p_runtime_alloc)
+{
+    if (other.p_data)
+    {
+        alloc();
+        std::memcpy(p_data, other.p_data, p_vec_dim * valueSize());
+    }
+}
+
+Kernel::Arg &Kernel::Arg::operator=(const Arg &other)
+{
+    if (this == &other)
+        return *this;
+
+    if (p_data)
+        std::free(p_data);
+
+    p_vec_dim = other.p_vec_dim;
+    p_file = other.p_file;
+    p_kind = other.p_kind;
+    p_data = 0;
+    p_defined = other.p_defined;
+    p_runtime_alloc = other.p_runtime_alloc;
+
+    if (other.p_data)
+    {
+        alloc();
+        std::memcpy(p_data, other.p_data, p_vec_dim * valueSize());
+    }
+
+    return *this;
+}
+
 Kernel::Arg::~Arg()
 {
     if (p_data)
@@ -118,6 +118,8 @@ class Kernel : public Object
                  * \param kind \c Kind of the argument
                  */
                 Arg(unsigned short vec_dim, File file, Kind kind);
+                Arg(const Arg &other);            /*!< \brief Copy \p other and its value */
+                Arg &operator=(const Arg &other); /*!< \brief Copy \p other and its value */
                 ~Arg();
 
                 /**
@@ -249,6 +251,27 @@ class Kernel : public Object
          */
         cl_int setArg(cl_uint index, size_t size, const void *value);
 
+        /**
+         * \brief Give back to an argument a value it had before
+         * \param index index of the argument
+         * \param arg copy of \c arg() taken before the argument changed
+         */
+        void restoreArg(cl_uint index, const Arg &arg);
+
+        /**
+         * \brief Copy this kernel and the current value of its arguments
+         *
+         * The copy has its own \c Coal::DeviceKernel for each device. It is
+         * used to record the kernel in a \c Coal::CommandBuffer, later
+         * \c setArg() on this kernel don't change it.
+         *
+         * \param errcode_ret return code (\c CL_SUCCESS if all is good)
+         * \return the new kernel, to be deleted by the caller even in case of
+         *         error
+         */
+        Kernel *clone(cl_int *errcode_ret) const;
+
+        const std::string &name() const;          /*!< \brief Name of the kernel function */
         unsigned int numArgs() const;             /*!< \brief Number of arguments of this kernel */
         const Arg &arg(unsigned int index) const; /*!< \brief \c Arg at the given \p index */
 
@@ -34,6 +34,10 @@
 #include "context.h"
 #include "deviceinterface.h"
 #include "propertylist.h"
+#include "hostsnapshot.h"
+#include "filemapping.h"
+
+#include <CL/cl_ext.h>
 
 #include <cstdlib>
 #include <cstring>
@@ -48,12 +52,22 @@ using namespace Coal;
 MemObject::MemObject(Context *ctx, cl_mem_flags flags, void *host_ptr,
                      cl_int *errcode_ret)
 : Object(Object::T_MemObject, ctx), p_num_devices(0), p_flags(flags),
-  p_host_ptr(host_ptr), p_devicebuffers(0), p_dtor_callback(0)
+  p_host_ptr(host_ptr), p_host_copied(false), p_host_snapshot(0),
+  p_devicebuffers(0), p_devicebuffer(0), p_dtor_callback(0)
 {
+    pthread_mutex_init(&p_mappings_mutex, 0);
+
+    if (!registered())
+    {
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return;
+    }
+
     // Check the flags value
     const cl_mem_flags all_flags = CL_MEM_READ_WRITE | CL_MEM_WRITE_ONLY |
                                    CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR |
-                                   CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR;
+                                   CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR |
+                                   CL_MEM_COPY_ON_WRITE_CLOVER;
 
     if ((flags & ~all_flags) != 0)
     {
@@ -61,6 +75,12 @@ MemObject::MemObject(Context *ctx, cl_mem_flags flags, void *host_ptr,
         return;
     }
 
+    if ((flags & CL_MEM_COPY_ON_WRITE_CLOVER) && !(flags & CL_MEM_COPY_HOST_PTR))
+    {
+        *errcode_ret = CL_INVALID_VALUE;
+        return;
+    }
+
     if ((flags & CL_MEM_ALLOC_HOST_PTR) && (flags & CL_MEM_USE_HOST_PTR))
     {
         *errcode_ret = CL_INVALID_VALUE;
@@ -98,48 +118,43 @@ MemObject::~MemObject()
         for (unsigned int i=0; i<p_num_devices; ++i)
             delete p_devicebuffers[i];
 
-        std::free((void *)p_devicebuffers);
+        if (p_devicebuffers != &p_devicebuffer)
+            std::free((void *)p_devicebuffers);
     }
+
+    // Copy of host_ptr not yet used by all the devices
+    if (p_host_copied)
+        freeHostCopy();
+
+    pthread_mutex_destroy(&p_mappings_mutex);
 }
 
 cl_int MemObject::init()
 {
     // Get the device list of the context
-    DeviceInterface **devices = 0;
+    Context *ctx = (Context *)parent();
+    DeviceInterface *const *devices = ctx->devices();
     cl_int rs;
 
-    rs = ((Context *)parent())->info(CL_CONTEXT_NUM_DEVICES,
-                                     sizeof(unsigned int),
-                                     &p_num_devices, 0);
-
-    if (rs != CL_SUCCESS)
-        return rs;
-
+    p_num_devices = ctx->numDevices();
     p_devices_to_allocate = p_num_devices;
-    devices = (DeviceInterface **)std::malloc(p_num_devices *
-                                        sizeof(DeviceInterface *));
 
-    if (!devices)
-        return CL_OUT_OF_HOST_MEMORY;
-
-    rs = ((Context *)parent())->info(CL_CONTEXT_DEVICES,
-                                     p_num_devices * sizeof(DeviceInterface *),
-                                     devices, 0);
-
-    if (rs != CL_SUCCESS)
+    // Allocate a table of DeviceBuffers, the common case of a single device
+    // doesn't need to go through malloc()
+    if (p_num_devices == 1)
     {
-        std::free((void *)devices);
-        return rs;
+        p_devicebuffers = &p_devicebuffer;
     }
+    else
+    {
+        p_devicebuffers = (DeviceBuffer **)std::malloc(p_num_devices *
+                                                 sizeof(DeviceBuffer *));
 
-    // Allocate a table of DeviceBuffers
-    p_devicebuffers = (DeviceBuffer **)std::malloc(p_num_devices *
-                                             sizeof(DeviceBuffer *));
+        if (!p_devicebuffers)
+            return CL_OUT_OF_HOST_MEMORY;
 
-    if (!p_devicebuffers)
-    {
-        std::free((void *)devices);
-        return CL_OUT_OF_HOST_MEMORY;
+        std::memset((void *)p_devicebuffers, 0,
+                    p_num_devices * sizeof(DeviceBuffer *));
     }
 
     // If we have more than one device, the allocation on the devices is
@@ -148,18 +163,30 @@ cl_int MemObject::init()
     // they don't need to reallocate and re-copy host_ptr
     if (p_num_devices > 1 && (p_flags & CL_MEM_COPY_HOST_PTR))
     {
-        void *tmp_hostptr = std::malloc(size());
+        // Large regions can be kept as a copy-on-write snapshot if the
+        // application asks for it, the devices only read it
+        if ((p_flags & CL_MEM_COPY_ON_WRITE_CLOVER) &&
+            size() >= HostSnapshot::min_size)
+            p_host_snapshot = HostSnapshot::create(p_host_ptr, size());
 
-        if (!tmp_hostptr)
+        if (p_host_snapshot)
         {
-            std::free((void *)devices);
-            return CL_OUT_OF_HOST_MEMORY;
+            p_host_ptr = p_host_snapshot->data();
         }
+        else
+        {
+            void *tmp_hostptr = std::malloc(size());
+
+            if (!tmp_hostptr)
+                return CL_OUT_OF_HOST_MEMORY;
 
-        std::memcpy(tmp_hostptr, p_host_ptr, size());
+            std::memcpy(tmp_hostptr, p_host_ptr, size());
+
+            p_host_ptr = tmp_hostptr;
+        }
 
-        p_host_ptr = tmp_hostptr;
         // Now, the client application can safely std::free() its host_ptr
+        p_host_copied = true;
     }
 
     // Create a DeviceBuffer for each device
@@ -180,32 +207,26 @@ cl_int MemObject::init()
     }
 
     if (failed_devices == p_num_devices)
-    {
         // Each device found a reason to reject the buffer, so it's invalid
-        std::free((void *)devices);
         return rs;
-    }
-
-    std::free((void *)devices);
-    devices = 0;
 
     // If we have only one device, already allocate the buffer
     if (p_num_devices == 1)
     {
-        if (!p_devicebuffers[0]->allocate())
+        if (!p_devicebuffers[0]->allocate(false))
             return CL_MEM_OBJECT_ALLOCATION_FAILURE;
     }
 
     return CL_SUCCESS;
 }
 
-bool MemObject::allocate(DeviceInterface *device)
+bool MemObject::allocate(DeviceInterface *device, bool discard)
 {
     DeviceBuffer *buffer = deviceBuffer(device);
 
     if (!buffer->allocated())
     {
-        return buffer->allocate();
+        return buffer->allocate(discard);
     }
 
     return true;
@@ -253,14 +274,88 @@ void MemObject::deviceAllocated(DeviceBuffer *buffer)
     // std::free() it.
     p_devices_to_allocate--;
 
-    if (p_devices_to_allocate == 0 &&
-        p_num_devices > 1 &&
-        (p_flags & CL_MEM_COPY_HOST_PTR))
+    if (p_devices_to_allocate == 0 && p_host_copied)
+    {
+        freeHostCopy();
+    }
+
+}
+
+void MemObject::addMapping(void *ptr)
+{
+    pthread_mutex_lock(&p_mappings_mutex);
+    p_mappings.push_back(ptr);
+    pthread_mutex_unlock(&p_mappings_mutex);
+}
+
+bool MemObject::hasMapping(void *ptr) const
+{
+    bool found = false;
+
+    pthread_mutex_lock(&p_mappings_mutex);
+
+    for (std::list<void *>::const_iterator it = p_mappings.begin();
+         it != p_mappings.end(); ++it)
+    {
+        if (*it == ptr)
+        {
+            found = true;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&p_mappings_mutex);
+
+    return found;
+}
+
+bool MemObject::removeMapping(void *ptr)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&p_mappings_mutex);
+
+    for (std::list<void *>::iterator it = p_mappings.begin();
+         it != p_mappings.end(); ++it)
+    {
+        if (*it == ptr)
+        {
+            p_mappings.erase(it);
+            found = true;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&p_mappings_mutex);
+
+    return found;
+}
+
+cl_uint MemObject::mapCount() const
+{
+    cl_uint rs;
+
+    pthread_mutex_lock(&p_mappings_mutex);
+    rs = p_mappings.size();
+    pthread_mutex_unlock(&p_mappings_mutex);
+
+    return rs;
+}
+
+void MemObject::freeHostCopy()
+{
+    if (p_host_snapshot)
+    {
+        delete p_host_snapshot;
+        p_host_snapshot = 0;
+    }
+    else
     {
         std::free(p_host_ptr);
-        p_host_ptr = 0;
     }
 
+    p_host_ptr = 0;
+    p_host_copied = false;
 }
 
 void MemObject::setDestructorCallback(void (CL_CALLBACK *pfn_notify)
@@ -328,7 +423,7 @@ cl_int MemObject::info(cl_mem_info param_name,
             break;
 
         case CL_MEM_MAP_COUNT:
-            SIMPLE_ASSIGN(cl_uint, 0); // TODO
+            SIMPLE_ASSIGN(cl_uint, mapCount());
             break;
 
         case CL_MEM_REFERENCE_COUNT:
@@ -375,7 +470,8 @@ cl_int MemObject::info(cl_mem_info param_name,
 
 Buffer::Buffer(Context *ctx, size_t size, void *host_ptr, cl_mem_flags flags,
                cl_int *errcode_ret)
-: MemObject(ctx, flags, host_ptr, errcode_ret), p_size(size)
+: MemObject(ctx, flags, host_ptr, errcode_ret), p_size(size),
+  p_file_mapping(0)
 {
     if (size == 0)
     {
@@ -384,6 +480,24 @@ Buffer::Buffer(Context *ctx, size_t size, void *host_ptr, cl_mem_flags flags,
     }
 }
 
+Buffer::Buffer(Context *ctx, FileMapping *mapping, cl_mem_flags flags,
+               cl_int *errcode_ret)
+: MemObject(ctx, flags | CL_MEM_USE_HOST_PTR, mapping->data(), errcode_ret),
+  p_size(mapping->size()), p_file_mapping(mapping)
+{
+}
+
+Buffer::~Buffer()
+{
+    if (p_file_mapping)
+        delete p_file_mapping;
+}
+
+FileMapping *Buffer::fileMapping() const
+{
+    return p_file_mapping;
+}
+
 size_t Buffer::size() const
 {
     return p_size;
@@ -452,9 +566,12 @@ MemObject::Type SubBuffer::type() const
     return MemObject::SubBuffer;
 }
 
-bool SubBuffer::allocate(DeviceInterface *device)
+bool SubBuffer::allocate(DeviceInterface *device, bool discard)
 {
-    return p_parent->allocate(device);
+    // The parent holds more than the data of this sub-buffer
+    (void)discard;
+
+    return p_parent->allocate(device, false);
 }
 
 size_t SubBuffer::offset() const
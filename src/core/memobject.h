@@ -37,11 +37,16 @@
 
 #include <CL/cl.h>
 
+#include <pthread.h>
+#include <list>
+
 namespace Coal
 {
 
 class DeviceBuffer;
 class Context;
+class HostSnapshot;
+class FileMapping;
 class DeviceInterface;
 
 /**
@@ -89,7 +94,13 @@ class MemObject : public Object
          * \return \c CL_SUCCESS if success, an error code otherwise
          */
         virtual cl_int init();
-        virtual bool allocate(DeviceInterface *device); /*!< \brief Allocate this memory object on the given \p device */
+        /**
+         * \brief Allocate this memory object on the given \p device
+         * \param device device on which to allocate the object
+         * \param discard the command allocating the object overwrites all of
+         *        it, see \c Coal::DeviceBuffer::allocate()
+         */
+        virtual bool allocate(DeviceInterface *device, bool discard = false);
         virtual size_t size() const = 0;                /*!< \brief Device-independent size of the memory object */
         virtual Type type() const = 0;                  /*!< \brief Type of the memory object */
 
@@ -99,6 +110,32 @@ class MemObject : public Object
 
         void deviceAllocated(DeviceBuffer *buffer);     /*!< \brief Is the \c Coal::DeviceBuffer for \p buffer allocated ? */
 
+        /**
+         * \brief Record a mapping of this memory object
+         *
+         * Called when \c clEnqueueMapBuffer() or \c clEnqueueMapImage()
+         * returns \p ptr to the application. The same address can be mapped
+         * more than once.
+         *
+         * \param ptr mapped address
+         */
+        void addMapping(void *ptr);
+
+        /**
+         * \brief Check that \p ptr is a mapping of this memory object
+         * \param ptr mapped address
+         * \return true if \p ptr was returned by a map not yet unmapped
+         */
+        bool hasMapping(void *ptr) const;
+
+        /**
+         * \brief Forget a mapping of this memory object
+         * \param ptr mapped address
+         * \return false if \p ptr isn't a mapping of this object
+         */
+        bool removeMapping(void *ptr);
+        cl_uint mapCount() const;                       /*!< \brief Number of mappings not yet unmapped */
+
         /**
          * \brief Set a destructor callback for this memory object
          * 
@@ -128,10 +165,18 @@ class MemObject : public Object
         unsigned int p_num_devices, p_devices_to_allocate;
         cl_mem_flags p_flags;
         void *p_host_ptr;
+        bool p_host_copied;
+        HostSnapshot *p_host_snapshot;
         DeviceBuffer **p_devicebuffers;
+        DeviceBuffer *p_devicebuffer; /*!< \brief Storage of \c p_devicebuffers for single-device contexts */
 
         void (CL_CALLBACK *p_dtor_callback)(cl_mem memobj, void *user_data);
         void *p_dtor_userdata;
+
+        std::list<void *> p_mappings;
+        mutable pthread_mutex_t p_mappings_mutex;
+
+        void freeHostCopy();
 };
 
 /**
@@ -151,10 +196,27 @@ class Buffer : public MemObject
         Buffer(Context *ctx, size_t size, void *host_ptr, cl_mem_flags flags,
                cl_int *errcode_ret);
 
+        /**
+         * \brief Constructor of a buffer backed by a file
+         *
+         * The buffer uses the mapping as a \c CL_MEM_USE_HOST_PTR host
+         * pointer.
+         *
+         * \param ctx parent \c Coal::Context
+         * \param mapping file mapping, owned by the buffer
+         * \param flags memory flags, \c CL_MEM_USE_HOST_PTR is added
+         * \param errcode_ret return code
+         */
+        Buffer(Context *ctx, FileMapping *mapping, cl_mem_flags flags,
+               cl_int *errcode_ret);
+        ~Buffer();
+
         size_t size() const; /*!< \brief Size of the buffer, in bytes */
         Type type() const;   /*!< \brief Return that we are a \c Coal::MemObject::Buffer */
+        FileMapping *fileMapping() const; /*!< \brief File backing the buffer, 0 if none */
     private:
         size_t p_size;
+        FileMapping *p_file_mapping;
 
 };
 
@@ -177,7 +239,7 @@ class SubBuffer : public MemObject
 
         size_t size() const;                    /*!< \brief Size */
         Type type() const;                      /*!< \brief Return that we are a \c Coal::MemObject::SubBuffer */
-        bool allocate(DeviceInterface *device); /*!< \brief Allocate the \b parent \c Coal::Buffer */
+        bool allocate(DeviceInterface *device, bool discard = false); /*!< \brief Allocate the \b parent \c Coal::Buffer, never discarding it */
 
         size_t offset() const;                  /*!< \brief Offset in bytes */
         class Buffer *parent() const;           /*!< \brief Parent \c Coal::Buffer */
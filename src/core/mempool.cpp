@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file mempool.cpp
+ * \brief Caching allocator for memory objects
+ */
+
+#include "mempool.h"
+
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace Coal;
+
+static inline void *&nextSlot(void *slot)
+{
+    // Free slots are linked through their first bytes
+    return *(void **)slot;
+}
+
+MemoryPool::MemoryPool()
+: p_cached_size(0)
+{
+    pthread_mutex_init(&p_mutex, 0);
+
+    for (unsigned int i=0; i<num_small_classes; ++i)
+    {
+        p_small[i].available = 0;
+        p_small[i].full = 0;
+        p_small[i].empty_slabs = 0;
+    }
+}
+
+MemoryPool::~MemoryPool()
+{
+    // The memory objects are all destroyed, everything can be freed
+    for (unsigned int i=0; i<num_small_classes; ++i)
+    {
+        Slab *lists[2] = {p_small[i].available, p_small[i].full};
+
+        for (unsigned int l=0; l<2; ++l)
+        {
+            Slab *slab = lists[l];
+
+            while (slab)
+            {
+                Slab *next = slab->next;
+
+                std::free((void *)slab);
+                slab = next;
+            }
+        }
+    }
+
+    for (std::map<size_t, std::vector<void *> >::iterator it = p_large.begin();
+         it != p_large.end(); ++it)
+    {
+        for (size_t i=0; i<it->second.size(); ++i)
+            std::free(it->second[i]);
+    }
+
+    pthread_mutex_destroy(&p_mutex);
+}
+
+unsigned int MemoryPool::smallClass(size_t size)
+{
+    unsigned int size_class = 0;
+    size_t class_size = alignment;
+
+    while (class_size < size)
+    {
+        class_size <<= 1;
+        size_class++;
+    }
+
+    return size_class;
+}
+
+size_t MemoryPool::largeClassSize(size_t size)
+{
+    // Four classes per power of two : 2^k * {1.25, 1.5, 1.75, 2}, for
+    // 2^k < size <= 2^(k+1)
+    unsigned int k = 0;
+
+    while (((size_t)2 << k) < size)
+        k++;
+
+    size_t base = (size_t)1 << k;
+    size_t step = base >> 2;
+
+    return base + ((size - 1 - base) / step + 1) * step;
+}
+
+void *MemoryPool::allocate(size_t size)
+{
+    void *ptr = 0;
+
+    pthread_mutex_lock(&p_mutex);
+
+    if (size <= max_small_size)
+    {
+        ptr = allocateSmall(smallClass(size));
+    }
+    else
+    {
+        size_t class_size = largeClassSize(size);
+        std::vector<void *> &blocks = p_large[class_size];
+
+        if (blocks.size())
+        {
+            ptr = blocks.back();
+            blocks.pop_back();
+            p_cached_size -= class_size;
+        }
+        else if (posix_memalign(&ptr, alignment, class_size) != 0)
+        {
+            ptr = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&p_mutex);
+
+    return ptr;
+}
+
+void MemoryPool::release(void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+
+    pthread_mutex_lock(&p_mutex);
+
+    if (size <= max_small_size)
+    {
+        releaseSmall(ptr, smallClass(size));
+    }
+    else
+    {
+        size_t class_size = largeClassSize(size);
+
+        if (p_cached_size + class_size > max_cached_size)
+        {
+            // Don't keep too much memory
+            std::free(ptr);
+        }
+        else
+        {
+            p_large[class_size].push_back(ptr);
+            p_cached_size += class_size;
+        }
+    }
+
+    pthread_mutex_unlock(&p_mutex);
+}
+
+size_t MemoryPool::trim()
+{
+    size_t released = 0, slabs_released = 0;
+
+    pthread_mutex_lock(&p_mutex);
+
+    for (unsigned int i=0; i<num_small_classes; ++i)
+        slabs_released += trimSlabs(i);
+
+    for (std::map<size_t, std::vector<void *> >::iterator it = p_large.begin();
+         it != p_large.end(); ++it)
+    {
+        for (size_t i=0; i<it->second.size(); ++i)
+            std::free(it->second[i]);
+
+        released += it->second.size() * it->first;
+    }
+
+    p_large.clear();
+    p_cached_size -= released;
+
+    pthread_mutex_unlock(&p_mutex);
+
+    return released + slabs_released;
+}
+
+size_t MemoryPool::cachedSize() const
+{
+    size_t rs;
+
+    pthread_mutex_lock(&p_mutex);
+    rs = p_cached_size;
+    pthread_mutex_unlock(&p_mutex);
+
+    return rs;
+}
+
+MemoryPool &MemoryPool::eventPool()
+{
+    static MemoryPool *pool = new MemoryPool();
+
+    return *pool;
+}
+
+void *MemoryPool::allocateSmall(unsigned int size_class)
+{
+    SmallClass &cls = p_small[size_class];
+    size_t slot_size = alignment << size_class;
+    Slab *slab = cls.available;
+
+    if (!slab)
+    {
+        // Create a new slab. It is aligned on its size so that the slab of a
+        // slot can be found from its address. Its first slot holds the header.
+        void *mem;
+
+        if (posix_memalign(&mem, slab_size, slab_size) != 0)
+            return 0;
+
+        slab = (Slab *)mem;
+        slab->free_list = 0;
+        slab->used = 0;
+
+        for (size_t offset = slab_size - slot_size; offset >= slot_size;
+             offset -= slot_size)
+        {
+            void *slot = (unsigned char *)mem + offset;
+
+            nextSlot(slot) = slab->free_list;
+            slab->free_list = slot;
+        }
+
+        linkSlab(cls.available, slab);
+        cls.empty_slabs++;
+
+        p_cached_size += slab_size - slot_size;
+    }
+
+    void *ptr = slab->free_list;
+
+    slab->free_list = nextSlot(ptr);
+
+    if (slab->used++ == 0)
+        cls.empty_slabs--;
+
+    if (!slab->free_list)
+    {
+        unlinkSlab(cls.available, slab);
+        linkSlab(cls.full, slab);
+    }
+
+    p_cached_size -= slot_size;
+
+    return ptr;
+}
+
+void MemoryPool::releaseSmall(void *ptr, unsigned int size_class)
+{
+    SmallClass &cls = p_small[size_class];
+    size_t slot_size = alignment << size_class;
+    Slab *slab = (Slab *)((uintptr_t)ptr & ~(uintptr_t)(slab_size - 1));
+
+    if (!slab->free_list)
+    {
+        unlinkSlab(cls.full, slab);
+        linkSlab(cls.available, slab);
+    }
+
+    nextSlot(ptr) = slab->free_list;
+    slab->free_list = ptr;
+
+    p_cached_size += slot_size;
+
+    if (--slab->used != 0)
+        return;
+
+    // Keep a few empty slabs for the next allocations, give back the others
+    if (cls.empty_slabs < max_empty_slabs)
+    {
+        cls.empty_slabs++;
+        return;
+    }
+
+    unlinkSlab(cls.available, slab);
+    std::free((void *)slab);
+
+    p_cached_size -= slab_size - slot_size;
+}
+
+size_t MemoryPool::trimSlabs(unsigned int size_class)
+{
+    SmallClass &cls = p_small[size_class];
+    size_t slot_size = alignment << size_class;
+    size_t released = 0;
+
+    // Only the slabs having free slots can be empty
+    Slab *slab = cls.available;
+
+    while (slab)
+    {
+        Slab *next = slab->next;
+
+        if (slab->used == 0)
+        {
+            unlinkSlab(cls.available, slab);
+            std::free((void *)slab);
+            released += slab_size - slot_size;
+        }
+
+        slab = next;
+    }
+
+    cls.empty_slabs = 0;
+    p_cached_size -= released;
+
+    return released;
+}
+
+void MemoryPool::linkSlab(Slab *&list, Slab *slab)
+{
+    slab->prev = 0;
+    slab->next = list;
+
+    if (list)
+        list->prev = slab;
+
+    list = slab;
+}
+
+void MemoryPool::unlinkSlab(Slab *&list, Slab *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        list = slab->next;
+
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file mempool.h
+ * \brief Caching allocator for memory objects
+ */
+
+#ifndef __MEMPOOL_H__
+#define __MEMPOOL_H__
+
+#include <pthread.h>
+#include <cstddef>
+
+#include <map>
+#include <vector>
+
+namespace Coal
+{
+
+/**
+ * \brief Caching allocator for the data of memory objects
+ *
+ * Applications often create and release many small buffers. Each \c Coal::Context
+ * owns a memory pool that devices storing buffers in host memory can use
+ * instead of calling the system allocator for every one of them.
+ *
+ * Small allocations, up to \c max_small_size bytes, are carved out of slabs of
+ * \c slab_size bytes, one kind of slab per power-of-two size class. Each slab
+ * keeps its own free slots, so that an empty slab can be given back without
+ * looking at the others. Larger
+ * allocations are rounded up to one of four classes per power of two and
+ * released blocks are kept in a free list per class, so that a buffer of the
+ * same size created later reuses them.
+ *
+ * The memory kept by the pool is bounded: at most \c max_empty_slabs empty
+ * slabs are kept per class and at most \c max_cached_size bytes of large
+ * blocks are cached, blocks beyond this limit being given back to the system.
+ * \c trim() gives back all the memory not used by a memory object.
+ *
+ * Every allocation is aligned on \c alignment bytes.
+ */
+class MemoryPool
+{
+    public:
+        MemoryPool();
+        ~MemoryPool();
+
+        static const size_t alignment = 128;            /*!< \brief Alignment of the allocations */
+        static const size_t max_small_size = 2048;      /*!< \brief Largest allocation served by a slab */
+        static const size_t slab_size = 64 << 10;       /*!< \brief Size of a slab */
+        static const size_t max_cached_size = 64 << 20; /*!< \brief Largest amount of cached large blocks */
+        static const unsigned int max_empty_slabs = 1;  /*!< \brief Empty slabs kept per class */
+
+        /**
+         * \brief Allocate memory
+         * \param size size of the allocation, in bytes
+         * \return the allocated memory, 0 if there isn't enough memory
+         */
+        void *allocate(size_t size);
+
+        /**
+         * \brief Release memory allocated by \c allocate()
+         * \param ptr memory to release
+         * \param size size given to \c allocate() for \p ptr
+         */
+        void release(void *ptr, size_t size);
+
+        /**
+         * \brief Give back to the system all the memory not in use
+         * \return number of bytes released
+         */
+        size_t trim();
+
+        /**
+         * \brief Number of bytes kept by the pool and not in use
+         */
+        size_t cachedSize() const;
+
+        /**
+         * \brief Pool of the kernel events
+         *
+         * \c Coal::KernelEvent and the device data of kernel events are
+         * created and released at a high rate, outside of any context. They
+         * share this pool, which is never destroyed as events may be released
+         * after the static destructors.
+         */
+        static MemoryPool &eventPool();
+
+    private:
+        struct Slab
+        {
+            Slab *prev;
+            Slab *next;
+            void *free_list;    /*!< \brief Free slots of this slab */
+            unsigned int used;  /*!< \brief Slots in use */
+        };
+
+        struct SmallClass
+        {
+            Slab *available;    /*!< \brief Slabs having free slots */
+            Slab *full;         /*!< \brief Slabs having none */
+            unsigned int empty_slabs;
+        };
+
+        static const unsigned int num_small_classes = 5; // 128 to 2048 bytes
+
+        SmallClass p_small[num_small_classes];
+        std::map<size_t, std::vector<void *> > p_large;
+        size_t p_cached_size;
+
+        mutable pthread_mutex_t p_mutex;
+
+        static unsigned int smallClass(size_t size);
+        static size_t largeClassSize(size_t size);
+
+        void *allocateSmall(unsigned int size_class);
+        void releaseSmall(void *ptr, unsigned int size_class);
+        size_t trimSlabs(unsigned int size_class);
+
+        static void linkSlab(Slab *&list, Slab *slab);
+        static void unlinkSlab(Slab *&list, Slab *slab);
+};
+
+}
+
+#endif
@@ -32,14 +32,189 @@
 
 #include "object.h"
 
+#include <pthread.h>
+#include <stdint.h>
+#include <cstddef>
+#include <cstdlib>
+
 using namespace Coal;
 
-static std::list<Object *>& getKnownObjects()
+/*
+ * Registry of the live objects, used by Object::isA() to validate the
+ * handles given by the application. The pointers are spread over shards,
+ * each one being an open-addressing hash table protected by its own mutex.
+ */
+
+static const unsigned int registry_shard_bits = 6;
+static const unsigned int registry_shards = 1 << registry_shard_bits;
+static const size_t registry_min_capacity = 64;
+
+// Marks a slot whose object was removed, probing has to continue past it
+static Object *const registry_tombstone = (Object *)1;
+
+struct RegistryShard
+{
+    pthread_mutex_t mutex;
+    Object **slots;
+    size_t capacity;    // Power of two
+    size_t used;        // Objects and tombstones
+    size_t count;       // Objects
+};
+
+static size_t registryHash(const Object *object)
+{
+    // Objects are at least 16-byte aligned, mix the significant bits
+    uint64_t h = (uint64_t)(uintptr_t)object >> 4;
+
+    h *= 0x9e3779b97f4a7c15ULL;
+
+    return (size_t)(h ^ (h >> 32));
+}
+
+static RegistryShard *registryShards()
+{
+    // Static storage, never destroyed as objects may be released after the
+    // static destructors
+    static RegistryShard shards[registry_shards];
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    struct Init
+    {
+        static void run()
+        {
+            for (unsigned int i=0; i<registry_shards; ++i)
+                pthread_mutex_init(&shards[i].mutex, 0);
+        }
+    };
+
+    pthread_once(&once, &Init::run);
+
+    return shards;
+}
+
+static RegistryShard &registryShard(size_t hash)
 {
-    static std::list<Object *> known_objects;
-    return known_objects;
+    return registryShards()[hash >> (sizeof(size_t) * 8 - registry_shard_bits)];
 }
 
+// Called with the mutex of the shard locked, false if there isn't enough
+// memory, the shard being then left unchanged
+static bool registryResize(RegistryShard &shard, size_t capacity)
+{
+    Object **old_slots = shard.slots;
+    size_t old_capacity = shard.capacity;
+    Object **slots = (Object **)std::calloc(capacity, sizeof(Object *));
+
+    if (!slots)
+        return false;
+
+    shard.slots = slots;
+    shard.capacity = capacity;
+    shard.used = shard.count;
+
+    for (size_t i=0; i<old_capacity; ++i)
+    {
+        Object *object = old_slots[i];
+
+        if (!object || object == registry_tombstone)
+            continue;
+
+        size_t index = registryHash(object) & (capacity - 1);
+
+        while (shard.slots[index])
+            index = (index + 1) & (capacity - 1);
+
+        shard.slots[index] = object;
+    }
+
+    std::free(old_slots);
+
+    return true;
+}
+
+static bool registryInsert(Object *object)
+{
+    size_t hash = registryHash(object);
+    RegistryShard &shard = registryShard(hash);
+
+    pthread_mutex_lock(&shard.mutex);
+
+    // Keep the load, tombstones included, under 3/4. Grow only if the
+    // objects themselves fill half of the table.
+    if ((shard.used + 1) * 4 > shard.capacity * 3)
+    {
+        size_t capacity = shard.capacity;
+
+        if (capacity < registry_min_capacity)
+            capacity = registry_min_capacity;
+        else if ((shard.count + 1) * 2 > capacity)
+            capacity *= 2;
+
+        // Without memory, a full table cannot take the object
+        if (!registryResize(shard, capacity) && shard.used + 1 >= shard.capacity)
+        {
+            pthread_mutex_unlock(&shard.mutex);
+            return false;
+        }
+    }
+
+    size_t index = hash & (shard.capacity - 1);
+
+    while (shard.slots[index] && shard.slots[index] != registry_tombstone)
+        index = (index + 1) & (shard.capacity - 1);
+
+    if (!shard.slots[index])
+        shard.used++;
+
+    shard.slots[index] = object;
+    shard.count++;
+
+    pthread_mutex_unlock(&shard.mutex);
+
+    return true;
+}
+
+// Called with the mutex of the shard locked, return the slot of object or -1
+static std::ptrdiff_t registryFind(const RegistryShard &shard, size_t hash,
+                              const Object *object)
+{
+    if (!shard.capacity)
+        return -1;
+
+    size_t index = hash & (shard.capacity - 1);
+
+    while (shard.slots[index])
+    {
+        if (shard.slots[index] == object)
+            return index;
+
+        index = (index + 1) & (shard.capacity - 1);
+    }
+
+    return -1;
+}
+
+static void registryRemove(Object *object)
+{
+    size_t hash = registryHash(object);
+    RegistryShard &shard = registryShard(hash);
+
+    pthread_mutex_lock(&shard.mutex);
+
+    std::ptrdiff_t index = registryFind(shard, hash, object);
+
+    if (index >= 0)
+    {
+        shard.slots[index] = registry_tombstone;
+        shard.count--;
+    }
+
+    pthread_mutex_unlock(&shard.mutex);
+}
+
+/*
+ * Object
+ */
 
 Object::Object(Type type, Object *parent)
 : p_references(1), p_parent(parent), p_type(type), p_release_parent(true)
@@ -47,9 +222,8 @@ Object::Object(Type type, Object *parent)
     if (parent)
         parent->reference();
 
-    // Add object in the list of known objects
-    getKnownObjects().push_front(this);
-    p_it = getKnownObjects().begin();
+    // Add object in the registry of known objects
+    p_registered = registryInsert(this);
 }
 
 Object::~Object()
@@ -57,19 +231,19 @@ Object::~Object()
     if (p_parent && p_parent->dereference() && p_release_parent)
         delete p_parent;
 
-    // Remove object from the list of known objects
-    getKnownObjects().erase(p_it);
+    // Remove object from the registry of known objects
+    if (p_registered)
+        registryRemove(this);
 }
 
 void Object::reference()
 {
-    p_references++;
+    __sync_add_and_fetch(&p_references, 1);
 }
 
 bool Object::dereference()
 {
-    p_references--;
-    return (p_references == 0);
+    return (__sync_sub_and_fetch(&p_references, 1) == 0);
 }
 
 void Object::setReleaseParent (bool release)
@@ -82,6 +256,11 @@ unsigned int Object::references() const
     return p_references;
 }
 
+bool Object::registered() const
+{
+    return p_registered;
+}
+
 Object *Object::parent() const
 {
     return p_parent;
@@ -98,16 +277,17 @@ bool Object::isA(Object::Type type) const
     if (this == 0)
         return false;
 
-    // Check that the value isn't garbage or freed pointer
-    std::list<Object *>::const_iterator it = getKnownObjects().begin(),
-                                        e = getKnownObjects().end();
-    while (it != e)
-    {
-        if (*it == this)
-            return this->type() == type;
+    // Check that the value isn't garbage or freed pointer. The type is read
+    // while the shard is locked, the object cannot be deleted meanwhile.
+    size_t hash = registryHash(this);
+    RegistryShard &shard = registryShard(hash);
+    bool rs;
 
-        ++it;
-    }
+    pthread_mutex_lock(&shard.mutex);
+
+    rs = (registryFind(shard, hash, this) >= 0 && p_type == type);
+
+    pthread_mutex_unlock(&shard.mutex);
 
-    return false;
+    return rs;
 }
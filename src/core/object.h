@@ -33,8 +33,6 @@
 #ifndef __REFCOUNTED_H__
 #define __REFCOUNTED_H__
 
-#include <list>
-
 namespace Coal
 {
 
@@ -44,7 +42,7 @@ namespace Coal
  * This class implements functions needed by all the Clover objects, like
  * reference counting, the object tree (parents/children), etc.
  * 
- * It also uses a special list of known objects, used to check that a pointer
+ * It also uses a registry of known objects, used to check that a pointer
  * passed by the user to an OpenCL function actually is an object of the correct
  * type. See \c isA().
  */
@@ -63,7 +61,8 @@ class Object
             T_Kernel,       /*!< \brief \c Coal::Kernel */
             T_MemObject,    /*!< \brief \c Coal::MemObject */
             T_Program,      /*!< \brief \c Coal::Program */
-            T_Sampler       /*!< \brief \c Coal::Sampler */
+            T_Sampler,      /*!< \brief \c Coal::Sampler */
+            T_CommandBuffer /*!< \brief \c Coal::CommandBuffer */
         };
 
         /**
@@ -107,6 +106,17 @@ class Object
          */
         void setReleaseParent(bool release);
 
+        /**
+         * \brief Returns whether this object made it into the registry
+         *
+         * The registry may fail to grow when memory is exhausted. An object
+         * left out of it is not recognized by \c isA(), so whoever creates
+         * it must delete it and return \c CL_OUT_OF_HOST_MEMORY.
+         *
+         * \return false if there was not enough memory to register the object
+         */
+        bool registered() const;
+
         Object *parent() const;    /*!< \brief Parent object */
         Type type() const;         /*!< \brief Type */
 
@@ -121,11 +131,11 @@ class Object
         bool isA(Type type) const;
 
     private:
-        unsigned int p_references;
+        volatile unsigned int p_references; /*!< \brief Changed atomically */
         Object *p_parent;
         Type p_type;
-        std::list<Object *>::iterator p_it;
         bool p_release_parent;
+        bool p_registered;
 };
 
 }
@@ -36,6 +36,7 @@
 #include "kernel.h"
 #include "propertylist.h"
 #include "deviceinterface.h"
+#include "trace.h"
 
 #include <string>
 #include <cstring>
@@ -167,6 +168,12 @@ Kernel *Program::createKernel(const std::string &name, cl_int *errcode_ret)
 {
     Kernel *rs = new Kernel(this);
 
+    if (!rs->registered())
+    {
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return rs;
+    }
+
     // Add a function definition for each device
     for (size_t i=0; i<p_device_dependent.size(); ++i)
     {
@@ -322,6 +329,10 @@ cl_int Program::build(const char *options,
 {
     p_state = Failed;
 
+    // The phases of the build are recorded in the trace of the context
+    Trace *trace = ((Context *)parent())->trace();
+    cl_ulong phase;
+
     // Set device infos
     if (!p_device_dependent.size())
     {
@@ -336,6 +347,8 @@ cl_int Program::build(const char *options,
         if (p_type == Source)
         {
             // Load source
+            phase = monotonicTime();
+
             const llvm::StringRef s_data(p_source);
             const llvm::StringRef s_name("<source>");
 
@@ -357,11 +370,15 @@ cl_int Program::build(const char *options,
             llvm::raw_string_ostream ostream(dep.unlinked_binary);
             llvm::WriteBitcodeToFile(dep.linked_module, ostream);
             ostream.flush();
+
+            trace->record(Trace::Build, "compile", phase);
         }
 
         // Link p_linked_module with the stdlib if the device needs that
         if (dep.program->linkStdLib())
         {
+            phase = monotonicTime();
+
             // Load the stdlib bitcode
             const llvm::StringRef s_data(embed_stdlib_c_bc,
                                          sizeof(embed_stdlib_c_bc) - 1);
@@ -396,9 +413,13 @@ cl_int Program::build(const char *options,
 
                 return CL_BUILD_PROGRAM_FAILURE;
             }
+
+            trace->record(Trace::Build, "link", phase);
         }
 
         // Get list of kernels to strip other unused functions
+        phase = monotonicTime();
+
         std::vector<const char *> api;
         std::vector<std::string> api_s;     // Needed to keep valid data in api
         const std::vector<llvm::Function *> &kernels = kernelFunctions(dep);
@@ -429,6 +450,9 @@ cl_int Program::build(const char *options,
         manager->run(*dep.linked_module);
         delete manager;
 
+        trace->record(Trace::Build, "optimize", phase);
+        phase = monotonicTime();
+
         // Now that the LLVM module is built, build the device-specific
         // representation
         if (!dep.program->build(dep.linked_module))
@@ -438,6 +462,8 @@ cl_int Program::build(const char *options,
 
             return CL_BUILD_PROGRAM_FAILURE;
         }
+
+        trace->record(Trace::Build, "device build", phase);
     }
 
     // TODO: Asynchronous compile
@@ -47,6 +47,12 @@ Sampler::Sampler(Context *ctx,
                  cl_int *errcode_ret)
 : Object(Object::T_Sampler, ctx), p_bitfield(0)
 {
+    if (!registered())
+    {
+        *errcode_ret = CL_OUT_OF_HOST_MEMORY;
+        return;
+    }
+
     if (normalized_coords)
         p_bitfield |= CLK_NORMALIZED_COORDS_TRUE;
     else
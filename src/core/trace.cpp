@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file trace.cpp
+ * \brief Execution trace of a context
+ */
+
+#include "trace.h"
+
+#include <time.h>
+#include <cstdio>
+
+using namespace Coal;
+
+cl_ulong Coal::monotonicTime()
+{
+    struct timespec tp;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+        clock_gettime(CLOCK_REALTIME, &tp);
+
+    return (cl_ulong)tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static volatile unsigned int enabled_traces = 0;
+static volatile unsigned int next_thread_id = 0;
+static __thread unsigned int thread_id = 0;
+
+Trace::Trace()
+: p_enabled(false), p_origin(0)
+{
+    pthread_mutex_init(&p_mutex, 0);
+}
+
+Trace::~Trace()
+{
+    setEnabled(false);
+
+    pthread_mutex_destroy(&p_mutex);
+}
+
+void Trace::setEnabled(bool enable)
+{
+    pthread_mutex_lock(&p_mutex);
+
+    if (enable)
+    {
+        p_spans.clear();
+        p_origin = monotonicTime();
+    }
+
+    if (enable && !p_enabled)
+        __sync_fetch_and_add(&enabled_traces, 1);
+    else if (!enable && p_enabled)
+        __sync_fetch_and_sub(&enabled_traces, 1);
+
+    p_enabled = enable;
+
+    pthread_mutex_unlock(&p_mutex);
+}
+
+bool Trace::enabled() const
+{
+    return p_enabled;
+}
+
+bool Trace::anyEnabled()
+{
+    return enabled_traces != 0;
+}
+
+unsigned int Trace::threadId()
+{
+    if (!thread_id)
+        thread_id = __sync_add_and_fetch(&next_thread_id, 1);
+
+    return thread_id;
+}
+
+void Trace::record(Span &span)
+{
+    span.thread = threadId();
+
+    pthread_mutex_lock(&p_mutex);
+
+    if (p_enabled)
+        p_spans.push_back(span);
+
+    pthread_mutex_unlock(&p_mutex);
+}
+
+void Trace::record(Category category, const std::string &name,
+                   cl_ulong start)
+{
+    Span span;
+
+    span.category = category;
+    span.name = name;
+    span.start = start;
+    span.end = monotonicTime();
+    span.work_dim = 0;
+    span.queue_wait = 0;
+
+    record(span);
+}
+
+// Nanoseconds as microseconds, the unit of the trace-event format
+static void appendTime(std::string &out, cl_ulong ns)
+{
+    char buf[32];
+
+    std::snprintf(buf, sizeof(buf), "%llu.%03u", (unsigned long long)(ns / 1000),
+                  (unsigned int)(ns % 1000));
+    out += buf;
+}
+
+static void appendString(std::string &out, const std::string &s)
+{
+    out += '"';
+
+    for (size_t i=0; i<s.size(); ++i)
+    {
+        unsigned char c = s[i];
+
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20)
+        {
+            char buf[8];
+
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+
+    out += '"';
+}
+
+std::string Trace::json() const
+{
+    static const char *const categories[] = {"work-group", "build", "jit"};
+    std::string out;
+    char buf[64];
+
+    pthread_mutex_lock(&p_mutex);
+
+    out.reserve(64 + p_spans.size() * 160);
+    out += "{\"traceEvents\":[";
+
+    for (size_t i=0; i<p_spans.size(); ++i)
+    {
+        const Span &span = p_spans[i];
+
+        // Spans already running when the trace started are cut
+        cl_ulong start = (span.start > p_origin ? span.start : p_origin);
+        cl_ulong end = (span.end > start ? span.end : start);
+
+        if (i)
+            out += ',';
+
+        out += "\n{\"name\":";
+        appendString(out, span.name);
+        out += ",\"cat\":\"";
+        out += categories[span.category];
+        std::snprintf(buf, sizeof(buf), "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,",
+                      span.thread);
+        out += buf;
+        out += "\"ts\":";
+        appendTime(out, start - p_origin);
+        out += ",\"dur\":";
+        appendTime(out, end - start);
+
+        if (span.work_dim)
+        {
+            out += ",\"args\":{\"group\":[";
+
+            for (cl_uint d=0; d<span.work_dim; ++d)
+            {
+                std::snprintf(buf, sizeof(buf), d ? ",%lu" : "%lu",
+                              (unsigned long)span.group[d]);
+                out += buf;
+            }
+
+            out += "],\"queue_wait_us\":";
+            appendTime(out, span.queue_wait);
+            out += '}';
+        }
+
+        out += '}';
+    }
+
+    pthread_mutex_unlock(&p_mutex);
+
+    out += "\n],\"displayTimeUnit\":\"ns\"}\n";
+
+    return out;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2011, Denis Steckelmacher <steckdenis@yahoo.fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file trace.h
+ * \brief Execution trace of a context
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <CL/cl.h>
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+namespace Coal
+{
+
+/**
+ * \brief Current time, in nanoseconds
+ *
+ * Read from \c CLOCK_MONOTONIC. It is the clock of the profiling info of the
+ * events and of the traces.
+ */
+cl_ulong monotonicTime();
+
+/**
+ * \brief Execution trace
+ *
+ * Each \c Coal::Context owns a trace, disabled by default. Once enabled, it
+ * records what happens in the context as spans of time:
+ *
+ * - Each work-group of a kernel, with the worker thread that ran it and the
+ *   time this worker waited for the device queue before taking it
+ * - The phases of \c Coal::Program::build()
+ * - The JIT compilation of the programs and kernels
+ *
+ * \c json() exports the spans in the Chrome trace-event format, that
+ * <tt>chrome://tracing</tt> and Perfetto display as one timeline per thread.
+ */
+class Trace
+{
+    public:
+        Trace();
+        ~Trace();
+
+        /**
+         * \brief Category of a span
+         */
+        enum Category
+        {
+            WorkGroup,  /*!< \brief Work-group of a kernel, named after it */
+            Build,      /*!< \brief Phase of a program build */
+            JIT         /*!< \brief JIT compilation, of a program or a kernel */
+        };
+
+        /**
+         * \brief Span of time recorded in a trace
+         */
+        struct Span
+        {
+            Category category;
+            std::string name;
+            cl_ulong start, end;        /*!< \brief From \c monotonicTime() */
+            unsigned int thread;        /*!< \brief See \c threadId() */
+            cl_uint work_dim;           /*!< \brief Dimensions of \c group, 0 if not a work-group */
+            size_t group[3];            /*!< \brief Index of the work-group */
+            cl_ulong queue_wait;        /*!< \brief Time waited for the device queue before the work-group, in nanoseconds */
+        };
+
+        /**
+         * \brief Start or stop recording
+         *
+         * Starting a trace discards the spans previously recorded.
+         *
+         * \param enable true to start recording, false to stop
+         */
+        void setEnabled(bool enable);
+        bool enabled() const;       /*!< \brief The trace is recording */
+
+        /**
+         * \brief Record a span
+         *
+         * Does nothing if the trace isn't enabled. \c Span::thread is set
+         * to the calling thread.
+         */
+        void record(Span &span);
+
+        /**
+         * \brief Record a span without work-group
+         * \param category category of the span
+         * \param name name of the span
+         * \param start beginning of the span, from \c monotonicTime()
+         */
+        void record(Category category, const std::string &name,
+                    cl_ulong start);
+
+        /**
+         * \brief Export the trace
+         * \return the recorded spans, in the Chrome trace-event JSON format.
+         *         Timestamps are relative to the moment the trace was
+         *         started.
+         */
+        std::string json() const;
+
+        /**
+         * \brief Small integer identifying the calling thread
+         *
+         * Threads are numbered from 1 in the order they first record a span.
+         */
+        static unsigned int threadId();
+
+        /**
+         * \brief At least one trace is enabled
+         *
+         * Lets the worker threads skip reading the time when nobody
+         * traces.
+         */
+        static bool anyEnabled();
+
+    private:
+        mutable pthread_mutex_t p_mutex;
+        volatile bool p_enabled;
+        cl_ulong p_origin;
+        std::vector<Span> p_spans;
+};
+
+}
+
+#endif
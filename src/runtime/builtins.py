@@ -91,8 +91,10 @@ class Function:
             else:
                 vecdim = current_type[-1]
 
-        # $vecdim expansion
-        return type_name.replace('$vecdim', vecdim).replace('$type', current_type)
+        # $vecdim and $scalar expansion ($scalar is the element type)
+        return type_name.replace('$vecdim', vecdim) \
+                        .replace('$scalar', current_type.rstrip('0123456789')) \
+                        .replace('$type', current_type)
 
     def arg_list(self, current_type, handle_first_arg):
         rs = ''
@@ -251,7 +253,8 @@ class Function:
                     vecdim = current_type[-1]
 
             rs += self.body.replace('$type', current_type) \
-                           .replace('$vecdim', vecdim)
+                           .replace('$vecdim', vecdim) \
+                           .replace('$scalar', current_type.rstrip('0123456789'))
             rs += '\n}\n\n'
 
         return rs
@@ -368,6 +371,293 @@ class Parser:
 
         def_file.close()
 
+class Conversions:
+    """Generates the convert_<type>[_sat][_<rounding>] family
+
+    Scalar conversions are written with the exact range and rounding checks
+    they need for a given pair of types, vector conversions are built from
+    them lane by lane (or half by half) so that LLVM can merge them back in
+    packed conversions and packs.
+    """
+
+    # name : (bits, signed)
+    int_types = {
+        'char': (8, True), 'uchar': (8, False),
+        'short': (16, True), 'ushort': (16, False),
+        'int': (32, True), 'uint': (32, False),
+        'long': (64, True), 'ulong': (64, False),
+    }
+
+    # name : (mantissa bits, builtin suffix)
+    float_types = {
+        'float': (24, 'f'),
+        'double': (53, ''),
+    }
+
+    types = ['char', 'uchar', 'short', 'ushort', 'int', 'uint', 'long',
+             'ulong', 'float', 'double']
+    dims = ['', '2', '3', '4', '8', '16']
+    roundings = ['', '_rte', '_rtz', '_rtp', '_rtn']
+
+    def __init__(self, generator):
+        self.generator = generator
+
+    def range_of(self, ty):
+        bits, signed = self.int_types[ty]
+
+        if signed:
+            return (-(1 << (bits - 1)), (1 << (bits - 1)) - 1)
+        else:
+            return (0, (1 << bits) - 1)
+
+    def int_literal(self, value):
+        if value > (1 << 63) - 1:
+            return '%dUL' % value
+        elif value == -(1 << 63):
+            return '(-9223372036854775807L - 1)'
+        else:
+            return '%dL' % value
+
+    def float_literal(self, value, ty):
+        # Bounds are powers of two or small integers, exact in both types
+        rs = float(value).hex()
+
+        if ty == 'float':
+            rs += 'f'
+
+        return rs
+
+    def scalar_body(self, dst, src, sat, rounding):
+        if dst == src:
+            return '    return x;\n'
+
+        if src in self.int_types and dst in self.int_types:
+            return self.int_to_int(dst, src, sat)
+        elif dst in self.int_types:
+            return self.float_to_int(dst, src, sat, rounding)
+        elif src in self.int_types:
+            return self.int_to_float(dst, src, rounding)
+        else:
+            return self.float_to_float(dst, src, rounding)
+
+    def int_to_int(self, dst, src, sat):
+        src_min, src_max = self.range_of(src)
+        dst_min, dst_max = self.range_of(dst)
+        rs = '(%s)x' % dst
+
+        if not sat:
+            return '    return %s;\n' % rs
+
+        if src_max > dst_max:
+            rs = '(x > %s ? (%s)%s : %s)' % (self.int_literal(dst_max), dst,
+                                             self.int_literal(dst_max), rs)
+        if src_min < dst_min:
+            rs = '(x < %s ? (%s)%s : %s)' % (self.int_literal(dst_min), dst,
+                                             self.int_literal(dst_min), rs)
+
+        return '    return %s;\n' % rs
+
+    def float_to_int(self, dst, src, sat, rounding):
+        suffix = self.float_types[src][1]
+        dst_min, dst_max = self.range_of(dst)
+        fn = {
+            '': None,
+            '_rtz': None,
+            '_rte': '__builtin_rint',
+            '_rtp': '__builtin_ceil',
+            '_rtn': '__builtin_floor',
+        }[rounding]
+
+        rs = ''
+
+        if fn:
+            rs += '    x = %s%s(x);\n' % (fn, suffix)
+
+        if not sat:
+            return rs + '    return (%s)x;\n' % dst
+
+        # NaN gives 0, values out of the range are clamped
+        rs += '    return (x != x ? (%s)0 :\n' % dst
+        rs += '            x <= %s ? (%s)%s :\n' % \
+            (self.float_literal(dst_min, src), dst, self.int_literal(dst_min))
+        rs += '            x >= %s ? (%s)%s :\n' % \
+            (self.float_literal(dst_max + 1, src), dst,
+             self.int_literal(dst_max))
+        rs += '            (%s)x);\n' % dst
+
+        return rs
+
+    def int_to_float(self, dst, src, rounding):
+        bits, signed = self.int_types[src]
+        mantissa, suffix = self.float_types[dst]
+
+        if rounding in ('', '_rte') or bits - (1 if signed else 0) <= mantissa:
+            # Exact, or round to nearest even as the hardware does
+            return '    return (%s)x;\n' % dst
+
+        rs = '    %s r = (%s)x;\n' % (dst, dst)
+
+        # Compare the rounded value with x. For 64-bit sources, r may be
+        # 2^63 or 2^64, that cannot be converted back
+        if bits == 64:
+            rs += '    int cmp = (r >= %s ? 1 : ((%s)r > x) - ((%s)r < x));\n' % \
+                (self.float_literal(1 << (bits - 1 if signed else bits), dst),
+                 src, src)
+        else:
+            rs += '    int cmp = ((long)r > (long)x) - ((long)r < (long)x);\n'
+
+        rs += self.adjust(dst, rounding)
+
+        return rs
+
+    def float_to_float(self, dst, src, rounding):
+        if self.float_types[dst][0] >= self.float_types[src][0] or \
+           rounding in ('', '_rte'):
+            return '    return (%s)x;\n' % dst
+
+        rs = '    %s r = (%s)x;\n' % (dst, dst)
+        rs += '    int cmp = ((%s)r > x) - ((%s)r < x);\n' % (src, src)
+        rs += self.adjust(dst, rounding)
+
+        return rs
+
+    def adjust(self, dst, rounding):
+        # cmp is 1 if r > x, -1 if r < x. Move r by one ulp if needed
+        suffix = self.float_types[dst][1]
+        rs = ''
+
+        if rounding == '_rtz':
+            rs += '    if ((cmp > 0 && r > 0) || (cmp < 0 && r < 0))\n'
+            rs += '        r = __builtin_nextafter%s(r, 0);\n' % suffix
+        elif rounding == '_rtp':
+            rs += '    if (cmp < 0)\n'
+            rs += '        r = __builtin_nextafter%s(r, __builtin_inf%s());\n' % \
+                (suffix, suffix)
+        elif rounding == '_rtn':
+            rs += '    if (cmp > 0)\n'
+            rs += '        r = __builtin_nextafter%s(r, -__builtin_inf%s());\n' % \
+                (suffix, suffix)
+
+        rs += '\n    return r;\n'
+
+        return rs
+
+    def vector_body(self, dst, src, dim, sat, rounding):
+        name = 'convert_' + dst
+        mode = ('_sat' if sat else '') + rounding
+        n = int(dim)
+
+        if n > 4:
+            # Build from the two halves
+            half = str(n // 2)
+            return '    return (%s%s)(%s%s%s(x.lo), %s%s%s(x.hi));\n' % \
+                (dst, dim, name, half, mode, name, half, mode)
+
+        rs = ''
+
+        if sat and src in self.float_types and self.int_types[dst][0] <= 16:
+            # The bounds are exact in float, clamp the whole vector at
+            # once (NaN gives 0) and convert the lanes without checks
+            dst_min, dst_max = self.range_of(dst)
+            lo = self.float_literal(dst_min, src)
+            hi = self.float_literal(dst_max, src)
+
+            rs += '    x = (x != x ? (%s%s)0 : x);\n' % (src, dim)
+            rs += '    x = (x < %s ? (%s%s)%s : x);\n' % (lo, src, dim, lo)
+            rs += '    x = (x > %s ? (%s%s)%s : x);\n\n' % (hi, src, dim, hi)
+            mode = rounding
+
+        lanes = ['%s%s(x.s%x)' % (name, mode, i) for i in range(n)]
+
+        rs += '    return (%s%s)(%s);\n' % (dst, dim, ', '.join(lanes))
+
+        return rs
+
+    def generate(self):
+        for dst in self.types:
+            sats = [False]
+
+            if dst in self.int_types:
+                sats.append(True)
+
+            for sat in sats:
+                for rounding in self.roundings:
+                    for dim in self.dims:
+                        name = 'convert_' + dst + dim
+
+                        if sat:
+                            name += '_sat'
+
+                        name += rounding
+
+                        for src in self.types:
+                            func = Function(name, False)
+                            func.set_return_type(dst + dim)
+                            func.add_arg('x', '$type')
+                            func.add_type(src + dim)
+
+                            if dim:
+                                func.append_body(self.vector_body(dst, src,
+                                                 dim, sat, rounding))
+                            else:
+                                func.append_body(self.scalar_body(dst, src,
+                                                 sat, rounding))
+
+                            self.generator.add_function(func)
+
+
+class Shuffles:
+    """Generates shuffle and shuffle2 for every vector size combination
+
+    Each lane of the result is an element picked in the source vectors. When
+    the mask is a constant, which is by far the most common case, LLVM folds
+    the lanes in a single shufflevector.
+    """
+
+    # element type : mask element type
+    types = [
+        ('char', 'uchar'), ('uchar', 'uchar'),
+        ('short', 'ushort'), ('ushort', 'ushort'),
+        ('int', 'uint'), ('uint', 'uint'), ('float', 'uint'),
+        ('long', 'ulong'), ('ulong', 'ulong'), ('double', 'ulong'),
+    ]
+    dims = [2, 4, 8, 16]
+
+    def __init__(self, generator):
+        self.generator = generator
+
+    def generate(self):
+        for ty, mask_ty in self.types:
+            for n in self.dims:
+                for m in self.dims:
+                    # gentypen shuffle(gentypem x, ugentypen mask)
+                    lanes = ['x[mask.s%x & %i]' % (i, m - 1) for i in range(n)]
+
+                    func = Function('shuffle', False)
+                    func.set_return_type('%s%i' % (ty, n))
+                    func.add_type('%s%i' % (ty, m))
+                    func.add_arg('x', '$type')
+                    func.add_arg('mask', '%s%i' % (mask_ty, n))
+                    func.append_body('    return (%s%i)(%s);\n' %
+                                     (ty, n, ', '.join(lanes)))
+
+                    self.generator.add_function(func)
+
+                    # gentypen shuffle2(gentypem x, gentypem y, ugentypen mask)
+                    lanes = ['(mask.s%x & %i ? y : x)[mask.s%x & %i]' %
+                             (i, m, i, m - 1) for i in range(n)]
+
+                    func = Function('shuffle2', False)
+                    func.set_return_type('%s%i' % (ty, n))
+                    func.add_type('%s%i' % (ty, m))
+                    func.add_arg('x', '$type')
+                    func.add_arg('y', '$type')
+                    func.add_arg('mask', '%s%i' % (mask_ty, n))
+                    func.append_body('    return (%s%i)(%s);\n' %
+                                     (ty, n, ',\n        '.join(lanes)))
+
+                    self.generator.add_function(func)
+
 if __name__ == '__main__':
     def_file = sys.argv[1]
     out_dir = sys.argv[2]
@@ -376,4 +666,6 @@ if __name__ == '__main__':
     parser = Parser(gen, def_file)
 
     parser.parse()
+    Conversions(gen).generate()
+    Shuffles(gen).generate()
     gen.write()
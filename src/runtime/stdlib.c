@@ -37,13 +37,8 @@ int debug(const char *format, ...);
  * Image functions
  */
 
-int __cpu_get_image_width(void *image);
-int __cpu_get_image_height(void *image);
-int __cpu_get_image_depth(void *image);
-int __cpu_get_image_channel_data_type(void *image);
-int __cpu_get_image_channel_order(void *image);
-int __cpu_is_image_3d(void *image);
 void *__cpu_image_data(void *image, int x, int y, int z, int *order, int *type);
+int __cpu_is_image_3d(void *image);
 
 void __cpu_write_imagef(void *image, int x, int y, int z, float4 *color);
 void __cpu_write_imagei(void *image, int x, int y, int z, int4 *color);
@@ -62,11 +57,232 @@ void __cpu_read_imageif(int4 *result, void *image, float x, float y, float z,
 void __cpu_read_imageuif(uint4 *result, void *image, float x, float y, float z,
                         sampler_t sampler);
 
+/* The kernels receive a Coal::CPUImageDescriptor for each image. Pixels of the
+ * common formats are addressed and converted here, and these functions are
+ * inlined in the kernels. When the sampler is a constant, all the tests on it
+ * fold away. Everything else goes to the sampling engine of Clover. */
+
+#define COAL_TILE_SHIFT 2   /* Coal::CPUBuffer::tile_shift */
+#define COAL_TILE_MASK  3
+
+#define COAL_SAMPLER_NORMALIZED 0x00f
+#define COAL_SAMPLER_ADDRESS    0x0f0
+#define COAL_SAMPLER_FILTER     0xf00
+
+enum __coal_fast_format
+{
+    COAL_FORMAT_OTHER,
+    COAL_FORMAT_RGBA_UNORM_INT8,
+    COAL_FORMAT_BGRA_UNORM_INT8,
+    COAL_FORMAT_RGBA_FLOAT,
+    COAL_FORMAT_RGBA_INT32
+};
+
+int __coal_image_format(struct image2d *image)
+{
+    if (image->order == CLK_RGBA)
+    {
+        switch (image->type)
+        {
+            case CLK_UNORM_INT8:
+                return COAL_FORMAT_RGBA_UNORM_INT8;
+            case CLK_FLOAT:
+                return COAL_FORMAT_RGBA_FLOAT;
+            case CLK_SIGNED_INT32:
+            case CLK_UNSIGNED_INT32:
+                return COAL_FORMAT_RGBA_INT32;
+        }
+    }
+    else if (image->order == CLK_BGRA && image->type == CLK_UNORM_INT8)
+    {
+        return COAL_FORMAT_BGRA_UNORM_INT8;
+    }
+
+    return COAL_FORMAT_OTHER;
+}
+
+uchar *__coal_pixel(struct image2d *image, int x, int y, int z)
+{
+    if (image->tiles_x)
+    {
+        /* See Coal::CPUBuffer::texelAddress() */
+        int depth_mask = (1 << image->tile_depth_shift) - 1;
+        size_t tile, inside;
+
+        tile = ((size_t)(z >> image->tile_depth_shift) * image->tiles_y
+                + (y >> COAL_TILE_SHIFT)) * image->tiles_x
+               + (x >> COAL_TILE_SHIFT);
+        inside = ((((z & depth_mask) << COAL_TILE_SHIFT) + (y & COAL_TILE_MASK))
+                  << COAL_TILE_SHIFT) + (x & COAL_TILE_MASK);
+
+        return image->data +
+            ((tile << image->tile_texels_shift) + inside) * image->pixel_size;
+    }
+
+    return image->data + z * image->slice_pitch + y * image->row_pitch
+                       + x * image->pixel_size;
+}
+
+/* Address of the pixel read with integer coordinates, 0 if the read must be
+ * done by Clover. Like the sampling engine, CLK_ADDRESS_NONE clamps. */
+uchar *__coal_sampled_pixel(struct image2d *image, sampler_t sampler,
+                            int x, int y, int z)
+{
+    if (sampler & (COAL_SAMPLER_NORMALIZED | COAL_SAMPLER_FILTER))
+        return 0;
+
+    switch (sampler & COAL_SAMPLER_ADDRESS)
+    {
+        case CLK_ADDRESS_NONE:
+        case CLK_ADDRESS_CLAMP_TO_EDGE:
+            break;
+        default:
+            return 0;
+    }
+
+    x = clamp(x, 0, (int)image->width - 1);
+    y = clamp(y, 0, (int)image->height - 1);
+    z = clamp(z, 0, (int)image->depth - 1);
+
+    return __coal_pixel(image, x, y, z);
+}
+
+int __coal_ifloor(float x)
+{
+    int i = (int)x;
+
+    return i - (x < (float)i);
+}
+
+/* Integer coordinates of the pixel nearest to (x, y, z) for samplers that
+ * don't filter, 0 if Clover has to be called */
+int __coal_nearest(struct image2d *image, sampler_t sampler, float x, float y,
+                   float z, int *i, int *j, int *k)
+{
+    if (sampler & COAL_SAMPLER_FILTER)
+        return 0;
+
+    if (sampler & COAL_SAMPLER_NORMALIZED)
+    {
+        x *= (float)image->width;
+        y *= (float)image->height;
+        z *= (float)image->depth;
+    }
+
+    *i = __coal_ifloor(x);
+    *j = __coal_ifloor(y);
+    *k = __coal_ifloor(z);
+
+    return 1;
+}
+
+int __coal_read_fast(float4 *result, struct image2d *image, sampler_t sampler,
+                     int x, int y, int z)
+{
+    int format = __coal_image_format(image);
+    uchar *p;
+    float *f;
+
+    if (format == COAL_FORMAT_OTHER || format == COAL_FORMAT_RGBA_INT32)
+        return 0;
+
+    p = __coal_sampled_pixel(image, sampler, x, y, z);
+
+    if (!p)
+        return 0;
+
+    switch (format)
+    {
+        case COAL_FORMAT_RGBA_UNORM_INT8:
+            *result = convert_float4((uchar4)(p[0], p[1], p[2], p[3]))
+                      * (1.0f / 255.0f);
+            break;
+        case COAL_FORMAT_BGRA_UNORM_INT8:
+            *result = convert_float4((uchar4)(p[2], p[1], p[0], p[3]))
+                      * (1.0f / 255.0f);
+            break;
+        case COAL_FORMAT_RGBA_FLOAT:
+            f = (float *)p;
+            *result = (float4)(f[0], f[1], f[2], f[3]);
+            break;
+    }
+
+    return 1;
+}
+
+int __coal_read_fast_int(int4 *result, struct image2d *image, sampler_t sampler,
+                         int x, int y, int z)
+{
+    int *v;
+
+    if (__coal_image_format(image) != COAL_FORMAT_RGBA_INT32)
+        return 0;
+
+    v = (int *)__coal_sampled_pixel(image, sampler, x, y, z);
+
+    if (!v)
+        return 0;
+
+    *result = (int4)(v[0], v[1], v[2], v[3]);
+
+    return 1;
+}
+
+int __coal_write_fast(struct image2d *image, int x, int y, int z, float4 color)
+{
+    int format = __coal_image_format(image);
+    uchar4 c;
+    uchar *p;
+    float *f;
+
+    if (format == COAL_FORMAT_OTHER || format == COAL_FORMAT_RGBA_INT32 ||
+        (uint)x >= image->width || (uint)y >= image->height ||
+        (uint)z >= image->depth)
+        return 0;
+
+    p = __coal_pixel(image, x, y, z);
+
+    switch (format)
+    {
+        case COAL_FORMAT_RGBA_UNORM_INT8:
+            c = convert_uchar4_sat_rte(color * 255.0f);
+            p[0] = c.x; p[1] = c.y; p[2] = c.z; p[3] = c.w;
+            break;
+        case COAL_FORMAT_BGRA_UNORM_INT8:
+            c = convert_uchar4_sat_rte(color * 255.0f);
+            p[0] = c.z; p[1] = c.y; p[2] = c.x; p[3] = c.w;
+            break;
+        case COAL_FORMAT_RGBA_FLOAT:
+            f = (float *)p;
+            f[0] = color.x; f[1] = color.y; f[2] = color.z; f[3] = color.w;
+            break;
+    }
+
+    return 1;
+}
+
+int __coal_write_fast_int(struct image2d *image, int x, int y, int z, int4 color)
+{
+    int *v;
+
+    if (__coal_image_format(image) != COAL_FORMAT_RGBA_INT32 ||
+        (uint)x >= image->width || (uint)y >= image->height ||
+        (uint)z >= image->depth)
+        return 0;
+
+    v = (int *)__coal_pixel(image, x, y, z);
+    v[0] = color.x; v[1] = color.y; v[2] = color.z; v[3] = color.w;
+
+    return 1;
+}
+
 float4 OVERLOAD read_imagef(image2d_t image, sampler_t sampler, int2 coord)
 {
     float4 rs;
 
-    __cpu_read_imagefi(&rs, image, coord.x, coord.y, 0, sampler);
+    if (!__coal_read_fast(&rs, (struct image2d *)image, sampler, coord.x,
+                          coord.y, 0))
+        __cpu_read_imagefi(&rs, image, coord.x, coord.y, 0, sampler);
 
     return rs;
 }
@@ -75,7 +291,9 @@ float4 OVERLOAD read_imagef(image3d_t image, sampler_t sampler, int4 coord)
 {
     float4 rs;
 
-    __cpu_read_imagefi(&rs, image, coord.x, coord.y, coord.z, sampler);
+    if (!__coal_read_fast(&rs, (struct image2d *)image, sampler, coord.x,
+                          coord.y, coord.z))
+        __cpu_read_imagefi(&rs, image, coord.x, coord.y, coord.z, sampler);
 
     return rs;
 }
@@ -83,8 +301,13 @@ float4 OVERLOAD read_imagef(image3d_t image, sampler_t sampler, int4 coord)
 float4 OVERLOAD read_imagef(image2d_t image, sampler_t sampler, float2 coord)
 {
     float4 rs;
+    int x, y, z;
 
-    __cpu_read_imageff(&rs, image, coord.x, coord.y, 0.0f, sampler);
+    if (!__coal_nearest((struct image2d *)image, sampler, coord.x, coord.y,
+                        0.0f, &x, &y, &z) ||
+        !__coal_read_fast(&rs, (struct image2d *)image,
+                          sampler & ~COAL_SAMPLER_NORMALIZED, x, y, z))
+        __cpu_read_imageff(&rs, image, coord.x, coord.y, 0.0f, sampler);
 
     return rs;
 }
@@ -92,8 +315,13 @@ float4 OVERLOAD read_imagef(image2d_t image, sampler_t sampler, float2 coord)
 float4 OVERLOAD read_imagef(image3d_t image, sampler_t sampler, float4 coord)
 {
     float4 rs;
+    int x, y, z;
 
-    __cpu_read_imageff(&rs, image, coord.x, coord.y, coord.z, sampler);
+    if (!__coal_nearest((struct image2d *)image, sampler, coord.x, coord.y,
+                        coord.z, &x, &y, &z) ||
+        !__coal_read_fast(&rs, (struct image2d *)image,
+                          sampler & ~COAL_SAMPLER_NORMALIZED, x, y, z))
+        __cpu_read_imageff(&rs, image, coord.x, coord.y, coord.z, sampler);
 
     return rs;
 }
@@ -102,7 +330,9 @@ int4 OVERLOAD read_imagei(image2d_t image, sampler_t sampler, int2 coord)
 {
     int4 rs;
 
-    __cpu_read_imageii(&rs, image, coord.x, coord.y, 0, sampler);
+    if (!__coal_read_fast_int(&rs, (struct image2d *)image, sampler, coord.x,
+                              coord.y, 0))
+        __cpu_read_imageii(&rs, image, coord.x, coord.y, 0, sampler);
 
     return rs;
 }
@@ -111,7 +341,9 @@ int4 OVERLOAD read_imagei(image3d_t image, sampler_t sampler, int4 coord)
 {
     int4 rs;
 
-    __cpu_read_imageii(&rs, image, coord.x, coord.y, coord.z, sampler);
+    if (!__coal_read_fast_int(&rs, (struct image2d *)image, sampler, coord.x,
+                              coord.y, coord.z))
+        __cpu_read_imageii(&rs, image, coord.x, coord.y, coord.z, sampler);
 
     return rs;
 }
@@ -119,8 +351,13 @@ int4 OVERLOAD read_imagei(image3d_t image, sampler_t sampler, int4 coord)
 int4 OVERLOAD read_imagei(image2d_t image, sampler_t sampler, float2 coord)
 {
     int4 rs;
+    int x, y, z;
 
-    __cpu_read_imageif(&rs, image, coord.x, coord.y, 0.0f, sampler);
+    if (!__coal_nearest((struct image2d *)image, sampler, coord.x, coord.y,
+                        0.0f, &x, &y, &z) ||
+        !__coal_read_fast_int(&rs, (struct image2d *)image,
+                              sampler & ~COAL_SAMPLER_NORMALIZED, x, y, z))
+        __cpu_read_imageif(&rs, image, coord.x, coord.y, 0.0f, sampler);
 
     return rs;
 }
@@ -128,8 +365,13 @@ int4 OVERLOAD read_imagei(image2d_t image, sampler_t sampler, float2 coord)
 int4 OVERLOAD read_imagei(image3d_t image, sampler_t sampler, float4 coord)
 {
     int4 rs;
+    int x, y, z;
 
-    __cpu_read_imageif(&rs, image, coord.x, coord.y, coord.z, sampler);
+    if (!__coal_nearest((struct image2d *)image, sampler, coord.x, coord.y,
+                        coord.z, &x, &y, &z) ||
+        !__coal_read_fast_int(&rs, (struct image2d *)image,
+                              sampler & ~COAL_SAMPLER_NORMALIZED, x, y, z))
+        __cpu_read_imageif(&rs, image, coord.x, coord.y, coord.z, sampler);
 
     return rs;
 }
@@ -137,6 +379,11 @@ int4 OVERLOAD read_imagei(image3d_t image, sampler_t sampler, float4 coord)
 uint4 OVERLOAD read_imageui(image2d_t image, sampler_t sampler, int2 coord)
 {
     uint4 rs;
+    int4 v;
+
+    if (__coal_read_fast_int(&v, (struct image2d *)image, sampler, coord.x,
+                             coord.y, 0))
+        return (uint4)v;
 
     __cpu_read_imageuii(&rs, image, coord.x, coord.y, 0, sampler);
 
@@ -146,6 +393,11 @@ uint4 OVERLOAD read_imageui(image2d_t image, sampler_t sampler, int2 coord)
 uint4 OVERLOAD read_imageui(image3d_t image, sampler_t sampler, int4 coord)
 {
     uint4 rs;
+    int4 v;
+
+    if (__coal_read_fast_int(&v, (struct image2d *)image, sampler, coord.x,
+                             coord.y, coord.z))
+        return (uint4)v;
 
     __cpu_read_imageuii(&rs, image, coord.x, coord.y, coord.z, sampler);
 
@@ -155,6 +407,14 @@ uint4 OVERLOAD read_imageui(image3d_t image, sampler_t sampler, int4 coord)
 uint4 OVERLOAD read_imageui(image2d_t image, sampler_t sampler, float2 coord)
 {
     uint4 rs;
+    int4 v;
+    int x, y, z;
+
+    if (__coal_nearest((struct image2d *)image, sampler, coord.x, coord.y,
+                       0.0f, &x, &y, &z) &&
+        __coal_read_fast_int(&v, (struct image2d *)image,
+                             sampler & ~COAL_SAMPLER_NORMALIZED, x, y, z))
+        return (uint4)v;
 
     __cpu_read_imageuif(&rs, image, coord.x, coord.y, 0.0f, sampler);
 
@@ -164,6 +424,14 @@ uint4 OVERLOAD read_imageui(image2d_t image, sampler_t sampler, float2 coord)
 uint4 OVERLOAD read_imageui(image3d_t image, sampler_t sampler, float4 coord)
 {
     uint4 rs;
+    int4 v;
+    int x, y, z;
+
+    if (__coal_nearest((struct image2d *)image, sampler, coord.x, coord.y,
+                       coord.z, &x, &y, &z) &&
+        __coal_read_fast_int(&v, (struct image2d *)image,
+                             sampler & ~COAL_SAMPLER_NORMALIZED, x, y, z))
+        return (uint4)v;
 
     __cpu_read_imageuif(&rs, image, coord.x, coord.y, coord.z, sampler);
 
@@ -172,32 +440,43 @@ uint4 OVERLOAD read_imageui(image3d_t image, sampler_t sampler, float4 coord)
 
 void OVERLOAD write_imagef(image2d_t image, int2 coord, float4 color)
 {
-    __cpu_write_imagef(image, coord.x, coord.y, 0, &color);
+    if (!__coal_write_fast((struct image2d *)image, coord.x, coord.y, 0, color))
+        __cpu_write_imagef(image, coord.x, coord.y, 0, &color);
 }
 
 void OVERLOAD write_imagef(image3d_t image, int4 coord, float4 color)
 {
-    __cpu_write_imagef(image, coord.x, coord.y, coord.z, &color);
+    if (!__coal_write_fast((struct image2d *)image, coord.x, coord.y, coord.z,
+                           color))
+        __cpu_write_imagef(image, coord.x, coord.y, coord.z, &color);
 }
 
 void OVERLOAD write_imagei(image2d_t image, int2 coord, int4 color)
 {
-    __cpu_write_imagei(image, coord.x, coord.y, 0, &color);
+    if (!__coal_write_fast_int((struct image2d *)image, coord.x, coord.y, 0,
+                               color))
+        __cpu_write_imagei(image, coord.x, coord.y, 0, &color);
 }
 
 void OVERLOAD write_imagei(image3d_t image, int4 coord, int4 color)
 {
-    __cpu_write_imagei(image, coord.x, coord.y, coord.z, &color);
+    if (!__coal_write_fast_int((struct image2d *)image, coord.x, coord.y,
+                               coord.z, color))
+        __cpu_write_imagei(image, coord.x, coord.y, coord.z, &color);
 }
 
 void OVERLOAD write_imageui(image2d_t image, int2 coord, uint4 color)
 {
-   __cpu_write_imageui(image, coord.x, coord.y, 0, &color);
+    if (!__coal_write_fast_int((struct image2d *)image, coord.x, coord.y, 0,
+                               (int4)color))
+        __cpu_write_imageui(image, coord.x, coord.y, 0, &color);
 }
 
 void OVERLOAD write_imageui(image3d_t image, int4 coord, uint4 color)
 {
-    __cpu_write_imageui(image, coord.x, coord.y, coord.z, &color);
+    if (!__coal_write_fast_int((struct image2d *)image, coord.x, coord.y,
+                               coord.z, (int4)color))
+        __cpu_write_imageui(image, coord.x, coord.y, coord.z, &color);
 }
 
 int2 OVERLOAD get_image_dim(image2d_t image)
@@ -224,47 +503,47 @@ int4 OVERLOAD get_image_dim(image3d_t image)
 
 int OVERLOAD get_image_width(image2d_t image)
 {
-    return __cpu_get_image_width(image);
+    return image->width;
 }
 
 int OVERLOAD get_image_width(image3d_t image)
 {
-    return __cpu_get_image_width(image);
+    return image->width;
 }
 
 int OVERLOAD get_image_height(image2d_t image)
 {
-    return __cpu_get_image_height(image);
+    return image->height;
 }
 
 int OVERLOAD get_image_height(image3d_t image)
 {
-    return __cpu_get_image_height(image);
+    return image->height;
 }
 
 int OVERLOAD get_image_depth(image3d_t image)
 {
-    return __cpu_get_image_depth(image);
+    return image->depth;
 }
 
 int OVERLOAD get_image_channel_data_type(image2d_t image)
 {
-    return __cpu_get_image_channel_data_type(image);
+    return image->type;
 }
 
 int OVERLOAD get_image_channel_data_type(image3d_t image)
 {
-    return __cpu_get_image_channel_data_type(image);
+    return image->type;
 }
 
 int OVERLOAD get_image_channel_order(image2d_t image)
 {
-    return __cpu_get_image_channel_order(image);
+    return image->order;
 }
 
 int OVERLOAD get_image_channel_order(image3d_t image)
 {
-    return __cpu_get_image_channel_order(image);
+    return image->order;
 }
 
 /*
@@ -58,6 +58,21 @@ typedef unsigned int sampler_t;
 typedef struct image2d *image2d_t;
 typedef struct image3d *image3d_t;
 
+/* Images, laid out like Coal::CPUImageDescriptor */
+#define COAL_IMAGE_FIELDS                                       \
+   void *image;                                                 \
+   uchar *data;                                                 \
+   size_t row_pitch;                                            \
+   size_t slice_pitch;                                          \
+   uint width, height, depth;                                   \
+   uint order, type;                                            \
+   uint pixel_size;                                             \
+   uint tiles_x, tiles_y;                                       \
+   uint tile_depth_shift, tile_texels_shift;
+
+struct image2d { COAL_IMAGE_FIELDS };
+struct image3d { COAL_IMAGE_FIELDS };
+
 /* Vectors */
 #define COAL_VECTOR(type, len)                                  \
    typedef type type##len __attribute__((ext_vector_type(len)))
@@ -81,6 +96,7 @@ COAL_VECTOR_SET(long)
 COAL_VECTOR_SET(ulong)
 
 COAL_VECTOR_SET(float)
+COAL_VECTOR_SET(double)
 
 #undef COAL_VECTOR_SET
 #undef COAL_VECTOR
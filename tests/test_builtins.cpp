@@ -93,6 +93,32 @@ const char image_source[] =
     "   fcoords.x = 0.31f;\n"
     "   fcoords.y = 0.1415f;\n"
     "   fcolor = read_imagef(image3, sampler, fcoords);\n"
+    "\n"
+    "   sampler_t linear = CLK_NORMALIZED_COORDS_FALSE |\n"
+    "                      CLK_ADDRESS_CLAMP_TO_EDGE |\n"
+    "                      CLK_FILTER_LINEAR;\n"
+    "\n"
+    "   fcoords.x = 1.0f;\n"
+    "   fcoords.y = 0.5f;\n"
+    "   fcolor = read_imagef(image3, linear, fcoords);\n"
+    "   if (fabs(fcolor.x - 0.5f) > 0.01f || fabs(fcolor.y - 0.5f) > 0.01f ||\n"
+    "       fcolor.z > 0.01f) { *rs = 6; return; }\n"
+    "\n"
+    "   const sampler_t edge = CLK_NORMALIZED_COORDS_TRUE |\n"
+    "                          CLK_ADDRESS_CLAMP_TO_EDGE |\n"
+    "                          CLK_FILTER_NEAREST;\n"
+    "\n"
+    "   fcoords.x = 0.9f;\n"
+    "   fcoords.y = 0.2f;\n"
+    "   fcolor = read_imagef(image3, edge, fcoords);\n"
+    "   if (fabs(fcolor.x - 0.5f) > 0.01f || fabs(fcolor.z - 0.5f) > 0.01f ||\n"
+    "       fcolor.w > 0.01f) { *rs = 7; return; }\n"
+    "\n"
+    "   coord.x = -1;\n"
+    "   coord.y = 5;\n"
+    "   fcolor = read_imagef(image3, CLK_ADDRESS_CLAMP_TO_EDGE, coord);\n"
+    "   if (fcolor.x < 0.99f || fabs(fcolor.y - 0.5f) > 0.01f ||\n"
+    "       fcolor.z > 0.01f) { *rs = 8; return; }\n"
     "}\n";
 
 const char builtins_source[] =
@@ -110,6 +136,48 @@ const char builtins_source[] =
     "   if (copysign(1.0f, -0.5f) != -1.0f) { *rs = 3; return; }\n"
     "   if (copysign(f2, f2b).x != -1.0f) { *rs = 4; return; }\n"
     "   if (exp2(3.0f) != 8.0f) { *rs = 5; return; }\n"
+    "\n"
+    "   float4 f4 = (float4)(1.0f, 2.0f, 3.0f, 4.0f);\n"
+    "   float3 f3a = (float3)(1.0f, 0.0f, 0.0f);\n"
+    "   float3 f3b = (float3)(0.0f, 1.0f, 0.0f);\n"
+    "\n"
+    "   if (dot(f4, f4) != 30.0f) { *rs = 6; return; }\n"
+    "   if (cross(f3a, f3b).z != 1.0f) { *rs = 7; return; }\n"
+    "   if (length((float2)(3.0f, 4.0f)) != 5.0f) { *rs = 8; return; }\n"
+    "   if (fabs(length((float2)(3e30f, 4e30f)) - 5e30f) > 1e25f) { *rs = 9; return; }\n"
+    "   if (fabs(length(normalize(f4)) - 1.0f) > 1e-6f) { *rs = 10; return; }\n"
+    "   if (distance(f3a, f3b) != sqrt(2.0f)) { *rs = 11; return; }\n"
+    "\n"
+    "   uint4 u4 = (uint4)(1, 0x80000000, 0xf0f0, 0);\n"
+    "   char4 c4 = (char4)(100, -100, 3, -3);\n"
+    "\n"
+    "   if (add_sat(c4, c4).x != 127 || add_sat(c4, c4).y != -128) { *rs = 12; return; }\n"
+    "   if (sub_sat((uchar)3, (uchar)5) != 0) { *rs = 13; return; }\n"
+    "   if (mul_hi(u4, (uint4)4).y != 2) { *rs = 14; return; }\n"
+    "   if (popcount(u4).z != 8 || clz(u4).x != 31 || clz(u4).w != 32) { *rs = 15; return; }\n"
+    "   if (rotate(u4, (uint4)1).y != 1) { *rs = 16; return; }\n"
+    "   if (hadd((uchar)255, (uchar)255) != 255) { *rs = 17; return; }\n"
+    "   if (upsample((char)1, (uchar)2) != 258) { *rs = 18; return; }\n"
+    "   if (abs_diff(c4, -c4).y != 200) { *rs = 19; return; }\n"
+    "\n"
+    "   uchar4 uc4 = convert_uchar4_sat_rte((float4)(-1.0f, 0.5f, 1.5f, 300.0f));\n"
+    "\n"
+    "   if (uc4.x != 0 || uc4.y != 0 || uc4.z != 2 || uc4.w != 255) { *rs = 20; return; }\n"
+    "   if (convert_int_rtn(-1.5f) != -2 || convert_int(-1.5f) != -1) { *rs = 21; return; }\n"
+    "   if (convert_float_rtz(16777217) != 16777216.0f ||\n"
+    "       convert_float_rtp(16777217) != 16777218.0f) { *rs = 22; return; }\n"
+    "   if (convert_short_sat(70000) != 32767) { *rs = 23; return; }\n"
+    "\n"
+    "   int4 i4 = isless(f4, (float4)2.5f);\n"
+    "\n"
+    "   if (i4.x != -1 || i4.z != 0 || isless(1.0f, 2.0f) != 1) { *rs = 24; return; }\n"
+    "   if (!any(i4) || all(i4)) { *rs = 25; return; }\n"
+    "   if (select(f4, -f4, i4).y != -2.0f || select(f4, -f4, i4).w != 4.0f) { *rs = 26; return; }\n"
+    "   if (!isnan(sqrt(-1.0f)) || !isinf(1.0f / 0.0f)) { *rs = 27; return; }\n"
+    "   if (clamp(f4, 1.5f, 3.5f).x != 1.5f || clamp(5, 0, 3) != 3) { *rs = 28; return; }\n"
+    "   if (shuffle(f4, (uint2)(3, 0)).x != 4.0f ||\n"
+    "       shuffle2(f4, -f4, (uint4)(5, 0, 0, 0)).x != -2.0f) { *rs = 29; return; }\n"
+    "   if (smoothstep(0.0f, 1.0f, 0.5f) != 0.5f || sign(-3.0f) != -1.0f) { *rs = 30; return; }\n"
     "}\n";
 
 enum TestCaseKind
@@ -363,6 +431,15 @@ START_TEST (test_image)
         case 5:
             errstr = "The value read from the image is not good";
             break;
+        case 6:
+            errstr = "Bilinear filtering doesn't behave correctly";
+            break;
+        case 7:
+            errstr = "Nearest filtering with normalized coordinates doesn't behave correctly";
+            break;
+        case 8:
+            errstr = "Integer coordinates aren't clamped to the edge";
+            break;
         default:
             errstr = default_error(rs);
     }
@@ -396,6 +473,81 @@ START_TEST (test_builtins)
         case 5:
             errstr = "exp2() doesn't behave correctly";
             break;
+        case 6:
+            errstr = "float dot(float4, float4) doesn't behave correctly";
+            break;
+        case 7:
+            errstr = "float3 cross(float3, float3) doesn't behave correctly";
+            break;
+        case 8:
+            errstr = "float length(float2) doesn't behave correctly";
+            break;
+        case 9:
+            errstr = "float length(float2) overflows for large components";
+            break;
+        case 10:
+            errstr = "float4 normalize(float4) doesn't return a unit vector";
+            break;
+        case 11:
+            errstr = "float distance(float3, float3) doesn't behave correctly";
+            break;
+        case 12:
+            errstr = "char4 add_sat(char4, char4) doesn't saturate";
+            break;
+        case 13:
+            errstr = "uchar sub_sat(uchar, uchar) doesn't saturate";
+            break;
+        case 14:
+            errstr = "uint4 mul_hi(uint4, uint4) doesn't behave correctly";
+            break;
+        case 15:
+            errstr = "uint4 popcount(uint4) or clz(uint4) doesn't behave correctly";
+            break;
+        case 16:
+            errstr = "uint4 rotate(uint4, uint4) doesn't behave correctly";
+            break;
+        case 17:
+            errstr = "uchar hadd(uchar, uchar) overflows";
+            break;
+        case 18:
+            errstr = "short upsample(char, uchar) doesn't behave correctly";
+            break;
+        case 19:
+            errstr = "uchar4 abs_diff(char4, char4) doesn't behave correctly";
+            break;
+        case 20:
+            errstr = "convert_uchar4_sat_rte(float4) doesn't round or saturate correctly";
+            break;
+        case 21:
+            errstr = "convert_int(float) doesn't honour the rounding mode";
+            break;
+        case 22:
+            errstr = "convert_float(int) doesn't honour the rounding mode";
+            break;
+        case 23:
+            errstr = "convert_short_sat(int) doesn't saturate";
+            break;
+        case 24:
+            errstr = "isless() doesn't return -1/0 masks for vectors and 1/0 for scalars";
+            break;
+        case 25:
+            errstr = "any() or all() doesn't behave correctly";
+            break;
+        case 26:
+            errstr = "float4 select(float4, float4, int4) doesn't behave correctly";
+            break;
+        case 27:
+            errstr = "isnan() or isinf() doesn't behave correctly";
+            break;
+        case 28:
+            errstr = "clamp() doesn't behave correctly";
+            break;
+        case 29:
+            errstr = "shuffle() or shuffle2() doesn't behave correctly";
+            break;
+        case 30:
+            errstr = "smoothstep() or sign() doesn't behave correctly";
+            break;
         default:
             errstr = default_error(rs);
     }
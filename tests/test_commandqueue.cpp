@@ -31,8 +31,10 @@
 
 #include "test_commandqueue.h"
 #include "CL/cl.h"
+#include "CL/cl_ext.h"
 
 #include <unistd.h>
+#include <pthread.h>
 
 START_TEST (test_create_command_queue)
 {
@@ -577,6 +579,137 @@ START_TEST (test_copy_buffer)
     );
 
     clReleaseEvent(event);
+
+    // Copy "data" at the beginning of the destination
+    result = clEnqueueCopyBuffer(queue, src_buf, dst_buf, 12, 0, 4, 0, 0,
+                                 &event);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to queue a copy buffer event"
+    );
+
+    result = clWaitForEvents(1, &event);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to wait for the event"
+    );
+
+    fail_if(
+        std::memcmp(dst, "data is the data.", sizeof(dst)) != 0,
+        "the offsets of the copy must be honored"
+    );
+
+    clReleaseEvent(event);
+    clReleaseMemObject(src_buf);
+    clReleaseMemObject(dst_buf);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_large_transfers)
+{
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_int result;
+    cl_mem src_buf, dst_buf;
+
+    // Large enough to be split between the workers and to bypass the caches
+    const size_t count = (64 << 20) / sizeof(unsigned int);
+    const size_t size = count * sizeof(unsigned int);
+    const size_t offset = 3 * sizeof(unsigned int);
+
+    unsigned int *data = (unsigned int *)std::malloc(size);
+    unsigned int *result_data = (unsigned int *)std::malloc(size);
+
+    fail_if(
+        !data || !result_data,
+        "cannot allocate host memory"
+    );
+
+    for (size_t i=0; i<count; ++i)
+        data[i] = i;
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    src_buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE, size, 0, &result);
+    dst_buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE, size, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create the buffers"
+    );
+
+    result = clEnqueueWriteBuffer(queue, src_buf, 1, 0, size, data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to write the source buffer"
+    );
+
+    // Shift the data by three integers
+    result = clEnqueueCopyBuffer(queue, src_buf, dst_buf, 0, offset,
+                                 size - offset, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to copy the buffer"
+    );
+
+    result = clEnqueueReadBuffer(queue, dst_buf, 1, offset, size - offset,
+                                 result_data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the destination buffer"
+    );
+
+    fail_if(
+        std::memcmp(data, result_data, size - offset) != 0,
+        "the data was not transferred correctly"
+    );
+
+    // Extract a large sub-region of the source, seen as rows of 8192 bytes
+    size_t buffer_origin[3] = {12, 5, 0};
+    size_t host_origin[3] = {0, 0, 0};
+    size_t region[3] = {4096, 300, 1};
+
+    result = clEnqueueReadBufferRect(queue, src_buf, 1, buffer_origin,
+                                     host_origin, region, 8192, 0, 4096, 0,
+                                     result_data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read a rectangular region"
+    );
+
+    for (size_t y=0; y<region[1]; ++y)
+    {
+        const unsigned char *row = (const unsigned char *)data
+                                   + (y + buffer_origin[1]) * 8192
+                                   + buffer_origin[0];
+
+        fail_if(
+            std::memcmp((unsigned char *)result_data + y * 4096, row, 4096) != 0,
+            "the rectangular region was not read correctly"
+        );
+    }
+
+    std::free(data);
+    std::free(result_data);
+
     clReleaseMemObject(src_buf);
     clReleaseMemObject(dst_buf);
     clReleaseCommandQueue(queue);
@@ -584,6 +717,214 @@ START_TEST (test_copy_buffer)
 }
 END_TEST
 
+START_TEST (test_fill)
+{
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_int result;
+    cl_mem buf, small_buf, image;
+
+    // Large enough to be mapped and filled by all the workers
+    const size_t count = (8 << 20) / sizeof(unsigned int);
+    const size_t size = count * sizeof(unsigned int);
+
+    unsigned int *data = (unsigned int *)std::malloc(size);
+
+    fail_if(
+        !data,
+        "cannot allocate host memory"
+    );
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE, size, 0, &result);
+    small_buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE, 64, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create the buffers"
+    );
+
+    // Invalid patterns
+    unsigned char bytes[16] = {1, 2, 3, 4, 5, 6, 7, 8,
+                               9, 10, 11, 12, 13, 14, 15, 16};
+
+    result = clEnqueueFillBuffer(queue, small_buf, bytes, 3, 0, 12, 0, 0, 0);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "the size of a pattern must be a power of two"
+    );
+
+    result = clEnqueueFillBuffer(queue, small_buf, bytes, 4, 2, 12, 0, 0, 0);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "the offset must be a multiple of the pattern size"
+    );
+
+    result = clEnqueueFillBuffer(queue, small_buf, bytes, 4, 60, 8, 0, 0, 0);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "filling out of the bounds of the buffer must fail"
+    );
+
+    // Small fills
+    unsigned char small_data[64];
+
+    result = clEnqueueFillBuffer(queue, small_buf, bytes, 1, 0, 64, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to fill the small buffer with a byte"
+    );
+
+    result = clEnqueueFillBuffer(queue, small_buf, bytes, 16, 16, 32, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to fill the small buffer with a 16-byte pattern"
+    );
+
+    result = clEnqueueReadBuffer(queue, small_buf, 1, 0, 64, small_data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the small buffer"
+    );
+
+    for (unsigned int i=0; i<64; ++i)
+    {
+        unsigned char expected = (i >= 16 && i < 48 ? bytes[i % 16] : 1);
+
+        fail_if(
+            small_data[i] != expected,
+            "the small buffer was not filled correctly"
+        );
+    }
+
+    // Large fill, then zero all but the first and last integers
+    unsigned int value = 0xdeadbeef, zero = 0;
+
+    result = clEnqueueFillBuffer(queue, buf, &value, sizeof(value), 0, size,
+                                 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to fill the large buffer"
+    );
+
+    result = clEnqueueFillBuffer(queue, buf, &zero, sizeof(zero), sizeof(zero),
+                                 size - 2 * sizeof(zero), 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to zero the large buffer"
+    );
+
+    result = clEnqueueReadBuffer(queue, buf, 1, 0, size, data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the large buffer"
+    );
+
+    fail_if(
+        data[0] != value || data[count - 1] != value,
+        "the ends of the large buffer must not be zeroed"
+    );
+
+    for (size_t i=1; i<count - 1; ++i)
+    {
+        if (data[i] != 0)
+        {
+            fail_if(true, "the large buffer was not zeroed correctly");
+            break;
+        }
+    }
+
+    // Fill a region of a tiled image
+    cl_image_format fmt;
+    float color[4] = {1.0f, 0.0f, 0.5f, 1.0f};
+    unsigned char pixels[5][6][4];
+    size_t origin[3] = {2, 1, 0};
+    size_t region[3] = {3, 3, 1};
+    size_t full_origin[3] = {0, 0, 0};
+    size_t full_region[3] = {6, 5, 1};
+
+    fmt.image_channel_data_type = CL_UNORM_INT8;
+    fmt.image_channel_order = CL_RGBA;
+
+    image = clCreateImage2D(ctx, CL_MEM_READ_WRITE, &fmt, 6, 5, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create the image"
+    );
+
+    result = clEnqueueFillBuffer(queue, image, bytes, 4, 0, 16, 0, 0, 0);
+    fail_if(
+        result != CL_INVALID_MEM_OBJECT,
+        "an image cannot be filled as a buffer"
+    );
+
+    std::memset(pixels, 0, sizeof(pixels));
+
+    result = clEnqueueWriteImage(queue, image, 1, full_origin, full_region, 0,
+                                 0, pixels, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to clear the image"
+    );
+
+    result = clEnqueueFillImage(queue, image, color, origin, region, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to fill the image"
+    );
+
+    result = clEnqueueReadImage(queue, image, 1, full_origin, full_region, 0,
+                                0, pixels, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the image"
+    );
+
+    for (unsigned int y=0; y<5; ++y)
+    {
+        for (unsigned int x=0; x<6; ++x)
+        {
+            bool inside = (x >= 2 && x < 5 && y >= 1 && y < 4);
+            unsigned char *p = pixels[y][x];
+
+            fail_if(
+                inside && (p[0] != 255 || p[1] != 0 || p[2] != 128 || p[3] != 255),
+                "the region of the image was not filled correctly"
+            );
+            fail_if(
+                !inside && (p[0] || p[1] || p[2] || p[3]),
+                "the image was filled out of the region"
+            );
+        }
+    }
+
+    std::free(data);
+
+    clReleaseMemObject(image);
+    clReleaseMemObject(buf);
+    clReleaseMemObject(small_buf);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
 START_TEST (test_read_write_image)
 {
     cl_platform_id platform = 0;
@@ -836,14 +1177,33 @@ START_TEST (test_copy_image_buffer)
 }
 END_TEST
 
-START_TEST (test_misc_events)
+START_TEST (test_tiled_image)
 {
     cl_platform_id platform = 0;
     cl_device_id device;
     cl_context ctx;
     cl_command_queue queue;
+    cl_mem image, copy;
     cl_int result;
-    cl_event uevent1, uevent2, marker1, marker2;
+
+    // 6x5 RGBA image, not a multiple of the tile size
+    unsigned char image_data[5][6][4];
+    unsigned char read_data[5][6][4];
+    unsigned char *mapped;
+    size_t row_pitch;
+
+    for (unsigned int y=0; y<5; ++y)
+        for (unsigned int x=0; x<6; ++x)
+            for (unsigned int c=0; c<4; ++c)
+                image_data[y][x][c] = y * 24 + x * 4 + c;
+
+    cl_image_format fmt;
+
+    fmt.image_channel_data_type = CL_UNORM_INT8;
+    fmt.image_channel_order = CL_RGBA;
+
+    size_t origin[3] = {3, 1, 0};
+    size_t region[3] = {3, 4, 1};
 
     result = clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
     fail_if(
@@ -863,71 +1223,192 @@ START_TEST (test_misc_events)
         "cannot create a command queue"
     );
 
-    /*
-     * This test will build a command queue blocked by an user event. The events
-     * will be in this order :
-     *
-     * -: UserEvent1
-     * 0: WaitForEvents1 (wait=UserEvent1)
-     * 1: Marker1
-     * -: UserEvent2
-     * 2: WaitForEvents2 (wait=UserEvent2)
-     * 3: Barrier
-     * 4: Marker2 (to check the barrier worked)
-     *
-     * When the command queue is built, we :
-     *  - Check that Marker1 is Queued (WaitForEvents waits)
-     *  - Set UserEvent1 to Complete
-     *  - Check that Marker1 is Complete (WaitForEvents stopped to wait)
-     *  - Check that Marker2 is Queued (Barrier is there)
-     *  - Set UserEvent2 to Complete
-     *  - Check that Marker2 is Complete (no more barrier)
-     */
-    uevent1 = clCreateUserEvent(ctx, &result);
+    // The image doesn't use a host ptr and is therefore stored tiled
+    image = clCreateImage2D(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, &fmt,
+                            6, 5, 0, image_data, &result);
     fail_if(
         result != CL_SUCCESS,
-        "unable to create UserEvent1"
+        "unable to create a 6x5 image"
     );
 
-    uevent2 = clCreateUserEvent(ctx, &result);
+    copy = clCreateImage2D(ctx, CL_MEM_READ_WRITE, &fmt, 6, 5, 0, 0, &result);
     fail_if(
         result != CL_SUCCESS,
-        "unable to create UserEvent2"
+        "unable to create a 6x5 image"
     );
 
-    result = clEnqueueWaitForEvents(queue, 1, &uevent1);
+    // Read a region crossing tile boundaries, with the pitch of image_data
+    std::memset(read_data, 0, sizeof(read_data));
+
+    result = clEnqueueReadImage(queue, image, 1, origin, region,
+                                sizeof(read_data[0]), 0, &read_data[1][3], 0, 0, 0);
     fail_if(
         result != CL_SUCCESS,
-        "unable to enqueue WaitForEvents(UserEvent1)"
+        "cannot enqueue a blocking read image event"
     );
 
-    result = clEnqueueMarker(queue, &marker1);
+    for (unsigned int y=1; y<5; ++y)
+        fail_if(
+            std::memcmp(read_data[y][3], image_data[y][3], 3 * 4) != 0,
+            "reading a tiled image doesn't give the pixels written into it"
+        );
+
+    // Map a region, check it and modify it
+    origin[0] = 2;
+    origin[1] = 2;
+    region[0] = 4;
+    region[1] = 3;
+
+    mapped = (unsigned char *)clEnqueueMapImage(queue, image, 1,
+                                                CL_MAP_READ | CL_MAP_WRITE,
+                                                origin, region, &row_pitch, 0,
+                                                0, 0, 0, &result);
     fail_if(
         result != CL_SUCCESS,
-        "unable to enqueue Marker1"
+        "unable to map an image"
     );
 
-    result = clEnqueueWaitForEvents(queue, 1, &uevent2);
+    for (unsigned int y=0; y<3; ++y)
+    {
+        fail_if(
+            std::memcmp(mapped + y * row_pitch, image_data[y + 2][2], 4 * 4) != 0,
+            "mapping a tiled image doesn't give its pixels"
+        );
+
+        std::memset(mapped + y * row_pitch, 0xff, 4 * 4);
+        std::memset(image_data[y + 2][2], 0xff, 4 * 4);
+    }
+
+    result = clEnqueueUnmapMemObject(queue, image, mapped, 0, 0, 0);
     fail_if(
         result != CL_SUCCESS,
-        "unable to enqueue WaitForEvents(UserEvent2)"
+        "unable to unmap an image"
     );
 
-    result = clEnqueueBarrier(queue);
+    // Copy the image into another tiled image and read it back
+    origin[0] = 0;
+    origin[1] = 0;
+    region[0] = 6;
+    region[1] = 5;
+
+    result = clEnqueueCopyImage(queue, image, copy, origin, origin, region,
+                                0, 0, 0);
     fail_if(
         result != CL_SUCCESS,
-        "unable to enqueue Barrier"
+        "unable to enqueue a copy image event"
     );
 
-    result = clEnqueueMarker(queue, &marker2);
+    result = clEnqueueReadImage(queue, copy, 1, origin, region, 0, 0,
+                                read_data, 0, 0, 0);
     fail_if(
         result != CL_SUCCESS,
-        "unable to enqueue Marker2"
+        "cannot enqueue a blocking read image event"
     );
 
-    // Now the checks
-    cl_int status;
-
+    fail_if(
+        std::memcmp(read_data, image_data, sizeof(image_data)) != 0,
+        "writing a mapped tiled image or copying it doesn't work"
+    );
+
+    clReleaseMemObject(copy);
+    clReleaseMemObject(image);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_misc_events)
+{
+    cl_platform_id platform = 0;
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_int result;
+    cl_event uevent1, uevent2, marker1, marker2;
+
+    result = clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    /*
+     * This test will build a command queue blocked by an user event. The events
+     * will be in this order :
+     *
+     * -: UserEvent1
+     * 0: WaitForEvents1 (wait=UserEvent1)
+     * 1: Marker1
+     * -: UserEvent2
+     * 2: WaitForEvents2 (wait=UserEvent2)
+     * 3: Barrier
+     * 4: Marker2 (to check the barrier worked)
+     *
+     * When the command queue is built, we :
+     *  - Check that Marker1 is Queued (WaitForEvents waits)
+     *  - Set UserEvent1 to Complete
+     *  - Check that Marker1 is Complete (WaitForEvents stopped to wait)
+     *  - Check that Marker2 is Queued (Barrier is there)
+     *  - Set UserEvent2 to Complete
+     *  - Check that Marker2 is Complete (no more barrier)
+     */
+    uevent1 = clCreateUserEvent(ctx, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create UserEvent1"
+    );
+
+    uevent2 = clCreateUserEvent(ctx, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create UserEvent2"
+    );
+
+    result = clEnqueueWaitForEvents(queue, 1, &uevent1);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to enqueue WaitForEvents(UserEvent1)"
+    );
+
+    result = clEnqueueMarker(queue, &marker1);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to enqueue Marker1"
+    );
+
+    result = clEnqueueWaitForEvents(queue, 1, &uevent2);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to enqueue WaitForEvents(UserEvent2)"
+    );
+
+    result = clEnqueueBarrier(queue);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to enqueue Barrier"
+    );
+
+    result = clEnqueueMarker(queue, &marker2);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to enqueue Marker2"
+    );
+
+    // Now the checks
+    cl_int status;
+
     result = clGetEventInfo(marker1, CL_EVENT_COMMAND_EXECUTION_STATUS,
                             sizeof(cl_int), &status, 0);
     fail_if(
@@ -979,6 +1460,541 @@ START_TEST (test_misc_events)
 }
 END_TEST
 
+START_TEST (test_event_graph)
+{
+    cl_platform_id platform = 0;
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue ooo_queue, queue;
+    cl_int result;
+    cl_event uevent, write_event, after_barrier, marker;
+    cl_mem buf1, buf2;
+    cl_int status;
+
+    char s1[] = "Original content", s2[] = "Original content";
+
+    result = clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    ooo_queue = clCreateCommandQueue(ctx, device,
+                                     CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE,
+                                     &result);
+    fail_if(
+        result != CL_SUCCESS || ooo_queue == 0,
+        "cannot create an out-of-order command queue"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    uevent = clCreateUserEvent(ctx, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create an user event"
+    );
+
+    buf1 = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                          sizeof(s1), s1, &result);
+    buf2 = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                          sizeof(s2), s2, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create the buffers"
+    );
+
+    /*
+     * The out-of-order queue holds a write waiting on the user event, then a
+     * barrier, then a write without wait list. The in-order queue copies the
+     * first buffer once the first write is done, and then holds a long chain
+     * of markers.
+     */
+    result = clEnqueueWriteBuffer(ooo_queue, buf1, 0, 0, 8, "Modified", 1,
+                                  &uevent, &write_event);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a write waiting on an user event"
+    );
+
+    result = clEnqueueBarrier(ooo_queue);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a barrier"
+    );
+
+    result = clEnqueueWriteBuffer(ooo_queue, buf1, 0, 9, 7, "CONTENT", 0, 0,
+                                  &after_barrier);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a write after a barrier"
+    );
+
+    result = clEnqueueCopyBuffer(queue, buf1, buf2, 0, 0, 8, 1, &write_event,
+                                 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a copy waiting on another command queue"
+    );
+
+    for (unsigned int i=0; i<1000; ++i)
+    {
+        result = clEnqueueMarker(queue, &marker);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot enqueue a marker"
+        );
+
+        if (i != 999)
+            clReleaseEvent(marker);
+    }
+
+    sleep(1); // Let the worker threads a chance to do faulty things
+
+    result = clGetEventInfo(after_barrier, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                            sizeof(cl_int), &status, 0);
+    fail_if(
+        result != CL_SUCCESS || status != CL_QUEUED,
+        "the write after the barrier must wait for the user event"
+    );
+
+    result = clGetEventInfo(marker, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                            sizeof(cl_int), &status, 0);
+    fail_if(
+        result != CL_SUCCESS || status != CL_QUEUED,
+        "the in-order queue must wait for the other command queue"
+    );
+
+    fail_if(
+        strncmp(s1, "Original content", sizeof(s1)) ||
+        strncmp(s2, "Original content", sizeof(s2)),
+        "nothing can have happened, the user event isn't complete"
+    );
+
+    result = clSetUserEventStatus(uevent, CL_COMPLETE);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot set the user event as completed"
+    );
+
+    result = clWaitForEvents(1, &marker);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot wait for the last marker"
+    );
+
+    clFinish(ooo_queue);
+    clFinish(queue);
+
+    fail_if(
+        strncmp(s1, "Modified CONTENT", sizeof(s1)),
+        "the first buffer must contain \"Modified CONTENT\""
+    );
+    fail_if(
+        strncmp(s2, "Modified content", sizeof(s2)),
+        "the second buffer must contain \"Modified content\""
+    );
+
+    clReleaseEvent(marker);
+    clReleaseEvent(after_barrier);
+    clReleaseEvent(write_event);
+    clReleaseEvent(uevent);
+    clReleaseMemObject(buf1);
+    clReleaseMemObject(buf2);
+    clReleaseCommandQueue(queue);
+    clReleaseCommandQueue(ooo_queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+struct SubmitterThread
+{
+    cl_command_queue queue;
+    cl_mem buf;
+    unsigned int index;
+    unsigned int values[200];
+    cl_event events[200];
+    unsigned int errors;
+};
+
+static void *submitter_thread(void *data)
+{
+    SubmitterThread *thread = (SubmitterThread *)data;
+
+    for (unsigned int i=0; i<200; ++i)
+    {
+        thread->values[i] = i;
+
+        cl_int result = clEnqueueWriteBuffer(thread->queue, thread->buf, 0,
+                                             thread->index * sizeof(unsigned int),
+                                             sizeof(unsigned int),
+                                             &thread->values[i], 0, 0,
+                                             &thread->events[i]);
+
+        if (result != CL_SUCCESS)
+        {
+            thread->events[i] = 0;
+            thread->errors++;
+        }
+    }
+
+    return 0;
+}
+
+START_TEST (test_concurrent_submission)
+{
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_mem buf;
+    cl_int result;
+
+    const unsigned int num_threads = 8;
+    pthread_t threads[num_threads];
+    SubmitterThread *data = new SubmitterThread[num_threads];
+    unsigned int slots[num_threads];
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, CL_QUEUE_PROFILING_ENABLE,
+                                 &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE, sizeof(slots), 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer"
+    );
+
+    // Each thread writes its counter in its own slot of the buffer
+    for (unsigned int i=0; i<num_threads; ++i)
+    {
+        data[i].queue = queue;
+        data[i].buf = buf;
+        data[i].index = i;
+        data[i].errors = 0;
+
+        fail_if(
+            pthread_create(&threads[i], 0, &submitter_thread, &data[i]) != 0,
+            "unable to create a thread"
+        );
+    }
+
+    for (unsigned int i=0; i<num_threads; ++i)
+        pthread_join(threads[i], 0);
+
+    result = clFinish(queue);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to finish the command queue"
+    );
+
+    for (unsigned int t=0; t<num_threads; ++t)
+    {
+        fail_if(
+            data[t].errors != 0,
+            "cannot enqueue a write from several threads"
+        );
+
+        cl_ulong previous_end = 0;
+
+        for (unsigned int i=0; i<200; ++i)
+        {
+            cl_int status;
+            cl_ulong start, end;
+
+            result = clGetEventInfo(data[t].events[i],
+                                    CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                    sizeof(cl_int), &status, 0);
+            fail_if(
+                result != CL_SUCCESS || status != CL_COMPLETE,
+                "every event must be completed after clFinish()"
+            );
+
+            result = clGetEventProfilingInfo(data[t].events[i],
+                                             CL_PROFILING_COMMAND_START,
+                                             sizeof(cl_ulong), &start, 0);
+            result |= clGetEventProfilingInfo(data[t].events[i],
+                                              CL_PROFILING_COMMAND_END,
+                                              sizeof(cl_ulong), &end, 0);
+            fail_if(
+                result != CL_SUCCESS || start < previous_end,
+                "the commands of a thread must run in the order it queued them"
+            );
+
+            previous_end = end;
+            clReleaseEvent(data[t].events[i]);
+        }
+    }
+
+    result = clEnqueueReadBuffer(queue, buf, 1, 0, sizeof(slots), slots, 0, 0,
+                                 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the buffer"
+    );
+
+    for (unsigned int t=0; t<num_threads; ++t)
+    {
+        fail_if(
+            slots[t] != 199,
+            "the last write of each thread must be the last one run"
+        );
+    }
+
+    delete[] data;
+
+    clReleaseMemObject(buf);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_deferred_submission)
+{
+    cl_platform_id platform = 0;
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_command_queue_properties properties;
+    cl_int result;
+    cl_event write_event;
+    cl_mem buf;
+    cl_int status;
+
+    char s[] = "Original content", r[sizeof(s)];
+
+    result = clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device,
+                                 CL_QUEUE_DEFERRED_SUBMISSION_CLOVER, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a deferred command queue"
+    );
+
+    result = clGetCommandQueueInfo(queue, CL_QUEUE_PROPERTIES,
+                                   sizeof(properties), &properties, 0);
+    fail_if(
+        result != CL_SUCCESS ||
+        properties != CL_QUEUE_DEFERRED_SUBMISSION_CLOVER,
+        "the command queue must be deferred"
+    );
+
+    buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                         sizeof(s), s, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer"
+    );
+
+    result = clEnqueueWriteBuffer(queue, buf, 0, 0, 8, "Modified", 0, 0,
+                                  &write_event);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a write"
+    );
+
+    sleep(1); // Let the worker threads a chance to do faulty things
+
+    result = clGetEventInfo(write_event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                            sizeof(cl_int), &status, 0);
+    fail_if(
+        result != CL_SUCCESS || status != CL_QUEUED ||
+        strncmp(s, "Original content", sizeof(s)),
+        "the write must be buffered until the command queue is flushed"
+    );
+
+    result = clFlush(queue);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot flush the command queue"
+    );
+
+    result = clWaitForEvents(1, &write_event);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot wait for the write"
+    );
+
+    fail_if(
+        strncmp(s, "Modified content", sizeof(s)),
+        "the buffer must contain \"Modified content\""
+    );
+
+    // A blocking call submits the buffered commands by itself
+    result = clEnqueueWriteBuffer(queue, buf, 0, 9, 7, "CONTENT", 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a write"
+    );
+
+    result = clEnqueueReadBuffer(queue, buf, 1, 0, sizeof(r), r, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot read the buffer"
+    );
+
+    fail_if(
+        strncmp(r, "Modified CONTENT", sizeof(r)),
+        "the read must see the buffered write"
+    );
+
+    clReleaseEvent(write_event);
+
+    // A marker submits the buffered commands. Submitted events leave the
+    // CL_QUEUED state before clEnqueue*() returns.
+    cl_event marker;
+
+    result = clEnqueueWriteBuffer(queue, buf, 0, 0, 8, "Marked  ", 0, 0,
+                                  &write_event);
+    result |= clEnqueueMarker(queue, &marker);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a write and a marker"
+    );
+
+    result = clGetEventInfo(write_event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                            sizeof(cl_int), &status, 0);
+    fail_if(
+        result != CL_SUCCESS || status == CL_QUEUED,
+        "queuing a marker must submit the buffered commands"
+    );
+
+    clReleaseEvent(marker);
+    clReleaseEvent(write_event);
+
+    // A command buffered for more than 1ms is submitted when another one is
+    // queued. There is no timer, it stays buffered until then.
+    cl_event events[64];
+
+    result = clEnqueueWriteBuffer(queue, buf, 0, 0, 4, "Old ", 0, 0,
+                                  &events[0]);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a write"
+    );
+
+    usleep(10000);
+
+    result = clGetEventInfo(events[0], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                            sizeof(cl_int), &status, 0);
+    fail_if(
+        result != CL_SUCCESS || status != CL_QUEUED,
+        "a lone command must stay buffered"
+    );
+
+    result = clEnqueueWriteBuffer(queue, buf, 0, 4, 4, "New ", 0, 0,
+                                  &events[1]);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue a write"
+    );
+
+    for (unsigned int i=0; i<2; ++i)
+    {
+        result = clGetEventInfo(events[i], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                sizeof(cl_int), &status, 0);
+        fail_if(
+            result != CL_SUCCESS || status == CL_QUEUED,
+            "commands buffered for more than 1ms must be submitted"
+        );
+
+        clReleaseEvent(events[i]);
+    }
+
+    // The 64th buffered command submits them all, whatever the time the
+    // previous ones took to be queued
+    for (unsigned int i=0; i<64; ++i)
+    {
+        result = clEnqueueWriteBuffer(queue, buf, 0, 0, 1, "x", 0, 0,
+                                      &events[i]);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot enqueue a write"
+        );
+    }
+
+    for (unsigned int i=0; i<64; ++i)
+    {
+        result = clGetEventInfo(events[i], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                sizeof(cl_int), &status, 0);
+        fail_if(
+            result != CL_SUCCESS || status == CL_QUEUED,
+            "64 buffered commands must be submitted"
+        );
+
+        clReleaseEvent(events[i]);
+    }
+
+    // Waiting for a buffered command submits it, with the ones before it
+    for (unsigned int i=0; i<63; ++i)
+    {
+        result = clEnqueueWriteBuffer(queue, buf, 0, 0, 1, "y", 0, 0,
+                                      &events[i]);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot enqueue a write"
+        );
+    }
+
+    result = clWaitForEvents(1, &events[62]);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot wait for a buffered command"
+    );
+
+    for (unsigned int i=0; i<63; ++i)
+    {
+        result = clGetEventInfo(events[i], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                sizeof(cl_int), &status, 0);
+        fail_if(
+            result != CL_SUCCESS || status != CL_COMPLETE,
+            "waiting for a command must submit the ones buffered before it"
+        );
+
+        clReleaseEvent(events[i]);
+    }
+
+    clReleaseMemObject(buf);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
 TCase *cl_commandqueue_tcase_create(void)
 {
     TCase *tc = NULL;
@@ -989,8 +2005,14 @@ TCase *cl_commandqueue_tcase_create(void)
     tcase_add_test(tc, test_events);
     tcase_add_test(tc, test_read_write_rect);
     tcase_add_test(tc, test_copy_buffer);
+    tcase_add_test(tc, test_large_transfers);
+    tcase_add_test(tc, test_fill);
     tcase_add_test(tc, test_read_write_image);
     tcase_add_test(tc, test_copy_image_buffer);
+    tcase_add_test(tc, test_tiled_image);
     tcase_add_test(tc, test_misc_events);
+    tcase_add_test(tc, test_event_graph);
+    tcase_add_test(tc, test_concurrent_submission);
+    tcase_add_test(tc, test_deferred_submission);
     return tc;
 }
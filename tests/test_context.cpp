@@ -28,6 +28,8 @@
 #include "test_context.h"
 #include "CL/cl.h"
 
+#include <pthread.h>
+
 START_TEST (test_create_context)
 {
     cl_platform_id platform = 0;
@@ -245,6 +247,104 @@ START_TEST (test_get_context_info)
 }
 END_TEST
 
+struct RegistryThread
+{
+    cl_context ctx;
+    unsigned int errors;
+};
+
+static void *registry_thread(void *data)
+{
+    RegistryThread *thread = (RegistryThread *)data;
+    cl_int result;
+    cl_uint refcount;
+
+    for (unsigned int i=0; i<2000; ++i)
+    {
+        // Share the context with the other threads
+        if (clRetainContext(thread->ctx) != CL_SUCCESS)
+            thread->errors++;
+
+        cl_event event = clCreateUserEvent(thread->ctx, &result);
+
+        if (result != CL_SUCCESS)
+        {
+            thread->errors++;
+            clReleaseContext(thread->ctx);
+            continue;
+        }
+
+        clRetainEvent(event);
+
+        result = clGetEventInfo(event, CL_EVENT_REFERENCE_COUNT,
+                                sizeof(cl_uint), &refcount, 0);
+
+        if (result != CL_SUCCESS || refcount != 2)
+            thread->errors++;
+
+        clReleaseEvent(event);
+        clReleaseEvent(event);
+
+        // Nothing was allocated by this thread meanwhile, the freed handle
+        // cannot be a new object
+        if (clRetainEvent(event) != CL_INVALID_EVENT)
+            thread->errors++;
+
+        if (clReleaseContext(thread->ctx) != CL_SUCCESS)
+            thread->errors++;
+    }
+
+    return 0;
+}
+
+START_TEST (test_object_registry)
+{
+    cl_context ctx;
+    cl_int result;
+    cl_uint refcount;
+
+    const unsigned int num_threads = 8;
+    pthread_t threads[num_threads];
+    RegistryThread data[num_threads];
+
+    ctx = clCreateContextFromType(0, CL_DEVICE_TYPE_CPU, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a valid context"
+    );
+
+    for (unsigned int i=0; i<num_threads; ++i)
+    {
+        data[i].ctx = ctx;
+        data[i].errors = 0;
+
+        fail_if(
+            pthread_create(&threads[i], 0, &registry_thread, &data[i]) != 0,
+            "unable to create a thread"
+        );
+    }
+
+    for (unsigned int i=0; i<num_threads; ++i)
+    {
+        pthread_join(threads[i], 0);
+
+        fail_if(
+            data[i].errors != 0,
+            "objects created and released concurrently must stay valid until released"
+        );
+    }
+
+    result = clGetContextInfo(ctx, CL_CONTEXT_REFERENCE_COUNT, sizeof(cl_uint),
+                              &refcount, 0);
+    fail_if(
+        result != CL_SUCCESS || refcount != 1,
+        "concurrent retains and releases must not lose an update"
+    );
+
+    clReleaseContext(ctx);
+}
+END_TEST
+
 TCase *cl_context_tcase_create(void)
 {
     TCase *tc = NULL;
@@ -252,5 +352,6 @@ TCase *cl_context_tcase_create(void)
     tcase_add_test(tc, test_create_context);
     tcase_add_test(tc, test_create_context_from_type);
     tcase_add_test(tc, test_get_context_info);
+    tcase_add_test(tc, test_object_registry);
     return tc;
 }
@@ -26,9 +26,11 @@
  */
 
 #include <iostream>
+#include <cstring>
 
 #include "test_kernel.h"
 #include "CL/cl.h"
+#include "CL/cl_ext.h"
 
 static const char source[] =
     "float simple_function(float a) {\n"
@@ -47,6 +49,25 @@ static const char source[] =
     "    buf[i % 256] = 2 * (i % 256);\n"
     "}\n";
 
+static const char fusion_source[] =
+    "__kernel void scale(__global float *dst, __global float *src, float f) {\n"
+    "    size_t i = get_global_id(0);\n"
+    "\n"
+    "    dst[i] = src[i] * f;\n"
+    "}\n"
+    "\n"
+    "__kernel void offset(__global float *dst, __global float *src, float o) {\n"
+    "    size_t i = get_global_id(0);\n"
+    "\n"
+    "    dst[i] = src[i] + o;\n"
+    "}\n"
+    "\n"
+    "__kernel void shift(__global float *dst, __global float *src) {\n"
+    "    size_t i = get_global_id(0);\n"
+    "\n"
+    "    dst[i] = src[(i + 1) % get_global_size(0)];\n"
+    "}\n";
+
 static void native_kernel(void *args)
 {
     struct ags
@@ -311,11 +332,638 @@ START_TEST (test_native_kernel)
 }
 END_TEST
 
+START_TEST (test_kernel_fusion)
+{
+    cl_platform_id platform = 0;
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_program program;
+    cl_int result;
+    cl_kernel scale, offset, shift;
+    cl_mem bufs[4];
+    cl_event events[3];
+    cl_int status;
+    cl_ulong start[3], end[3];
+
+    const char *src = fusion_source;
+    size_t program_len = sizeof(fusion_source);
+
+    float a[4096], d[4096];
+    float f = 2.0f, o = 1.0f;
+    size_t global_size = sizeof(a) / sizeof(a[0]);
+    size_t local_size = 256;
+
+    for (size_t i=0; i<global_size; ++i)
+        a[i] = (float)i;
+
+    result = clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    // Deferred, so that the kernels are all queued before the first one runs.
+    // Profiled, so that the kernels run together can be recognized.
+    queue = clCreateCommandQueue(ctx, device,
+                                 CL_QUEUE_KERNEL_FUSION_CLOVER |
+                                 CL_QUEUE_DEFERRED_SUBMISSION_CLOVER |
+                                 CL_QUEUE_PROFILING_ENABLE, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a command queue fusing kernels"
+    );
+
+    program = clCreateProgramWithSource(ctx, 1, &src, &program_len, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a program from source with sane arguments"
+    );
+
+    result = clBuildProgram(program, 1, &device, "", 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot build a valid program"
+    );
+
+    scale = clCreateKernel(program, "scale", &result);
+    offset = clCreateKernel(program, "offset", &result);
+    shift = clCreateKernel(program, "shift", &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create the kernels"
+    );
+
+    bufs[0] = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                             sizeof(a), a, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create the source buffer"
+    );
+
+    for (unsigned int i=1; i<4; ++i)
+    {
+        bufs[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE, sizeof(a), 0,
+                                 &result);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot create a temporary buffer"
+        );
+    }
+
+    /*
+     * d[i] = a[i + 1] * 2 + 1. offset consumes what scale produces at the same
+     * index, they can run together. shift reads another index and must see
+     * all of what offset produced.
+     */
+    result = clSetKernelArg(scale, 0, sizeof(cl_mem), &bufs[1]);
+    result |= clSetKernelArg(scale, 1, sizeof(cl_mem), &bufs[0]);
+    result |= clSetKernelArg(scale, 2, sizeof(float), &f);
+    result |= clSetKernelArg(offset, 0, sizeof(cl_mem), &bufs[2]);
+    result |= clSetKernelArg(offset, 1, sizeof(cl_mem), &bufs[1]);
+    result |= clSetKernelArg(offset, 2, sizeof(float), &o);
+    result |= clSetKernelArg(shift, 0, sizeof(cl_mem), &bufs[3]);
+    result |= clSetKernelArg(shift, 1, sizeof(cl_mem), &bufs[2]);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot set kernel arguments"
+    );
+
+    result = clEnqueueNDRangeKernel(queue, scale, 1, 0, &global_size,
+                                    &local_size, 0, 0, &events[0]);
+    result |= clEnqueueNDRangeKernel(queue, offset, 1, 0, &global_size,
+                                     &local_size, 0, 0, &events[1]);
+    result |= clEnqueueNDRangeKernel(queue, shift, 1, 0, &global_size,
+                                     &local_size, 0, 0, &events[2]);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to queue the kernels"
+    );
+
+    result = clEnqueueReadBuffer(queue, bufs[3], 1, 0, sizeof(d), d, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the result"
+    );
+
+    for (unsigned int i=0; i<3; ++i)
+    {
+        result = clGetEventInfo(events[i], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                sizeof(cl_int), &status, 0);
+        fail_if(
+            result != CL_SUCCESS || status != CL_COMPLETE,
+            "the kernel events must be completed"
+        );
+
+        result = clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START,
+                                         sizeof(cl_ulong), &start[i], 0);
+        result |= clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END,
+                                          sizeof(cl_ulong), &end[i], 0);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot get the profiling information of the kernels"
+        );
+
+        clReleaseEvent(events[i]);
+    }
+
+    // A kernel fused in another one gets its timings
+    fail_if(
+        start[1] != start[0] || end[1] != end[0],
+        "offset must have run fused with scale"
+    );
+    fail_if(
+        start[2] < end[1],
+        "shift must not have been fused"
+    );
+
+    bool ok = true;
+
+    for (size_t i=0; i<global_size; ++i)
+    {
+        if (d[i] != a[(i + 1) % global_size] * f + o)
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    fail_if(
+        ok == false,
+        "the kernels haven't done their job, the buffer is wrong"
+    );
+
+    for (unsigned int i=0; i<4; ++i)
+        clReleaseMemObject(bufs[i]);
+
+    clReleaseKernel(scale);
+    clReleaseKernel(offset);
+    clReleaseKernel(shift);
+    clReleaseProgram(program);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_command_buffer)
+{
+    cl_platform_id platform = 0;
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_program program;
+    cl_int result;
+    cl_kernel scale, offset;
+    cl_command_buffer_clover cmdbuf;
+    cl_mem bufs[4];
+    cl_uint offset_index;
+    cl_event event, user_event;
+    cl_int status;
+
+    const char *src = fusion_source;
+    size_t program_len = sizeof(fusion_source);
+
+    float a[1024], d[1024];
+    float f = 2.0f, o = 1.0f, zero = 0.0f;
+    size_t global_size = sizeof(a) / sizeof(a[0]);
+    size_t local_size = 64;
+
+    for (size_t i=0; i<global_size; ++i)
+        a[i] = (float)i;
+
+    result = clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a command queue"
+    );
+
+    program = clCreateProgramWithSource(ctx, 1, &src, &program_len, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a program from source with sane arguments"
+    );
+
+    result = clBuildProgram(program, 1, &device, "", 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot build a valid program"
+    );
+
+    scale = clCreateKernel(program, "scale", &result);
+    offset = clCreateKernel(program, "offset", &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create the kernels"
+    );
+
+    bufs[0] = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                             sizeof(a), a, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create the source buffer"
+    );
+
+    for (unsigned int i=1; i<4; ++i)
+    {
+        bufs[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE, sizeof(a), 0,
+                                 &result);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot create a temporary buffer"
+        );
+    }
+
+    result = clSetKernelArg(scale, 0, sizeof(cl_mem), &bufs[1]);
+    result |= clSetKernelArg(scale, 1, sizeof(cl_mem), &bufs[0]);
+    result |= clSetKernelArg(scale, 2, sizeof(float), &f);
+    result |= clSetKernelArg(offset, 0, sizeof(cl_mem), &bufs[2]);
+    result |= clSetKernelArg(offset, 1, sizeof(cl_mem), &bufs[1]);
+    result |= clSetKernelArg(offset, 2, sizeof(float), &o);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot set kernel arguments"
+    );
+
+    cmdbuf = clCreateCommandBufferCLOVER(queue, &result);
+    fail_if(
+        result != CL_SUCCESS || cmdbuf == 0,
+        "unable to create a command buffer"
+    );
+
+    /*
+     * d[i] = a[i] * 2 + 1, bufs[3] is cleared before being written
+     */
+    result = clCommandFillBufferCLOVER(cmdbuf, bufs[3], &zero, sizeof(zero), 0,
+                                       sizeof(a), 0);
+    result |= clCommandNDRangeKernelCLOVER(cmdbuf, scale, 1, 0, &global_size,
+                                           &local_size, 0);
+    result |= clCommandNDRangeKernelCLOVER(cmdbuf, offset, 1, 0, &global_size,
+                                           &local_size, &offset_index);
+    result |= clCommandCopyBufferCLOVER(cmdbuf, bufs[2], bufs[3], 0, 0,
+                                        sizeof(a), 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to record the commands"
+    );
+
+    result = clEnqueueCommandBufferCLOVER(cmdbuf, 0, 0, 0);
+    fail_if(
+        result != CL_INVALID_OPERATION,
+        "a command buffer cannot be enqueued before being finalized"
+    );
+
+    result = clFinalizeCommandBufferCLOVER(cmdbuf);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to finalize the command buffer"
+    );
+
+    result = clCommandCopyBufferCLOVER(cmdbuf, bufs[2], bufs[3], 0, 0,
+                                       sizeof(a), 0);
+    fail_if(
+        result != CL_INVALID_OPERATION,
+        "a finalized command buffer cannot record commands"
+    );
+
+    // The recorded kernels keep their arguments
+    result = clSetKernelArg(scale, 2, sizeof(float), &o);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot set kernel arguments"
+    );
+
+    for (unsigned int i=0; i<3; ++i)
+    {
+        result = clEnqueueCommandBufferCLOVER(cmdbuf, 0, 0, 0);
+        fail_if(
+            result != CL_SUCCESS,
+            "unable to enqueue the command buffer"
+        );
+    }
+
+    result = clEnqueueReadBuffer(queue, bufs[3], 1, 0, sizeof(d), d, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the result"
+    );
+
+    bool ok = true;
+
+    for (size_t i=0; i<global_size; ++i)
+    {
+        if (d[i] != a[i] * f + o)
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    fail_if(
+        ok == false,
+        "the commands haven't done their job, the buffer is wrong"
+    );
+
+    // Change the offset for the next enqueues
+    o = 3.0f;
+
+    result = clUpdateCommandBufferKernelArgCLOVER(cmdbuf, offset_index, 2,
+                                                  sizeof(float), &o);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to update an argument of a recorded kernel"
+    );
+
+    result = clUpdateCommandBufferKernelArgCLOVER(cmdbuf, offset_index, 2,
+                                                  sizeof(double), &o);
+    fail_if(
+        result != CL_INVALID_ARG_SIZE,
+        "the new value of an argument must have the right size"
+    );
+
+    result = clEnqueueCommandBufferCLOVER(cmdbuf, 0, 0, &event);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to enqueue the command buffer"
+    );
+
+    result = clEnqueueReadBuffer(queue, bufs[3], 1, 0, sizeof(d), d, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the result"
+    );
+
+    result = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                            sizeof(cl_int), &status, 0);
+    fail_if(
+        result != CL_SUCCESS || status != CL_COMPLETE,
+        "the event of the command buffer must be completed"
+    );
+
+    for (size_t i=0; i<global_size; ++i)
+    {
+        if (d[i] != a[i] * f + o)
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    fail_if(
+        ok == false,
+        "the updated argument isn't used, the buffer is wrong"
+    );
+
+    clReleaseEvent(event);
+
+    /*
+     * The command buffer and the buffers only used by its commands can be
+     * released while the commands wait for an event
+     */
+    user_event = clCreateUserEvent(ctx, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a user event"
+    );
+
+    o = 5.0f;
+
+    result = clUpdateCommandBufferKernelArgCLOVER(cmdbuf, offset_index, 2,
+                                                  sizeof(float), &o);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to update an argument of a recorded kernel"
+    );
+
+    result = clEnqueueCommandBufferCLOVER(cmdbuf, 1, &user_event, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to enqueue the command buffer"
+    );
+
+    clReleaseCommandBufferCLOVER(cmdbuf);
+
+    for (unsigned int i=0; i<3; ++i)
+        clReleaseMemObject(bufs[i]);
+
+    result = clSetUserEventStatus(user_event, CL_COMPLETE);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to complete the user event"
+    );
+
+    result = clEnqueueReadBuffer(queue, bufs[3], 1, 0, sizeof(d), d, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to read the result"
+    );
+
+    for (size_t i=0; i<global_size; ++i)
+    {
+        if (d[i] != a[i] * f + o)
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    fail_if(
+        ok == false,
+        "the released buffers must stay valid for the queued commands"
+    );
+
+    clReleaseEvent(user_event);
+    clReleaseMemObject(bufs[3]);
+
+    clReleaseKernel(scale);
+    clReleaseKernel(offset);
+    clReleaseProgram(program);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_execution_trace)
+{
+    cl_platform_id platform = 0;
+    cl_device_id device;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_program program;
+    cl_int result;
+    cl_kernel kernel;
+    cl_mem bufs[2];
+    cl_event event;
+    cl_ulong queued, start, end;
+    size_t trace_size;
+
+    const char *src = fusion_source;
+    size_t program_len = sizeof(fusion_source);
+
+    float a[1024];
+    float f = 2.0f;
+    size_t global_size = sizeof(a) / sizeof(a[0]);
+    size_t local_size = 64;
+
+    for (size_t i=0; i<global_size; ++i)
+        a[i] = (float)i;
+
+    result = clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to get the default device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || ctx == 0,
+        "unable to create a valid context"
+    );
+
+    result = clEnableTraceCLOVER(ctx, CL_TRUE);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to start a trace"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, CL_QUEUE_PROFILING_ENABLE,
+                                 &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a command queue"
+    );
+
+    program = clCreateProgramWithSource(ctx, 1, &src, &program_len, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a program from source with sane arguments"
+    );
+
+    result = clBuildProgram(program, 1, &device, "", 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot build a valid program"
+    );
+
+    kernel = clCreateKernel(program, "scale", &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create the kernel"
+    );
+
+    bufs[0] = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                             sizeof(a), a, &result);
+    bufs[1] = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY, sizeof(a), 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create the buffers"
+    );
+
+    result = clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufs[1]);
+    result |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufs[0]);
+    result |= clSetKernelArg(kernel, 2, sizeof(float), &f);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot set kernel arguments"
+    );
+
+    result = clEnqueueNDRangeKernel(queue, kernel, 1, 0, &global_size,
+                                    &local_size, 0, 0, &event);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot enqueue the kernel"
+    );
+
+    result = clWaitForEvents(1, &event);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot wait for the kernel"
+    );
+
+    result = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED,
+                                     sizeof(cl_ulong), &queued, 0);
+    result |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+                                      sizeof(cl_ulong), &start, 0);
+    result |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,
+                                      sizeof(cl_ulong), &end, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot get the profiling information of the kernel"
+    );
+    fail_if(
+        queued > start || start > end,
+        "the profiling timestamps must be increasing"
+    );
+
+    result = clGetTraceCLOVER(ctx, 0, 0, &trace_size);
+    fail_if(
+        result != CL_SUCCESS || trace_size == 0,
+        "unable to get the size of the trace"
+    );
+
+    char *trace = new char[trace_size];
+
+    result = clGetTraceCLOVER(ctx, trace_size - 1, trace, 0);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "the trace must not be truncated"
+    );
+
+    result = clGetTraceCLOVER(ctx, trace_size, trace, 0);
+    fail_if(
+        result != CL_SUCCESS || trace[trace_size - 1] != 0,
+        "unable to get the trace"
+    );
+    fail_if(
+        std::strstr(trace, "\"traceEvents\"") == 0,
+        "the trace must be in the trace-event format"
+    );
+    fail_if(
+        std::strstr(trace, "{\"name\":\"scale\",\"cat\":\"work-group\"") == 0,
+        "the work-groups of the kernel must be traced"
+    );
+    fail_if(
+        std::strstr(trace, "\"cat\":\"build\"") == 0,
+        "the build of the program must be traced"
+    );
+
+    delete[] trace;
+
+    clReleaseEvent(event);
+    clReleaseMemObject(bufs[0]);
+    clReleaseMemObject(bufs[1]);
+    clReleaseKernel(kernel);
+    clReleaseProgram(program);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
 TCase *cl_kernel_tcase_create(void)
 {
     TCase *tc = NULL;
     tc = tcase_create("kernel");
     tcase_add_test(tc, test_native_kernel);
     tcase_add_test(tc, test_compiled_kernel);
+    tcase_add_test(tc, test_kernel_fusion);
+    tcase_add_test(tc, test_command_buffer);
+    tcase_add_test(tc, test_execution_trace);
     return tc;
 }
@@ -26,9 +26,15 @@
  */
 
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "test_mem.h"
 #include "CL/cl.h"
+#include "CL/cl_ext.h"
 
 START_TEST (test_create_buffer)
 {
@@ -183,11 +189,13 @@ END_TEST
 START_TEST (test_read_write_subbuf)
 {
     cl_context ctx;
-    cl_mem buf, subbuf;
+    cl_mem buf, subbuf, aligned_buf, aligned_subbuf;
     cl_command_queue queue;
     cl_device_id device;
     cl_int result;
+    cl_uint align;
     char s[] = "Hello, Denis !";
+    char aligned_s[512];
 
     cl_buffer_region create_info;
 
@@ -241,6 +249,41 @@ START_TEST (test_read_write_subbuf)
     );
 
     result = clEnqueueWriteBuffer(queue, subbuf, 1, 0, 5, "world", 0, 0, 0);
+    fail_if(
+        result != CL_MISALIGNED_SUB_BUFFER_OFFSET,
+        "the origin of a sub-buffer must be aligned on CL_DEVICE_MEM_BASE_ADDR_ALIGN"
+    );
+
+    // The same string, with "Denis" at the first aligned origin
+    result = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+                             sizeof(cl_uint), &align, 0);
+    fail_if(
+        result != CL_SUCCESS || align / 8 + sizeof(s) > sizeof(aligned_s),
+        "cannot get the base address alignment"
+    );
+
+    create_info.origin = align / 8;
+
+    std::memset(aligned_s, 0, sizeof(aligned_s));
+    std::memcpy(aligned_s + create_info.origin - 7, s, sizeof(s));
+
+    aligned_buf = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 sizeof(aligned_s), aligned_s, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a valid CL_MEM_COPY_HOST_PTR buffer"
+    );
+
+    aligned_subbuf = clCreateSubBuffer(aligned_buf, CL_MEM_WRITE_ONLY,
+                                       CL_BUFFER_CREATE_TYPE_REGION,
+                                       (void *)&create_info, &result);
+    fail_if(
+        result != CL_SUCCESS || aligned_subbuf == 0,
+        "cannot create a valid sub-buffer"
+    );
+
+    result = clEnqueueWriteBuffer(queue, aligned_subbuf, 1, 0, 5, "world", 0,
+                                  0, 0);
     fail_if(
         result != CL_SUCCESS,
         "unable to write to the sub buffer"
@@ -248,7 +291,7 @@ START_TEST (test_read_write_subbuf)
 
     char data[16];
 
-    result = clEnqueueReadBuffer(queue, subbuf, 1, 0, 5, data, 0, 0, 0);
+    result = clEnqueueReadBuffer(queue, aligned_subbuf, 1, 0, 5, data, 0, 0, 0);
     fail_if(
         result != CL_SUCCESS,
         "unable to read the sub buffer"
@@ -258,7 +301,9 @@ START_TEST (test_read_write_subbuf)
         "the subbuffer must contain \"world\""
     );
 
-    result = clEnqueueReadBuffer(queue, buf, 1, 0, sizeof(s), data, 0, 0, 0);
+    result = clEnqueueReadBuffer(queue, aligned_buf, 1,
+                                 create_info.origin - 7, sizeof(s), data, 0,
+                                 0, 0);
     fail_if(
         result != CL_SUCCESS,
         "unable to read the buffer"
@@ -269,12 +314,827 @@ START_TEST (test_read_write_subbuf)
     );
 
     clReleaseCommandQueue(queue);
+    clReleaseMemObject(aligned_subbuf);
+    clReleaseMemObject(aligned_buf);
     clReleaseMemObject(subbuf);
     clReleaseMemObject(buf);
     clReleaseContext(ctx);
 }
 END_TEST
 
+START_TEST (test_buffer_alignment)
+{
+    cl_context ctx;
+    cl_mem buf;
+    cl_command_queue queue;
+    cl_device_id device;
+    cl_int result;
+    cl_uint align;
+
+    // A small buffer and one large enough to use huge pages
+    size_t sizes[2] = {5, 6 << 20};
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_CPU, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot get a device"
+    );
+
+    result = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+                             sizeof(cl_uint), &align, 0);
+    fail_if(
+        result != CL_SUCCESS || align < 64 * 8,
+        "buffers must be aligned at least on a cache line"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    for (unsigned int i=0; i<2; ++i)
+    {
+        buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE, sizes[i], 0, &result);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot create a buffer"
+        );
+
+        unsigned char *data = (unsigned char *)
+            clEnqueueMapBuffer(queue, buf, 1, CL_MAP_WRITE, 0, sizes[i], 0, 0,
+                               0, &result);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot map a buffer"
+        );
+        fail_if(
+            (size_t)data % (align / 8) != 0,
+            "the buffer isn't aligned as the device reports"
+        );
+
+        // The whole buffer must be usable
+        data[0] = 1;
+        data[sizes[i] - 1] = 2;
+
+        result = clEnqueueUnmapMemObject(queue, buf, data, 0, 0, 0);
+        fail_if(
+            result != CL_SUCCESS,
+            "cannot unmap a buffer"
+        );
+
+        clFinish(queue);
+        clReleaseMemObject(buf);
+    }
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_buffer_pool)
+{
+    cl_context ctx;
+    cl_mem bufs[16];
+    cl_command_queue queue;
+    cl_device_id device;
+    cl_int result;
+
+    // Sizes served by slabs and by the large classes of the pool
+    size_t sizes[4] = {3, 700, 5000, 300000};
+
+    clTrimMemoryPoolCLOVER_fn trim = (clTrimMemoryPoolCLOVER_fn)
+        clGetExtensionFunctionAddress("clTrimMemoryPoolCLOVER");
+    fail_if(
+        trim == 0,
+        "the memory pool extension must be available"
+    );
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_CPU, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot get a device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    // Create and release buffers several times, the memory being reused
+    for (unsigned int round=0; round<4; ++round)
+    {
+        for (unsigned int i=0; i<16; ++i)
+        {
+            size_t size = sizes[i % 4];
+            unsigned char value = round * 16 + i;
+            unsigned char first, last;
+
+            bufs[i] = clCreateBuffer(ctx, CL_MEM_READ_WRITE, size, 0, &result);
+            fail_if(
+                result != CL_SUCCESS,
+                "cannot create a buffer"
+            );
+
+            result = clEnqueueWriteBuffer(queue, bufs[i], 1, 0, 1, &value, 0,
+                                          0, 0);
+            result |= clEnqueueWriteBuffer(queue, bufs[i], 1, size - 1, 1,
+                                           &value, 0, 0, 0);
+            fail_if(
+                result != CL_SUCCESS,
+                "cannot write into a buffer"
+            );
+
+            if (i == 0)
+                continue;
+
+            // Buffers don't share their memory
+            size = sizes[(i - 1) % 4];
+
+            result = clEnqueueReadBuffer(queue, bufs[i - 1], 1, 0, 1, &first,
+                                         0, 0, 0);
+            result |= clEnqueueReadBuffer(queue, bufs[i - 1], 1, size - 1, 1,
+                                          &last, 0, 0, 0);
+            fail_if(
+                result != CL_SUCCESS,
+                "cannot read a buffer"
+            );
+            fail_if(
+                first != value - 1 || last != value - 1,
+                "a buffer was overwritten by another one"
+            );
+        }
+
+        for (unsigned int i=0; i<16; ++i)
+            clReleaseMemObject(bufs[i]);
+    }
+
+    size_t released = 0;
+
+    result = trim(ctx, &released);
+    fail_if(
+        result != CL_SUCCESS || released == 0,
+        "the released buffers must be cached until the pool is trimmed"
+    );
+
+    result = trim(ctx, &released);
+    fail_if(
+        result != CL_SUCCESS || released != 0,
+        "a trimmed pool must not keep memory"
+    );
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_copy_host_ptr_snapshot)
+{
+    cl_context ctx;
+    cl_mem buf;
+    cl_command_queue queue;
+    cl_device_id device;
+    cl_int result;
+    unsigned int *host, value;
+
+    // Large and page-aligned, the buffer can be a copy-on-write snapshot
+    const size_t count = (4 << 20) / sizeof(unsigned int);
+    const size_t size = count * sizeof(unsigned int);
+
+    fail_if(
+        posix_memalign((void **)&host, 4096, size) != 0,
+        "cannot allocate host memory"
+    );
+
+    for (size_t i=0; i<count; ++i)
+        host[i] = i;
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_CPU, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot get a device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    buf = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR |
+                         CL_MEM_COPY_ON_WRITE_CLOVER, size, host, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer"
+    );
+
+    // The host memory keeps its content and modifying it doesn't change the
+    // buffer
+    fail_if(
+        host[0] != 0 || host[count - 1] != count - 1,
+        "the host memory must not change"
+    );
+
+    host[1] = 0xdead;
+
+    result = clEnqueueReadBuffer(queue, buf, 1, sizeof(unsigned int),
+                                 sizeof(unsigned int), &value, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS || value != 1,
+        "the buffer must be a copy of the host memory"
+    );
+
+    // Writing the buffer doesn't change the host memory
+    value = 0xbeef;
+
+    result = clEnqueueWriteBuffer(queue, buf, 1, size - sizeof(unsigned int),
+                                  sizeof(unsigned int), &value, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot write into the buffer"
+    );
+
+    for (size_t i=0; i<count; ++i)
+    {
+        if (host[i] != (i == 1 ? 0xdead : i))
+        {
+            fail("writing the buffer changed the host memory");
+            break;
+        }
+    }
+
+    clReleaseMemObject(buf);
+
+    fail_if(
+        host[2] != 2 || host[count - 1] != count - 1,
+        "releasing the buffer changed the host memory"
+    );
+
+    std::free(host);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_copy_host_ptr_snapshot_partial_page)
+{
+    cl_context ctx;
+    cl_mem buf;
+    cl_command_queue queue;
+    cl_device_id device;
+    cl_int result;
+    unsigned char *host, *data;
+
+    // Page-aligned but ending in the middle of a page, whose end may be used
+    // by other allocations
+    const size_t size = (4 << 20) + 100;
+
+    fail_if(
+        posix_memalign((void **)&host, 4096, size) != 0,
+        "cannot allocate host memory"
+    );
+
+    for (size_t i=0; i<size; ++i)
+        host[i] = i % 251;
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_CPU, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot get a device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    buf = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR |
+                         CL_MEM_COPY_ON_WRITE_CLOVER, size, host, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer"
+    );
+
+    // Allocations made now can land in the last page of host
+    void *other = std::malloc(64);
+
+    host[size - 1] = 0xff;
+    host[0] = 0xff;
+
+    data = (unsigned char *)std::malloc(size);
+
+    result = clEnqueueReadBuffer(queue, buf, 1, 0, size, data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot read the buffer"
+    );
+
+    for (size_t i=0; i<size; ++i)
+    {
+        if (data[i] != i % 251)
+        {
+            fail("the buffer must be a copy of the whole host memory");
+            break;
+        }
+    }
+
+    clReleaseMemObject(buf);
+
+    for (size_t i=1; i<size - 1; ++i)
+    {
+        if (host[i] != i % 251)
+        {
+            fail("releasing the buffer changed the host memory");
+            break;
+        }
+    }
+
+    fail_if(
+        host[0] != 0xff || host[size - 1] != 0xff,
+        "the writes of the application must be kept"
+    );
+
+    std::free(data);
+    std::free(other);
+    std::free(host);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_copy_host_ptr_snapshot_released)
+{
+    cl_context ctx;
+    cl_mem buf, buf2;
+    cl_command_queue queue;
+    cl_device_id device;
+    cl_int result;
+    unsigned char *host, *host2, *data;
+
+    const size_t size = 4 << 20;
+    const size_t page = sysconf(_SC_PAGESIZE);
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_CPU, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot get a device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    buf = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_ON_WRITE_CLOVER,
+                         size, 0, &result);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "CL_MEM_COPY_ON_WRITE_CLOVER needs CL_MEM_COPY_HOST_PTR"
+    );
+
+    host = (unsigned char *)mmap(0, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    fail_if(
+        host == MAP_FAILED,
+        "cannot allocate host memory"
+    );
+
+    for (size_t i=0; i<size; ++i)
+        host[i] = i % 251;
+
+    buf = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR |
+                         CL_MEM_COPY_ON_WRITE_CLOVER, size, host, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer"
+    );
+
+    // The application releases its memory and gets the same address again
+    munmap(host, size);
+
+    host2 = (unsigned char *)mmap(host, size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                                  -1, 0);
+    fail_if(
+        host2 != host,
+        "cannot map the host memory again"
+    );
+
+    for (size_t i=0; i<size; ++i)
+        host2[i] = i % 241;
+
+    buf2 = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR |
+                          CL_MEM_COPY_ON_WRITE_CLOVER, size, host2, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer"
+    );
+
+    // Discarded pages read as zeros
+    madvise(host2, page, MADV_DONTNEED);
+
+    clReleaseMemObject(buf);
+
+    fail_if(
+        host2[0] != 0 || host2[page - 1] != 0,
+        "discarded pages must be zeros"
+    );
+
+    for (size_t i=page; i<size; ++i)
+    {
+        if (host2[i] != i % 241)
+        {
+            fail("releasing a buffer changed the memory now at its host_ptr");
+            break;
+        }
+    }
+
+    data = (unsigned char *)std::malloc(size);
+
+    result = clEnqueueReadBuffer(queue, buf2, 1, 0, size, data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot read the buffer"
+    );
+
+    for (size_t i=0; i<size; ++i)
+    {
+        if (data[i] != i % 241)
+        {
+            fail("the buffer must be a copy of the host memory");
+            break;
+        }
+    }
+
+    clReleaseMemObject(buf2);
+    munmap(host2, size);
+    std::free(data);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_map_count)
+{
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_device_id device;
+    cl_mem buf, unused_buf, image;
+    cl_int result;
+    cl_uint count;
+
+    unsigned char data[64], read_data[64];
+
+    for (unsigned int i=0; i<sizeof(data); ++i)
+        data[i] = i;
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_CPU, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot get a device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                         sizeof(data), data, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer"
+    );
+
+    // Map the same region twice
+    void *map1 = clEnqueueMapBuffer(queue, buf, 1, CL_MAP_READ, 0, 16, 0, 0, 0,
+                                    &result);
+    void *map2 = clEnqueueMapBuffer(queue, buf, 1, CL_MAP_READ, 0, 16, 0, 0, 0,
+                                    &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot map the buffer"
+    );
+
+    result = clGetMemObjectInfo(buf, CL_MEM_MAP_COUNT, sizeof(cl_uint), &count,
+                                0);
+    fail_if(
+        result != CL_SUCCESS || count != 2,
+        "the buffer must be mapped two times"
+    );
+
+    result = clEnqueueUnmapMemObject(queue, buf, data, 0, 0, 0);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "only mapped addresses can be unmapped"
+    );
+
+    result = clEnqueueUnmapMemObject(queue, buf, map1, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot unmap the buffer"
+    );
+
+    clGetMemObjectInfo(buf, CL_MEM_MAP_COUNT, sizeof(cl_uint), &count, 0);
+    fail_if(
+        count != 1,
+        "the map count must be decremented when unmapping"
+    );
+
+    result = clEnqueueUnmapMemObject(queue, buf, map2, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot unmap the buffer a second time"
+    );
+
+    result = clEnqueueUnmapMemObject(queue, buf, map2, 0, 0, 0);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "a mapping cannot be unmapped more than once"
+    );
+
+    // Write-invalidate maps
+    clEnqueueMapBuffer(queue, buf, 1,
+                       CL_MAP_READ | CL_MAP_WRITE_INVALIDATE_REGION, 0, 16,
+                       0, 0, 0, &result);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "invalidating a region cannot be combined with reading it"
+    );
+
+    unsigned char *mapped = (unsigned char *)
+        clEnqueueMapBuffer(queue, buf, 1, CL_MAP_WRITE_INVALIDATE_REGION, 0,
+                           sizeof(data), 0, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot map the buffer for write-invalidate"
+    );
+
+    std::memset(mapped, 0x42, sizeof(data));
+
+    result = clEnqueueUnmapMemObject(queue, buf, mapped, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot unmap the invalidated region"
+    );
+
+    result = clEnqueueReadBuffer(queue, buf, 1, 0, sizeof(read_data),
+                                 read_data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot read the buffer"
+    );
+
+    for (unsigned int i=0; i<sizeof(read_data); ++i)
+        fail_if(
+            read_data[i] != 0x42,
+            "the invalidated region must hold what the application wrote"
+        );
+
+    // A rejected map doesn't invalidate anything
+    unused_buf = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                sizeof(data), data, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer"
+    );
+
+    clEnqueueMapBuffer(queue, unused_buf, 1,
+                       CL_MAP_READ | CL_MAP_WRITE_INVALIDATE_REGION, 0,
+                       sizeof(data), 0, 0, 0, &result);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "invalidating a region cannot be combined with reading it"
+    );
+
+    result = clEnqueueReadBuffer(queue, unused_buf, 1, 0, sizeof(read_data),
+                                 read_data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS ||
+        std::memcmp(read_data, data, sizeof(data)) != 0,
+        "a rejected map must keep the contents of the buffer"
+    );
+
+    clReleaseMemObject(unused_buf);
+
+    // Images without a host pointer are mapped through a staging area
+    cl_image_format fmt;
+    size_t origin[3] = {0, 0, 0};
+    size_t region[3] = {4, 4, 1};
+    size_t row_pitch;
+
+    fmt.image_channel_data_type = CL_UNORM_INT8;
+    fmt.image_channel_order = CL_RGBA;
+
+    image = clCreateImage2D(ctx, CL_MEM_READ_WRITE, &fmt, 4, 4, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create an image"
+    );
+
+    mapped = (unsigned char *)clEnqueueMapImage(queue, image, 1,
+                                                CL_MAP_WRITE_INVALIDATE_REGION,
+                                                origin, region, &row_pitch, 0,
+                                                0, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot map the image for write-invalidate"
+    );
+
+    for (unsigned int y=0; y<4; ++y)
+        std::memcpy(mapped + y * row_pitch, data + y * 16, 16);
+
+    result = clEnqueueUnmapMemObject(queue, image, mapped, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot unmap the image"
+    );
+
+    // Mapping for writing only still shows the pixels
+    mapped = (unsigned char *)clEnqueueMapImage(queue, image, 1, CL_MAP_WRITE,
+                                                origin, region, &row_pitch, 0,
+                                                0, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot map the image for writing"
+    );
+
+    for (unsigned int y=0; y<4; ++y)
+        fail_if(
+            std::memcmp(mapped + y * row_pitch, data + y * 16, 16) != 0,
+            "the image doesn't hold the pixels written in the invalidated region"
+        );
+
+    result = clEnqueueUnmapMemObject(queue, image, mapped, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot unmap the image"
+    );
+
+    clFinish(queue);
+    clReleaseMemObject(image);
+    clReleaseMemObject(buf);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
+START_TEST (test_file_buffer)
+{
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_device_id device;
+    cl_mem buf;
+    cl_int result;
+
+    unsigned char data[12000], read_data[3000];
+    char filename[] = "/tmp/clover_file_bufferXXXXXX";
+    int fd;
+
+    for (unsigned int i=0; i<sizeof(data); ++i)
+        data[i] = (i * 7) & 0xff;
+
+    fd = mkstemp(filename);
+    fail_if(
+        fd == -1,
+        "cannot create a temporary file"
+    );
+    unlink(filename);
+
+    fail_if(
+        pwrite(fd, data, sizeof(data), 0) != sizeof(data),
+        "cannot write the temporary file"
+    );
+
+    result = clGetDeviceIDs(0, CL_DEVICE_TYPE_CPU, 1, &device, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot get a device"
+    );
+
+    ctx = clCreateContext(0, 1, &device, 0, 0, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "unable to create a valid context"
+    );
+
+    queue = clCreateCommandQueue(ctx, device, 0, &result);
+    fail_if(
+        result != CL_SUCCESS || queue == 0,
+        "cannot create a command queue"
+    );
+
+    // The region must be inside the file
+    buf = clCreateBufferFromFileCLOVER(ctx, CL_MEM_READ_ONLY, fd, 5000,
+                                       sizeof(data), 0, &result);
+    fail_if(
+        result != CL_INVALID_BUFFER_SIZE,
+        "a buffer cannot extend past the end of its file"
+    );
+
+    buf = clCreateBufferFromFileCLOVER(ctx, CL_MEM_READ_ONLY |
+                                       CL_MEM_COPY_HOST_PTR, fd, 0, 16, 0,
+                                       &result);
+    fail_if(
+        result != CL_INVALID_VALUE,
+        "only access flags can be given to a file-backed buffer"
+    );
+
+    // Unaligned read-only region
+    buf = clCreateBufferFromFileCLOVER(ctx, CL_MEM_READ_ONLY, fd, 5000,
+                                       sizeof(read_data),
+                                       CL_FILE_BUFFER_POPULATE_CLOVER, &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a buffer from a file"
+    );
+
+    result = clEnqueueReadBuffer(queue, buf, 1, 0, sizeof(read_data),
+                                 read_data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot read the file-backed buffer"
+    );
+    fail_if(
+        std::memcmp(read_data, data + 5000, sizeof(read_data)) != 0,
+        "the buffer doesn't hold the file region"
+    );
+
+    clReleaseMemObject(buf);
+
+    // Writes to a read-write buffer reach the file
+    buf = clCreateBufferFromFileCLOVER(ctx, CL_MEM_READ_WRITE, fd, 100, 64, 0,
+                                       &result);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot create a writable buffer from a file"
+    );
+
+    std::memset(read_data, 0x5a, 64);
+
+    result = clEnqueueWriteBuffer(queue, buf, 1, 0, 64, read_data, 0, 0, 0);
+    fail_if(
+        result != CL_SUCCESS,
+        "cannot write the file-backed buffer"
+    );
+
+    clReleaseMemObject(buf);
+
+    fail_if(
+        pread(fd, data, 64, 100) != 64 ||
+        std::memcmp(data, read_data, 64) != 0,
+        "the file doesn't hold the data written in the buffer"
+    );
+
+    close(fd);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(ctx);
+}
+END_TEST
+
 START_TEST (test_images)
 {
     cl_context ctx;
@@ -339,6 +1199,13 @@ TCase *cl_mem_tcase_create(void)
     tcase_add_test(tc, test_create_buffer);
     tcase_add_test(tc, test_create_sub_buffer);
     tcase_add_test(tc, test_read_write_subbuf);
+    tcase_add_test(tc, test_buffer_alignment);
+    tcase_add_test(tc, test_buffer_pool);
+    tcase_add_test(tc, test_copy_host_ptr_snapshot);
+    tcase_add_test(tc, test_copy_host_ptr_snapshot_partial_page);
+    tcase_add_test(tc, test_copy_host_ptr_snapshot_released);
+    tcase_add_test(tc, test_map_count);
+    tcase_add_test(tc, test_file_buffer);
     tcase_add_test(tc, test_images);
     return tc;
 }